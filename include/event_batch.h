@@ -3,43 +3,56 @@
 #define EVENT_BATCH_H
 
 #include "uv.h"
+#ifdef _WIN32
 #include "../src/win/internal.h"
+#else
+#include "../src/unix/internal.h"
+#endif
 
-#ifdef __cplusplus 
+#ifdef __cplusplus
 extern "C" {
 #endif
 
 /* Configuration constants */
 #define UV_BATCH_MAX_SIZE       1000
 #define UV_BATCH_TIMEOUT_MS     100
-#define UV_BATCH_MAX_EVENT_TYPES 16
+#define UV_BATCH_TIMEOUT_US     (UV_BATCH_TIMEOUT_MS * 1000)
 #define UV_BATCH_EVENT_VALID  0x01  /* Event contains valid data */
-#define UV_BATCH_AUTO_PROCESS      0x01  /* Automatically process when full */
-#define UV_BATCH_THRESHOLD_PROCESS 0x02  /* Process when threshold is reached */
+#define UV_BATCH_EVENT_HEAP   0x02  /* Data too big for inline storage */
+#define UV_BATCH_EVENT_SUBMITTED 0x04 /* Allocated by uv_batch_submit() */
+#define UV_BATCH_MAX_LATENCY_US 1000000  /* Upper bound for latency_us */
+#define UV_BATCH_DRAIN_ROUNDS   8  /* Forced flushes before giving up */
+#define UV_BATCH_ADAPT_WINDOW   256  /* Events per UV_BATCH_ADAPTIVE p99 check */
 
 
-/* Configuration for the event batching system */
-typedef struct uv_batch_config_s {
-  unsigned int batch_size;  /* Maximum number of events to batch together */
-  unsigned int timeout_ms;  /* Maximum time to wait before processing a batch */
-  unsigned int flags;       /* Configuration flags */
-} uv_batch_config_t;
-
 /* Default configuration values */
 #define UV_BATCH_DEFAULT_SIZE    64
 #define UV_BATCH_DEFAULT_TIMEOUT 10
 #define UV_BATCH_DEFAULT_FLAGS   0
 #define UV_BATCH_MAX_EVENT_SIZE  100
 
-/* Flag definitions */
-#define UV_BATCH_AUTO_PROCESS  0x01  /* Automatically process batches when full */
+/* Distinct callbacks UV_BATCH_LOCALITY groups per priority, the events of
+ * any others keep their place after the groups */
+#define UV_BATCH_LOCALITY_GROUPS 16
+
+/* Number of uv_batch_priority_t levels, one FIFO bucket each */
+#define UV_BATCH_PRIORITY_LEVELS (UV_BATCH_PRIORITY_LOW + 1)
 
+#ifdef _WIN32
 /* IOCP event structure for batching */
 typedef struct uv_batch_iocp_event_s {
   DWORD bytes;             /* Transferred bytes */
   ULONG_PTR key;           /* Completion key */
   OVERLAPPED* overlapped;  /* Overlapped structure */
 } uv_batch_iocp_event_t;
+#else
+/* Readiness event staged by uv__io_poll(), coalesced per file descriptor */
+typedef struct uv_batch_io_event_s {
+  int fd;                  /* Watched file descriptor, -1 if invalidated */
+  unsigned int events;     /* Accumulated epoll event mask */
+  uint64_t timestamp;      /* uv_hrtime() when first staged */
+} uv_batch_io_event_t;
+#endif
 
 
 /* Event structure */
@@ -52,56 +65,199 @@ struct uv_batch_event_s {
   uint64_t timestamp;
   void (*callback)(void* result);
   struct uv_batch_event_s* next;
-  void* data;
-  // unsigned char data[UV_BATCH_MAX_EVENT_SIZE];  /* Storage for event data */
+  void* data;                                   /* inline_data or heap copy */
   size_t size;                                  /* Actual size of event data */
   unsigned int flags;                           /* Event flags */
+  /* Storage for event data, 8-byte aligned so it can hold any struct */
+  uint64_t inline_data[(UV_BATCH_MAX_EVENT_SIZE + 7) / 8];
 };
 
-/* Batch structure - Windows specific */
+/* UV_BATCH_ADAPTIVE controller state. The averages are exponentially
+ * weighted, count, fill and scale are fixed point with 8 fractional bits.
+ */
+typedef struct uv_batch_adaptive_s {
+  uint64_t last;                       /* uv_hrtime() of the previous dispatch */
+  uint64_t interval;                   /* Time between dispatches, ns */
+  uint64_t run;                        /* Time spent in callbacks per batch, ns */
+  uint64_t count;                      /* Events per batch */
+  uint64_t fill;                       /* Events per batch / limit, 256 = full */
+  uint64_t seen;                       /* Events in the current p99 window */
+  uint64_t late;                       /* Of those, waited longer than the bound */
+  uint64_t scale;                      /* Share of the bound to plan with, 256 = all */
+} uv_batch_adaptive_t;
+
+/* FIFO bucket of events sharing one priority */
+typedef struct uv_batch_queue_s {
+  uv_batch_event_t* head;
+  uv_batch_event_t* tail;
+} uv_batch_queue_t;
+
+/* Events that are dispatched together. Types without a policy share the
+ * default lane, which follows the loop wide size and timeout.
+ */
+typedef struct uv_batch_lane_s {
+  uv_batch_queue_t queues[UV_BATCH_PRIORITY_LEVELS]; /* Indexed by priority */
+  unsigned int count;                  /* Number of queued events */
+  unsigned int batch_size;             /* uv_batch_policy_t dispatch size */
+  unsigned int timeout_us;             /* uv_batch_policy_t timeout */
+  int has_policy;                      /* Set by uv_batch_set_policy() */
+  int flush_requested;                 /* Drain on the next loop iteration */
+  uv_batch_flush_reason_t flush_reason; /* Why flush_requested was set */
+  uint64_t deadline;                   /* uv_hrtime() dispatch deadline, 0 if none */
+} uv_batch_lane_t;
+
+/* Batch structure */
 struct uv_batch_s {
   uv_loop_t* loop;
-  uv_batch_event_t* queue_head;
-  uv_batch_event_t* queue_tail;
-  size_t current_size;
-  uv_mutex_t mutex;
+  uv_batch_lane_t lane;                /* Types without a policy */
+  uv_batch_lane_t types[UV_BATCH_MAX_EVENT_TYPE]; /* Indexed by type */
+  unsigned int npolicies;              /* Number of types with a policy */
+  size_t current_size;                 /* Queued events, all lanes */
+  uv_mutex_t mutex;                    /* Guards the Windows IOCP events */
+  uv_async_t submit_async;             /* Wakes the loop for uv_batch_submit() */
+#ifdef _MSC_VER
+  uv_batch_event_t* volatile submitted;
+#else
+  _Atomic(uv_batch_event_t*) submitted; /* Submitted events, newest first */
+#endif
   uv_batch_stats_t stats;
   int initialized;
   int is_processing;
+  int flush_requested;                 /* Some lane has flush_requested set */
   void (*process_batch_cb)(uv_batch_event_t*, size_t);
   void (*error_cb)(uv_batch_event_t*, int);
+#ifdef _WIN32
   HANDLE event_handle;  /* Windows-specific field */
-  unsigned int size;                  /* Current number of events in batch */
   uv_batch_iocp_event_t* iocp_events; /* Array of batched IOCP events */
+#else
+  uv_batch_io_event_t* io_events;      /* Staged readiness events */
+  unsigned int io_count;               /* Number of staged readiness events */
+  unsigned char* io_groups;            /* UV_BATCH_LOCALITY group of each event */
+  unsigned int* io_slots;              /* fd -> index into io_events + 1 */
+  unsigned int io_nslots;              /* Number of entries in io_slots */
+  uint64_t io_start;                   /* uv_hrtime() of the first staged event */
+  int io_wakefd;                       /* Linux: epoll set of the wakeup fds */
+  int io_wakefds[4];                   /* Descriptors added to io_wakefd */
+#endif
+  unsigned int size;                  /* Current number of events in batch */
   uv_timer_t timeout_timer;           /* Timer for batch processing */
-  unsigned int timeout_ms;            /* Timeout in milliseconds */
+  uint64_t deadline;                   /* Earliest lane deadline, 0 if none */
+  unsigned int timeout_us;             /* Timeout in microseconds */
+  unsigned int max_timeout_us;         /* Configured timeout, bounds timeout_us */
+  unsigned int latency_us;             /* Configured p99 latency bound */
   unsigned int capacity;               /* Maximum number of events in batch */
+  unsigned int limit;                  /* Dispatch size, at most capacity */
+  uv_batch_adaptive_t adaptive;        /* UV_BATCH_ADAPTIVE state */
   unsigned int event_size;             /* Maximum size of each event */
   unsigned int process_threshold;      /* Threshold for early processing */
-  uv_batch_event_t* events;            /* Array of batched events */
+  uv_batch_event_t* events;            /* Slab of preallocated events */
+  uv_batch_event_t* free_events;       /* Unused events in the slab */
+  unsigned int nevents;                /* Number of events in the slab */
   unsigned int flags;                  /* Batch flags */
 };
 
-typedef void (*uv_batch_callback_t)(void *result);
+typedef uv_batch_cb uv_batch_callback_t;
 
 /* Internal functions */
-void uv__batch_process(uv_batch_t* batch);
-int uv__batch_windows_init(uv_loop_t* loop, uv_batch_t* batch);
-void uv__batch_windows_cleanup(uv_batch_t* batch);
+void uv__batch_process(uv_batch_t* batch, uv_batch_flush_reason_t reason);
 uint64_t uv__batch_hrtime(void);
-void uv__batch_update_stats(uv_batch_t* batch, size_t processed_count);
+void uv__batch_update_stats(uv_batch_t* batch,
+                            const uv_batch_lane_t* lane,
+                            unsigned int count,
+                            uv_batch_flush_reason_t reason,
+                            uint64_t run_ns);
 int uv__batch_validate_config(uv_batch_t* batch);
-void uv__batch_free_events(uv_batch_event_t* head);
-void uv__batch_sort_by_priority(uv_batch_event_t** head);
-int uv__batch_process_pending(uv_loop_t* loop);
+void uv__batch_adapt_reset(uv_batch_t* batch);
+uint64_t uv__batch_adapt_bound(const uv_batch_t* batch);
+void uv__batch_adapt(uv_batch_t* batch,
+                     unsigned int count,
+                     unsigned int late,
+                     uint64_t start,
+                     uint64_t end);
+int uv__batch_slab_init(uv_batch_t* batch);
+void uv__batch_slab_free(uv_batch_t* batch);
+uv_batch_event_t* uv__batch_event_get(uv_batch_t* batch, size_t data_size);
+void uv__batch_event_put(uv_batch_t* batch, uv_batch_event_t* event);
+void uv__batch_enqueue(uv_batch_lane_t* lane, uv_batch_event_t* event);
+int uv__batch_submit_push(uv_batch_t* batch, uv_batch_event_t* event);
+uv_batch_event_t* uv__batch_submit_take(uv_batch_t* batch);
+uv_batch_event_t* uv__batch_dequeue(uv_batch_lane_t* lane);
+uv_batch_event_t* uv__batch_group(uv_batch_event_t* head);
+int uv__batch_process_pending(uv_loop_t* loop, uv_batch_flush_reason_t reason);
+void uv__batch_schedule_processing(uv_loop_t* loop, int immediate);
+void uv__batch_run(uv_loop_t* loop);
+int64_t uv__batch_adjust_timeout(uv_loop_t *loop, int64_t timeout);
+int uv__batch_add_event_internal(uv_loop_t *loop, uv_batch_event_type_t type, uv_batch_priority_t priority, const void *event, size_t event_size, uv_batch_callback_t callback);
+int uv__batch_platform_init(uv_loop_t* loop, uv_batch_t* batch);
+void uv__batch_platform_cleanup(uv_batch_t* batch);
+int uv__batch_platform_resize(uv_batch_t* batch, unsigned int capacity);
+#ifdef _WIN32
+int uv__batch_windows_init(uv_loop_t* loop, uv_batch_t* batch);
+void uv__batch_windows_cleanup(uv_batch_t* batch);
 int uv__batch_add_iocp_event(uv_loop_t* loop, DWORD bytes, ULONG_PTR key, OVERLAPPED* overlapped);
-uint64_t uv__batch_adjust_timeout(uv_loop_t *loop, uint64_t timeout);
-int uv__batch_add_event_internal(uv_loop_t *loop, uv_batch_event_type_t type, uv_batch_priority_t priority, void *event, size_t event_size, uv_batch_callback_t callback);
-// int uv__batch_add_event_internal(uv_loop_t* loop, void* event, size_t event_size);
-// void uv__batch_process_internal(uv_loop_t* loop);
+#else
+int uv__batch_io_stage(uv_loop_t* loop, int fd, unsigned int events);
+void uv__batch_io_flush(uv_loop_t* loop, uv_batch_flush_reason_t reason);
+void uv__batch_io_invalidate(uv_loop_t* loop, int fd);
+uint64_t uv__batch_io_window(uv_loop_t* loop);
+#endif
+
+/* Index of the highest bit set in v, which must not be zero */
+static inline unsigned int uv__batch_log2(uint64_t v) {
+#if defined(__GNUC__)
+  return 63 - __builtin_clzll(v);
+#else
+  unsigned int n;
+
+  for (n = 0; v >>= 1; n++);
+  return n;
+#endif
+}
+
+/* Latency histogram bucket for a value in nanoseconds */
+static inline unsigned int uv__batch_latency_bucket(uint64_t ns) {
+  unsigned int shift;
+  unsigned int index;
+
+  if (ns < (1u << UV_BATCH_LATENCY_SUB_BITS))
+    return (unsigned int) ns;
+
+  shift = uv__batch_log2(ns) - UV_BATCH_LATENCY_SUB_BITS;
+  index = ((shift + 1) << UV_BATCH_LATENCY_SUB_BITS) +
+          (unsigned int) ((ns >> shift) & ((1u << UV_BATCH_LATENCY_SUB_BITS) - 1));
+
+  if (index >= UV_BATCH_LATENCY_BUCKETS)
+    index = UV_BATCH_LATENCY_BUCKETS - 1;
+  return index;
+}
+
+/* Lane that events of the given type are queued on */
+static inline uv_batch_lane_t* uv__batch_lane(uv_batch_t* batch,
+                                              uv_batch_event_type_t type) {
+  if ((unsigned int) type < UV_BATCH_MAX_EVENT_TYPE &&
+      batch->types[type].has_policy)
+    return &batch->types[type];
+  return &batch->lane;
+}
+
+/* Account for one dispatched event, called right before its callback runs */
+static inline void uv__batch_stats_event(uv_batch_t* batch,
+                                         uv_batch_event_type_t type,
+                                         uint64_t latency) {
+  uv_batch_stats_t* stats;
+
+  stats = &batch->stats;
+  if ((unsigned int) type < UV_BATCH_MAX_EVENT_TYPE)
+    stats->events_by_type[type]++;
+
+  stats->total_latency += latency;
+  if (latency > stats->max_latency)
+    stats->max_latency = latency;
+  stats->latency_hist[uv__batch_latency_bucket(latency)]++;
+}
 
 #ifdef __cplusplus
 }
 #endif
 
-#endif /* EVENT_BATCH_H */
\ No newline at end of file
+#endif /* EVENT_BATCH_H */
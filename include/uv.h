@@ -249,6 +249,7 @@ extern "C"
   typedef struct uv_udp_send_s uv_udp_send_t;
   typedef struct uv_fs_s uv_fs_t;
   typedef struct uv_work_s uv_work_t;
+  typedef struct uv_work_batch_s uv_work_batch_t;
   typedef struct uv_random_s uv_random_t;
 
   /* None of the above. */
@@ -267,8 +268,18 @@ extern "C"
   {
     UV_LOOP_BLOCK_SIGNAL = 0,
     UV_METRICS_IDLE_TIME,
-    UV_LOOP_USE_IO_URING_SQPOLL
+    UV_LOOP_USE_IO_URING_SQPOLL,
 #define UV_LOOP_USE_IO_URING_SQPOLL UV_LOOP_USE_IO_URING_SQPOLL
+    UV_LOOP_USE_IO_URING_STREAMS,
+#define UV_LOOP_USE_IO_URING_STREAMS UV_LOOP_USE_IO_URING_STREAMS
+    UV_LOOP_READ_BUDGET,
+#define UV_LOOP_READ_BUDGET UV_LOOP_READ_BUDGET
+    UV_LOOP_USE_EDGE_TRIGGERED,
+#define UV_LOOP_USE_EDGE_TRIGGERED UV_LOOP_USE_EDGE_TRIGGERED
+    UV_LOOP_CORK_WRITES,
+#define UV_LOOP_CORK_WRITES UV_LOOP_CORK_WRITES
+    UV_LOOP_USE_IO_URING_ACCEPT
+#define UV_LOOP_USE_IO_URING_ACCEPT UV_LOOP_USE_IO_URING_ACCEPT
   } uv_loop_option;
 
   typedef enum
@@ -332,6 +343,10 @@ extern "C"
   typedef void (*uv_read_cb)(uv_stream_t *stream,
                              ssize_t nread,
                              const uv_buf_t *buf);
+  typedef void (*uv_alloc_v_cb)(uv_handle_t *handle,
+                                size_t suggested_size,
+                                uv_buf_t *bufs,
+                                unsigned int *nbufs);
   typedef void (*uv_write_cb)(uv_write_t *req, int status);
   typedef void (*uv_connect_cb)(uv_connect_t *req, int status);
   typedef void (*uv_shutdown_cb)(uv_shutdown_t *req, int status);
@@ -348,6 +363,7 @@ extern "C"
   typedef void (*uv_fs_cb)(uv_fs_t *req);
   typedef void (*uv_work_cb)(uv_work_t *req);
   typedef void (*uv_after_work_cb)(uv_work_t *req, int status);
+  typedef void (*uv_after_work_batch_cb)(uv_work_batch_t *batch, int status);
   typedef void (*uv_getaddrinfo_cb)(uv_getaddrinfo_t *req,
                                     int status,
                                     struct addrinfo *res);
@@ -556,6 +572,10 @@ extern "C"
   UV_EXTERN int uv_read_start(uv_stream_t *,
                               uv_alloc_cb alloc_cb,
                               uv_read_cb read_cb);
+  UV_EXTERN int uv_read_start_pooled(uv_stream_t *, uv_read_cb read_cb);
+  UV_EXTERN int uv_read_start_v(uv_stream_t *,
+                                uv_alloc_v_cb alloc_cb,
+                                uv_read_cb read_cb);
   UV_EXTERN int uv_read_stop(uv_stream_t *);
 
   UV_EXTERN int uv_write(uv_write_t *req,
@@ -614,6 +634,7 @@ extern "C"
                                  int enable,
                                  unsigned int delay);
   UV_EXTERN int uv_tcp_simultaneous_accepts(uv_tcp_t *handle, int enable);
+  UV_EXTERN int uv_tcp_zerocopy(uv_tcp_t *handle, int enable);
 
   enum uv_tcp_flags
   {
@@ -1208,6 +1229,51 @@ extern "C"
                               uv_work_cb work_cb,
                               uv_after_work_cb after_work_cb);
 
+  /* Threadpool work runs highest priority first, library work is NORMAL */
+  typedef enum
+  {
+    UV_WORK_PRIORITY_HIGH,
+    UV_WORK_PRIORITY_NORMAL,
+    UV_WORK_PRIORITY_LOW,
+    UV_WORK_PRIORITY_MAX
+  } uv_work_priority_t;
+
+  typedef struct uv_work_options_s
+  {
+    uv_work_priority_t priority;
+  } uv_work_options_t;
+
+  UV_EXTERN int uv_queue_work_ex(uv_loop_t *loop,
+                                 uv_work_t *req,
+                                 const uv_work_options_t *options,
+                                 uv_work_cb work_cb,
+                                 uv_after_work_cb after_work_cb);
+
+  /*
+   * A group of uv_work_t requests queued with one call and completed with one
+   * callback, see uv_queue_work_batch().
+   */
+  struct uv_work_batch_s
+  {
+    void *data;
+    uv_loop_t *loop;
+    uv_work_t *reqs;
+    unsigned int nreqs;
+    uv_after_work_batch_cb after_work_cb;
+    /* private */
+    unsigned int pending;
+    int status;
+    struct uv__work work_req;
+  };
+
+  UV_EXTERN int uv_queue_work_batch(uv_loop_t *loop,
+                                    uv_work_batch_t *batch,
+                                    uv_work_t reqs[],
+                                    unsigned int nreqs,
+                                    const uv_work_options_t *options,
+                                    uv_work_cb work_cb,
+                                    uv_after_work_batch_cb after_work_cb);
+
   UV_EXTERN int uv_cancel(uv_req_t *req);
 
   struct uv_cpu_times_s
@@ -1422,6 +1488,45 @@ extern "C"
   UV_EXTERN int uv_metrics_info(uv_loop_t *loop, uv_metrics_t *metrics);
   UV_EXTERN uint64_t uv_metrics_idle_time(uv_loop_t *loop);
 
+  /* Kinds of threadpool work, uv_queue_work() submits UV_THREADPOOL_CPU */
+  typedef enum
+  {
+    UV_THREADPOOL_CPU,
+    UV_THREADPOOL_FAST_IO,    /* File system requests */
+    UV_THREADPOOL_SLOW_IO,    /* DNS requests */
+    UV_THREADPOOL_KIND_MAX
+  } uv_threadpool_kind_t;
+
+  /* Threadpool durations are counted in nanoseconds, in power of two
+   * buckets: bucket i holds the durations of 2^i to 2^(i+1) - 1 ns. The
+   * first bucket also holds 0, the last one everything longer.
+   */
+#define UV_THREADPOOL_TIMING_BUCKETS 40
+
+  typedef struct uv_threadpool_timing_s
+  {
+    uint64_t count;
+    uint64_t total; /* ns */
+    uint64_t max;   /* ns */
+    uint64_t hist[UV_THREADPOOL_TIMING_BUCKETS];
+  } uv_threadpool_timing_t;
+
+  /* Work that completed on the loop, indexed by uv_threadpool_kind_t */
+  typedef struct uv_threadpool_metrics_s
+  {
+    uv_threadpool_timing_t wait[UV_THREADPOOL_KIND_MAX]; /* Submit to start */
+    uv_threadpool_timing_t run[UV_THREADPOOL_KIND_MAX];  /* In the worker */
+    uv_threadpool_timing_t done[UV_THREADPOOL_KIND_MAX]; /* End to callback */
+    /* Slow I/O work held back because half of the threads ran slow I/O */
+    uint64_t slow_io_throttled;
+    /* The pool right now, shared by all loops */
+    uint64_t size;        /* Threads */
+    uint64_t queue_depth; /* Work waiting for a thread */
+  } uv_threadpool_metrics_t;
+
+  UV_EXTERN int uv_threadpool_metrics(uv_loop_t *loop,
+                                      uv_threadpool_metrics_t *metrics);
+
   typedef enum
   {
     UV_FS_UNKNOWN = -1,
@@ -2010,17 +2115,90 @@ extern "C"
   typedef struct uv_batch_event_s uv_batch_event_t;
   typedef struct uv_batch_stats_s uv_batch_stats_t;
 
+  /* Why a batch was dispatched */
+  typedef enum
+  {
+    UV_BATCH_FLUSH_FULL = 0,  /* Reached the batch size */
+    UV_BATCH_FLUSH_THRESHOLD, /* Reached the UV_BATCH_THRESHOLD_PROCESS mark */
+    UV_BATCH_FLUSH_TIMEOUT,   /* The batch timeout expired */
+    UV_BATCH_FLUSH_FORCED,    /* Drained early, e.g. by uv_batch_disable() */
+    UV_BATCH_FLUSH_REASON_MAX
+  } uv_batch_flush_reason_t;
+
+  /* Batch sizes are counted in power of two buckets: bucket i holds the
+   * batches of 2^i to 2^(i+1) - 1 events.
+   */
+#define UV_BATCH_SIZE_BUCKETS 11
+
+  /* Enqueue to dispatch latencies are counted in nanoseconds, in log-linear
+   * buckets like an HDR histogram: each power of two range is split into
+   * 2^UV_BATCH_LATENCY_SUB_BITS equal buckets, for a relative error of at
+   * most 12.5%. The last bucket also holds everything above 2^34 ns.
+   */
+#define UV_BATCH_LATENCY_SUB_BITS 3
+#define UV_BATCH_LATENCY_BUCKETS 256
+
   /* Batch statistics structure */
   struct uv_batch_stats_s
   {
     size_t total_events_processed;
-    size_t events_by_type[16]; /* Match UV_BATCH_MAX_EVENT_TYPES */
+    size_t events_by_type[UV_BATCH_MAX_EVENT_TYPE];
     size_t failed_events;
-    uint64_t total_processing_time;
+    uint64_t total_processing_time; /* Time spent in callbacks, ns */
     uint64_t avg_batch_size;
     uint64_t max_batch_size;
+    uint64_t total_batches;
+    uint64_t flushes[UV_BATCH_FLUSH_REASON_MAX]; /* By uv_batch_flush_reason_t */
+    /* Flushes of the types that have a policy, see uv_batch_set_policy() */
+    uint64_t type_flushes[UV_BATCH_MAX_EVENT_TYPE][UV_BATCH_FLUSH_REASON_MAX];
+    uint64_t batch_size_hist[UV_BATCH_SIZE_BUCKETS];
+    /* Time from uv_batch_add_event() or readiness to dispatch, ns */
+    uint64_t total_latency;
+    uint64_t avg_latency;
+    uint64_t max_latency;
+    uint64_t latency_p50; /* Percentiles are bucket upper bounds */
+    uint64_t latency_p99;
+    uint64_t latency_p999;
+    uint64_t latency_hist[UV_BATCH_LATENCY_BUCKETS];
   };
 
+  /* Invoked with the event's copy of its data when the batch is dispatched */
+  typedef void (*uv_batch_cb)(void *data);
+
+  /* Event batching configuration flags */
+  enum uv_batch_flags
+  {
+    UV_BATCH_AUTO_PROCESS = 0x01,      /* Process a full batch to make room */
+    UV_BATCH_THRESHOLD_PROCESS = 0x02, /* Process once the batch is half full */
+    /* Tune the batch size and timeout at runtime from the observed arrival
+     * rate and dispatch cost. batch_size and timeout_ms become upper bounds.
+     */
+    UV_BATCH_ADAPTIVE = 0x04,
+    /* Run the events of a batch grouped by type and callback, in order of
+     * first appearance, so each handler stays cache hot. Priority order and
+     * the relative order of events sharing a callback are kept.
+     */
+    UV_BATCH_LOCALITY = 0x08
+  };
+
+  /* Configuration for the event batching system */
+  typedef struct uv_batch_config_s
+  {
+    unsigned int batch_size; /* Maximum number of events to batch together */
+    unsigned int timeout_ms; /* Maximum time to wait before processing a batch */
+    unsigned int flags;      /* Configuration flags */
+    unsigned int latency_us; /* UV_BATCH_ADAPTIVE: p99 latency bound, 0 = timeout_ms */
+  } uv_batch_config_t;
+
+  /* Batching policy for one uv_batch_event_type_t. Events of a type with a
+   * policy are queued apart from the others and dispatched on their own.
+   */
+  typedef struct uv_batch_policy_s
+  {
+    unsigned int batch_size; /* Dispatch size, at most the batch capacity */
+    unsigned int timeout_us; /* Maximum time an event waits, 0 = next iteration */
+  } uv_batch_policy_t;
+
   struct uv_loop_s
   {
     /* User data - use this for whatever. */
@@ -2069,14 +2247,47 @@ extern "C"
 
   UV_EXTERN int uv_batch_init(uv_loop_t *loop);
 
+  UV_EXTERN int uv_batch_init_ex(uv_loop_t *loop, const uv_batch_config_t *config);
+
+  UV_EXTERN int uv_batch_configure(uv_loop_t *loop, const uv_batch_config_t *config);
+
+  UV_EXTERN void uv_batch_enable(uv_loop_t *loop);
+
+  UV_EXTERN void uv_batch_disable(uv_loop_t *loop);
+
+  UV_EXTERN int uv_batch_add_event(uv_loop_t *loop,
+                                   uv_batch_event_type_t type,
+                                   uv_batch_priority_t priority,
+                                   const void *data,
+                                   size_t size,
+                                   uv_batch_cb cb);
+
+  /* Like uv_batch_add_event() but safe to call from any thread */
+  UV_EXTERN int uv_batch_submit(uv_loop_t *loop,
+                                uv_batch_event_type_t type,
+                                uv_batch_priority_t priority,
+                                const void *data,
+                                size_t size,
+                                uv_batch_cb cb);
+
   UV_EXTERN int uv_batch_set_timeout(uv_loop_t *loop, uint64_t timeout_ms);
 
+  UV_EXTERN int uv_batch_set_timeout_us(uv_loop_t *loop, uint64_t timeout_us);
+
   UV_EXTERN int uv_batch_set_max_size(uv_loop_t *loop, size_t max_size);
 
+  /* Pass NULL to have the type follow the loop wide settings again */
+  UV_EXTERN int uv_batch_set_policy(uv_loop_t *loop,
+                                    uv_batch_event_type_t type,
+                                    const uv_batch_policy_t *policy);
+
   UV_EXTERN int uv_batch_get_stats(uv_loop_t *loop, uv_batch_stats_t *stats);
 
   UV_EXTERN void uv_batch_reset_stats(uv_loop_t *loop);
 
+  UV_EXTERN uint64_t uv_batch_stats_percentile(const uv_batch_stats_t *stats,
+                                               double percentile);
+
   UV_EXTERN void uv_batch_cleanup(uv_loop_t *loop);
 
 /* Don't export the private CPP symbols. */
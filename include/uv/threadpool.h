@@ -30,7 +30,7 @@
 struct uv__work {
   void (*work)(struct uv__work *w);
   void (*done)(struct uv__work *w, int status);
-  struct uv_loop_s* loop;
+  struct uv__work_info* info;
   struct uv__queue wq;
 };
 
@@ -1,7 +1,4 @@
 /* src/event-batch.c */
-#define UV_HANDLE_INTERVAL 0x0001
-#define UV_BATCH_AUTO_PROCESS 0x01      /* Automatically process batches when full */
-#define UV_BATCH_THRESHOLD_PROCESS 0x02 /* Process when threshold is reached */
 #include <stdlib.h>
 #include <string.h>
 
@@ -9,18 +6,190 @@
 #include "event_batch.h"
 #include "uv-common.h"
 
-/* Timer callback for batch processing */
-static void uv__batch_timer_cb(uv_timer_t *handle)
+static void uv__batch_submit_cb(uv_async_t *handle);
+
+static void uv__batch_timeout_cb(uv_timer_t *handle);
+
+/* Dispatch size of a lane */
+static unsigned int uv__batch_lane_size(uv_batch_t *batch,
+                                        const uv_batch_lane_t *lane)
 {
-  uv_batch_t *batch = (uv_batch_t *)handle->data;
+  return lane->has_policy ? lane->batch_size : batch->limit;
+}
 
-  uv_mutex_lock(&batch->mutex);
-  if (batch->current_size > 0 && !batch->is_processing)
+/* Timeout of a lane in microseconds */
+static unsigned int uv__batch_lane_timeout(uv_batch_t *batch,
+                                           const uv_batch_lane_t *lane)
+{
+  return lane->has_policy ? lane->timeout_us : batch->timeout_us;
+}
+
+/*
+ * Points the batch deadline and the timer at the earliest lane deadline,
+ * called whenever a lane has been dispatched.
+ */
+static void uv__batch_rearm(uv_batch_t *batch)
+{
+  uv_batch_lane_t *lane;
+  uint64_t deadline;
+  uint64_t now;
+  int flush_requested;
+  unsigned int i;
+
+  deadline = batch->lane.deadline;
+  flush_requested = batch->lane.flush_requested;
+
+  for (i = 0; batch->npolicies > 0 && i < UV_BATCH_MAX_EVENT_TYPE; i++)
   {
-    batch->is_processing = 1;
-    uv__batch_process(batch);
+    lane = &batch->types[i];
+    if (lane->count == 0)
+      continue;
+
+    flush_requested |= lane->flush_requested;
+    if (deadline == 0 || lane->deadline < deadline)
+      deadline = lane->deadline;
+  }
+
+  batch->flush_requested = flush_requested;
+  batch->deadline = deadline;
+
+  if (deadline == 0)
+  {
+    uv_timer_stop(&batch->timeout_timer);
+    return;
   }
-  uv_mutex_unlock(&batch->mutex);
+
+  now = uv__batch_hrtime();
+  uv_timer_start(&batch->timeout_timer,
+                 uv__batch_timeout_cb,
+                 deadline > now ? (deadline - now + 999999) / 1000000 : 0,
+                 0);
+}
+
+/* Runs the callbacks for all events queued on one lane */
+static void uv__batch_dispatch(uv_batch_t *batch,
+                               uv_batch_lane_t *lane,
+                               uv_batch_flush_reason_t reason)
+{
+  uv_batch_event_t *head, *current, *next;
+  uint64_t start_time;
+  uint64_t end_time;
+  uint64_t latency;
+  uint64_t bound;
+  size_t count;
+  size_t processed = 0;
+  unsigned int late = 0;
+  int adapt;
+
+  if (batch->is_processing || lane->count == 0)
+    return;
+
+  /* Detach the queue so callbacks can add events to a fresh batch. The
+   * priority buckets come out already in dispatch order. */
+  count = lane->count;
+  head = uv__batch_dequeue(lane);
+  if ((batch->flags & UV_BATCH_LOCALITY) && count > 1)
+    head = uv__batch_group(head);
+
+  batch->current_size -= count;
+  batch->is_processing = 1;
+
+  /* Policies are fixed, only the default lane is tuned */
+  adapt = (batch->flags & UV_BATCH_ADAPTIVE) && !lane->has_policy;
+  bound = adapt ? uv__batch_adapt_bound(batch) : UINT64_MAX;
+
+  /* One clock read per batch, the latency of each event is measured
+   * against the start of the dispatch */
+  start_time = uv__batch_hrtime();
+
+  /* Process all events */
+  if (batch->process_batch_cb)
+  {
+    batch->process_batch_cb(head, count);
+  }
+
+  /* Update event status and call callbacks, handing each event back to
+   * the slab as soon as its callback has run */
+  current = head;
+  while (current != NULL)
+  {
+    next = current->next;
+
+    current->status = UV_BATCH_STATUS_COMPLETED;
+    latency = start_time - current->timestamp;
+    uv__batch_stats_event(batch, current->type, latency);
+    if (latency > bound)
+      late++;
+    if (current->callback)
+    {
+      current->callback(current->data);
+    }
+
+    uv__batch_event_put(batch, current);
+    processed++;
+    current = next;
+  }
+
+  /* Update statistics */
+  end_time = uv__batch_hrtime();
+  uv__batch_update_stats(batch,
+                         lane,
+                         (unsigned int)processed,
+                         reason,
+                         end_time - start_time);
+
+  if (adapt)
+    uv__batch_adapt(batch, (unsigned int)processed, late, start_time, end_time);
+
+  batch->loop->batch_pending -= processed;
+  batch->is_processing = 0;
+
+  uv__batch_rearm(batch);
+}
+
+/* Dispatches the lanes that asked for it or whose deadline has passed */
+static void uv__batch_flush_due(uv_batch_t *batch)
+{
+  uv_batch_lane_t *lane;
+  uint64_t now;
+  unsigned int i;
+
+  now = uv__batch_hrtime();
+
+  for (i = 0; i <= UV_BATCH_MAX_EVENT_TYPE; i++)
+  {
+    lane = i == 0 ? &batch->lane : &batch->types[i - 1];
+    if (lane->count == 0)
+      continue;
+
+    if (lane->flush_requested)
+      uv__batch_dispatch(batch, lane, lane->flush_reason);
+    else if (lane->deadline <= now)
+      uv__batch_dispatch(batch, lane, UV_BATCH_FLUSH_TIMEOUT);
+  }
+
+  /* Nothing was due when the timer fired early, wait for the next lane */
+  uv__batch_rearm(batch);
+}
+
+/*
+ * Dispatches the queued events until all lanes are empty. Their callbacks
+ * can queue new events, which land in the slab too, so one pass isn't
+ * enough before the slab is released. Returns UV_EBUSY when the callbacks
+ * keep adding events.
+ */
+static int uv__batch_drain(uv_loop_t *loop)
+{
+  uv_batch_t *batch;
+  unsigned int i;
+
+  batch = loop->batch_system;
+  for (i = 0; i < UV_BATCH_DRAIN_ROUNDS && batch->current_size > 0; i++)
+  {
+    uv__batch_process_pending(loop, UV_BATCH_FLUSH_FORCED);
+  }
+
+  return batch->current_size == 0 ? 0 : UV_EBUSY;
 }
 
 /* Callback for the batch timeout timer */
@@ -29,9 +198,9 @@ static void uv__batch_timeout_cb(uv_timer_t *handle)
   uv_loop_t *loop = handle->loop;
 
   /* Process pending batched events if there are any */
-  if (loop->batch_pending > 0)
+  if (loop->batch_pending > 0 && !loop->batch_system->is_processing)
   {
-    uv__batch_process_pending(loop);
+    uv__batch_flush_due(loop->batch_system);
   }
 }
 
@@ -47,52 +216,75 @@ int uv_batch_init_ex(uv_loop_t *loop, const uv_batch_config_t *config)
     return UV_EINVAL;
   }
 
+  if (config->timeout_ms > UV_BATCH_TIMEOUT_MS ||
+      config->latency_us > UV_BATCH_MAX_LATENCY_US)
+    return UV_EINVAL;
+
   /* Check if batch system is already initialized */
   if (loop->batch_system != NULL)
     return UV_EALREADY;
 
   /* Allocate memory for the batch system */
-  batch_system = (uv_batch_t *)uv__malloc(sizeof(uv_batch_t));
+  batch_system = (uv_batch_t *)uv__calloc(1, sizeof(uv_batch_t));
   if (batch_system == NULL)
     return UV_ENOMEM;
 
-  /* Allocate batch system structure */
-  batch_system->iocp_events = (uv_batch_iocp_event_t *)
-      uv__malloc(sizeof(uv_batch_iocp_event_t) * config->batch_size);
+  /* Initialize batch system fields */
+  batch_system->loop = loop;
+  batch_system->size = 0;
+  batch_system->capacity = config->batch_size;
+  batch_system->max_timeout_us = config->timeout_ms * 1000;
+  batch_system->latency_us = config->latency_us;
+  batch_system->flags = config->flags;
+  uv__batch_adapt_reset(batch_system);
 
-  if (batch_system->iocp_events == NULL)
+  /* Allocate platform specific event storage */
+  err = uv__batch_platform_init(loop, batch_system);
+  if (err)
   {
     uv__free(batch_system);
-    return UV_ENOMEM;
+    return err;
   }
 
   /* Initialize mutex */
   err = uv_mutex_init(&batch_system->mutex);
   if (err)
   {
-    uv__free(batch_system->iocp_events);
+    uv__batch_platform_cleanup(batch_system);
     uv__free(batch_system);
     return err;
   }
 
-  /* Initialize batch system fields */
-  batch_system->size = 0;
-  batch_system->capacity = config->batch_size;
-  batch_system->timeout_ms = config->timeout_ms;
-  batch_system->flags = config->flags;
-
   /* Initialize timeout timer */
   err = uv_timer_init(loop, &batch_system->timeout_timer);
   if (err)
   {
     uv_mutex_destroy(&batch_system->mutex);
-    uv__free(batch_system->iocp_events);
+    uv__batch_platform_cleanup(batch_system);
     uv__free(batch_system);
     return err;
   }
 
-  /* Set timer as internal handle so it doesn't prevent loop from exiting */
-  batch_system->timeout_timer.flags |= UV_HANDLE_INTERVAL;
+  /* Hide the timer from uv_walk(). It is only active while events are
+   * pending, which keeps the loop alive until they have been dispatched. */
+  batch_system->timeout_timer.flags |= UV_HANDLE_INTERNAL;
+
+  /* Wakes the loop for events from uv_batch_submit(). Like the thread pool's
+   * async handle it doesn't keep the loop alive by itself. */
+  err = uv_async_init(loop, &batch_system->submit_async, uv__batch_submit_cb);
+  if (err)
+  {
+    uv__queue_remove(&batch_system->timeout_timer.handle_queue);
+    uv_mutex_destroy(&batch_system->mutex);
+    uv__batch_platform_cleanup(batch_system);
+    uv__free(batch_system);
+    return err;
+  }
+
+  uv__handle_unref(&batch_system->submit_async);
+  batch_system->submit_async.flags |= UV_HANDLE_INTERNAL;
+
+  batch_system->initialized = 1;
 
   /* Store batch system in the loop */
   loop->batch_system = batch_system;
@@ -107,14 +299,65 @@ int uv_batch_init(uv_loop_t *loop)
   uv_batch_config_t default_config = {
       .batch_size = UV_BATCH_DEFAULT_SIZE,
       .timeout_ms = UV_BATCH_DEFAULT_TIMEOUT,
-      .flags = UV_BATCH_DEFAULT_FLAGS};
+      .flags = UV_BATCH_DEFAULT_FLAGS,
+      .latency_us = 0};
 
   return uv_batch_init_ex(loop, &default_config);
 }
 
+/*
+ * Loops don't pay for the batch system until they use it. It is created with
+ * the default configuration by the first call that needs it.
+ */
+static int uv__batch_create(uv_loop_t *loop)
+{
+  if (loop == NULL)
+    return UV_EINVAL;
+
+  if (loop->batch_system != NULL)
+    return 0;
+
+  return uv_batch_init(loop);
+}
+
+int uv_batch_configure(uv_loop_t *loop, const uv_batch_config_t *config)
+{
+  uv_batch_t *batch_system;
+  int err;
+
+  if (loop == NULL || config == NULL)
+    return UV_EINVAL;
+
+  if (loop->batch_system == NULL)
+    return uv_batch_init_ex(loop, config);
+
+  if (config->batch_size == 0 || config->batch_size > UV_BATCH_MAX_SIZE ||
+      config->timeout_ms > UV_BATCH_TIMEOUT_MS ||
+      config->latency_us > UV_BATCH_MAX_LATENCY_US)
+    return UV_EINVAL;
+
+  batch_system = loop->batch_system;
+
+  if (config->batch_size != batch_system->capacity)
+  {
+    err = uv_batch_set_max_size(loop, config->batch_size);
+    if (err)
+      return err;
+  }
+
+  batch_system->max_timeout_us = config->timeout_ms * 1000;
+  batch_system->latency_us = config->latency_us;
+  batch_system->flags = config->flags;
+
+  /* Start tuning from scratch, the old averages were taken under a
+   * different configuration */
+  uv__batch_adapt_reset(batch_system);
+  return 0;
+}
+
 void uv_batch_enable(uv_loop_t *loop)
 {
-  if (loop == NULL || loop->batch_system == NULL)
+  if (uv__batch_create(loop))
     return;
 
   loop->batch_enabled = 1;
@@ -128,7 +371,7 @@ void uv_batch_disable(uv_loop_t *loop)
   /* Process any pending batched events */
   if (loop->batch_pending > 0)
   {
-    uv__batch_process_pending(loop);
+    uv__batch_process_pending(loop, UV_BATCH_FLUSH_FORCED);
   }
 
   /* Stop the timeout timer */
@@ -137,114 +380,236 @@ void uv_batch_disable(uv_loop_t *loop)
   loop->batch_enabled = 0;
 }
 
-void uv_batch_cleanup(uv_loop_t *loop)
+int uv_batch_set_timeout(uv_loop_t *loop, uint64_t timeout_ms)
+{
+  if (timeout_ms > UV_BATCH_TIMEOUT_MS)
+    return UV_EINVAL;
+
+  return uv_batch_set_timeout_us(loop, timeout_ms * 1000);
+}
+
+int uv_batch_set_timeout_us(uv_loop_t *loop, uint64_t timeout_us)
 {
   uv_batch_t *batch_system;
+  int err;
 
-  if (loop == NULL || loop->batch_system == NULL)
-    return;
+  if (timeout_us > UV_BATCH_TIMEOUT_US)
+    return UV_EINVAL;
 
-  batch_system = (uv_batch_t *)loop->batch_system;
+  err = uv__batch_create(loop);
+  if (err)
+    return err;
 
-  /* Process any pending batched events */
-  if (loop->batch_pending > 0)
+  batch_system = loop->batch_system;
+  batch_system->max_timeout_us = (unsigned int)timeout_us;
+
+  /* The adaptive controller picks up the new bound on the next dispatch */
+  if (batch_system->flags & UV_BATCH_ADAPTIVE)
+  {
+    if (batch_system->timeout_us > batch_system->max_timeout_us)
+      batch_system->timeout_us = batch_system->max_timeout_us;
+  }
+  else
   {
-    uv__batch_process_pending(loop);
+    batch_system->timeout_us = batch_system->max_timeout_us;
   }
 
-  /* Stop and close the timeout timer */
-  uv_timer_stop(&batch_system->timeout_timer);
-  uv_close((uv_handle_t *)&batch_system->timeout_timer, NULL);
+  return 0;
+}
 
-  /* Destroy the mutex */
-  uv_mutex_destroy(&batch_system->mutex);
+int uv_batch_set_max_size(uv_loop_t *loop, size_t max_size)
+{
+  uv_batch_t *batch_system;
+  unsigned int i;
+  int err;
 
-  /* Free resources */
-  uv__free(batch_system->iocp_events);
-  uv__free(batch_system);
+  if (max_size == 0 || max_size > UV_BATCH_MAX_SIZE)
+    return UV_EINVAL;
 
-  loop->batch_system = NULL;
-  loop->batch_enabled = 0;
-  loop->batch_pending = 0;
+  err = uv__batch_create(loop);
+  if (err)
+    return err;
+
+  batch_system = loop->batch_system;
+
+  /* Can't resize the event storage from inside a batch callback */
+  if (batch_system->is_processing)
+    return UV_EBUSY;
+
+  /* Flush what is already queued so it fits the new capacity */
+  err = uv__batch_drain(loop);
+  if (err)
+    return err;
+
+  err = uv__batch_platform_resize(batch_system, (unsigned int)max_size);
+  if (err)
+    return err;
+
+  /* The slab is reallocated at the new size when the next event is added */
+  uv__batch_slab_free(batch_system);
+
+  batch_system->capacity = (unsigned int)max_size;
+
+  if (!(batch_system->flags & UV_BATCH_ADAPTIVE))
+    batch_system->limit = batch_system->capacity;
+  else if (batch_system->limit > batch_system->capacity)
+    batch_system->limit = batch_system->capacity;
+
+  batch_system->process_threshold = batch_system->limit / 2;
+
+  for (i = 0; i < UV_BATCH_MAX_EVENT_TYPE; i++)
+  {
+    if (batch_system->types[i].batch_size > batch_system->capacity)
+      batch_system->types[i].batch_size = batch_system->capacity;
+  }
+
+  return 0;
 }
 
-int uv__batch_add_iocp_event(uv_loop_t *loop, DWORD bytes, ULONG_PTR key, OVERLAPPED *overlapped)
+/*
+ * Gives events of one type their own dispatch size and timeout. They are
+ * queued apart from the other types, so a type that needs low latency isn't
+ * held back by one that is batched aggressively and vice versa.
+ */
+int uv_batch_set_policy(uv_loop_t *loop,
+                        uv_batch_event_type_t type,
+                        const uv_batch_policy_t *policy)
 {
   uv_batch_t *batch_system;
-  unsigned int index;
+  uv_batch_lane_t *lane;
+  int err;
+
+  if ((unsigned int)type >= UV_BATCH_MAX_EVENT_TYPE)
+    return UV_EINVAL;
 
-  if (loop == NULL || loop->batch_system == NULL || !loop->batch_enabled)
-    return -1; /* Pass through to normal processing */
+  err = uv__batch_create(loop);
+  if (err)
+    return err;
 
   batch_system = loop->batch_system;
 
-  if (batch_system->events == NULL)
+  if (policy != NULL &&
+      (policy->batch_size == 0 ||
+       policy->batch_size > batch_system->capacity ||
+       policy->timeout_us > UV_BATCH_TIMEOUT_US))
+    return UV_EINVAL;
+
+  if (batch_system->is_processing)
+    return UV_EBUSY;
+
+  /* Events that are already queued are dispatched under the old policy */
+  if (loop->batch_pending > 0)
   {
-    return -1;
+    uv__batch_process_pending(loop, UV_BATCH_FLUSH_FORCED);
   }
 
-  index = loop->batch_pending;
-  batch_system->iocp_events[index].bytes = bytes;
-  batch_system->iocp_events[index].key = key;
-  batch_system->iocp_events[index].overlapped = overlapped;
+  lane = &batch_system->types[type];
 
-  /* Check if batch is full */
-  if (loop->batch_pending >= batch_system->capacity)
+  if (policy == NULL)
   {
-    /* Process the batch if auto-processing is enabled */
-    if (batch_system->flags & UV_BATCH_AUTO_PROCESS)
-    {
-      uv__batch_process_pending(loop);
-    }
-    else
-    {
-      return -1; /* Batch is full, pass through to normal processing */
-    }
+    if (lane->has_policy)
+      batch_system->npolicies--;
+    lane->has_policy = 0;
+    return 0;
   }
 
-  /* Add event to batch */
-  index = loop->batch_pending;
-  batch_system->iocp_events[index].bytes = bytes;
-  batch_system->iocp_events[index].key = key;
-  batch_system->iocp_events[index].overlapped = overlapped;
+  if (!lane->has_policy)
+    batch_system->npolicies++;
 
-  /* Increment pending event count */
-  loop->batch_pending++;
+  lane->has_policy = 1;
+  lane->batch_size = policy->batch_size;
+  lane->timeout_us = policy->timeout_us;
+  return 0;
+}
 
-  /* Increment current size */
-  batch_system->current_size++;
+void uv_batch_cleanup(uv_loop_t *loop)
+{
+  uv_batch_t *batch_system;
+  uv_batch_lane_t *lane;
+  uv_batch_event_t *event;
+  uv_batch_event_t *next;
+  unsigned int i;
+
+  if (loop == NULL || loop->batch_system == NULL)
+    return;
+
+  batch_system = (uv_batch_t *)loop->batch_system;
 
-  /* Start timeout timer if this is the first event in batch */
-  if (loop->batch_pending == 1)
+  /* Pick up events submitted since the last wakeup, then process any
+   * pending batched events. Whatever the callbacks keep queueing after
+   * that is dropped along with the slab. */
+  uv__batch_submit_cb(&batch_system->submit_async);
+  if (uv__batch_drain(loop))
   {
-    if (uv_timer_start(&batch_system->timeout_timer, uv__batch_timeout_cb, batch_system->timeout_ms, 0) != 0)
+    for (i = 0; i <= UV_BATCH_MAX_EVENT_TYPE; i++)
     {
-      return -1;
+      lane = i == 0 ? &batch_system->lane : &batch_system->types[i - 1];
+      for (event = uv__batch_dequeue(lane); event != NULL; event = next)
+      {
+        next = event->next;
+        uv__batch_event_put(batch_system, event);
+      }
     }
   }
 
-  return 0; /* Successfully batched */
+  /* Both handles are freed along with the batch system below, and when the
+   * loop is being closed it never runs again to finish a uv_close(). Stop
+   * them and unlink them from the loop by hand instead. */
+  uv_timer_stop(&batch_system->timeout_timer);
+#ifdef _WIN32
+  uv__handle_stop(&batch_system->submit_async);
+#else
+  uv__async_close(&batch_system->submit_async);
+#endif
+  uv__queue_remove(&batch_system->timeout_timer.handle_queue);
+  uv__queue_remove(&batch_system->submit_async.handle_queue);
+
+  /* Destroy the mutex */
+  uv_mutex_destroy(&batch_system->mutex);
+
+  /* Free resources */
+  uv__batch_slab_free(batch_system);
+  uv__batch_platform_cleanup(batch_system);
+  uv__free(batch_system);
+
+  loop->batch_system = NULL;
+  loop->batch_enabled = 0;
+  loop->batch_pending = 0;
 }
 
-uint64_t uv__batch_adjust_timeout(uv_loop_t *loop, uint64_t timeout)
+/*
+ * Clamps a poll timeout in nanoseconds, -1 meaning infinite, to the flush
+ * deadline of the pending batch. The batch timer only has millisecond
+ * resolution, platforms that can sleep with a finer granularity use this
+ * to wake up right when the batch is due.
+ */
+int64_t uv__batch_adjust_timeout(uv_loop_t *loop, int64_t timeout)
 {
   uv_batch_t *batch_system;
+  uint64_t now;
 
   /* If batching isn't enabled or there are no pending events, don't modify timeout */
   if (loop == NULL || loop->batch_system == NULL || !loop->batch_enabled || loop->batch_pending == 0)
     return timeout;
 
   batch_system = (uv_batch_t *)loop->batch_system;
+  if (batch_system->flush_requested)
+    return 0;
+
+  if (batch_system->deadline == 0)
+    return timeout;
+
+  now = uv__batch_hrtime();
+  if (now >= batch_system->deadline)
+    return 0;
 
   /*
-   * If the current timeout is longer than our batch timeout, reduce it
-   * to ensure batched events get processed reasonably soon.
-   *
-   * This is important because we don't want events sitting in the batch
-   * for too long just because the event loop is waiting for a longer timeout.
+   * If the current timeout is longer than the time left until the deadline,
+   * reduce it so that batched events don't sit in the batch for too long
+   * just because the event loop is waiting for a longer timeout.
    */
-  if (timeout > batch_system->timeout_ms || timeout == INFINITE)
-    return batch_system->timeout_ms;
+  if (timeout == -1 || (uint64_t)timeout > batch_system->deadline - now)
+    return (int64_t)(batch_system->deadline - now);
 
   /*
    * If the current timeout is already shorter than our batch timeout,
@@ -253,66 +618,40 @@ uint64_t uv__batch_adjust_timeout(uv_loop_t *loop, uint64_t timeout)
   return timeout;
 }
 
-/* Process a batch of events */
-void uv__batch_process(uv_batch_t *batch)
+/* Dispatch every lane, the default lane first */
+void uv__batch_process(uv_batch_t *batch, uv_batch_flush_reason_t reason)
 {
-  uv_batch_event_t *current, *next;
-  size_t processed = 0;
-  uint64_t start_time = uv__batch_hrtime();
+  unsigned int i;
 
   if (!batch || batch->is_processing || batch->current_size == 0)
   {
     return;
   }
 
-  batch->is_processing = 1;
-  batch->current_size = 0;
-
-  /* Sort events by priority */
-  uv__batch_sort_by_priority(&batch->queue_head);
+  uv__batch_dispatch(batch, &batch->lane, reason);
 
-  /* Process all events */
-  if (batch->process_batch_cb)
+  for (i = 0; batch->npolicies > 0 && i < UV_BATCH_MAX_EVENT_TYPE; i++)
   {
-    batch->process_batch_cb(batch->queue_head, batch->current_size);
+    uv__batch_dispatch(batch, &batch->types[i], reason);
   }
-
-  /* Update event status and call callbacks */
-  current = batch->queue_head;
-  while (current != NULL)
-  {
-    next = current->next;
-
-    current->status = UV_BATCH_STATUS_COMPLETED;
-    if (current->callback)
-    {
-      current->callback(current->data);
-    }
-
-    processed++;
-    current = next;
-  }
-
-  /* Update statistics */
-  // uv__batch_update_stats(batch, processed);
-  // batch->stats.total_processing_time += uv__batch_hrtime() - start_time;
-
-  /* Clean up processed events */
-  uv__batch_free_events(batch->queue_head);
-  batch->queue_head = NULL;
-  batch->queue_tail = NULL;
-  batch->current_size = 0;
-  batch->loop->batch_pending -= processed;
-  batch->is_processing = 0;
 }
 
-/* Signal batch processing on Windows */
-void uv__batch_windows_signal(uv_batch_t *batch)
+/* Dispatches a lane now, or on the next loop iteration */
+static void uv__batch_flush_lane(uv_batch_t *batch,
+                                 uv_batch_lane_t *lane,
+                                 uv_batch_flush_reason_t reason,
+                                 int immediate)
 {
-  if (batch && batch->event_handle)
+  if (immediate && !batch->is_processing)
   {
-    SetEvent(batch->event_handle);
+    uv__batch_dispatch(batch, lane, reason);
+    return;
   }
+
+  /* Let uv_run() drain the lane after the next poll for I/O */
+  lane->flush_requested = 1;
+  lane->flush_reason = reason;
+  batch->flush_requested = 1;
 }
 
 void uv__batch_schedule_processing(uv_loop_t *loop, int immediate)
@@ -324,14 +663,92 @@ void uv__batch_schedule_processing(uv_loop_t *loop, int immediate)
 
   batch_system = (uv_batch_t *)loop->batch_system;
 
-  if (immediate)
+  if (immediate && !batch_system->is_processing)
   {
-    uv__batch_process_pending(loop);
+    uv__batch_process_pending(loop, UV_BATCH_FLUSH_FULL);
+  }
+  else if (batch_system->lane.count >= batch_system->limit)
+  {
+    uv__batch_flush_lane(batch_system, &batch_system->lane, UV_BATCH_FLUSH_FULL, 0);
   }
   else
   {
-    // Schedule processing for the next iteration of the event loop
-    uv_timer_start(&batch_system->timeout_timer, uv__batch_timeout_cb, batch_system->timeout_ms, 0);
+    uv__batch_flush_lane(batch_system, &batch_system->lane, UV_BATCH_FLUSH_THRESHOLD, 0);
+  }
+}
+
+/* Called by uv_run() once per loop iteration, right after polling for I/O */
+void uv__batch_run(uv_loop_t *loop)
+{
+  uv_batch_t *batch_system;
+
+  batch_system = loop->batch_system;
+  if (batch_system == NULL || batch_system->is_processing)
+    return;
+
+  /* The poll may have woken up for the deadline before the timer is due */
+  if (!batch_system->flush_requested &&
+      (batch_system->deadline == 0 ||
+       uv__batch_hrtime() < batch_system->deadline))
+    return;
+
+  uv__batch_flush_due(batch_system);
+}
+
+/*
+ * Queues an event that has been filled in for dispatch on the lane for its
+ * type, arming the lane deadline on its first event and flushing the lane
+ * when it is full.
+ */
+static void uv__batch_queue_event(uv_loop_t *loop,
+                                  uv_batch_t *batch_system,
+                                  uv_batch_event_t *batch_event)
+{
+  uv_batch_lane_t *lane;
+  unsigned int size;
+  unsigned int timeout_us;
+
+  /* Append to the bucket for its priority */
+  lane = uv__batch_lane(batch_system, batch_event->type);
+  uv__batch_enqueue(lane, batch_event);
+
+  /* Increment pending event count */
+  loop->batch_pending++;
+
+  /* Increment current size */
+  batch_system->current_size++;
+
+  /* If this is the first event on the lane, set its deadline. The timer is
+   * rounded up to whole milliseconds, it keeps the loop alive and flushes
+   * the lane on platforms where the poll can't wait for the exact deadline.
+   */
+  if (lane->count == 1)
+  {
+    timeout_us = uv__batch_lane_timeout(batch_system, lane);
+    lane->deadline = batch_event->timestamp + (uint64_t)timeout_us * 1000;
+
+    if (batch_system->deadline == 0 || lane->deadline < batch_system->deadline)
+    {
+      batch_system->deadline = lane->deadline;
+      uv_timer_start(&batch_system->timeout_timer,
+                     uv__batch_timeout_cb,
+                     (timeout_us + 999) / 1000,
+                     0);
+    }
+  }
+
+  /* Full lanes are dispatched right away, threshold-based triggers wait
+   * for the next loop iteration */
+  size = uv__batch_lane_size(batch_system, lane);
+  if (lane->count >= size)
+  {
+    uv__batch_flush_lane(batch_system, lane, UV_BATCH_FLUSH_FULL, 1);
+  }
+  else if ((batch_system->flags & UV_BATCH_THRESHOLD_PROCESS) &&
+           lane->count >= (lane->has_policy ? size / 2
+                                            : batch_system->process_threshold))
+  {
+    uv__batch_flush_lane(batch_system, lane, UV_BATCH_FLUSH_THRESHOLD, 0);
   }
 }
 
@@ -342,115 +759,268 @@ void uv__batch_schedule_processing(uv_loop_t *loop, int immediate)
  *
  * Parameters:
  *   loop       - The event loop that owns the batch system
+ *   type       - Kind of event, used for statistics
+ *   priority   - Dispatch priority within the batch
  *   event      - Pointer to the event data to be batched
  *   event_size - Size of the event data in bytes
+ *   callback   - Invoked with a copy of the event data on dispatch
  *
  * Returns:
  *   0 on success (event added to batch)
- *   -1 on failure (batch full, batching disabled, etc.)
+ *   UV_EINVAL if batching is disabled or the arguments are invalid
+ *   UV_ENOBUFS if the batch is full and can't be processed right now
+ *   UV_ENOMEM if the event couldn't be allocated
  */
-int uv__batch_add_event_internal(uv_loop_t *loop, void *event, size_t event_size)
+int uv__batch_add_event_internal(uv_loop_t *loop,
+                                 uv_batch_event_type_t type,
+                                 uv_batch_priority_t priority,
+                                 const void *event,
+                                 size_t event_size,
+                                 uv_batch_callback_t callback)
 {
   uv_batch_t *batch_system;
-  char *storage_ptr;
   uv_batch_event_t *batch_event;
 
   /* Validate parameters and check if batching is enabled */
   if (loop == NULL || loop->batch_system == NULL ||
       !loop->batch_enabled || event == NULL || event_size == 0)
   {
-    return -1;
+    return UV_EINVAL;
   }
 
   batch_system = loop->batch_system;
 
   /* Check if batch is at capacity */
-  if (loop->batch_pending >= batch_system->capacity)
+  if (batch_system->current_size >= batch_system->capacity)
   {
     /* If auto-process is enabled, process the current batch first */
-    if (batch_system->flags & UV_BATCH_AUTO_PROCESS)
+    if ((batch_system->flags & UV_BATCH_AUTO_PROCESS) &&
+        !batch_system->is_processing)
     {
-      uv__batch_process_pending(loop);
+      uv__batch_process_pending(loop, UV_BATCH_FLUSH_FULL);
     }
     else
     {
       /* Batch is full and auto-process is disabled */
-      return -1;
+      return UV_ENOBUFS;
     }
   }
 
-  /* Get pointer to the next available event storage slot */
-  batch_event = &batch_system->events[loop->batch_pending];
+  /* The slab is allocated on first use, sized from the batch capacity */
+  if (batch_system->events == NULL && uv__batch_slab_init(batch_system))
+    return UV_ENOMEM;
 
-  /* Check if the event will fit in our storage */
-  if (event_size > batch_system->event_size)
-  {
-    return -1; // Event is too large for pre-allocated storage
-  }
+  batch_event = uv__batch_event_get(batch_system, event_size);
+  if (batch_event == NULL)
+    return batch_system->free_events == NULL ? UV_ENOBUFS : UV_ENOMEM;
 
   /* Copy the event data into our storage */
-  memcpy(&batch_event->data, event, event_size);
+  memcpy(batch_event->data, event, event_size);
+
+  batch_event->type = type;
+  batch_event->priority = priority;
+  batch_event->status = UV_BATCH_STATUS_PENDING;
+  batch_event->data_size = event_size;
   batch_event->size = event_size;
+  batch_event->timestamp = uv__batch_hrtime();
+  batch_event->callback = callback;
+  batch_event->next = NULL;
 
   /* Mark the event as valid */
-  batch_event->flags = UV_BATCH_EVENT_VALID;
+  batch_event->flags |= UV_BATCH_EVENT_VALID;
 
-  /* Increment pending event count */
-  loop->batch_pending++;
+  uv__batch_queue_event(loop, batch_system, batch_event);
 
-  /* Increment current size */
-  batch_system->current_size++;
+  return 0;
+}
+
+int uv_batch_get_stats(uv_loop_t *loop, uv_batch_stats_t *stats)
+{
+  uv_batch_t *batch_system;
+
+  if (loop == NULL || loop->batch_system == NULL || stats == NULL)
+    return UV_EINVAL;
+
+  batch_system = loop->batch_system;
+  *stats = batch_system->stats;
+
+  /* The means and percentiles are derived here rather than kept up to date
+   * on every dispatch */
+  if (stats->total_batches > 0)
+    stats->avg_batch_size = stats->total_events_processed / stats->total_batches;
+
+  if (stats->total_events_processed > 0)
+    stats->avg_latency = stats->total_latency / stats->total_events_processed;
+
+  stats->latency_p50 = uv_batch_stats_percentile(stats, 50.0);
+  stats->latency_p99 = uv_batch_stats_percentile(stats, 99.0);
+  stats->latency_p999 = uv_batch_stats_percentile(stats, 99.9);
+
+  return 0;
+}
+
+void uv_batch_reset_stats(uv_loop_t *loop)
+{
+  if (loop == NULL || loop->batch_system == NULL)
+    return;
+
+  memset(&loop->batch_system->stats, 0, sizeof(loop->batch_system->stats));
+}
 
-  /* If this is the first event in the batch, start the timeout timer */
-  if (loop->batch_pending == 1 && batch_system->timeout_ms > 0)
+/*
+ * Returns the latency in nanoseconds below which the given percentage of
+ * the dispatched events fall, rounded up to the upper bound of its
+ * histogram bucket. Returns 0 if no events have been dispatched.
+ */
+uint64_t uv_batch_stats_percentile(const uv_batch_stats_t *stats,
+                                   double percentile)
+{
+  uint64_t total;
+  uint64_t rank;
+  uint64_t seen;
+  uint64_t bound;
+  unsigned int shift;
+  unsigned int i;
+
+  total = 0;
+  for (i = 0; i < UV_BATCH_LATENCY_BUCKETS; i++)
+    total += stats->latency_hist[i];
+
+  if (total == 0)
+    return 0;
+
+  if (percentile < 0.0)
+    percentile = 0.0;
+  if (percentile > 100.0)
+    percentile = 100.0;
+
+  rank = (uint64_t)(total * percentile / 100.0 + 0.5);
+  if (rank == 0)
+    rank = 1;
+
+  seen = 0;
+  for (i = 0; i < UV_BATCH_LATENCY_BUCKETS - 1; i++)
   {
-    uv_timer_start(&batch_system->timeout_timer,
-                   uv__batch_timeout_cb,
-                   batch_system->timeout_ms,
-                   0);
+    seen += stats->latency_hist[i];
+    if (seen >= rank)
+      break;
   }
 
-  /* If we've reached capacity or threshold, schedule processing */
-  if (loop->batch_pending >= batch_system->capacity ||
-      (batch_system->flags & UV_BATCH_THRESHOLD_PROCESS &&
-       loop->batch_pending >= batch_system->process_threshold))
-  {
+  /* The last bucket is unbounded, report the largest latency seen */
+  if (i == UV_BATCH_LATENCY_BUCKETS - 1)
+    return stats->max_latency;
 
-    /* Signal the event loop that processing is needed */
-    if (loop->batch_pending >= batch_system->capacity)
-    {
-      /* For full batches, we might want immediate processing */
-      uv__batch_schedule_processing(loop, 1); /* 1 = immediate */
-    }
-    else
-    {
-      /* For threshold-based triggers, regular scheduling is fine */
-      uv__batch_schedule_processing(loop, 0); /* 0 = regular */
-    }
-  }
+  if (i < (1u << UV_BATCH_LATENCY_SUB_BITS))
+    return i;
+
+  shift = (i >> UV_BATCH_LATENCY_SUB_BITS) - 1;
+  bound = ((uint64_t)((1u << UV_BATCH_LATENCY_SUB_BITS) +
+                      (i & ((1u << UV_BATCH_LATENCY_SUB_BITS) - 1)))
+           << shift) + (((uint64_t)1 << shift) - 1);
+
+  return bound < stats->max_latency ? bound : stats->max_latency;
+}
+
+int uv_batch_add_event(uv_loop_t *loop,
+                       uv_batch_event_type_t type,
+                       uv_batch_priority_t priority,
+                       const void *data,
+                       size_t size,
+                       uv_batch_cb cb)
+{
+  return uv__batch_add_event_internal(loop, type, priority, data, size, cb);
+}
+
+/*
+ * Thread-safe counterpart of uv_batch_add_event(). The event is allocated
+ * here rather than taken from the slab, which belongs to the loop thread,
+ * and pushed onto a lock-free stack that the loop empties in one atomic
+ * exchange. Only the push that finds the stack empty wakes the loop.
+ */
+int uv_batch_submit(uv_loop_t *loop,
+                    uv_batch_event_type_t type,
+                    uv_batch_priority_t priority,
+                    const void *data,
+                    size_t size,
+                    uv_batch_cb cb)
+{
+  uv_batch_t *batch_system;
+  uv_batch_event_t *event;
+  size_t extra;
+
+  if (loop == NULL || loop->batch_system == NULL || data == NULL || size == 0)
+    return UV_EINVAL;
+
+  batch_system = loop->batch_system;
+
+  /* Payloads that don't fit inline go right behind the event */
+  extra = 0;
+  if (size > sizeof(event->inline_data))
+    extra = size;
+
+  event = (uv_batch_event_t *)uv__malloc(sizeof(*event) + extra);
+  if (event == NULL)
+    return UV_ENOMEM;
+
+  event->data = extra ? (void *)(event + 1) : (void *)event->inline_data;
+  memcpy(event->data, data, size);
+
+  event->type = type;
+  event->priority = priority;
+  event->status = UV_BATCH_STATUS_PENDING;
+  event->data_size = size;
+  event->size = size;
+  event->timestamp = uv__batch_hrtime();
+  event->callback = cb;
+  event->flags = UV_BATCH_EVENT_SUBMITTED | UV_BATCH_EVENT_VALID;
+
+  if (uv__batch_submit_push(batch_system, event))
+    return uv_async_send(&batch_system->submit_async);
 
   return 0;
 }
 
+/* Moves submitted events into the batch, runs on the loop thread */
+static void uv__batch_submit_cb(uv_async_t *handle)
+{
+  uv_batch_t *batch_system;
+  uv_batch_event_t *event;
+  uv_batch_event_t *next;
+  uv_loop_t *loop;
+
+  loop = handle->loop;
+  batch_system = loop->batch_system;
+
+  for (event = uv__batch_submit_take(batch_system); event != NULL; event = next)
+  {
+    next = event->next;
+    uv__batch_queue_event(loop, batch_system, event);
+  }
+
+  /* Producers can't tell whether batching is enabled, don't hold their
+   * events back if it isn't */
+  if (!loop->batch_enabled && loop->batch_pending > 0)
+    uv__batch_process_pending(loop, UV_BATCH_FLUSH_FORCED);
+}
+
 /* Process any pending batches - called during event loop */
-int uv__batch_process_pending(uv_loop_t *loop)
+int uv__batch_process_pending(uv_loop_t *loop, uv_batch_flush_reason_t reason)
 {
   uv_batch_t *batch;
 
-  if (!loop || !loop->batch_enabled || !loop->batch_system || loop->batch_pending == 0)
+  if (!loop || !loop->batch_system || loop->batch_pending == 0)
   {
     return 0;
   }
 
   batch = loop->batch_system;
 
-  uv_mutex_lock(&batch->mutex);
+  /* The queues are only touched from the loop thread, other threads go
+   * through uv_batch_submit(), so no lock is held while callbacks run */
   if (batch->current_size > 0 && !batch->is_processing)
   {
-    batch->is_processing = 1;
-    uv__batch_process(batch);
+    uv__batch_process(batch, reason);
   }
-  uv_mutex_unlock(&batch->mutex);
 
   return 1;
-}
\ No newline at end of file
+}
@@ -3,42 +3,53 @@
  * Common utilities for event batching system
  */
 
+ #include <stdio.h>
+ #include <stdarg.h>
+ #include <string.h>
+
  #include "uv.h"
  #include "event_batch.h"
- #include "corecrt_malloc.h"
+ #include "uv-common.h"
  
- /* Get high-resolution timestamp */
+ /* Get high-resolution timestamp in nanoseconds. Flush deadlines can be
+  * well under a millisecond, so don't round to the loop's time base.
+  */
  uint64_t uv__batch_hrtime(void) {
-     return uv_hrtime() / 1000000; /* Convert from nanoseconds to milliseconds */
- } 
+     return uv_hrtime();
+ }
  
- /* Update batch statistics */
- void uv__batch_update_stats(uv_batch_t* batch, size_t processed_count) {
-     batch->stats.total_events_processed += processed_count;
-     
-     if (processed_count > batch->stats.max_batch_size) {
-         batch->stats.max_batch_size = processed_count;
-     }
-     
-     /* Update average batch size using moving average */
-     if (batch->stats.total_events_processed > 0) {
-         batch->stats.avg_batch_size = 
-             (batch->stats.avg_batch_size + processed_count) / 2;
-     } else {
-         batch->stats.avg_batch_size = processed_count;
-     }
-     
-     /* Count events by type */
-     uv_batch_event_t* current = batch->queue_head;
-     while (current != NULL) {
-         if (current->type < UV_BATCH_MAX_EVENT_TYPES) {
-             batch->stats.events_by_type[current->type]++;
-         }
-         if (current->status == UV_BATCH_STATUS_FAILED) {
-             batch->stats.failed_events++;
-         }
-         current = current->next;
-     }
+ /* Update batch statistics for a dispatched batch of count events whose
+  * callbacks took run_ns. The per event counters are updated as the events
+  * are dispatched, see uv__batch_stats_event().
+  */
+ void uv__batch_update_stats(uv_batch_t* batch,
+                             const uv_batch_lane_t* lane,
+                             unsigned int count,
+                             uv_batch_flush_reason_t reason,
+                             uint64_t run_ns) {
+     uv_batch_stats_t* stats;
+     unsigned int bucket;
+
+     if (count == 0)
+         return;
+
+     stats = &batch->stats;
+     stats->total_events_processed += count;
+     stats->total_batches++;
+     stats->total_processing_time += run_ns;
+     stats->flushes[reason]++;
+
+     /* lane is NULL for the readiness stage */
+     if (lane != NULL && lane->has_policy)
+         stats->type_flushes[lane - batch->types][reason]++;
+
+     if (count > stats->max_batch_size)
+         stats->max_batch_size = count;
+
+     bucket = uv__batch_log2(count);
+     if (bucket >= UV_BATCH_SIZE_BUCKETS)
+         bucket = UV_BATCH_SIZE_BUCKETS - 1;
+     stats->batch_size_hist[bucket]++;
  }
  
  /* Utility function to validate batch configuration */
@@ -58,67 +69,412 @@
      return 0;
  }
  
- /* Helper function to free event chain */
- void uv__batch_free_events(uv_batch_event_t* head) {
-     uv_batch_event_t* current = head;
-     while (current != NULL) {
-         uv_batch_event_t* next = current->next;
-         if (current->data) {
-             free(current->data);
-         }
-         free(current);
-         current = next;
+ /* Exponentially weighted moving average with a weight of 1/8 */
+ #define UV__BATCH_EWMA(avg, sample) ((avg) - ((avg) >> 3) + ((sample) >> 3))
+
+ /* Put the controller back in its starting state. Adaptive batching starts
+  * out dispatching every event immediately and only starts holding events
+  * back once it has seen enough traffic to make it worthwhile.
+  */
+ void uv__batch_adapt_reset(uv_batch_t* batch) {
+     memset(&batch->adaptive, 0, sizeof(batch->adaptive));
+     batch->adaptive.scale = 256;
+
+     if (batch->flags & UV_BATCH_ADAPTIVE) {
+         batch->limit = 1;
+         batch->timeout_us = 0;
+     } else {
+         batch->limit = batch->capacity;
+         batch->timeout_us = batch->max_timeout_us;
      }
+
+     batch->process_threshold = batch->limit / 2;
  }
- 
- /* Sort events by priority (bubble sort) */
- void uv__batch_sort_by_priority(uv_batch_event_t** head) {
-     int swapped;
-     uv_batch_event_t *ptr1;
-     uv_batch_event_t *lptr = NULL;
- 
-     if (*head == NULL)
+
+ /* Latency bound of the UV_BATCH_ADAPTIVE controller in nanoseconds */
+ uint64_t uv__batch_adapt_bound(const uv_batch_t* batch) {
+     if (batch->latency_us != 0)
+         return (uint64_t) batch->latency_us * 1000;
+     return (uint64_t) batch->max_timeout_us * 1000;
+ }
+
+ /* Feed a batch of count events, dispatched between the uv_hrtime() values
+  * start and end, to the UV_BATCH_ADAPTIVE controller and retune the dispatch
+  * size and timeout. late of the events waited longer than the latency bound.
+  *
+  * An event can wait for up to limit / rate to be dispatched, plus the time
+  * it takes to run the callbacks of the events in front of it. The controller
+  * picks the largest limit for which that stays within the latency bound, so
+  * batches grow with the arrival rate. When fewer than two events are
+  * expected to arrive within the bound, holding events back can't amortize
+  * anything and it falls back to dispatching them immediately. The limit is
+  * lowered right away but only raised while batches fill up, so a short
+  * lull doesn't turn into extra latency for the next burst.
+  *
+  * The model only bounds the mean wait. Bursts throw off the averages and
+  * the loop can be busy elsewhere when a batch is due, so the observed
+  * latencies are fed back too. When more than 1% of the events in a window
+  * of UV_BATCH_ADAPT_WINDOW waited longer than the bound, the p99 is over
+  * it, and the share of the bound the model plans with is halved. That
+  * shrinks both the limit and the timeout. Windows well within the bound
+  * slowly give the cut back.
+  */
+ void uv__batch_adapt(uv_batch_t* batch,
+                      unsigned int count,
+                      unsigned int late,
+                      uint64_t start,
+                      uint64_t end) {
+     uv_batch_adaptive_t* a;
+     uint64_t interval;
+     uint64_t run_ns;
+     uint64_t budget;
+     uint64_t window;
+     uint64_t target;
+     uint64_t rate;
+     uint64_t cost;
+     uint64_t fill;
+
+     if (count == 0)
          return;
- 
+
+     a = &batch->adaptive;
+     run_ns = end - start;
+
+     fill = ((uint64_t) count << 8) / batch->limit;
+     if (fill > 256)
+         fill = 256;
+
+     if (a->last == 0) {
+         a->interval = run_ns;
+         a->run = run_ns;
+         a->count = (uint64_t) count << 8;
+         a->fill = fill;
+     } else {
+         interval = end - a->last;
+         a->interval = UV__BATCH_EWMA(a->interval, interval);
+         a->run = UV__BATCH_EWMA(a->run, run_ns);
+         a->count = UV__BATCH_EWMA(a->count, (uint64_t) count << 8);
+         a->fill = UV__BATCH_EWMA(a->fill, fill);
+     }
+     a->last = end;
+
+     a->seen += count;
+     a->late += late;
+     if (a->seen >= UV_BATCH_ADAPT_WINDOW) {
+         if (a->late * 100 > a->seen)
+             a->scale -= a->scale / 2;
+         else if (a->late * 200 <= a->seen)
+             a->scale += (256 - a->scale + 31) / 32;
+         a->seen = 0;
+         a->late = 0;
+     }
+
+     budget = uv__batch_adapt_bound(batch) * a->scale / 256;
+
+     /* Arrival rate in events per second and dispatch cost in ns per event,
+      * clamped so that the products below can't overflow.
+      */
+     if (a->interval > 0)
+         rate = a->count * 1000000000 / (a->interval << 8);
+     else
+         rate = 1000000000;
+     if (rate > 1000000000)
+         rate = 1000000000;
+     cost = a->count > 0 ? (a->run << 8) / a->count : 0;
+     if (cost > 1000000000)
+         cost = 1000000000;
+
+     if (rate * budget / 1000000000 < 2) {
+         batch->limit = 1;
+         batch->timeout_us = 0;
+         batch->process_threshold = 0;
+         return;
+     }
+
+     target = budget * rate / (1000000000 + cost * rate);
+     if (target < 1)
+         target = 1;
+     if (target > batch->capacity)
+         target = batch->capacity;
+
+     if (target < batch->limit)
+         batch->limit = (unsigned int) target;
+     else if (a->fill >= 192)
+         batch->limit += batch->limit / 4 + 1;
+
+     if (batch->limit > target)
+         batch->limit = (unsigned int) target;
+
+     /* Hold events for as long as it takes to fill the batch, minus the time
+      * needed to dispatch it.
+      */
+     window = (uint64_t) batch->limit * 1000000000 / rate;
+     if (batch->limit * cost >= budget)
+         window = 0;
+     else if (window > budget - batch->limit * cost)
+         window = budget - batch->limit * cost;
+     if (window > (uint64_t) batch->max_timeout_us * 1000)
+         window = (uint64_t) batch->max_timeout_us * 1000;
+
+     batch->timeout_us = (unsigned int) (window / 1000);
+     batch->process_threshold = batch->limit / 2;
+ }
+
+ /* Allocate the event slab. It holds two batches worth of events: the batch
+  * being dispatched keeps its events until their callbacks have run, and those
+  * callbacks can fill up the next batch in the meantime.
+  */
+ int uv__batch_slab_init(uv_batch_t* batch) {
+     unsigned int i;
+     unsigned int n;
+
+     n = 2 * batch->capacity;
+     batch->events = uv__malloc(n * sizeof(*batch->events));
+     if (batch->events == NULL)
+         return UV_ENOMEM;
+
+     for (i = 0; i + 1 < n; i++)
+         batch->events[i].next = &batch->events[i + 1];
+     batch->events[n - 1].next = NULL;
+
+     batch->free_events = batch->events;
+     batch->nevents = n;
+     return 0;
+ }
+
+ /* Release the slab, all events must have been returned to it */
+ void uv__batch_slab_free(uv_batch_t* batch) {
+     uv__free(batch->events);
+     batch->events = NULL;
+     batch->free_events = NULL;
+     batch->nevents = 0;
+ }
+
+ /* Take an event from the slab. Small payloads are stored inline, larger
+  * ones fall back to a heap copy. Returns NULL if the slab is exhausted.
+  */
+ uv_batch_event_t* uv__batch_event_get(uv_batch_t* batch, size_t data_size) {
+     uv_batch_event_t* event;
+
+     event = batch->free_events;
+     if (event == NULL)
+         return NULL;
+
+     if (data_size <= sizeof(event->inline_data)) {
+         event->data = event->inline_data;
+         event->flags = 0;
+     } else {
+         event->data = uv__malloc(data_size);
+         if (event->data == NULL)
+             return NULL;
+         event->flags = UV_BATCH_EVENT_HEAP;
+     }
+
+     batch->free_events = event->next;
+     event->next = NULL;
+     return event;
+ }
+
+ /* Return an event to the slab */
+ void uv__batch_event_put(uv_batch_t* batch, uv_batch_event_t* event) {
+     /* Submitted events carry their payload in the same allocation */
+     if (event->flags & UV_BATCH_EVENT_SUBMITTED) {
+         uv__free(event);
+         return;
+     }
+
+     if (event->flags & UV_BATCH_EVENT_HEAP)
+         uv__free(event->data);
+
+     event->data = NULL;
+     event->flags = 0;
+     event->next = batch->free_events;
+     batch->free_events = event;
+ }
+
+ /* Push an event onto the submission stack, safe to call from any thread.
+  * Producers never remove anything, so a plain compare-and-swap loop is
+  * free of ABA problems. Returns 1 if the stack was empty, in which case
+  * the loop has to be woken up.
+  */
+ int uv__batch_submit_push(uv_batch_t* batch, uv_batch_event_t* event) {
+     uv_batch_event_t* head;
+
+ #ifdef _MSC_VER
      do {
-         swapped = 0;
-         ptr1 = *head;
- 
-         while (ptr1->next != lptr) {
-             if (ptr1->priority > ptr1->next->priority) {
-                 /* Swap nodes */
-                 void* temp_data = ptr1->data;
-                 size_t temp_size = ptr1->data_size;
-                 uv_batch_event_type_t temp_type = ptr1->type;
-                 uv_batch_priority_t temp_priority = ptr1->priority;
-                 uv_batch_status_t temp_status = ptr1->status;
-                 uint64_t temp_timestamp = ptr1->timestamp;
-                 void (*temp_callback)(void*) = ptr1->callback;
- 
-                 ptr1->data = ptr1->next->data;
-                 ptr1->data_size = ptr1->next->data_size;
-                 ptr1->type = ptr1->next->type;
-                 ptr1->priority = ptr1->next->priority;
-                 ptr1->status = ptr1->next->status;
-                 ptr1->timestamp = ptr1->next->timestamp;
-                 ptr1->callback = ptr1->next->callback;
- 
-                 ptr1->next->data = temp_data;
-                 ptr1->next->data_size = temp_size;
-                 ptr1->next->type = temp_type;
-                 ptr1->next->priority = temp_priority;
-                 ptr1->next->status = temp_status;
-                 ptr1->next->timestamp = temp_timestamp;
-                 ptr1->next->callback = temp_callback;
+         head = batch->submitted;
+         event->next = head;
+     } while (InterlockedCompareExchangePointer((PVOID volatile*) &batch->submitted,
+                                                event,
+                                                head) != head);
+ #else
+     head = atomic_load_explicit(&batch->submitted, memory_order_relaxed);
+     do
+         event->next = head;
+     while (!atomic_compare_exchange_weak_explicit(&batch->submitted,
+                                                   &head,
+                                                   event,
+                                                   memory_order_release,
+                                                   memory_order_relaxed));
+ #endif
+
+     return head == NULL;
+ }
+
+ /* Take all submitted events in one atomic exchange, oldest first. Must be
+  * called from the loop thread.
+  */
+ uv_batch_event_t* uv__batch_submit_take(uv_batch_t* batch) {
+     uv_batch_event_t* event;
+     uv_batch_event_t* prev;
+     uv_batch_event_t* next;
+
+ #ifdef _MSC_VER
+     event = InterlockedExchangePointer((PVOID volatile*) &batch->submitted, NULL);
+ #else
+     event = atomic_exchange_explicit(&batch->submitted,
+                                      NULL,
+                                      memory_order_acquire);
+ #endif
+
+     /* The stack is newest first, reverse it to restore submission order */
+     prev = NULL;
+     while (event != NULL) {
+         next = event->next;
+         event->next = prev;
+         prev = event;
+         event = next;
+     }
+
+     return prev;
+ }
+
+ /* Append an event to the FIFO bucket for its priority, O(1) */
+ void uv__batch_enqueue(uv_batch_lane_t* lane, uv_batch_event_t* event) {
+     uv_batch_queue_t* queue;
+
+     if ((unsigned int) event->priority >= UV_BATCH_PRIORITY_LEVELS)
+         event->priority = UV_BATCH_PRIORITY_LOW;
+
+     queue = &lane->queues[event->priority];
+     event->next = NULL;
+     lane->count++;
+
+     if (queue->tail != NULL)
+         queue->tail->next = event;
+     else
+         queue->head = event;
+     queue->tail = event;
+ }
+
+ /* Detach all events queued on a lane as a single list. The buckets are
+  * chained highest priority first, so the list is in dispatch order without
+  * any sorting and events of equal priority keep their arrival order.
+  */
+ uv_batch_event_t* uv__batch_dequeue(uv_batch_lane_t* lane) {
+     uv_batch_event_t* head;
+     uv_batch_event_t** link;
+     uv_batch_queue_t* queue;
+     int i;
+
+     head = NULL;
+     link = &head;
+
+     for (i = 0; i < UV_BATCH_PRIORITY_LEVELS; i++) {
+         queue = &lane->queues[i];
+         if (queue->head == NULL)
+             continue;
+
+         *link = queue->head;
+         link = &queue->tail->next;
+         queue->head = NULL;
+         queue->tail = NULL;
+     }
+
+     lane->count = 0;
+     lane->flush_requested = 0;
+     lane->deadline = 0;
+     return head;
+ }
  
-                 swapped = 1;
+ /* Reorder a dispatch list for UV_BATCH_LOCALITY. Events with the same
+  * type and callback are moved next to each other, groups come in the order
+  * of their first event and never cross a priority boundary. The sort is
+  * stable, so events for one handler still run in the order they were added.
+  */
+ uv_batch_event_t* uv__batch_group(uv_batch_event_t* head) {
+     struct {
+         uv_batch_event_type_t type;
+         uv_batch_cb cb;
+         uv_batch_event_t* head;
+         uv_batch_event_t** link;
+     } groups[UV_BATCH_LOCALITY_GROUPS];
+     uv_batch_event_t* event;
+     uv_batch_event_t* next;
+     uv_batch_event_t* rest;
+     uv_batch_event_t** rest_link;
+     uv_batch_event_t** link;
+     uv_batch_priority_t priority;
+     unsigned int ngroups;
+     unsigned int last;
+     unsigned int i;
+
+     link = &head;
+     event = head;
+
+     while (event != NULL) {
+         priority = event->priority;
+         ngroups = 0;
+         last = 0;
+         rest = NULL;
+         rest_link = &rest;
+
+         for (; event != NULL && event->priority == priority; event = next) {
+             next = event->next;
+
+             /* Runs of the same handler are the common case */
+             i = last;
+             if (i >= ngroups ||
+                 groups[i].type != event->type ||
+                 groups[i].cb != event->callback) {
+                 for (i = 0; i < ngroups; i++)
+                     if (groups[i].type == event->type &&
+                         groups[i].cb == event->callback)
+                         break;
+
+                 if (i == ngroups && ngroups < UV_BATCH_LOCALITY_GROUPS) {
+                     groups[i].type = event->type;
+                     groups[i].cb = event->callback;
+                     groups[i].link = &groups[i].head;
+                     ngroups++;
+                 }
              }
-             ptr1 = ptr1->next;
+
+             if (i < ngroups) {
+                 *groups[i].link = event;
+                 groups[i].link = &event->next;
+                 last = i;
+             } else {
+                 *rest_link = event;
+                 rest_link = &event->next;
+             }
+         }
+
+         for (i = 0; i < ngroups; i++) {
+             *link = groups[i].head;
+             link = groups[i].link;
          }
-         lptr = ptr1;
-     } while (swapped);
+
+         if (rest != NULL) {
+             *link = rest;
+             link = rest_link;
+         }
+     }
+
+     *link = NULL;
+     return head;
  }
- 
+
  /* Debug logging helper */
  void uv__batch_log(const char* format, ...) {
  #ifdef UV_BATCH_DEBUG
@@ -26,59 +26,586 @@
 #endif
 
 #include <stdlib.h>
+#include <string.h>
 
 #define MAX_THREADPOOL_SIZE 1024
 
+/* Queue wait after which a pool below UV_THREADPOOL_MAX_SIZE grows. */
+#define THREADPOOL_GROW_WAIT 1000000  /* 1 ms */
+
+/* Default UV_THREADPOOL_IDLE_TIMEOUT, in milliseconds. */
+#define THREADPOOL_IDLE_TIMEOUT 5000
+
+/* Times in a row that work of a uv_work_priority_t can be passed over for
+ * higher priority work before it gets a turn.
+ */
+#define WORK_STARVE_LIMIT 8
+
+/* State of a thread slot when the pool size is dynamic. */
+enum {
+  THREAD_FREE,
+  THREAD_RUNNING,
+  THREAD_EXITED  /* Retired, still needs to be joined. */
+};
+
+/* Selected with UV_THREADPOOL_MODE when the threadpool starts. */
+enum uv__pool_mode {
+  UV__POOL_SHARED,      /* One queue for all workers, the default. */
+  UV__POOL_STEAL,       /* Per worker queues, work is spread round-robin. */
+  UV__POOL_STEAL_LOOP   /* Per worker queues, each loop posts to one worker. */
+};
+
+/* Selected with UV_THREADPOOL_PIN when the threadpool starts. */
+enum uv__pool_pin {
+  UV__PIN_NONE,
+  UV__PIN_NODE,  /* Workers run on the CPUs of their NUMA node. */
+  UV__PIN_CPU    /* Workers run on one CPU of their NUMA node. */
+};
+
+/* A worker in the work-stealing modes. Each worker has its own queue and
+ * lock; a worker that runs out of work takes it from the others before it
+ * goes to sleep, so posting work only contends with the worker it is
+ * posted to.
+ */
+struct uv__worker {
+  uv_mutex_t mutex;
+  uv_cond_t cond;
+  struct uv__queue wq[UV_WORK_PRIORITY_MAX];  /* See work_queues */
+  unsigned int passed[UV_WORK_PRIORITY_MAX];  /* See work_passed */
+  int sleeping;  /* Cleared by whoever wakes the worker up. */
+  int exiting;
+  uv_sem_t* ready;
+};
+
 static uv_once_t once = UV_ONCE_INIT;
 static uv_cond_t cond;
 static uv_mutex_t mutex;
 static unsigned int idle_threads;
 static unsigned int slow_io_work_running;
 static unsigned int nthreads;
+static unsigned int min_threads;
+static unsigned int max_threads;
+static unsigned int starting_threads;
+static uint64_t idle_timeout;
 static uv_thread_t* threads;
 static uv_thread_t default_threads[4];
+static unsigned char* thread_state;  /* Only if the pool size is dynamic. */
+static uv_thread_t monitor_thread;
+static uv_cond_t monitor_cond;
+static int monitor_waiting;
+static int monitor_exiting;
+static int pool_size;    /* nthreads, readable without `mutex`. */
+static int queue_depth;  /* Work items waiting for a worker. */
 static struct uv__queue exit_message;
-static struct uv__queue wq;
+static struct uv__queue wq;  /* UV_WORK_PRIORITY_NORMAL */
+static struct uv__queue high_wq;
+static struct uv__queue low_wq;
+static struct uv__queue* const work_queues[UV_WORK_PRIORITY_MAX] = {
+  &high_wq,
+  &wq,
+  &low_wq
+};
+static unsigned int work_passed[UV_WORK_PRIORITY_MAX];
 static struct uv__queue run_slow_work_message;
 static struct uv__queue slow_io_pending_wq;
+static enum uv__pool_mode mode;
+static struct uv__worker* workers;
+static int steal_idle;  /* Workers that are sleeping or about to. */
+static int steal_next;
+static int steal_slow;  /* Slow I/O work waiting to run. */
+static enum uv__pool_pin pin;
+static unsigned int nnodes;  /* Worker i belongs to node i % nnodes. */
+static size_t cpumask_size;
+static char* node_masks;  /* nnodes CPU masks of cpumask_size bytes. */
+static char* pin_mask;
+static unsigned short* cpu_nodes;  /* Node of each CPU. */
 
 static unsigned int slow_work_thread_threshold(void) {
   return (nthreads + 1) / 2;
 }
 
+
+/* Records of a loop that ran out of memory are shared and not accounted. */
+static int uv__work_timed(const struct uv__work_info* info) {
+  return info != &uv__get_internal_fields(info->loop)->work_untimed;
+}
+
+
+/* Marks the slow I/O work next in line as held back by
+ * slow_work_thread_threshold(). Called with `mutex` held.
+ */
+static void slow_work_throttled(void) {
+  struct uv__work* w;
+
+  if (uv__queue_empty(&slow_io_pending_wq))
+    return;
+
+  w = uv__queue_data(uv__queue_head(&slow_io_pending_wq), struct uv__work, wq);
+  if (uv__work_timed(w->info))
+    w->info->throttled = 1;
+}
+
+
+/* Whether a worker can take work of the given priority. Slow I/O at its
+ * thread limit has to wait. Called with `mutex` held.
+ */
+static int work_ready(unsigned int priority) {
+  struct uv__queue* q;
+
+  q = work_queues[priority];
+  if (uv__queue_empty(q))
+    return 0;
+
+  return q != &wq ||
+         uv__queue_head(&wq) != &run_slow_work_message ||
+         uv__queue_next(&run_slow_work_message) != &wq ||
+         slow_io_work_running < slow_work_thread_threshold();
+}
+
+
+/* Picks the queue a worker takes its next work from, NULL if there is
+ * none. That is the highest priority one, unless lower priority work has
+ * been passed over WORK_STARVE_LIMIT times. Called with `mutex` held.
+ */
+static struct uv__queue* work_next(void) {
+  unsigned int priority;
+  int pick;
+
+  pick = -1;
+  for (priority = 0; priority < UV_WORK_PRIORITY_MAX; priority++) {
+    if (!work_ready(priority))
+      continue;
+
+    if (pick == -1) {
+      pick = priority;
+    } else if (++work_passed[priority] > WORK_STARVE_LIMIT) {
+      pick = priority;
+      break;
+    }
+  }
+
+  if (pick == -1)
+    return NULL;
+
+  work_passed[pick] = 0;
+  return work_queues[pick];
+}
+
+
 static void uv__cancelled(struct uv__work* w) {
   abort();
 }
 
 
+/* Never called, marks the requests of a uv_queue_work_batch(). */
+static void uv__work_batch_item_done(struct uv__work* w, int err) {
+  abort();
+}
+
+
+/* Completed work is linked through `wq.next`, the queue node is unused once
+ * a worker took the work or uv_cancel() took it off its queue. `wq.prev`
+ * still points to itself, see uv__work_cancel().
+ */
+static struct uv__work* uv__work_next(struct uv__work* w) {
+  if (w->wq.next == NULL)
+    return NULL;
+  return uv__queue_data(w->wq.next, struct uv__work, wq);
+}
+
+
+static void uv__work_link(struct uv__work* w, struct uv__work* next) {
+  w->wq.next = next != NULL ? &next->wq : NULL;
+}
+
+
+/* Pushes completed work onto the loop's list without taking a lock.
+ * Returns non-zero if the list was empty. Otherwise the loop has been woken
+ * up already and will see the work when it takes the list.
+ */
+static int uv__work_push(uv_loop_t* loop, struct uv__work* w) {
+  uv__loop_internal_fields_t* lfields;
+  struct uv__work* head;
+
+  lfields = uv__get_internal_fields(loop);
+
+#ifdef _MSC_VER
+  do {
+    head = lfields->work_done;
+    uv__work_link(w, head);
+  } while (InterlockedCompareExchangePointer((PVOID volatile*) &lfields->work_done,
+                                             w,
+                                             head) != head);
+#else
+  head = atomic_load_explicit(&lfields->work_done, memory_order_relaxed);
+  do
+    uv__work_link(w, head);
+  while (!atomic_compare_exchange_weak_explicit(&lfields->work_done,
+                                                &head,
+                                                w,
+                                                memory_order_release,
+                                                memory_order_relaxed));
+#endif
+
+  return head == NULL;
+}
+
+
+/* Takes all completed work of the loop, oldest first. Only called from the
+ * loop thread.
+ */
+static struct uv__work* uv__work_take(uv_loop_t* loop) {
+  uv__loop_internal_fields_t* lfields;
+  struct uv__work* prev;
+  struct uv__work* next;
+  struct uv__work* w;
+
+  lfields = uv__get_internal_fields(loop);
+
+#ifdef _MSC_VER
+  w = InterlockedExchangePointer((PVOID volatile*) &lfields->work_done, NULL);
+#else
+  w = atomic_exchange_explicit(&lfields->work_done, NULL, memory_order_acquire);
+#endif
+
+  prev = NULL;
+  while (w != NULL) {
+    next = uv__work_next(w);
+    uv__work_link(w, prev);
+    prev = w;
+    w = next;
+  }
+
+  return prev;
+}
+
+
+/* Takes a record for a request that is about to be submitted. Records are
+ * only taken and given back on the loop thread.
+ */
+static struct uv__work_info* uv__work_info_get(uv_loop_t* loop,
+                                               enum uv__work_kind kind,
+                                               uint64_t now) {
+  uv__loop_internal_fields_t* lfields;
+  struct uv__work_info* info;
+
+  lfields = uv__get_internal_fields(loop);
+  info = lfields->work_spare;
+  if (info != NULL)
+    lfields->work_spare = info->next;
+  else
+    info = uv__malloc(sizeof(*info));
+
+  if (info == NULL) {
+    /* Set before any request shares it, workers only read it. */
+    lfields->work_untimed.loop = loop;
+    return &lfields->work_untimed;
+  }
+
+  info->loop = loop;
+  info->queued = now;
+  info->kind = kind;
+  info->throttled = 0;
+  return info;
+}
+
+
+static void uv__work_info_put(struct uv__work_info* info) {
+  uv__loop_internal_fields_t* lfields;
+
+  if (!uv__work_timed(info))
+    return;
+
+  lfields = uv__get_internal_fields(info->loop);
+  info->next = lfields->work_spare;
+  lfields->work_spare = info;
+}
+
+
+void uv__work_cleanup(uv_loop_t* loop) {
+  uv__loop_internal_fields_t* lfields;
+  struct uv__work_info* info;
+
+  lfields = uv__get_internal_fields(loop);
+  while (lfields->work_spare != NULL) {
+    info = lfields->work_spare;
+    lfields->work_spare = info->next;
+    uv__free(info);
+  }
+}
+
+
+/* Hands a finished or cancelled work item back to its loop. The requests of
+ * a batch are held back until all of them are done, the loop then gets one
+ * wakeup for the whole batch. Only the first item of an empty list wakes up
+ * the loop, the others are picked up by the same uv__work_done() call.
+ * A request of a batch keeps a pointer to it in its first reserved slot.
+ */
+static void uv__work_complete(struct uv__work* w) {
+  uv_work_batch_t* batch;
+  uv_loop_t* loop;
+
+  loop = w->info->loop;
+
+  if (w->done == uv__work_batch_item_done) {
+    batch = container_of(w, uv_work_t, work_req)->reserved[0];
+    if (w->work == uv__cancelled)
+      batch->status = UV_ECANCELED;
+    if (uv__fetch_add_int(&batch->pending, -1) > 1)
+      return;
+    w = &batch->work_req;
+  }
+
+  if (uv__work_push(loop, w))
+    uv_async_send(&loop->wq_async);
+}
+
+
+/* Runs the work on a worker thread. */
+static void uv__work_run(struct uv__work* w) {
+  struct uv__work_info* info;
+  uint64_t started;
+
+  info = w->info;
+  started = uv_hrtime();
+  w->work(w);
+
+  if (uv__work_timed(info)) {
+    info->started = started;
+    info->finished = uv_hrtime();
+  }
+
+  uv__work_complete(w);
+}
+
+
+static void worker(void* arg);
+static void uv__work_batch_done(struct uv__work* w, int err);
+
+
+/* Restricts worker i to the CPUs of its NUMA node, or to a single one of
+ * them. Errors are ignored, an unpinned worker still works.
+ */
+static void worker_pin(unsigned int i) {
+  unsigned int count;
+  unsigned int cpu;
+  char* mask;
+
+  if (pin == UV__PIN_NONE)
+    return;
+
+  mask = node_masks + (i % nnodes) * cpumask_size;
+
+  if (pin == UV__PIN_CPU) {
+    count = 0;
+    for (cpu = 0; cpu < cpumask_size; cpu++)
+      count += mask[cpu];
+
+    /* Spread the node's workers over its CPUs. */
+    count = (i / nnodes) % count;
+    for (cpu = 0; !mask[cpu] || count-- > 0; cpu++)
+      ;
+
+    memset(pin_mask, 0, cpumask_size);
+    pin_mask[cpu] = 1;
+    mask = pin_mask;
+  }
+
+  uv_thread_setaffinity(threads + i, mask, NULL, cpumask_size);
+}
+
+
+/* Frees the slot of the calling worker, which is about to exit. Called with
+ * `mutex` held.
+ */
+static void worker_retire(void) {
+  uv_thread_t self;
+  unsigned int i;
+
+  self = uv_thread_self();
+  for (i = 0; i < max_threads; i++) {
+    if (thread_state[i] == THREAD_RUNNING && uv_thread_equal(&threads[i], &self)) {
+      thread_state[i] = THREAD_EXITED;
+      break;
+    }
+  }
+
+  nthreads--;
+  uv__fetch_add_int(&pool_size, -1);
+}
+
+
+/* Starts another worker in a free slot. Called with `mutex` held. */
+static int worker_grow(void) {
+  uv_thread_options_t config;
+  unsigned int i;
+  int err;
+
+  for (i = 0; i < max_threads; i++)
+    if (thread_state[i] != THREAD_RUNNING)
+      break;
+
+  if (thread_state[i] == THREAD_EXITED) {
+    if (uv_thread_join(threads + i))
+      abort();
+    thread_state[i] = THREAD_FREE;
+  }
+
+  config.flags = UV_THREAD_HAS_STACK_SIZE;
+  config.stack_size = 8u << 20;  /* 8 MB */
+
+  err = uv_thread_create_ex(threads + i, &config, worker, NULL);
+  if (err)
+    return err;
+
+  worker_pin(i);
+  thread_state[i] = THREAD_RUNNING;
+  starting_threads++;
+  nthreads++;
+  uv__fetch_add_int(&pool_size, 1);
+  return 0;
+}
+
+
+/* How long the oldest work item has been waiting for a worker. Returns
+ * non-zero if there is one. Called with `mutex` held.
+ */
+static int queue_wait(uint64_t* wait) {
+  struct uv__work* w;
+  struct uv__queue* q;
+  unsigned int priority;
+  uint64_t oldest;
+
+  oldest = 0;
+  for (priority = 0; priority < UV_WORK_PRIORITY_MAX; priority++) {
+    if (uv__queue_empty(work_queues[priority]))
+      continue;
+
+    q = uv__queue_head(work_queues[priority]);
+    if (q == &exit_message)
+      continue;
+
+    if (q == &run_slow_work_message) {
+      /* Slow I/O held back by its threshold doesn't need more workers. */
+      if (uv__queue_empty(&slow_io_pending_wq) ||
+          slow_io_work_running >= slow_work_thread_threshold())
+        continue;
+      q = uv__queue_head(&slow_io_pending_wq);
+    }
+
+    w = uv__queue_data(q, struct uv__work, wq);
+    if (!uv__work_timed(w->info))
+      continue;
+    if (oldest == 0 || w->info->queued < oldest)
+      oldest = w->info->queued;
+  }
+
+  if (oldest == 0)
+    return 0;
+
+  *wait = uv_hrtime() - oldest;
+  return 1;
+}
+
+
+/* Grows the pool while work waits longer than THREADPOOL_GROW_WAIT. Sleeps
+ * while there is no such work, see monitor_wake().
+ */
+static void monitor(void* arg) {
+  uint64_t wait;
+
+  uv_thread_setname("libuv-monitor");
+
+  uv_mutex_lock(&mutex);
+  while (!monitor_exiting) {
+    if (nthreads >= max_threads || !queue_wait(&wait)) {
+      monitor_waiting = 1;
+      uv_cond_wait(&monitor_cond, &mutex);
+      continue;
+    }
+
+    /* Let idle and starting workers take the work first. */
+    if (idle_threads + starting_threads > 0)
+      wait = 0;
+
+    if (wait < THREADPOOL_GROW_WAIT)
+      uv_cond_timedwait(&monitor_cond, &mutex, THREADPOOL_GROW_WAIT - wait);
+    else if (worker_grow())
+      uv_cond_timedwait(&monitor_cond, &mutex, THREADPOOL_GROW_WAIT);
+  }
+  uv_mutex_unlock(&mutex);
+}
+
+
+/* Wakes the monitor up when more work is queued than there are idle
+ * workers to take it. Called with `mutex` held.
+ */
+static void monitor_wake(void) {
+  /* Counts submitted work that isn't queued yet, so it may wake up the
+   * monitor when it isn't needed but never misses work.
+   */
+  if ((unsigned int) uv__load_int(&queue_depth) <= idle_threads)
+    return;
+
+  if (monitor_waiting) {
+    monitor_waiting = 0;
+    uv_cond_signal(&monitor_cond);
+  }
+}
+
+
 /* To avoid deadlock with uv_cancel() it's crucial that the worker
  * never holds the global mutex and the loop-local mutex at the same time.
  */
 static void worker(void* arg) {
+  struct uv__queue* queue;
   struct uv__work* w;
   struct uv__queue* q;
   int is_slow_work;
+  int timedout;
+  int grown;
 
   uv_thread_setname("libuv-worker");
-  uv_sem_post((uv_sem_t*) arg);
+  grown = arg == NULL;
+  if (!grown)
+    uv_sem_post((uv_sem_t*) arg);
   arg = NULL;
 
   uv_mutex_lock(&mutex);
+  if (grown)
+    starting_threads -= 1;
+
   for (;;) {
     /* `mutex` should always be locked at this point. */
 
     /* Keep waiting while either no work is present or only slow I/O
        and we're at the threshold for that. */
-    while (uv__queue_empty(&wq) ||
-           (uv__queue_head(&wq) == &run_slow_work_message &&
-            uv__queue_next(&run_slow_work_message) == &wq &&
-            slow_io_work_running >= slow_work_thread_threshold())) {
+    while ((queue = work_next()) == NULL) {
+      /* Only slow I/O is left and it is at its thread limit. */
+      if (!uv__queue_empty(&wq))
+        slow_work_throttled();
+
       idle_threads += 1;
-      uv_cond_wait(&cond, &mutex);
+      timedout = 0;
+      if (nthreads > min_threads)
+        timedout = uv_cond_timedwait(&cond, &mutex, idle_timeout) != 0;
+      else
+        uv_cond_wait(&cond, &mutex);
       idle_threads -= 1;
+
+      /* Retire workers above the minimum that had nothing to do. */
+      if (timedout &&
+          uv__queue_empty(&wq) &&
+          uv__queue_empty(&high_wq) &&
+          uv__queue_empty(&low_wq) &&
+          nthreads > min_threads) {
+        worker_retire();
+        uv_mutex_unlock(&mutex);
+        return;
+      }
     }
 
-    q = uv__queue_head(&wq);
+    q = uv__queue_head(queue);
     if (q == &exit_message) {
       uv_cond_signal(&cond);
       uv_mutex_unlock(&mutex);
@@ -89,10 +616,14 @@ static void worker(void* arg) {
     uv__queue_init(q);  /* Signal uv_cancel() that the work req is executing. */
 
     is_slow_work = 0;
+    if (q != &run_slow_work_message)
+      uv__fetch_add_int(&queue_depth, -1);
+
     if (q == &run_slow_work_message) {
       /* If we're at the slow I/O threshold, re-schedule until after all
          other work in the queue is done. */
       if (slow_io_work_running >= slow_work_thread_threshold()) {
+        slow_work_throttled();
         uv__queue_insert_tail(&wq, q);
         continue;
       }
@@ -108,6 +639,7 @@ static void worker(void* arg) {
       q = uv__queue_head(&slow_io_pending_wq);
       uv__queue_remove(q);
       uv__queue_init(q);
+      uv__fetch_add_int(&queue_depth, -1);
 
       /* If there is more slow I/O work, schedule it to be run as well. */
       if (!uv__queue_empty(&slow_io_pending_wq)) {
@@ -120,14 +652,7 @@ static void worker(void* arg) {
     uv_mutex_unlock(&mutex);
 
     w = uv__queue_data(q, struct uv__work, wq);
-    w->work(w);
-
-    uv_mutex_lock(&w->loop->wq_mutex);
-    w->work = NULL;  /* Signal uv_cancel() that the work req is done
-                        executing. */
-    uv__queue_insert_tail(&w->loop->wq, &w->wq);
-    uv_async_send(&w->loop->wq_async);
-    uv_mutex_unlock(&w->loop->wq_mutex);
+    uv__work_run(w);
 
     /* Lock `mutex` since that is expected at the start of the next
      * iteration. */
@@ -140,7 +665,292 @@ static void worker(void* arg) {
 }
 
 
-static void post(struct uv__queue* q, enum uv__work_kind kind) {
+/* Like work_next(), for the queues of a worker. Called with its lock held. */
+static struct uv__queue* steal_queue(struct uv__worker* wk) {
+  unsigned int priority;
+  int pick;
+
+  pick = -1;
+  for (priority = 0; priority < UV_WORK_PRIORITY_MAX; priority++) {
+    if (uv__queue_empty(&wk->wq[priority]))
+      continue;
+
+    if (pick == -1) {
+      pick = priority;
+    } else if (++wk->passed[priority] > WORK_STARVE_LIMIT) {
+      pick = priority;
+      break;
+    }
+  }
+
+  if (pick == -1)
+    return NULL;
+
+  wk->passed[pick] = 0;
+  return &wk->wq[pick];
+}
+
+
+/* Takes the next work item from a worker's queues. Waits for the lock only
+ * if `block` is set, a contended queue is being worked on anyway.
+ */
+static struct uv__queue* steal_from(struct uv__worker* wk, int block) {
+  struct uv__queue* queue;
+  struct uv__queue* q;
+
+  if (block)
+    uv_mutex_lock(&wk->mutex);
+  else if (uv_mutex_trylock(&wk->mutex))
+    return NULL;
+
+  q = NULL;
+  queue = steal_queue(wk);
+  if (queue != NULL) {
+    q = uv__queue_head(queue);
+    uv__queue_remove(q);
+    uv__queue_init(q);  /* Signal uv_cancel() that the work req is executing. */
+    uv__fetch_add_int(&queue_depth, -1);
+  }
+
+  uv_mutex_unlock(&wk->mutex);
+  return q;
+}
+
+
+/* Looks for work in the worker's own queue first, then in the other
+ * workers' queues and finally in the slow I/O queue.
+ */
+static struct uv__queue* steal_take(struct uv__worker* self,
+                                    int block,
+                                    int* is_slow_work) {
+  struct uv__queue* q;
+  unsigned int victim;
+  unsigned int start;
+  unsigned int pass;
+  unsigned int i;
+
+  q = steal_from(self, 1);
+  if (q != NULL)
+    return q;
+
+  /* Workers on the same NUMA node first, then the others. */
+  start = self - workers;
+  for (pass = 0; pass < (nnodes > 1 ? 2u : 1u); pass++) {
+    for (i = 1; i < nthreads; i++) {
+      victim = (start + i) % nthreads;
+      if ((victim % nnodes == start % nnodes) != (pass == 0))
+        continue;
+
+      q = steal_from(&workers[victim], block);
+      if (q != NULL)
+        return q;
+    }
+  }
+
+  /* Keep idle workers off the global lock unless there is slow I/O. */
+  if (uv__load_int(&steal_slow) == 0)
+    return NULL;
+
+  uv_mutex_lock(&mutex);
+  if (slow_io_work_running >= slow_work_thread_threshold())
+    slow_work_throttled();
+  else if (!uv__queue_empty(&slow_io_pending_wq)) {
+    q = uv__queue_head(&slow_io_pending_wq);
+    uv__queue_remove(q);
+    uv__queue_init(q);
+    uv__fetch_add_int(&steal_slow, -1);
+    uv__fetch_add_int(&queue_depth, -1);
+    slow_io_work_running++;
+    *is_slow_work = 1;
+  }
+  uv_mutex_unlock(&mutex);
+
+  return q;
+}
+
+
+/* Wakes up the worker if it is sleeping. Returns non-zero if it was. */
+static int steal_wake_one(struct uv__worker* wk) {
+  int woken;
+
+  uv_mutex_lock(&wk->mutex);
+  woken = wk->sleeping;
+  if (woken) {
+    wk->sleeping = 0;
+    uv__fetch_add_int(&steal_idle, -1);
+    uv_cond_signal(&wk->cond);
+  }
+  uv_mutex_unlock(&wk->mutex);
+
+  return woken;
+}
+
+
+/* Wakes up a sleeping worker, if there is one, to steal newly posted work.
+ * A worker counts itself in `steal_idle` before its last look for work, so
+ * either it finds the work or it is found here. Returns non-zero if a
+ * worker was woken up.
+ */
+static int steal_wake(void) {
+  unsigned int i;
+
+  if (uv__load_int(&steal_idle) == 0)
+    return 0;
+
+  for (i = 0; i < nthreads; i++)
+    if (steal_wake_one(&workers[i]))
+      return 1;
+
+  return 0;
+}
+
+
+static void steal_worker(void* arg) {
+  struct uv__worker* self;
+  struct uv__work* w;
+  struct uv__queue* q;
+  int is_slow_work;
+  int exiting;
+
+  self = arg;
+  uv_thread_setname("libuv-worker");
+  uv_sem_post(self->ready);
+
+  for (;;) {
+    is_slow_work = 0;
+    q = steal_take(self, 0, &is_slow_work);
+
+    if (q == NULL) {
+      uv_mutex_lock(&self->mutex);
+      self->sleeping = 1;
+      uv_mutex_unlock(&self->mutex);
+      uv__fetch_add_int(&steal_idle, 1);
+
+      q = steal_take(self, 1, &is_slow_work);
+
+      uv_mutex_lock(&self->mutex);
+      exiting = self->exiting;
+      if (q != NULL || exiting) {
+        if (self->sleeping) {
+          self->sleeping = 0;
+          uv__fetch_add_int(&steal_idle, -1);
+        }
+      } else {
+        while (self->sleeping)
+          uv_cond_wait(&self->cond, &self->mutex);
+      }
+      uv_mutex_unlock(&self->mutex);
+
+      if (q == NULL) {
+        /* Only leave once all queued work has run. */
+        if (exiting)
+          break;
+        continue;
+      }
+    }
+
+    w = uv__queue_data(q, struct uv__work, wq);
+    uv__work_run(w);
+
+    if (is_slow_work) {
+      /* Slow I/O work that was held back can run now. */
+      uv_mutex_lock(&mutex);
+      slow_io_work_running--;
+      is_slow_work = !uv__queue_empty(&slow_io_pending_wq);
+      uv_mutex_unlock(&mutex);
+
+      if (is_slow_work)
+        steal_wake();
+    }
+  }
+}
+
+
+/* NUMA node of the CPU the calling thread runs on. */
+static unsigned int current_node(void) {
+  int cpu;
+
+  if (nnodes < 2)
+    return 0;
+
+  cpu = uv_thread_getcpu();
+  if (cpu < 0 || (size_t) cpu >= cpumask_size)
+    return 0;
+
+  return cpu_nodes[cpu];
+}
+
+
+/* Picks workers round-robin, among those on the calling thread's NUMA node
+ * if it has any.
+ */
+static unsigned int steal_pick(void) {
+  unsigned int next;
+  unsigned int node;
+
+  next = (unsigned int) uv__fetch_add_int(&steal_next, 1);
+  node = current_node();
+  if (node >= nthreads)
+    return next % nthreads;
+
+  return node + next % ((nthreads - node + nnodes - 1) / nnodes) * nnodes;
+}
+
+
+/* The worker that work from the loop is posted to */
+static struct uv__worker* steal_target(uv_loop_t* loop) {
+  uv__loop_internal_fields_t* lfields;
+  unsigned int i;
+
+  if (mode == UV__POOL_STEAL_LOOP) {
+    /* Only the loop thread posts work for the loop. */
+    lfields = uv__get_internal_fields(loop);
+    if (lfields->work_home == 0)
+      lfields->work_home = steal_pick() + 1;
+    i = lfields->work_home - 1;
+  } else {
+    i = steal_pick();
+  }
+
+  return &workers[i];
+}
+
+
+static void steal_post(uv_loop_t* loop,
+                       struct uv__queue* q,
+                       enum uv__work_kind kind,
+                       uv_work_priority_t priority) {
+  struct uv__worker* wk;
+
+  if (kind == UV__WORK_SLOW_IO) {
+    uv_mutex_lock(&mutex);
+    uv__queue_insert_tail(&slow_io_pending_wq, q);
+    uv__fetch_add_int(&steal_slow, 1);
+    uv_mutex_unlock(&mutex);
+    steal_wake();
+    return;
+  }
+
+  wk = steal_target(loop);
+  uv_mutex_lock(&wk->mutex);
+  uv__queue_insert_tail(&wk->wq[priority], q);
+  if (wk->sleeping) {
+    wk->sleeping = 0;
+    uv__fetch_add_int(&steal_idle, -1);
+    uv_cond_signal(&wk->cond);
+    uv_mutex_unlock(&wk->mutex);
+    return;
+  }
+  uv_mutex_unlock(&wk->mutex);
+
+  /* The worker is busy, let an idle one take the work instead. */
+  steal_wake();
+}
+
+
+static void post(struct uv__queue* q,
+                 enum uv__work_kind kind,
+                 uv_work_priority_t priority) {
   uv_mutex_lock(&mutex);
   if (kind == UV__WORK_SLOW_IO) {
     /* Insert into a separate queue. */
@@ -154,18 +964,60 @@ static void post(struct uv__queue* q, enum uv__work_kind kind) {
     q = &run_slow_work_message;
   }
 
-  uv__queue_insert_tail(&wq, q);
+  uv__queue_insert_tail(work_queues[priority], q);
   if (idle_threads > 0)
     uv_cond_signal(&cond);
+  if (nthreads < max_threads)
+    monitor_wake();
   uv_mutex_unlock(&mutex);
 }
 
 
+/* Posts a non-empty list of n work items with one lock acquisition. */
+static void post_list(uv_loop_t* loop,
+                      struct uv__queue* list,
+                      unsigned int n,
+                      uv_work_priority_t priority) {
+  struct uv__worker* wk;
+
+  if (mode == UV__POOL_SHARED) {
+    uv_mutex_lock(&mutex);
+    uv__queue_add(work_queues[priority], list);
+    if (idle_threads > 0) {
+      if (n > 1)
+        uv_cond_broadcast(&cond);
+      else
+        uv_cond_signal(&cond);
+    }
+    if (nthreads < max_threads)
+      monitor_wake();
+    uv_mutex_unlock(&mutex);
+    return;
+  }
+
+  /* The other workers steal their share. */
+  wk = steal_target(loop);
+  uv_mutex_lock(&wk->mutex);
+  uv__queue_add(&wk->wq[priority], list);
+  if (wk->sleeping) {
+    wk->sleeping = 0;
+    uv__fetch_add_int(&steal_idle, -1);
+    uv_cond_signal(&wk->cond);
+    n--;
+  }
+  uv_mutex_unlock(&wk->mutex);
+
+  while (n-- > 0 && steal_wake())
+    ;
+}
+
+
 #ifdef __MVS__
 /* TODO(itodorov) - zos: revisit when Woz compiler is available. */
 __attribute__((destructor))
 #endif
 void uv__threadpool_cleanup(void) {
+  unsigned int state;
   unsigned int i;
 
   if (nthreads == 0)
@@ -173,27 +1025,200 @@ void uv__threadpool_cleanup(void) {
 
 #ifndef __MVS__
   /* TODO(gabylb) - zos: revisit when Woz compiler is available. */
-  post(&exit_message, UV__WORK_CPU);
+  if (thread_state != NULL) {
+    /* Stop growing the pool before waiting for the workers. */
+    uv_mutex_lock(&mutex);
+    monitor_exiting = 1;
+    uv_cond_signal(&monitor_cond);
+    uv_mutex_unlock(&mutex);
+    if (uv_thread_join(&monitor_thread))
+      abort();
+  }
+
+  if (mode == UV__POOL_SHARED) {
+    post(&exit_message, UV__WORK_CPU, UV_WORK_PRIORITY_NORMAL);
+  } else {
+    for (i = 0; i < nthreads; i++) {
+      uv_mutex_lock(&workers[i].mutex);
+      workers[i].exiting = 1;
+      if (workers[i].sleeping) {
+        workers[i].sleeping = 0;
+        uv__fetch_add_int(&steal_idle, -1);
+        uv_cond_signal(&workers[i].cond);
+      }
+      uv_mutex_unlock(&workers[i].mutex);
+    }
+  }
 #endif
 
-  for (i = 0; i < nthreads; i++)
-    if (uv_thread_join(threads + i))
-      abort();
+  if (thread_state != NULL) {
+    for (i = 0; i < max_threads; i++) {
+      uv_mutex_lock(&mutex);
+      state = thread_state[i];
+      uv_mutex_unlock(&mutex);
+      if (state != THREAD_FREE && uv_thread_join(threads + i))
+        abort();
+    }
+    uv__free(thread_state);
+    thread_state = NULL;
+    uv_cond_destroy(&monitor_cond);
+  } else {
+    for (i = 0; i < nthreads; i++)
+      if (uv_thread_join(threads + i))
+        abort();
+  }
 
   if (threads != default_threads)
     uv__free(threads);
 
+  if (workers != NULL) {
+    for (i = 0; i < nthreads; i++) {
+      uv_mutex_destroy(&workers[i].mutex);
+      uv_cond_destroy(&workers[i].cond);
+    }
+    uv__free(workers);
+    workers = NULL;
+  }
+
+  uv__free(node_masks);
+  uv__free(pin_mask);
+  uv__free(cpu_nodes);
+  node_masks = NULL;
+  pin_mask = NULL;
+  cpu_nodes = NULL;
+
   uv_mutex_destroy(&mutex);
   uv_cond_destroy(&cond);
 
   threads = NULL;
   nthreads = 0;
+  pool_size = 0;
+  queue_depth = 0;
+}
+
+
+/* Reads the online NUMA nodes and the CPUs of node n. */
+static int read_nodes(char* set, size_t size) {
+#ifdef __linux__
+  return uv__read_list("/sys/devices/system/node/online", set, size);
+#else
+  return UV_ENOTSUP;
+#endif
+}
+
+
+static int read_node_cpus(unsigned int n, char* set, size_t size) {
+#ifdef __linux__
+  char path[64];
+
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", n);
+  return uv__read_list(path, set, size);
+#else
+  return UV_ENOTSUP;
+#endif
+}
+
+
+/* Splits the CPUs this thread may run on by NUMA node, for UV_THREADPOOL_PIN.
+ * Nodes without any of those CPUs are left out. Without NUMA information
+ * there is one node with all of them.
+ */
+static void init_topology(void) {
+  uv_thread_t self;
+  unsigned int count;
+  unsigned int cpu;
+  unsigned int n;
+  char* allowed;
+  char* online;
+  char* mask;
+  int size;
+  int any;
+
+  nnodes = 1;
+  node_masks = NULL;
+  pin_mask = NULL;
+  cpu_nodes = NULL;
+
+  if (pin == UV__PIN_NONE)
+    return;
+
+  size = uv_cpumask_size();
+  if (size <= 0) {
+    pin = UV__PIN_NONE;
+    return;
+  }
+
+  cpumask_size = size;
+  allowed = uv__malloc(cpumask_size);
+  online = uv__malloc(cpumask_size);
+  pin_mask = uv__malloc(cpumask_size);
+  cpu_nodes = uv__calloc(cpumask_size, sizeof(cpu_nodes[0]));
+  self = uv_thread_self();
+  if (allowed == NULL || online == NULL || pin_mask == NULL ||
+      cpu_nodes == NULL || uv_thread_getaffinity(&self, allowed, cpumask_size))
+    goto fail;
+
+  count = 0;
+  if (read_nodes(online, cpumask_size) == 0)
+    for (n = 0; n < cpumask_size; n++)
+      count += online[n];
+
+  node_masks = uv__malloc((count > 0 ? count : 1) * cpumask_size);
+  if (node_masks == NULL)
+    goto fail;
+
+  nnodes = 0;
+  for (n = 0; n < cpumask_size && nnodes < count; n++) {
+    if (!online[n])
+      continue;
+
+    mask = node_masks + nnodes * cpumask_size;
+    if (read_node_cpus(n, mask, cpumask_size))
+      continue;
+
+    any = 0;
+    for (cpu = 0; cpu < cpumask_size; cpu++) {
+      mask[cpu] &= allowed[cpu];
+      any |= mask[cpu];
+    }
+
+    if (!any)
+      continue;
+
+    for (cpu = 0; cpu < cpumask_size; cpu++)
+      if (mask[cpu])
+        cpu_nodes[cpu] = nnodes;
+    nnodes++;
+  }
+
+  if (nnodes == 0) {
+    memcpy(node_masks, allowed, cpumask_size);
+    memset(cpu_nodes, 0, cpumask_size * sizeof(cpu_nodes[0]));
+    nnodes = 1;
+  }
+
+  uv__free(allowed);
+  uv__free(online);
+  return;
+
+fail:
+  uv__free(allowed);
+  uv__free(online);
+  uv__free(pin_mask);
+  uv__free(cpu_nodes);
+  uv__free(node_masks);
+  node_masks = NULL;
+  pin_mask = NULL;
+  cpu_nodes = NULL;
+  pin = UV__PIN_NONE;
+  nnodes = 1;
 }
 
 
 static void init_threads(void) {
   uv_thread_options_t config;
   unsigned int i;
+  unsigned int j;
   const char* val;
   uv_sem_t sem;
 
@@ -206,15 +1231,66 @@ static void init_threads(void) {
   if (nthreads > MAX_THREADPOOL_SIZE)
     nthreads = MAX_THREADPOOL_SIZE;
 
+  max_threads = nthreads;
+  val = getenv("UV_THREADPOOL_MAX_SIZE");
+  if (val != NULL)
+    max_threads = atoi(val);
+  if (max_threads < nthreads)
+    max_threads = nthreads;
+  if (max_threads > MAX_THREADPOOL_SIZE)
+    max_threads = MAX_THREADPOOL_SIZE;
+
+  idle_timeout = THREADPOOL_IDLE_TIMEOUT;
+  val = getenv("UV_THREADPOOL_IDLE_TIMEOUT");
+  if (val != NULL && atoi(val) > 0)
+    idle_timeout = atoi(val);
+  idle_timeout *= 1000000;
+
+  mode = UV__POOL_SHARED;
+  val = getenv("UV_THREADPOOL_MODE");
+  if (val != NULL && strcmp(val, "steal") == 0)
+    mode = UV__POOL_STEAL;
+  if (val != NULL && strcmp(val, "steal-loop") == 0)
+    mode = UV__POOL_STEAL_LOOP;
+
+  /* The work-stealing modes have a fixed number of worker queues. */
+  if (mode != UV__POOL_SHARED)
+    max_threads = nthreads;
+
+  pin = UV__PIN_NONE;
+  val = getenv("UV_THREADPOOL_PIN");
+  if (val != NULL && strcmp(val, "node") == 0)
+    pin = UV__PIN_NODE;
+  if (val != NULL && strcmp(val, "cpu") == 0)
+    pin = UV__PIN_CPU;
+
+  init_topology();
+
   threads = default_threads;
-  if (nthreads > ARRAY_SIZE(default_threads)) {
-    threads = uv__malloc(nthreads * sizeof(threads[0]));
+  if (max_threads > ARRAY_SIZE(default_threads)) {
+    threads = uv__malloc(max_threads * sizeof(threads[0]));
     if (threads == NULL) {
       nthreads = ARRAY_SIZE(default_threads);
+      max_threads = nthreads;
       threads = default_threads;
     }
   }
 
+  /* Keep a fixed size if the slots can't be tracked. */
+  thread_state = NULL;
+  if (max_threads > nthreads) {
+    thread_state = uv__calloc(max_threads, sizeof(thread_state[0]));
+    if (thread_state == NULL)
+      max_threads = nthreads;
+  }
+
+  min_threads = nthreads;
+  starting_threads = 0;
+  monitor_waiting = 0;
+  monitor_exiting = 0;
+  pool_size = nthreads;
+  queue_depth = 0;
+
   if (uv_cond_init(&cond))
     abort();
 
@@ -222,23 +1298,66 @@ static void init_threads(void) {
     abort();
 
   uv__queue_init(&wq);
+  uv__queue_init(&high_wq);
+  uv__queue_init(&low_wq);
+  memset(work_passed, 0, sizeof(work_passed));
   uv__queue_init(&slow_io_pending_wq);
   uv__queue_init(&run_slow_work_message);
 
   if (uv_sem_init(&sem, 0))
     abort();
 
+  /* Fall back to the shared queue if the workers can't be allocated. */
+  workers = NULL;
+  steal_idle = 0;
+  steal_next = 0;
+  steal_slow = 0;
+  if (mode != UV__POOL_SHARED) {
+    workers = uv__calloc(nthreads, sizeof(workers[0]));
+    if (workers == NULL)
+      mode = UV__POOL_SHARED;
+  }
+
+  for (i = 0; workers != NULL && i < nthreads; i++) {
+    if (uv_mutex_init(&workers[i].mutex))
+      abort();
+    if (uv_cond_init(&workers[i].cond))
+      abort();
+    for (j = 0; j < UV_WORK_PRIORITY_MAX; j++)
+      uv__queue_init(&workers[i].wq[j]);
+    workers[i].ready = &sem;
+  }
+
   config.flags = UV_THREAD_HAS_STACK_SIZE;
   config.stack_size = 8u << 20;  /* 8 MB */
 
+  for (i = 0; i < nthreads; i++) {
+    if (workers != NULL) {
+      if (uv_thread_create_ex(threads + i, &config, steal_worker, &workers[i]))
+        abort();
+    } else {
+      if (uv_thread_create_ex(threads + i, &config, worker, &sem))
+        abort();
+    }
+  }
+
   for (i = 0; i < nthreads; i++)
-    if (uv_thread_create_ex(threads + i, &config, worker, &sem))
-      abort();
+    worker_pin(i);
 
   for (i = 0; i < nthreads; i++)
     uv_sem_wait(&sem);
 
   uv_sem_destroy(&sem);
+
+  if (thread_state != NULL) {
+    for (i = 0; i < nthreads; i++)
+      thread_state[i] = THREAD_RUNNING;
+
+    if (uv_cond_init(&monitor_cond))
+      abort();
+    if (uv_thread_create(&monitor_thread, monitor, NULL))
+      abort();
+  }
 }
 
 
@@ -263,16 +1382,31 @@ static void init_once(void) {
 }
 
 
+static void uv__work_submit_priority(uv_loop_t* loop,
+                                     struct uv__work* w,
+                                     enum uv__work_kind kind,
+                                     uv_work_priority_t priority,
+                                     void (*work)(struct uv__work* w),
+                                     void (*done)(struct uv__work* w,
+                                                  int status)) {
+  uv_once(&once, init_once);
+  w->info = uv__work_info_get(loop, kind, uv_hrtime());
+  w->work = work;
+  w->done = done;
+  uv__fetch_add_int(&queue_depth, 1);
+  if (mode == UV__POOL_SHARED)
+    post(&w->wq, kind, priority);
+  else
+    steal_post(loop, &w->wq, kind, priority);
+}
+
+
 void uv__work_submit(uv_loop_t* loop,
                      struct uv__work* w,
                      enum uv__work_kind kind,
                      void (*work)(struct uv__work* w),
                      void (*done)(struct uv__work* w, int status)) {
-  uv_once(&once, init_once);
-  w->loop = loop;
-  w->work = work;
-  w->done = done;
-  post(&w->wq, kind);
+  uv__work_submit_priority(loop, w, kind, UV_WORK_PRIORITY_NORMAL, work, done);
 }
 
 
@@ -280,53 +1414,93 @@ void uv__work_submit(uv_loop_t* loop,
  * that go through io_uring instead of the thread pool.
  */
 static int uv__work_cancel(uv_loop_t* loop, uv_req_t* req, struct uv__work* w) {
+  unsigned int i;
   int cancelled;
 
   uv_once(&once, init_once);  /* Ensure |mutex| is initialized. */
+
+  /* The request may sit in any of the worker queues. Workers never hold
+   * more than one of their locks, so taking all of them in order is safe.
+   */
+  for (i = 0; workers != NULL && i < nthreads; i++)
+    uv_mutex_lock(&workers[i].mutex);
+
   uv_mutex_lock(&mutex);
-  uv_mutex_lock(&w->loop->wq_mutex);
 
-  cancelled = !uv__queue_empty(&w->wq) && w->work != NULL;
-  if (cancelled)
+  /* Workers empty `wq` when they take the work, under the same locks.
+   * Completed work reuses `wq.next` only, so check `wq.prev`.
+   */
+  cancelled = w->wq.prev != &w->wq && w->work != NULL;
+  if (cancelled) {
     uv__queue_remove(&w->wq);
+    uv__queue_init(&w->wq);
+    uv__fetch_add_int(&queue_depth, -1);
+  }
 
-  uv_mutex_unlock(&w->loop->wq_mutex);
   uv_mutex_unlock(&mutex);
 
+  for (i = 0; workers != NULL && i < nthreads; i++)
+    uv_mutex_unlock(&workers[i].mutex);
+
   if (!cancelled)
     return UV_EBUSY;
 
   w->work = uv__cancelled;
-  uv_mutex_lock(&loop->wq_mutex);
-  uv__queue_insert_tail(&loop->wq, &w->wq);
-  uv_async_send(&loop->wq_async);
-  uv_mutex_unlock(&loop->wq_mutex);
+  uv__work_complete(w);
 
   return 0;
 }
 
 
+static void uv__work_timing(uv_threadpool_timing_t* t, uint64_t ns) {
+  unsigned int i;
+
+  t->count++;
+  t->total += ns;
+  if (ns > t->max)
+    t->max = ns;
+
+  for (i = 0; i < UV_THREADPOOL_TIMING_BUCKETS - 1 && (ns >> (i + 1)) != 0; i++);
+  t->hist[i]++;
+}
+
+
+/* Accounts for work that ran, right before its callback. Only the loop
+ * thread touches its metrics.
+ */
+static void uv__work_account(uv_loop_t* loop,
+                             struct uv__work_info* info,
+                             uint64_t now) {
+  uv_threadpool_metrics_t* m;
+
+  m = &uv__get_internal_fields(loop)->work_metrics;
+  uv__work_timing(&m->wait[info->kind], info->started - info->queued);
+  uv__work_timing(&m->run[info->kind], info->finished - info->started);
+  uv__work_timing(&m->done[info->kind], now - info->finished);
+  if (info->throttled)
+    m->slow_io_throttled++;
+}
+
+
 void uv__work_done(uv_async_t* handle) {
+  struct uv__work* next;
   struct uv__work* w;
   uv_loop_t* loop;
-  struct uv__queue* q;
-  struct uv__queue wq;
   int err;
   int nevents;
 
   loop = container_of(handle, uv_loop_t, wq_async);
-  uv_mutex_lock(&loop->wq_mutex);
-  uv__queue_move(&loop->wq, &wq);
-  uv_mutex_unlock(&loop->wq_mutex);
-
   nevents = 0;
 
-  while (!uv__queue_empty(&wq)) {
-    q = uv__queue_head(&wq);
-    uv__queue_remove(q);
-
-    w = container_of(q, struct uv__work, wq);
+  for (w = uv__work_take(loop); w != NULL; w = next) {
+    next = uv__work_next(w);
     err = (w->work == uv__cancelled) ? UV_ECANCELED : 0;
+    if (w->done != uv__work_batch_done) {
+      if (err == 0 && uv__work_timed(w->info))
+        uv__work_account(loop, w->info, uv_hrtime());
+      /* The callback may submit the request again. */
+      uv__work_info_put(w->info);
+    }
     w->done(w, err);
     nevents++;
   }
@@ -370,18 +1544,116 @@ int uv_queue_work(uv_loop_t* loop,
                   uv_work_t* req,
                   uv_work_cb work_cb,
                   uv_after_work_cb after_work_cb) {
+  return uv_queue_work_ex(loop, req, NULL, work_cb, after_work_cb);
+}
+
+
+int uv_queue_work_ex(uv_loop_t* loop,
+                     uv_work_t* req,
+                     const uv_work_options_t* options,
+                     uv_work_cb work_cb,
+                     uv_after_work_cb after_work_cb) {
+  uv_work_priority_t priority;
+
   if (work_cb == NULL)
     return UV_EINVAL;
 
+  priority = UV_WORK_PRIORITY_NORMAL;
+  if (options != NULL) {
+    if ((unsigned int) options->priority >= UV_WORK_PRIORITY_MAX)
+      return UV_EINVAL;
+    priority = options->priority;
+  }
+
   uv__req_init(loop, req, UV_WORK);
   req->loop = loop;
   req->work_cb = work_cb;
   req->after_work_cb = after_work_cb;
-  uv__work_submit(loop,
-                  &req->work_req,
-                  UV__WORK_CPU,
-                  uv__queue_work,
-                  uv__queue_done);
+  uv__work_submit_priority(loop,
+                           &req->work_req,
+                           UV__WORK_CPU,
+                           priority,
+                           uv__queue_work,
+                           uv__queue_done);
+  return 0;
+}
+
+
+static void uv__work_batch_done(struct uv__work* w, int err) {
+  uv_work_batch_t* batch;
+  uint64_t now;
+  unsigned int i;
+
+  batch = container_of(w, uv_work_batch_t, work_req);
+  now = uv_hrtime();
+  for (i = 0; i < batch->nreqs; i++) {
+    w = &batch->reqs[i].work_req;
+    if (w->work != uv__cancelled && uv__work_timed(w->info))
+      uv__work_account(batch->loop, w->info, now);
+    uv__work_info_put(w->info);
+    uv__req_unregister(batch->loop);
+  }
+
+  if (batch->after_work_cb == NULL)
+    return;
+
+  batch->after_work_cb(batch, batch->status);
+}
+
+
+int uv_queue_work_batch(uv_loop_t* loop,
+                        uv_work_batch_t* batch,
+                        uv_work_t reqs[],
+                        unsigned int nreqs,
+                        const uv_work_options_t* options,
+                        uv_work_cb work_cb,
+                        uv_after_work_batch_cb after_work_cb) {
+  uv_work_priority_t priority;
+  struct uv__queue list;
+  uv_work_t* req;
+  unsigned int i;
+  uint64_t now;
+
+  if (work_cb == NULL || reqs == NULL || nreqs == 0)
+    return UV_EINVAL;
+
+  priority = UV_WORK_PRIORITY_NORMAL;
+  if (options != NULL) {
+    if ((unsigned int) options->priority >= UV_WORK_PRIORITY_MAX)
+      return UV_EINVAL;
+    priority = options->priority;
+  }
+
+  uv_once(&once, init_once);
+
+  batch->loop = loop;
+  batch->reqs = reqs;
+  batch->nreqs = nreqs;
+  batch->after_work_cb = after_work_cb;
+  batch->pending = nreqs;
+  batch->status = 0;
+  batch->work_req.info = NULL;
+  batch->work_req.work = NULL;
+  batch->work_req.done = uv__work_batch_done;
+
+  now = uv_hrtime();
+
+  uv__queue_init(&list);
+  for (i = 0; i < nreqs; i++) {
+    req = &reqs[i];
+    uv__req_init(loop, req, UV_WORK);
+    req->loop = loop;
+    req->work_cb = work_cb;
+    req->after_work_cb = NULL;
+    req->reserved[0] = batch;
+    req->work_req.info = uv__work_info_get(loop, UV__WORK_CPU, now);
+    req->work_req.work = uv__queue_work;
+    req->work_req.done = uv__work_batch_item_done;
+    uv__queue_insert_tail(&list, &req->work_req.wq);
+  }
+
+  uv__fetch_add_int(&queue_depth, (int) nreqs);
+  post_list(loop, &list, nreqs, priority);
   return 0;
 }
 
@@ -417,3 +1689,14 @@ int uv_cancel(uv_req_t* req) {
 
   return uv__work_cancel(loop, req, wreq);
 }
+
+
+int uv_threadpool_metrics(uv_loop_t* loop, uv_threadpool_metrics_t* metrics) {
+  memcpy(metrics,
+         &uv__get_internal_fields(loop)->work_metrics,
+         sizeof(*metrics));
+  metrics->size = (unsigned int) uv__load_int(&pool_size);
+  metrics->queue_depth = (unsigned int) uv__load_int(&queue_depth);
+
+  return 0;
+}
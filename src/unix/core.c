@@ -21,6 +21,7 @@
 #include "uv.h"
 #include "internal.h"
 #include "strtok.h"
+#include "event_batch.h"
 
 #include <stddef.h> /* NULL */
 #include <stdio.h> /* printf */
@@ -165,6 +166,10 @@ void uv_close(uv_handle_t* handle, uv_close_cb close_cb) {
   switch (handle->type) {
   case UV_NAMED_PIPE:
     uv__pipe_close((uv_pipe_t*)handle);
+    /* Operations in the io_uring still use the stream. The stream code will
+     * call uv__make_close_pending() for us once they are done. */
+    if (uv__iou_busy((uv_stream_t*) handle, UV__IOU_BUSY))
+      return;
     break;
 
   case UV_TTY:
@@ -173,6 +178,12 @@ void uv_close(uv_handle_t* handle, uv_close_cb close_cb) {
 
   case UV_TCP:
     uv__tcp_close((uv_tcp_t*)handle);
+    if (uv__iou_busy((uv_stream_t*) handle, UV__IOU_BUSY))
+      return;  /* See UV_NAMED_PIPE. */
+    /* Zero-copy writes still use the socket, uv__stream_close() keeps it
+     * open and calls uv__make_close_pending() once they are released. */
+    if (uv__stream_zc_queued((uv_stream_t*) handle))
+      return;
     break;
 
   case UV_UDP:
@@ -399,13 +410,18 @@ static int uv__loop_alive(const uv_loop_t* loop) {
 
 
 static int uv__backend_timeout(const uv_loop_t* loop) {
+  uv__loop_internal_fields_t* lfields;
+
+  lfields = uv__get_internal_fields(loop);
   if (loop->stop_flag == 0 &&
       /* uv__loop_alive(loop) && */
       (uv__has_active_handles(loop) || uv__has_active_reqs(loop)) &&
       uv__queue_empty(&loop->pending_queue) &&
       uv__queue_empty(&loop->idle_handles) &&
       (loop->flags & UV_LOOP_REAP_CHILDREN) == 0 &&
-      loop->closing_handles == NULL)
+      loop->closing_handles == NULL &&
+      uv__queue_empty(&lfields->read_skipped) &&
+      uv__queue_empty(&lfields->read_cut))
     return uv__next_timeout(loop);
   return 0;
 }
@@ -457,6 +473,7 @@ int uv_run(uv_loop_t* loop, uv_run_mode mode) {
 
     uv__metrics_inc_loop_count(loop);
 
+    uv__stream_read_deferred(loop);
     uv__io_poll(loop, timeout);
 
     /* Process immediate callbacks (e.g. write_cb) a small fixed number of
@@ -471,6 +488,10 @@ int uv_run(uv_loop_t* loop, uv_run_mode mode) {
      */
     uv__metrics_update_idle_time(loop);
 
+    /* Drain batched events whose flush was requested since the last poll. */
+    if (loop->batch_pending != 0)
+      uv__batch_run(loop);
+
     uv__run_check(loop);
     uv__run_closing_handles(loop);
 
@@ -914,8 +935,22 @@ void uv__io_init(uv__io_t* w, uv__io_cb cb, int fd) {
 }
 
 
+static void uv__io_release(uv_loop_t* loop, uv__io_t* w) {
+  w->events = 0;
+
+  if (w == loop->watchers[w->fd]) {
+    assert(loop->nfds > 0);
+    loop->watchers[w->fd] = NULL;
+    loop->nfds--;
+  }
+}
+
+
 void uv__io_start(uv_loop_t* loop, uv__io_t* w, unsigned int events) {
-  assert(0 == (events & ~(POLLIN | POLLOUT | UV__POLLRDHUP | UV__POLLPRI)));
+  uv__io_t* old;
+
+  assert(0 == (events & ~(POLLIN | POLLOUT | POLLERR |
+                          UV__POLLRDHUP | UV__POLLPRI)));
   assert(0 != events);
   assert(w->fd >= 0);
   assert(w->fd < INT_MAX);
@@ -932,8 +967,15 @@ void uv__io_start(uv_loop_t* loop, uv__io_t* w, unsigned int events) {
     return;
 #endif
 
-  if (uv__queue_empty(&w->watcher_queue))
-    uv__queue_insert_tail(&loop->watcher_queue, &w->watcher_queue);
+  /* Edge-triggered watchers are registered for all events already. */
+  if (!(w->events & UV__POLLET))
+    if (uv__queue_empty(&w->watcher_queue))
+      uv__queue_insert_tail(&loop->watcher_queue, &w->watcher_queue);
+
+  /* Take the file descriptor over from a stopped edge-triggered watcher. */
+  old = loop->watchers[w->fd];
+  if (old != NULL && old != w && (old->pevents & ~UV__POLLET) == 0)
+    uv__io_release(loop, old);
 
   if (loop->watchers[w->fd] == NULL) {
     loop->watchers[w->fd] = w;
@@ -943,7 +985,8 @@ void uv__io_start(uv_loop_t* loop, uv__io_t* w, unsigned int events) {
 
 
 void uv__io_stop(uv_loop_t* loop, uv__io_t* w, unsigned int events) {
-  assert(0 == (events & ~(POLLIN | POLLOUT | UV__POLLRDHUP | UV__POLLPRI)));
+  assert(0 == (events & ~(POLLIN | POLLOUT | POLLERR |
+                          UV__POLLRDHUP | UV__POLLPRI)));
   assert(0 != events);
 
   if (w->fd == -1)
@@ -957,29 +1000,67 @@ void uv__io_stop(uv_loop_t* loop, uv__io_t* w, unsigned int events) {
 
   w->pevents &= ~events;
 
-  if (w->pevents == 0) {
+  if ((w->pevents & ~UV__POLLET) == 0) {
     uv__queue_remove(&w->watcher_queue);
     uv__queue_init(&w->watcher_queue);
-    w->events = 0;
 
-    if (w == loop->watchers[w->fd]) {
-      assert(loop->nfds > 0);
-      loop->watchers[w->fd] = NULL;
-      loop->nfds--;
-    }
+    /* Edge-triggered watchers stay registered until they're closed, so that
+     * starting them again doesn't take a system call either.
+     */
+    if (w->events & UV__POLLET)
+      return;
+
+    uv__io_release(loop, w);
+  }
+  else if (!(w->events & UV__POLLET) && uv__queue_empty(&w->watcher_queue))
+    uv__queue_insert_tail(&loop->watcher_queue, &w->watcher_queue);
+}
+
+
+/* Edge-triggered watchers are registered for reading and writing at once,
+ * starting and stopping them doesn't take a system call. The kernel reports
+ * an event only when the state of the file descriptor changes, so the owner
+ * has to read and write until EAGAIN or otherwise make sure it gets called
+ * again. The change takes effect the next time the loop polls.
+ */
+void uv__io_set_edge(uv_loop_t* loop, uv__io_t* w, int on) {
+  if (UV__POLLET == 0)
+    return;
+
+  if (on)
+    w->pevents |= UV__POLLET;
+  else
+    w->pevents &= ~UV__POLLET;
+
+  /* Not registered with the kernel, or already in the right mode. */
+  if (w->events == 0 || !(w->events & UV__POLLET) == !on)
+    return;
+
+  /* Stopped but still registered, see uv__io_stop(). */
+  if ((w->pevents & ~UV__POLLET) == 0) {
+    uv__io_release(loop, w);
+    return;
   }
-  else if (uv__queue_empty(&w->watcher_queue))
+
+  /* Makes uv__io_poll() replace the registration. */
+  w->events = 0;
+  if (uv__queue_empty(&w->watcher_queue))
     uv__queue_insert_tail(&loop->watcher_queue, &w->watcher_queue);
 }
 
 
 void uv__io_close(uv_loop_t* loop, uv__io_t* w) {
-  uv__io_stop(loop, w, POLLIN | POLLOUT | UV__POLLRDHUP | UV__POLLPRI);
+  uv__io_stop(loop,
+              w,
+              POLLIN | POLLOUT | POLLERR | UV__POLLRDHUP | UV__POLLPRI);
   uv__queue_remove(&w->pending_queue);
 
   /* Remove stale events for this file descriptor */
-  if (w->fd != -1)
+  if (w->fd != -1) {
+    if ((unsigned) w->fd < loop->nwatchers)
+      uv__io_release(loop, w);
     uv__platform_invalidate_fd(loop, w->fd);
+  }
 }
 
 
@@ -990,14 +1071,42 @@ void uv__io_feed(uv_loop_t* loop, uv__io_t* w) {
 
 
 int uv__io_active(const uv__io_t* w, unsigned int events) {
-  assert(0 == (events & ~(POLLIN | POLLOUT | UV__POLLRDHUP | UV__POLLPRI)));
+  assert(0 == (events & ~(POLLIN | POLLOUT | POLLERR |
+                          UV__POLLRDHUP | UV__POLLPRI)));
   assert(0 != events);
   return 0 != (w->pevents & events);
 }
 
 
 int uv__fd_exists(uv_loop_t* loop, int fd) {
-  return (unsigned) fd < loop->nwatchers && loop->watchers[fd] != NULL;
+  struct uv__queue* q;
+  uv_handle_t* handle;
+
+  /* Stopped edge-triggered watchers don't count, see uv__io_stop(). */
+  if ((unsigned) fd < loop->nwatchers &&
+      loop->watchers[fd] != NULL &&
+      (loop->watchers[fd]->pevents & ~UV__POLLET) != 0) {
+    return 1;
+  }
+
+  /* Streams that wait in the io_uring aren't in the epoll set. */
+  if (!(loop->flags & UV_LOOP_ENABLE_IO_URING_STREAMS))
+    return 0;
+
+  uv__queue_foreach(q, &loop->handle_queue) {
+    handle = uv__queue_data(q, uv_handle_t, handle_queue);
+
+    if (handle->type != UV_TCP && handle->type != UV_NAMED_PIPE)
+      continue;
+
+    if (uv__is_closing(handle) || uv__stream_fd((uv_stream_t*) handle) != fd)
+      continue;
+
+    if (uv__iou_busy((uv_stream_t*) handle, UV__IOU_BUSY))
+      return 1;
+  }
+
+  return 0;
 }
 
 
@@ -1,87 +1,318 @@
 /**
  * src/unix/event_batch_unix.c
  * Unix-specific implementation for event batching
+ *
+ * uv__io_poll() stages readiness events here instead of invoking the watcher
+ * callbacks straight away. Events for the same file descriptor that show up
+ * while the batch is open are merged into a single entry, and the whole stage
+ * is dispatched once it reaches the configured batch size or its timeout
+ * expires.
  */
 
- #ifndef _WIN32
-
- #include <pthread.h>
  #include "uv.h"
  #include "event_batch.h"
- #include "uv-event-batch-internal.h"
  #include "internal.h"
- 
+
+ #include <string.h>
+
  /* Initialize Unix-specific resources */
- int uv__batch_unix_init(uv_loop_t* loop, uv_batch_t* batch) {
-     int ret;
-     
-     /* Unix implementation primarily relies on the mutex 
-        which is already initialized in the common code */
-     
-     /* Set up eventfd for signaling if available */
- #ifdef __linux__
-     batch->eventfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
-     if (batch->eventfd >= 0) {
-         ret = uv__io_init(&batch->event_watcher, 
-                          uv__batch_unix_io_cb,
-                          batch->eventfd);
-         if (ret) {
-             close(batch->eventfd);
-             return ret;
-         }
-         uv__io_start(loop, &batch->event_watcher, POLLIN);
+ int uv__batch_platform_init(uv_loop_t* loop, uv_batch_t* batch) {
+     batch->io_events = uv__malloc(batch->capacity * sizeof(*batch->io_events));
+     if (batch->io_events == NULL)
+         return UV_ENOMEM;
+
+     batch->io_groups = uv__malloc(batch->capacity);
+     if (batch->io_groups == NULL) {
+         uv__free(batch->io_events);
+         batch->io_events = NULL;
+         return UV_ENOMEM;
      }
- #endif
- 
+
+     batch->io_count = 0;
+     batch->io_slots = NULL;
+     batch->io_nslots = 0;
+     batch->io_start = 0;
+     batch->io_wakefd = -1;
      return 0;
  }
- 
+
  /* Clean up Unix-specific resources */
- void uv__batch_unix_cleanup(uv_batch_t* batch) {
- #ifdef __linux__
-     if (batch->eventfd >= 0) {
-         uv__io_stop(batch->loop, &batch->event_watcher, POLLIN);
-         uv__io_close(batch->loop, &batch->event_watcher);
-         close(batch->eventfd);
-         batch->eventfd = -1;
+ void uv__batch_platform_cleanup(uv_batch_t* batch) {
+     if (batch->io_wakefd != -1)
+         uv__close(batch->io_wakefd);
+     batch->io_wakefd = -1;
+
+     uv__free(batch->io_events);
+     uv__free(batch->io_slots);
+     uv__free(batch->io_groups);
+     batch->io_events = NULL;
+     batch->io_groups = NULL;
+     batch->io_slots = NULL;
+     batch->io_nslots = 0;
+     batch->io_count = 0;
+ }
+
+ /* Resize the staging area, only called between loop iterations */
+ int uv__batch_platform_resize(uv_batch_t* batch, unsigned int capacity) {
+     uv_batch_io_event_t* events;
+     unsigned char* groups;
+
+     /* uv__batch_io_flush() is still walking the staged events. */
+     if (batch->io_count != 0)
+         return UV_EBUSY;
+
+     groups = uv__reallocf(batch->io_groups, capacity);
+     batch->io_groups = groups;
+     if (groups == NULL)
+         return UV_ENOMEM;
+
+     events = uv__reallocf(batch->io_events, capacity * sizeof(*events));
+     if (events == NULL) {
+         batch->io_events = NULL;
+         return UV_ENOMEM;
      }
- #endif
+
+     batch->io_events = events;
+     return 0;
  }
- 
- #ifdef __linux__
- /* IO callback for eventfd notifications */
- static void uv__batch_unix_io_cb(uv_loop_t* loop, 
-                                 uv__io_t* w,
-                                 unsigned int events) {
+
+ /* Make sure io_slots can be indexed by fd */
+ static int uv__batch_io_grow_slots(uv_loop_t* loop,
+                                    uv_batch_t* batch,
+                                    int fd) {
+     unsigned int* slots;
+     unsigned int nslots;
+
+     nslots = loop->nwatchers;
+     if ((unsigned int) fd >= nslots)
+         nslots = fd + 1;
+
+     slots = uv__realloc(batch->io_slots, nslots * sizeof(*slots));
+     if (slots == NULL)
+         return UV_ENOMEM;
+
+     memset(slots + batch->io_nslots,
+            0,
+            (nslots - batch->io_nslots) * sizeof(*slots));
+
+     batch->io_slots = slots;
+     batch->io_nslots = nslots;
+     return 0;
+ }
+
+ /* Stage a readiness event for fd. Returns 1 when it was staged as a new
+  * entry and 0 when it was merged into the entry already staged for fd, either
+  * way it is dispatched by uv__batch_io_flush(). Returns an error code when
+  * the caller should dispatch it directly.
+  */
+ int uv__batch_io_stage(uv_loop_t* loop, int fd, unsigned int events) {
      uv_batch_t* batch;
-     uint64_t val;
-     
-     batch = container_of(w, uv_batch_t, event_watcher);
-     
-     if (read(batch->eventfd, &val, sizeof(val)) == sizeof(val)) {
-         uv__batch_process(batch);
+     uv_batch_io_event_t* e;
+     unsigned int slot;
+
+     batch = loop->batch_system;
+
+     if ((unsigned int) fd >= batch->io_nslots)
+         if (uv__batch_io_grow_slots(loop, batch, fd))
+             return UV_ENOMEM;
+
+     /* Coalesce with the entry already staged for this handle. */
+     slot = batch->io_slots[fd];
+     if (slot != 0) {
+         batch->io_events[slot - 1].events |= events;
+         return 0;
      }
+
+     e = &batch->io_events[batch->io_count++];
+     e->fd = fd;
+     e->events = events;
+     e->timestamp = uv__batch_hrtime();
+
+     if (batch->io_count == 1)
+         batch->io_start = e->timestamp;
+     batch->io_slots[fd] = batch->io_count;
+
+     /* Dispatch full batches right away. */
+     if (batch->io_count >= batch->limit)
+         uv__batch_io_flush(loop, UV_BATCH_FLUSH_FULL);
+
+     return 1;
  }
- #endif
- 
- /* Signal batch processing on Unix */
- static void uv__batch_unix_signal(uv_batch_t* batch) {
- #ifdef __linux__
-     uint64_t val = 1;
-     if (batch->eventfd >= 0) {
-         write(batch->eventfd, &val, sizeof(val));
+
+ /* Split the staged events by watcher callback for UV_BATCH_LOCALITY.
+  * Returns the number of groups, events whose callback doesn't fit in the
+  * group table share the last group.
+  */
+ static unsigned int uv__batch_io_group(uv_loop_t* loop,
+                                        uv_batch_t* batch,
+                                        unsigned int count) {
+     uv__io_cb cbs[UV_BATCH_LOCALITY_GROUPS];
+     uv__io_cb cb;
+     uv__io_t* w;
+     unsigned int overflow;
+     unsigned int ngroups;
+     unsigned int last;
+     unsigned int i;
+     unsigned int j;
+
+     overflow = 0;
+     ngroups = 0;
+     last = 0;
+
+     for (i = 0; i < count; i++) {
+         cb = NULL;
+         if (batch->io_events[i].fd != -1) {
+             w = loop->watchers[batch->io_events[i].fd];
+             if (w != NULL)
+                 cb = w->cb;
+         }
+
+         if (last < ngroups && cbs[last] == cb) {
+             batch->io_groups[i] = last;
+             continue;
+         }
+
+         for (j = 0; j < ngroups; j++)
+             if (cbs[j] == cb)
+                 break;
+
+         if (j == UV_BATCH_LOCALITY_GROUPS)
+             overflow = 1;
+         else if (j == ngroups)
+             cbs[ngroups++] = cb;
+
+         batch->io_groups[i] = j;
+         last = j;
      }
- #endif
+
+     return ngroups + overflow;
  }
- 
- /* Map platform init function */
- int uv__batch_platform_init(uv_loop_t* loop, uv_batch_t* batch) {
-     return uv__batch_unix_init(loop, batch);
+
+ /* Run the watcher callbacks for all staged events, in staging order, or
+  * grouped by callback with UV_BATCH_LOCALITY.
+  */
+ void uv__batch_io_flush(uv_loop_t* loop, uv_batch_flush_reason_t reason) {
+     uv_batch_t* batch;
+     uv_batch_io_event_t* e;
+     uv__io_t* w;
+     uint64_t start_time;
+     uint64_t end_time;
+     uint64_t latency;
+     uint64_t bound;
+     unsigned int dispatched;
+     unsigned int late;
+     unsigned int events;
+     unsigned int count;
+     unsigned int ngroups;
+     unsigned int group;
+     unsigned int i;
+     int processing;
+
+     batch = loop->batch_system;
+     count = batch->io_count;
+     if (count == 0)
+         return;
+
+     start_time = uv__batch_hrtime();
+     dispatched = 0;
+     late = 0;
+
+     bound = UINT64_MAX;
+     if (batch->flags & UV_BATCH_ADAPTIVE)
+         bound = uv__batch_adapt_bound(batch);
+
+     /* Watcher callbacks can't resize the staging area while it is walked,
+      * see uv_batch_set_max_size().
+      */
+     processing = batch->is_processing;
+     batch->is_processing = 1;
+
+     ngroups = 1;
+     if ((batch->flags & UV_BATCH_LOCALITY) && count > 1)
+         ngroups = uv__batch_io_group(loop, batch, count);
+
+     for (group = 0; group < ngroups; group++) {
+         for (i = 0; i < count; i++) {
+             if (ngroups > 1 && batch->io_groups[i] != group)
+                 continue;
+
+             e = &batch->io_events[i];
+
+             /* Skip invalidated events, see uv__batch_io_invalidate */
+             if (e->fd == -1)
+                 continue;
+
+             batch->io_slots[e->fd] = 0;
+
+             w = loop->watchers[e->fd];
+             if (w == NULL)
+                 continue;
+
+             /* The watcher may have changed its interest while the event was
+              * staged, so filter again just like uv__io_poll() does.
+              */
+             if (w->pevents & UV__POLLET)
+                 events = e->events & (w->pevents | POLLIN | POLLERR |
+                                       POLLHUP | UV__POLLRDHUP);
+             else
+                 events = e->events & (w->pevents | POLLERR | POLLHUP);
+             if (events == POLLERR || events == POLLHUP)
+                 events |= w->pevents & (POLLIN | POLLOUT | UV__POLLRDHUP | UV__POLLPRI);
+
+             if (events != 0) {
+                 latency = start_time - e->timestamp;
+                 uv__batch_stats_event(batch, UV_BATCH_POLL_EVENT, latency);
+                 if (latency > bound)
+                     late++;
+                 uv__metrics_update_idle_time(loop);
+                 w->cb(loop, w, events);
+                 dispatched++;
+             }
+         }
+     }
+
+     batch->io_count = 0;
+     batch->is_processing = processing;
+
+     end_time = uv__batch_hrtime();
+     uv__batch_update_stats(batch,
+                            NULL,
+                            dispatched,
+                            reason,
+                            end_time - start_time);
+
+     if (batch->flags & UV_BATCH_ADAPTIVE)
+         uv__batch_adapt(batch, count, late, start_time, end_time);
  }
- 
- /* Map platform cleanup function */
- void uv__batch_platform_cleanup(uv_batch_t* batch) {
-     uv__batch_unix_cleanup(batch);
+
+ /* Drop the staged event for fd, called when the fd is closed. */
+ void uv__batch_io_invalidate(uv_loop_t* loop, int fd) {
+     uv_batch_t* batch;
+     unsigned int slot;
+
+     batch = loop->batch_system;
+     if ((unsigned int) fd >= batch->io_nslots)
+         return;
+
+     slot = batch->io_slots[fd];
+     if (slot == 0)
+         return;
+
+     batch->io_events[slot - 1].fd = -1;
+     batch->io_slots[fd] = 0;
+ }
+
+ /* Nanoseconds left before the staged events must be dispatched. */
+ uint64_t uv__batch_io_window(uv_loop_t* loop) {
+     uv_batch_t* batch;
+     uint64_t timeout;
+     uint64_t elapsed;
+
+     batch = loop->batch_system;
+     timeout = (uint64_t) batch->timeout_us * 1000;
+     elapsed = uv__batch_hrtime() - batch->io_start;
+     if (elapsed >= timeout)
+         return 0;
+
+     return timeout - elapsed;
  }
- 
- #endif /* !_WIN32 */
\ No newline at end of file
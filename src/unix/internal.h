@@ -151,6 +151,13 @@ union uv__sockaddr {
 # define UV__POLLPRI 0
 #endif
 
+/* Marks edge-triggered watchers in uv__io_t.pevents, the same as EPOLLET. */
+#if defined(__linux__)
+# define UV__POLLET 0x80000000u
+#else
+# define UV__POLLET 0
+#endif
+
 #if !defined(O_CLOEXEC) && defined(__FreeBSD__)
 /*
  * It may be that we are just missing `__POSIX_VISIBLE >= 200809`.
@@ -165,7 +172,11 @@ typedef struct uv__stream_queued_fds_s uv__stream_queued_fds_t;
 enum {
   UV_LOOP_BLOCK_SIGPROF = 0x1,
   UV_LOOP_REAP_CHILDREN = 0x2,
-  UV_LOOP_ENABLE_IO_URING_SQPOLL = 0x4
+  UV_LOOP_ENABLE_IO_URING_SQPOLL = 0x4,
+  UV_LOOP_ENABLE_IO_URING_STREAMS = 0x8,
+  UV_LOOP_ENABLE_EDGE_TRIGGERED = 0x10,
+  UV_LOOP_ENABLE_WRITE_CORK = 0x20,
+  UV_LOOP_ENABLE_IO_URING_ACCEPT = 0x40
 };
 
 /* flags of excluding ifaddr */
@@ -215,6 +226,10 @@ struct uv__statx {
   uint32_t stx_dev_minor;
   uint64_t unused1[14];
 };
+
+/* Zero-copy sends, Linux 4.14 and newer. */
+#define UV__SO_ZEROCOPY 60
+#define UV__MSG_ZEROCOPY 0x4000000
 #endif /* __linux__ */
 
 #if defined(_AIX) || \
@@ -261,6 +276,7 @@ void uv__io_start(uv_loop_t* loop, uv__io_t* w, unsigned int events);
 void uv__io_stop(uv_loop_t* loop, uv__io_t* w, unsigned int events);
 void uv__io_close(uv_loop_t* loop, uv__io_t* w);
 void uv__io_feed(uv_loop_t* loop, uv__io_t* w);
+void uv__io_set_edge(uv_loop_t* loop, uv__io_t* w, int on);
 int uv__io_active(const uv__io_t* w, unsigned int events);
 int uv__io_check_fd(uv_loop_t* loop, int fd);
 void uv__io_poll(uv_loop_t* loop, int timeout); /* in milliseconds or -1 */
@@ -278,14 +294,56 @@ void uv__run_check(uv_loop_t* loop);
 void uv__run_prepare(uv_loop_t* loop);
 
 /* stream */
+
+/* Stream state that has no room of its own in uv_stream_t. It lives in the
+ * handle's u.reserved, which streams don't use on Unix.
+ */
+struct uv__stream_fields {
+  struct uv__queue read_queue;  /* See uv__stream_read_defer(). */
+  uv_alloc_v_cb alloc_v_cb;     /* See uv_read_start_v(). */
+  struct uv__stream_ext* ext;   /* Linux, see uv__stream_ext(). */
+};
+
+#define uv__get_stream_fields(stream)                                         \
+  ((struct uv__stream_fields*) (stream)->u.reserved)
+
+#if defined(__linux__)
+/* The io_uring and zero-copy state of a stream, allocated when the stream
+ * is first checked in a loop that uses the io_uring for streams, or when
+ * uv_tcp_zerocopy() turns zero-copy sends on.
+ */
+struct uv__stream_ext {
+  uv_buf_t iou_buf;  /* Held data, see uv__iou_held_consume(). */
+  unsigned int iou_flags;
+  unsigned int iou_nreqs;  /* Write requests in the running send. */
+  uv_buf_t* iou_bufs;  /* Their buffers, see uv__write(). */
+  struct uv__queue iou_unsent;  /* See uv__iou_cancel(). */
+  uv_stream_t* stream;
+  unsigned int zc_seq;  /* Number of the next zero-copy send. */
+  int zc_keep;  /* Don't go back to copying, see uv_tcp_zerocopy(). */
+  struct uv__queue zc_queue;  /* Writes that wait for the kernel. */
+};
+
+struct uv__stream_ext* uv__stream_ext(uv_stream_t* stream);
+
+/* Whether written requests wait for the kernel to release their data. */
+#define uv__stream_zc_queued(stream)                                          \
+  (uv__get_stream_fields(stream)->ext != NULL &&                              \
+   !uv__queue_empty(&uv__get_stream_fields(stream)->ext->zc_queue))
+#else
+#define uv__stream_zc_queued(stream) 0
+#endif /* defined(__linux__) */
+
 void uv__stream_init(uv_loop_t* loop, uv_stream_t* stream,
     uv_handle_type type);
 int uv__stream_open(uv_stream_t*, int fd, int flags);
 void uv__stream_destroy(uv_stream_t* stream);
+void uv__stream_read_deferred(uv_loop_t* loop);
 #if defined(__APPLE__)
 int uv__stream_try_select(uv_stream_t* stream, int* fd);
 #endif /* defined(__APPLE__) */
 void uv__server_io(uv_loop_t* loop, uv__io_t* w, unsigned int events);
+void uv__server_start(uv_stream_t* stream);
 int uv__accept(int sockfd);
 int uv__dup2_cloexec(int oldfd, int newfd);
 int uv__open_cloexec(const char* path, int flags);
@@ -295,6 +353,7 @@ int uv__slurp(const char* filename, char* buf, size_t len);
 int uv__tcp_listen(uv_tcp_t* tcp, int backlog, uv_connection_cb cb);
 int uv__tcp_nodelay(int fd, int on);
 int uv__tcp_keepalive(int fd, int on, unsigned int delay);
+int uv__tcp_zerocopy(int fd, int on);
 
 /* tty */
 void uv__tty_close(uv_tty_t* handle);
@@ -344,6 +403,28 @@ int uv__random_readpath(const char* path, void* buf, size_t buflen);
 int uv__random_sysctl(void* buf, size_t buflen);
 
 /* io_uring */
+
+/* Stream operations that can be in the io_uring. The stream tracks them in
+ * the iou_flags of its uv__stream_ext, the ops in flight as (1u << op) and the cancelled ones as
+ * (UV__IOU_CANCEL << op), those whose cancellation didn't fit in the ring yet
+ * as (UV__IOU_UNSENT << op). UV__IOU_POLL is set while the receive is a wait
+ * for readiness, UV__IOU_HELD while iou_buf points at received data that the
+ * stream stopped reading before it was handed out.
+ */
+enum {
+  UV__IOU_RECV = 0,
+  UV__IOU_SEND = 1,
+  UV__IOU_CONNECT = 2,
+  UV__IOU_ACCEPT = 3,
+  UV__IOU_BUSY = 0xF,
+  UV__IOU_CANCEL = 0x10,
+  UV__IOU_CHECKED = 0x100,  /* UV__IOU_ENABLED is valid */
+  UV__IOU_ENABLED = 0x200,
+  UV__IOU_POLL = 0x400,
+  UV__IOU_HELD = 0x800,
+  UV__IOU_UNSENT = 0x1000
+};
+
 #ifdef __linux__
 int uv__iou_fs_close(uv_loop_t* loop, uv_fs_t* req);
 int uv__iou_fs_ftruncate(uv_loop_t* loop, uv_fs_t* req);
@@ -363,6 +444,32 @@ int uv__iou_fs_statx(uv_loop_t* loop,
                      int is_lstat);
 int uv__iou_fs_symlink(uv_loop_t* loop, uv_fs_t* req);
 int uv__iou_fs_unlink(uv_loop_t* loop, uv_fs_t* req);
+
+int uv__iou_stream(uv_stream_t* stream);
+int uv__iou_recv(uv_stream_t* stream);
+int uv__iou_poll(uv_stream_t* stream);
+int uv__iou_send(uv_stream_t* stream,
+                 const uv_buf_t* bufs,
+                 unsigned int nbufs);
+int uv__iou_connect(uv_stream_t* stream,
+                    const struct sockaddr* addr,
+                    socklen_t addrlen);
+int uv__iou_accept(uv_stream_t* stream);
+int uv__iou_cancel(uv_stream_t* stream, unsigned int ops);
+void uv__iou_cancel_forget(uv_stream_t* stream);
+void uv__iou_flush(uv_loop_t* loop);
+void uv__iou_held_consume(uv_stream_t* stream, size_t n);
+void uv__iou_held_drop(uv_stream_t* stream);
+int uv__stream_iou_done(uv_stream_t* stream,
+                        int op,
+                        int res,
+                        const uv_buf_t* buf);
+#define uv__iou_flags(stream)                                                 \
+  (uv__get_stream_fields(stream)->ext != NULL ?                               \
+   uv__get_stream_fields(stream)->ext->iou_flags : 0)
+#define uv__iou_busy(stream, ops) (uv__iou_flags(stream) & (ops) & UV__IOU_BUSY)
+#define uv__iou_held(stream) (uv__iou_flags(stream) & UV__IOU_HELD)
+#define uv__iou_held_buf(stream) (&uv__get_stream_fields(stream)->ext->iou_buf)
 #else
 #define uv__iou_fs_close(loop, req) 0
 #define uv__iou_fs_ftruncate(loop, req) 0
@@ -375,6 +482,19 @@ int uv__iou_fs_unlink(uv_loop_t* loop, uv_fs_t* req);
 #define uv__iou_fs_statx(loop, req, is_fstat, is_lstat) 0
 #define uv__iou_fs_symlink(loop, req) 0
 #define uv__iou_fs_unlink(loop, req) 0
+#define uv__iou_stream(stream) 0
+#define uv__iou_recv(stream) 0
+#define uv__iou_poll(stream) 0
+#define uv__iou_send(stream, bufs, nbufs) 0
+#define uv__iou_connect(stream, addr, addrlen) 0
+#define uv__iou_accept(stream) 0
+#define uv__iou_cancel(stream, ops) 0
+#define uv__iou_cancel_forget(stream) do {} while (0)
+#define uv__iou_flush(loop) do {} while (0)
+#define uv__iou_held_consume(stream, n) do {} while (0)
+#define uv__iou_held_drop(stream) do {} while (0)
+#define uv__iou_busy(stream, ops) 0
+#define uv__iou_held(stream) 0
 #endif
 
 #if defined(__APPLE__)
@@ -496,6 +616,7 @@ typedef struct {
 } uv__cpu_constraint;
 
 int uv__get_constrained_cpu(uv__cpu_constraint* constraint);
+int uv__read_list(const char* filename, char* set, size_t size);
 #endif
 
 #if defined(__sun) && !defined(__illumos__)
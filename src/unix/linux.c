@@ -25,6 +25,7 @@
 
 #include "uv.h"
 #include "internal.h"
+#include "event_batch.h"
 
 #include <inttypes.h>
 #include <stdatomic.h>
@@ -124,6 +125,14 @@
 # endif
 #endif /* __NR_getrandom */
 
+#ifndef __NR_epoll_pwait2
+# if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__) || \
+     defined(__arm__) || defined(__ppc__) || defined(__s390__) || \
+     defined(__riscv)
+#  define __NR_epoll_pwait2 441
+# endif
+#endif /* __NR_epoll_pwait2 */
+
 enum {
   UV__IORING_SETUP_SQPOLL = 2u,
   UV__IORING_SETUP_NO_SQARRAY = 0x10000u,
@@ -139,9 +148,15 @@ enum {
   UV__IORING_OP_READV = 1,
   UV__IORING_OP_WRITEV = 2,
   UV__IORING_OP_FSYNC = 3,
+  UV__IORING_OP_POLL_ADD = 6,
+  UV__IORING_OP_ACCEPT = 13,
+  UV__IORING_OP_ASYNC_CANCEL = 14,
+  UV__IORING_OP_CONNECT = 16,
   UV__IORING_OP_OPENAT = 18,
   UV__IORING_OP_CLOSE = 19,
   UV__IORING_OP_STATX = 21,
+  UV__IORING_OP_SEND = 26,
+  UV__IORING_OP_RECV = 27,
   UV__IORING_OP_EPOLL_CTL = 29,
   UV__IORING_OP_RENAMEAT = 35,
   UV__IORING_OP_UNLINKAT = 36,
@@ -161,6 +176,38 @@ enum {
   UV__IORING_SQ_CQ_OVERFLOW = 2u,
 };
 
+enum {
+  UV__IORING_REGISTER_PROBE = 8u,
+  UV__IORING_REGISTER_PBUF_RING = 22u,  /* linux v5.19 */
+};
+
+enum {
+  UV__IOSQE_BUFFER_SELECT = 32u,
+};
+
+enum {
+  UV__IORING_CQE_F_BUFFER = 1u,
+  UV__IORING_CQE_F_MORE = 2u,
+  UV__IORING_CQE_BUFFER_SHIFT = 16,
+};
+
+enum {
+  UV__IORING_ACCEPT_MULTISHOT = 1u,  /* linux v5.19 */
+  UV__IORING_RECV_MULTISHOT = 2u,  /* linux v6.0 */
+};
+
+/* Provided buffers of uv_read_start_pooled(), the count must be a power of
+ * two.
+ */
+enum {
+  UV__IOU_BUFS_COUNT = 64,
+  UV__IOU_BUFS_SIZE = 64 * 1024,
+};
+
+enum {
+  UV__IO_URING_OP_SUPPORTED = 1u,
+};
+
 struct uv__io_cqring_offsets {
   uint32_t head;
   uint32_t tail;
@@ -211,13 +258,17 @@ struct uv__io_uring_sqe {
   uint32_t len;
   union {
     uint32_t rw_flags;
+    uint32_t poll32_events;
     uint32_t fsync_flags;
     uint32_t open_flags;
     uint32_t statx_flags;
+    uint32_t msg_flags;
+    uint32_t accept_flags;
   };
   uint64_t user_data;
   union {
     uint16_t buf_index;
+    uint16_t buf_group;
     uint64_t pad[3];
   };
 };
@@ -250,6 +301,48 @@ STATIC_ASSERT(40 + 40 + 40 == sizeof(struct uv__io_uring_params));
 STATIC_ASSERT(40 == offsetof(struct uv__io_uring_params, sq_off));
 STATIC_ASSERT(80 == offsetof(struct uv__io_uring_params, cq_off));
 
+struct uv__io_uring_probe_op {
+  uint8_t op;
+  uint8_t resv;
+  uint16_t flags;
+  uint32_t resv2;
+};
+
+STATIC_ASSERT(8 == sizeof(struct uv__io_uring_probe_op));
+
+struct uv__io_uring_probe {
+  uint8_t last_op;
+  uint8_t ops_len;
+  uint16_t resv;
+  uint32_t resv2[3];
+  struct uv__io_uring_probe_op ops[64];
+};
+
+STATIC_ASSERT(16 + 64 * 8 == sizeof(struct uv__io_uring_probe));
+
+/* An entry of a provided-buffer ring. The kernel reads the ring tail from
+ * the resv field of the first entry.
+ */
+struct uv__io_uring_buf {
+  uint64_t addr;
+  uint32_t len;
+  uint16_t bid;
+  uint16_t resv;
+};
+
+STATIC_ASSERT(16 == sizeof(struct uv__io_uring_buf));
+STATIC_ASSERT(14 == offsetof(struct uv__io_uring_buf, resv));
+
+struct uv__io_uring_buf_reg {
+  uint64_t ring_addr;
+  uint32_t ring_entries;
+  uint16_t bgid;
+  uint16_t flags;
+  uint64_t resv[3];
+};
+
+STATIC_ASSERT(40 == sizeof(struct uv__io_uring_buf_reg));
+
 STATIC_ASSERT(EPOLL_CTL_ADD < 4);
 STATIC_ASSERT(EPOLL_CTL_DEL < 4);
 STATIC_ASSERT(EPOLL_CTL_MOD < 4);
@@ -639,10 +732,29 @@ static void uv__iou_delete(struct uv__iou* iou) {
 
 int uv__platform_loop_init(uv_loop_t* loop) {
   uv__loop_internal_fields_t* lfields;
+  char* val;
 
   lfields = uv__get_internal_fields(loop);
   lfields->ctl.ringfd = -1;
   lfields->iou.ringfd = -2;  /* "uninitialized" */
+  lfields->net.ringfd = -2;
+  lfields->bufs.state = 0;
+  uv__queue_init(&lfields->iou_unsent);
+
+  /* Same as UV_LOOP_USE_IO_URING_STREAMS, for all loops. */
+  val = getenv("UV_USE_IO_URING_STREAMS");
+  if (val != NULL && atoi(val) > 0)
+    loop->flags |= UV_LOOP_ENABLE_IO_URING_STREAMS;
+
+  /* Same as UV_LOOP_USE_IO_URING_ACCEPT. */
+  val = getenv("UV_USE_IO_URING_ACCEPT");
+  if (val != NULL && atoi(val) > 0)
+    loop->flags |= UV_LOOP_ENABLE_IO_URING_ACCEPT;
+
+  /* Same as UV_LOOP_USE_EDGE_TRIGGERED. */
+  val = getenv("UV_USE_EDGE_TRIGGERED");
+  if (val != NULL && atoi(val) > 0)
+    loop->flags |= UV_LOOP_ENABLE_EDGE_TRIGGERED;
 
   loop->inotify_watchers = NULL;
   loop->inotify_fd = -1;
@@ -666,6 +778,12 @@ int uv__io_fork(uv_loop_t* loop) {
   uv__close(loop->backend_fd);
   loop->backend_fd = -1;
 
+  /* The child gets new wakeup descriptors, and its own epoll set for them. */
+  if (loop->batch_system != NULL && loop->batch_system->io_wakefd != -1) {
+    uv__close(loop->batch_system->io_wakefd);
+    loop->batch_system->io_wakefd = -1;
+  }
+
   /* TODO(bnoordhuis) Loses items from the submission and completion rings. */
   uv__platform_loop_delete(loop);
 
@@ -683,6 +801,15 @@ void uv__platform_loop_delete(uv_loop_t* loop) {
   lfields = uv__get_internal_fields(loop);
   uv__iou_delete(&lfields->ctl);
   uv__iou_delete(&lfields->iou);
+  uv__iou_delete(&lfields->net);
+
+  if (lfields->bufs.state == 1) {
+    munmap(lfields->bufs.base, (size_t) UV__IOU_BUFS_COUNT * UV__IOU_BUFS_SIZE);
+    munmap(lfields->bufs.ring,
+           UV__IOU_BUFS_COUNT * sizeof(struct uv__io_uring_buf));
+  }
+
+  lfields->bufs.state = 0;
 
   if (loop->inotify_fd != -1) {
     uv__io_stop(loop, &loop->inotify_read_watcher, POLLIN);
@@ -714,6 +841,10 @@ void uv__platform_invalidate_fd(uv_loop_t* loop, int fd) {
       if (inv->events[i].data.fd == fd)
         inv->events[i].data.fd = -1;
 
+  /* Drop readiness events that are waiting in the batch stage */
+  if (loop->batch_system != NULL)
+    uv__batch_io_invalidate(loop, fd);
+
   /* Remove the file descriptor from the epoll.
    * This avoids a problem where the same file description remains open
    * in another process, causing repeated junk epoll events.
@@ -797,7 +928,7 @@ static struct uv__io_uring_sqe* uv__iou_get_sqe(struct uv__iou* iou,
   sqe->user_data = (uintptr_t) req;
 
   /* Pacify uv_cancel(). */
-  req->work_req.loop = loop;
+  req->work_req.info = NULL;
   req->work_req.work = NULL;
   req->work_req.done = NULL;
   uv__queue_init(&req->work_req.wq);
@@ -1239,6 +1370,711 @@ static void uv__poll_io_uring(uv_loop_t* loop, struct uv__iou* iou) {
 }
 
 
+/* The ring for TCP and pipe I/O. It is created on first use, its ringfd is -1
+ * when the kernel lacks one of the operations and streams use epoll instead.
+ */
+static struct uv__iou* uv__iou_net(uv_loop_t* loop) {
+  static const uint8_t ops[] = {
+    UV__IORING_OP_WRITEV,
+    UV__IORING_OP_POLL_ADD,
+    UV__IORING_OP_ASYNC_CANCEL,
+    UV__IORING_OP_CONNECT,
+    UV__IORING_OP_SEND,
+    UV__IORING_OP_RECV,
+  };
+  struct uv__io_uring_probe probe;
+  struct epoll_event e;
+  struct uv__iou* iou;
+  size_t i;
+
+  iou = &uv__get_internal_fields(loop)->net;
+  if (iou->ringfd != -2)
+    return iou;
+
+  uv__iou_init(loop->backend_fd, iou, 256, 0);
+  if (iou->ringfd == -2) {
+    iou->ringfd = -1;  /* "failed" */
+    return iou;
+  }
+
+  memset(&probe, 0, sizeof(probe));
+  if (uv__io_uring_register(iou->ringfd,
+                            UV__IORING_REGISTER_PROBE,
+                            &probe,
+                            ARRAY_SIZE(probe.ops))) {
+    goto fail;
+  }
+
+  for (i = 0; i < ARRAY_SIZE(ops); i++)
+    if (ops[i] > probe.last_op ||
+        !(probe.ops[ops[i]].flags & UV__IO_URING_OP_SUPPORTED))
+      goto fail;
+
+  /* Completions are picked up by uv__io_poll(), unlike the other rings this
+   * one is always in the epoll set.
+   */
+  memset(&e, 0, sizeof(e));
+  e.events = POLLIN;
+  e.data.fd = iou->ringfd;
+
+  if (epoll_ctl(loop->backend_fd, EPOLL_CTL_ADD, iou->ringfd, &e))
+    goto fail;
+
+  return iou;
+
+fail:
+  uv__iou_delete(iou);
+  return iou;
+}
+
+
+/* Whether the stream does its I/O through the io_uring. Only TCP sockets and
+ * pipes that are UNIX domain sockets qualify, IPC pipes need recvmsg() and
+ * sendmsg() to pass file descriptors and keep using epoll.
+ */
+int uv__iou_stream(uv_stream_t* stream) {
+  struct uv__stream_ext* ext;
+  struct stat s;
+  int fd;
+
+  if (uv__iou_flags(stream) & UV__IOU_CHECKED)
+    return !!(uv__iou_flags(stream) & UV__IOU_ENABLED);
+
+  if (!(stream->loop->flags & UV_LOOP_ENABLE_IO_URING_STREAMS))
+    return 0;
+
+  fd = uv__stream_fd(stream);
+  if (fd == -1)
+    return 0;  /* Not known yet. */
+
+  ext = uv__stream_ext(stream);
+  if (ext == NULL)
+    return 0;  /* Try again next time. */
+
+  ext->iou_flags |= UV__IOU_CHECKED;
+
+  if (stream->flags & UV_HANDLE_BLOCKING_WRITES)
+    return 0;
+
+  if (stream->type == UV_NAMED_PIPE) {
+    if (((uv_pipe_t*) stream)->ipc)
+      return 0;
+
+    if (fstat(fd, &s) || !S_ISSOCK(s.st_mode))
+      return 0;
+  } else if (stream->type != UV_TCP) {
+    return 0;
+  }
+
+  if (uv__iou_net(stream->loop)->ringfd == -1)
+    return 0;
+
+  ext->iou_flags |= UV__IOU_ENABLED;
+  return 1;
+}
+
+
+/* Submits everything in the stream ring. uv__io_poll() calls this before it
+ * blocks, so all operations that were started in one loop iteration enter
+ * the kernel together.
+ */
+void uv__iou_flush(uv_loop_t* loop) {
+  struct uv__iou* iou;
+  uint32_t head;
+  int rc;
+
+  iou = &uv__get_internal_fields(loop)->net;
+  if (iou->ringfd < 0)
+    return;
+
+  head = atomic_load_explicit((_Atomic uint32_t*) iou->sqhead,
+                              memory_order_acquire);
+  if (head == *iou->sqtail)
+    return;
+
+  do
+    rc = uv__io_uring_enter(iou->ringfd, *iou->sqtail - head, 0, 0);
+  while (rc == -1 && errno == EINTR);
+
+  /* EBUSY and EAGAIN mean the completion ring is full, the entries are
+   * submitted on the next try, after uv__poll_io_uring_net() has made room.
+   */
+  if (rc == -1 && errno != EBUSY && errno != EAGAIN)
+    perror("libuv: io_uring_enter(submit)");  /* Can't happen. */
+}
+
+
+/* The completion of a stream operation carries the stream with the operation
+ * in the low bits, cancellations carry zero. Caller must initialize the SQE
+ * and call uv__iou_net_submit().
+ */
+static struct uv__io_uring_sqe* uv__iou_net_get_sqe(uv_loop_t* loop,
+                                                    uv_stream_t* stream,
+                                                    int op) {
+  struct uv__io_uring_sqe* sqe;
+  struct uv__iou* iou;
+  uint32_t head;
+  uint32_t tail;
+  uint32_t mask;
+  uint32_t slot;
+
+  STATIC_ASSERT(UV__IOU_ACCEPT < 4);  /* Handles are at least 4 aligned. */
+
+  iou = &uv__get_internal_fields(loop)->net;
+  assert(iou->ringfd >= 0);
+
+  head = atomic_load_explicit((_Atomic uint32_t*) iou->sqhead,
+                              memory_order_acquire);
+  tail = *iou->sqtail;
+  mask = iou->sqmask;
+
+  if ((head & mask) == ((tail + 1) & mask)) {
+    uv__iou_flush(loop);
+
+    head = atomic_load_explicit((_Atomic uint32_t*) iou->sqhead,
+                                memory_order_acquire);
+    if ((head & mask) == ((tail + 1) & mask))
+      return NULL;  /* Still no room in ring buffer. */
+  }
+
+  slot = tail & mask;
+  sqe = iou->sqe;
+  sqe = &sqe[slot];
+  memset(sqe, 0, sizeof(*sqe));
+
+  if (stream != NULL) {
+    sqe->fd = uv__stream_fd(stream);
+    sqe->user_data = (uintptr_t) stream | op;
+    uv__get_stream_fields(stream)->ext->iou_flags |= 1u << op;
+  }
+
+  iou->in_flight++;
+
+  return sqe;
+}
+
+
+static void uv__iou_net_submit(uv_loop_t* loop) {
+  struct uv__iou* iou;
+
+  iou = &uv__get_internal_fields(loop)->net;
+  atomic_store_explicit((_Atomic uint32_t*) iou->sqtail,
+                        *iou->sqtail + 1,
+                        memory_order_release);
+}
+
+
+/* Hand provided buffer bid back to the kernel. */
+static void uv__iou_bufs_put(struct uv__iou_bufs* bufs, uint16_t bid) {
+  struct uv__io_uring_buf* ring;
+  struct uv__io_uring_buf* e;
+
+  ring = bufs->ring;
+  e = &ring[bufs->tail & (UV__IOU_BUFS_COUNT - 1)];
+  e->addr = (uintptr_t) (bufs->base + (size_t) bid * UV__IOU_BUFS_SIZE);
+  e->len = UV__IOU_BUFS_SIZE;
+  e->bid = bid;
+
+  bufs->tail++;
+  atomic_store_explicit((_Atomic uint16_t*) &ring->resv,
+                        bufs->tail,
+                        memory_order_release);
+}
+
+
+/* Keeps provided buffer bid with len bytes of data for a stream that isn't
+ * reading. The iou_buf of the stream points at the data that is left in the
+ * first held buffer, the others are chained in the order they arrived.
+ */
+static void uv__iou_bufs_hold(struct uv__iou_bufs* bufs,
+                              uv_stream_t* stream,
+                              uint16_t bid,
+                              uint32_t len) {
+  struct uv__stream_ext* ext;
+  uint16_t i;
+
+  STATIC_ASSERT(ARRAY_SIZE(bufs->held_next) == UV__IOU_BUFS_COUNT);
+
+  bufs->held_next[bid] = UV__IOU_BUFS_COUNT;  /* "last" */
+  bufs->held_len[bid] = len;
+
+  ext = uv__get_stream_fields(stream)->ext;
+  if (!(ext->iou_flags & UV__IOU_HELD)) {
+    ext->iou_flags |= UV__IOU_HELD;
+    ext->iou_buf =
+        uv_buf_init(bufs->base + (size_t) bid * UV__IOU_BUFS_SIZE, len);
+    return;
+  }
+
+  i = (ext->iou_buf.base - bufs->base) / UV__IOU_BUFS_SIZE;
+  while (bufs->held_next[i] != UV__IOU_BUFS_COUNT)
+    i = bufs->held_next[i];
+
+  bufs->held_next[i] = bid;
+}
+
+
+/* Marks n bytes of the held data as read, buffers that are used up go back
+ * to the kernel.
+ */
+void uv__iou_held_consume(uv_stream_t* stream, size_t n) {
+  struct uv__stream_ext* ext;
+  struct uv__iou_bufs* bufs;
+  uint16_t bid;
+  uint16_t next;
+
+  if (!uv__iou_held(stream))
+    return;  /* Dropped by uv_close() in read_cb. */
+
+  ext = uv__get_stream_fields(stream)->ext;
+  assert(n <= ext->iou_buf.len);
+  bufs = &uv__get_internal_fields(stream->loop)->bufs;
+  bid = (ext->iou_buf.base - bufs->base) / UV__IOU_BUFS_SIZE;
+
+  ext->iou_buf.base += n;
+  ext->iou_buf.len -= n;
+  if (ext->iou_buf.len > 0)
+    return;
+
+  next = bufs->held_next[bid];
+  uv__iou_bufs_put(bufs, bid);
+
+  if (next == UV__IOU_BUFS_COUNT) {
+    ext->iou_flags &= ~UV__IOU_HELD;
+    ext->iou_buf = uv_buf_init(NULL, 0);
+  } else {
+    ext->iou_buf =
+        uv_buf_init(bufs->base + (size_t) next * UV__IOU_BUFS_SIZE,
+                    bufs->held_len[next]);
+  }
+}
+
+
+void uv__iou_held_drop(uv_stream_t* stream) {
+  while (uv__iou_held(stream))
+    uv__iou_held_consume(stream, uv__iou_held_buf(stream)->len);
+}
+
+
+/* Register the provided-buffer ring the first time that a stream reads
+ * without a buffer of its own. The buffers don't take up memory until the
+ * kernel writes to them.
+ */
+static int uv__iou_bufs(uv_loop_t* loop) {
+  struct uv__io_uring_buf_reg reg;
+  struct uv__iou_bufs* bufs;
+  struct uv__iou* iou;
+  size_t ringlen;
+  size_t len;
+  uint16_t bid;
+
+  bufs = &uv__get_internal_fields(loop)->bufs;
+  if (bufs->state != 0)
+    return bufs->state > 0;
+
+  bufs->state = -1;  /* "failed" */
+  iou = &uv__get_internal_fields(loop)->net;
+  ringlen = UV__IOU_BUFS_COUNT * sizeof(struct uv__io_uring_buf);
+  len = (size_t) UV__IOU_BUFS_COUNT * UV__IOU_BUFS_SIZE;
+
+  bufs->ring = mmap(NULL,
+                    ringlen,
+                    PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS,
+                    -1,
+                    0);
+  if (bufs->ring == MAP_FAILED)
+    return 0;
+
+  bufs->base = mmap(NULL,
+                    len,
+                    PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS,
+                    -1,
+                    0);
+  if (bufs->base == MAP_FAILED)
+    goto fail;
+
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uintptr_t) bufs->ring;
+  reg.ring_entries = UV__IOU_BUFS_COUNT;
+  reg.bgid = 0;
+
+  if (uv__io_uring_register(iou->ringfd,
+                            UV__IORING_REGISTER_PBUF_RING,
+                            &reg,
+                            1)) {
+    munmap(bufs->base, len);
+    goto fail;
+  }
+
+  bufs->tail = 0;
+  for (bid = 0; bid < UV__IOU_BUFS_COUNT; bid++)
+    uv__iou_bufs_put(bufs, bid);
+
+  bufs->state = 1;
+  return 1;
+
+fail:
+  munmap(bufs->ring, ringlen);
+  return 0;
+}
+
+
+/* The kernel picks one of the provided buffers when data arrives. The
+ * receive is multishot, it stays armed and completes every time data arrives
+ * until it fails or the peer hangs up.
+ */
+int uv__iou_recv(uv_stream_t* stream) {
+  struct uv__io_uring_sqe* sqe;
+
+  if (!uv__iou_bufs(stream->loop))
+    return 0;
+
+  sqe = uv__iou_net_get_sqe(stream->loop, stream, UV__IOU_RECV);
+  if (sqe == NULL)
+    return 0;
+
+  sqe->flags = UV__IOSQE_BUFFER_SELECT;
+  sqe->buf_group = 0;
+  if (uv__kernel_version() >= /* 6.0.0 */ 0x060000)
+    sqe->ioprio = UV__IORING_RECV_MULTISHOT;
+  else
+    sqe->len = UV__IOU_BUFS_SIZE;
+
+  sqe->opcode = UV__IORING_OP_RECV;
+
+  uv__iou_net_submit(stream->loop);
+
+  return 1;
+}
+
+
+/* Waits until the stream is readable. The completion takes the place of a
+ * receive, uv__read() then reads the data the same way as after an epoll
+ * event. Nothing is allocated or read before there is data.
+ */
+int uv__iou_poll(uv_stream_t* stream) {
+  struct uv__io_uring_sqe* sqe;
+  uint32_t events;
+
+  sqe = uv__iou_net_get_sqe(stream->loop, stream, UV__IOU_RECV);
+  if (sqe == NULL)
+    return 0;
+
+  /* The kernel swaps the halves of the mask on big-endian machines. */
+  events = POLLIN;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  events = events << 16 | events >> 16;
+#endif
+
+  sqe->poll32_events = events;
+  sqe->opcode = UV__IORING_OP_POLL_ADD;
+  uv__get_stream_fields(stream)->ext->iou_flags |= UV__IOU_POLL;
+
+  uv__iou_net_submit(stream->loop);
+
+  return 1;
+}
+
+
+/* Caller must keep bufs around until the completion, nbufs is at most
+ * IOV_MAX.
+ */
+int uv__iou_send(uv_stream_t* stream,
+                 const uv_buf_t* bufs,
+                 unsigned int nbufs) {
+  struct uv__io_uring_sqe* sqe;
+
+  sqe = uv__iou_net_get_sqe(stream->loop, stream, UV__IOU_SEND);
+  if (sqe == NULL)
+    return 0;
+
+  if (nbufs == 1) {
+    sqe->addr = (uintptr_t) bufs->base;
+    sqe->len = bufs->len > INT32_MAX ? INT32_MAX : bufs->len;
+    sqe->opcode = UV__IORING_OP_SEND;
+  } else {
+    sqe->addr = (uintptr_t) bufs;
+    sqe->len = nbufs;
+    sqe->off = -1;  /* Current position, as writev() would. */
+    sqe->opcode = UV__IORING_OP_WRITEV;
+  }
+
+  uv__iou_net_submit(stream->loop);
+
+  return 1;
+}
+
+
+/* Submitted right away because addr need not outlive the call. The kernel
+ * copies the address when it takes the entry. If it doesn't take it, because
+ * the completion ring is full, the entry is taken back and the caller uses
+ * connect() instead.
+ */
+int uv__iou_connect(uv_stream_t* stream,
+                    const struct sockaddr* addr,
+                    socklen_t addrlen) {
+  struct uv__io_uring_sqe* sqe;
+  struct uv__iou* iou;
+  uint32_t head;
+
+  sqe = uv__iou_net_get_sqe(stream->loop, stream, UV__IOU_CONNECT);
+  if (sqe == NULL)
+    return 0;
+
+  sqe->addr = (uintptr_t) addr;
+  sqe->off = addrlen;
+  sqe->opcode = UV__IORING_OP_CONNECT;
+
+  uv__iou_net_submit(stream->loop);
+  uv__iou_flush(stream->loop);
+
+  /* The entry is the last one in the ring, it was taken if all of them were.
+   * Nobody else submits to this ring, so the tail can be moved back.
+   */
+  iou = &uv__get_internal_fields(stream->loop)->net;
+  head = atomic_load_explicit((_Atomic uint32_t*) iou->sqhead,
+                              memory_order_acquire);
+  if (head != *iou->sqtail) {
+    atomic_store_explicit((_Atomic uint32_t*) iou->sqtail,
+                          *iou->sqtail - 1,
+                          memory_order_release);
+    uv__get_stream_fields(stream)->ext->iou_flags &= ~(1u << UV__IOU_CONNECT);
+    iou->in_flight--;
+    return 0;
+  }
+
+  return 1;
+}
+
+
+/* Multishot accept, one submission accepts connections until it fails or is
+ * cancelled. It takes every connection off the backlog, so it is only used
+ * with UV_LOOP_USE_IO_URING_ACCEPT. Older kernels accept with epoll.
+ */
+int uv__iou_accept(uv_stream_t* stream) {
+  struct uv__io_uring_sqe* sqe;
+
+  if (!(stream->loop->flags & UV_LOOP_ENABLE_IO_URING_ACCEPT))
+    return 0;
+
+  if (uv__kernel_version() < /* 6.0.0 */ 0x060000)
+    return 0;
+
+  sqe = uv__iou_net_get_sqe(stream->loop, stream, UV__IOU_ACCEPT);
+  if (sqe == NULL)
+    return 0;
+
+  sqe->accept_flags = SOCK_CLOEXEC | SOCK_NONBLOCK;
+  sqe->ioprio = UV__IORING_ACCEPT_MULTISHOT;
+  sqe->opcode = UV__IORING_OP_ACCEPT;
+
+  uv__iou_net_submit(stream->loop);
+
+  return 1;
+}
+
+
+/* Cancels the operations in ops that are in flight. Returns whether any of
+ * them is. Their completions keep the loop alive until they arrive.
+ * Multishot operations don't complete by themselves, a cancellation that
+ * doesn't fit in the ring is submitted by uv__iou_cancel_unsent() once
+ * uv__poll_io_uring_net() has made room.
+ */
+int uv__iou_cancel(uv_stream_t* stream, unsigned int ops) {
+  struct uv__io_uring_sqe* sqe;
+  struct uv__stream_ext* ext;
+  unsigned int busy;
+  int op;
+
+  busy = uv__iou_busy(stream, ops);
+  if (busy == 0)
+    return 0;
+
+  ext = uv__get_stream_fields(stream)->ext;
+  for (op = UV__IOU_RECV; op <= UV__IOU_ACCEPT; op++) {
+    if (!(busy & (1u << op)))
+      continue;
+
+    if (ext->iou_flags & ((UV__IOU_CANCEL | UV__IOU_UNSENT) << op))
+      continue;
+
+    sqe = uv__iou_net_get_sqe(stream->loop, NULL, 0);
+    if (sqe == NULL) {
+      if (uv__queue_empty(&ext->iou_unsent)) {
+        uv__queue_insert_tail(&uv__get_internal_fields(stream->loop)->iou_unsent,
+                              &ext->iou_unsent);
+        uv__req_register(stream->loop);
+      }
+      ext->iou_flags |= UV__IOU_UNSENT << op;
+      continue;
+    }
+
+    sqe->addr = (uintptr_t) stream | op;
+    sqe->opcode = UV__IORING_OP_ASYNC_CANCEL;
+
+    uv__iou_net_submit(stream->loop);
+
+    ext->iou_flags |= UV__IOU_CANCEL << op;
+    uv__req_register(stream->loop);
+  }
+
+  return 1;
+}
+
+
+/* Submits the cancellations that didn't fit in the ring before. */
+static void uv__iou_cancel_unsent(uv_loop_t* loop) {
+  uv__loop_internal_fields_t* lfields;
+  struct uv__stream_ext* ext;
+  struct uv__queue queue;
+  struct uv__queue* q;
+  unsigned int ops;
+
+  lfields = uv__get_internal_fields(loop);
+  if (uv__queue_empty(&lfields->iou_unsent))
+    return;
+
+  uv__queue_move(&lfields->iou_unsent, &queue);
+  while (!uv__queue_empty(&queue)) {
+    q = uv__queue_head(&queue);
+    uv__queue_remove(q);
+    uv__queue_init(q);
+    uv__req_unregister(loop);
+
+    ext = uv__queue_data(q, struct uv__stream_ext, iou_unsent);
+    ops = (ext->iou_flags / UV__IOU_UNSENT) & UV__IOU_BUSY;
+    ext->iou_flags &= ~(ops * UV__IOU_UNSENT);
+    uv__iou_cancel(ext->stream, ops);
+  }
+}
+
+
+/* Drops the cancellations the stream still has to submit, it is going away. */
+void uv__iou_cancel_forget(uv_stream_t* stream) {
+  struct uv__stream_ext* ext;
+
+  ext = uv__get_stream_fields(stream)->ext;
+  if (ext == NULL || uv__queue_empty(&ext->iou_unsent))
+    return;
+
+  uv__queue_remove(&ext->iou_unsent);
+  uv__queue_init(&ext->iou_unsent);
+  uv__req_unregister(stream->loop);
+}
+
+
+static int uv__poll_io_uring_net(uv_loop_t* loop, struct uv__iou* iou) {
+  struct uv__io_uring_cqe* cqe;
+  struct uv__io_uring_cqe* e;
+  struct uv__stream_ext* ext;
+  struct uv__iou_bufs* bufs;
+  uv_stream_t* stream;
+  uv_buf_t buf;
+  uint32_t cflags;
+  uint16_t bid;
+  uint32_t head;
+  uint32_t tail;
+  uint32_t mask;
+  uint32_t i;
+  uint32_t flags;
+  int nevents;
+  int count;
+  int keep;
+  int op;
+  int rc;
+
+  bufs = &uv__get_internal_fields(loop)->bufs;
+  mask = iou->cqmask;
+  cqe = iou->cqe;
+  nevents = 0;
+
+  /* The callbacks usually start new operations. Submit them right away, the
+   * kernel often completes them before io_uring_enter() returns, and go
+   * another round without waiting in epoll_pwait(). Prevent loop starvation
+   * the same way as uv__write() does.
+   */
+  count = 32;
+
+again:
+  head = *iou->cqhead;
+  tail = atomic_load_explicit((_Atomic uint32_t*) iou->cqtail,
+                              memory_order_acquire);
+
+  for (i = head; i != tail; i++) {
+    e = &cqe[i & mask];
+    cflags = e->flags;
+
+    /* A multishot operation is done with its last completion. */
+    if (!(cflags & UV__IORING_CQE_F_MORE))
+      iou->in_flight--;
+
+    if (e->user_data == 0)
+      continue;  /* UV__IORING_OP_ASYNC_CANCEL */
+
+    op = e->user_data & 3;
+    stream = (uv_stream_t*) (uintptr_t) (e->user_data - op);
+
+    if (!(cflags & UV__IORING_CQE_F_MORE)) {
+      ext = uv__get_stream_fields(stream)->ext;
+      if (ext->iou_flags & (UV__IOU_CANCEL << op))
+        uv__req_unregister(loop);
+
+      ext->iou_flags &= ~((1u | UV__IOU_CANCEL | UV__IOU_UNSENT) << op);
+    }
+
+    /* The stream reads from the provided buffer until uv__stream_iou_done()
+     * returns, after that the kernel can have it back, unless the stream
+     * holds on to the data.
+     */
+    bid = cflags >> UV__IORING_CQE_BUFFER_SHIFT;
+    buf = uv_buf_init(NULL, 0);
+    if (cflags & UV__IORING_CQE_F_BUFFER)
+      buf = uv_buf_init(bufs->base + (size_t) bid * UV__IOU_BUFS_SIZE,
+                        UV__IOU_BUFS_SIZE);
+
+    uv__metrics_update_idle_time(loop);
+    keep = uv__stream_iou_done(stream, op, e->res, &buf);
+    nevents++;
+
+    if (cflags & UV__IORING_CQE_F_BUFFER) {
+      if (keep)
+        uv__iou_bufs_hold(bufs, stream, bid, e->res);
+      else
+        uv__iou_bufs_put(bufs, bid);
+    }
+  }
+
+  atomic_store_explicit((_Atomic uint32_t*) iou->cqhead,
+                        tail,
+                        memory_order_release);
+
+  if (head != tail && --count > 0) {
+    head = atomic_load_explicit((_Atomic uint32_t*) iou->sqhead,
+                                memory_order_acquire);
+    if (head != *iou->sqtail) {
+      uv__iou_flush(loop);
+      goto again;
+    }
+  }
+
+  flags = atomic_load_explicit((_Atomic uint32_t*) iou->sqflags,
+                               memory_order_acquire);
+
+  if (flags & UV__IORING_SQ_CQ_OVERFLOW) {
+    do
+      rc = uv__io_uring_enter(iou->ringfd, 0, 0, UV__IORING_ENTER_GETEVENTS);
+    while (rc == -1 && errno == EINTR);
+
+    if (rc < 0)
+      perror("libuv: io_uring_enter(getevents)");  /* Can't happen. */
+  }
+
+  return nevents;
+}
+
+
 /* Only for EPOLL_CTL_ADD and EPOLL_CTL_MOD. EPOLL_CTL_DEL should always be
  * executed immediately, otherwise the file descriptor may have been closed
  * by the time the kernel starts the operation.
@@ -1347,6 +2183,122 @@ static void uv__epoll_ctl_flush(int epollfd,
 }
 
 
+/* epoll_pwait() with a timeout in nanoseconds. Uses epoll_pwait2() when the
+ * kernel has it (Linux 5.11+), otherwise the timeout is rounded up to whole
+ * milliseconds.
+ */
+static int uv__epoll_pwait_ns(int epollfd,
+                              struct epoll_event* events,
+                              int maxevents,
+                              uint64_t timeout,
+                              sigset_t* sigmask) {
+#ifdef __NR_epoll_pwait2
+  static _Atomic int no_epoll_pwait2;
+  struct timespec ts;
+  int rc;
+
+  if (!atomic_load_explicit(&no_epoll_pwait2, memory_order_relaxed)) {
+    ts.tv_sec = timeout / 1000000000;
+    ts.tv_nsec = timeout % 1000000000;
+
+    /* The kernel's sigset_t is smaller than glibc's. */
+    rc = syscall(__NR_epoll_pwait2,
+                 epollfd,
+                 events,
+                 maxevents,
+                 &ts,
+                 sigmask,
+                 (size_t) _NSIG / 8);
+    if (rc != -1 || errno != ENOSYS)
+      return rc;
+
+    atomic_store_explicit(&no_epoll_pwait2, 1, memory_order_relaxed);
+  }
+#endif
+
+  return epoll_pwait(epollfd,
+                     events,
+                     maxevents,
+                     (int) ((timeout + 999999) / 1000000),
+                     sigmask);
+}
+
+
+/* The batch window is waited out in slices of at most this many nanoseconds,
+ * so a batch that fills up is dispatched without waiting for the window to
+ * close.
+ */
+#define UV__BATCH_IO_SLICE 200000
+
+/* Waits for up to timeout nanoseconds while readiness events are staged.
+ * The staged file descriptors are level-triggered and would keep the loop's
+ * epoll set from blocking, so this waits on a second set that only holds
+ * what has to cut the batch window short: uv_async_send() and thread pool
+ * completions, signals and io_uring completions. The caller collects
+ * everything that became ready with a non-blocking poll afterwards. Returns
+ * non-zero when the wait was cut short.
+ */
+static int uv__batch_io_wait(uv_loop_t* loop,
+                             uint64_t timeout,
+                             sigset_t* sigmask) {
+  uv__loop_internal_fields_t* lfields;
+  struct epoll_event events[4];
+  struct epoll_event e;
+  uv_batch_t* batch;
+  int fds[4];
+  int fd;
+  int rc;
+  int i;
+
+  lfields = uv__get_internal_fields(loop);
+  batch = loop->batch_system;
+
+  fds[0] = loop->async_io_watcher.fd;
+  fds[1] = loop->signal_pipefd[0];
+  fds[2] = lfields->iou.ringfd;
+  fds[3] = lfields->net.ringfd;
+
+  if (batch->io_wakefd == -1) {
+    batch->io_wakefd = epoll_create1(O_CLOEXEC);
+    if (batch->io_wakefd == -1)
+      return 1;  /* Dispatch right away. */
+
+    for (i = 0; i < (int) ARRAY_SIZE(fds); i++)
+      batch->io_wakefds[i] = -1;
+  }
+
+  /* The descriptors are created lazily, bring the set up to date. */
+  memset(&e, 0, sizeof(e));
+  for (i = 0; i < (int) ARRAY_SIZE(fds); i++) {
+    fd = batch->io_wakefds[i];
+    if (fd == fds[i])
+      continue;
+
+    if (fd != -1)
+      epoll_ctl(batch->io_wakefd, EPOLL_CTL_DEL, fd, &e);
+
+    batch->io_wakefds[i] = fds[i];
+    if (fds[i] == -1)
+      continue;
+
+    e.events = POLLIN;
+    e.data.fd = fds[i];
+    if (epoll_ctl(batch->io_wakefd, EPOLL_CTL_ADD, fds[i], &e))
+      if (errno != EEXIST)
+        batch->io_wakefds[i] = -1;
+  }
+
+  rc = uv__epoll_pwait_ns(batch->io_wakefd,
+                          events,
+                          ARRAY_SIZE(events),
+                          timeout,
+                          sigmask);
+
+  SAVE_ERRNO(uv__update_time(loop));
+  return rc != 0;
+}
+
+
 void uv__io_poll(uv_loop_t* loop, int timeout) {
   uv__loop_internal_fields_t* lfields;
   struct epoll_event events[1024];
@@ -1356,8 +2308,10 @@ void uv__io_poll(uv_loop_t* loop, int timeout) {
   struct epoll_event e;
   struct uv__iou* ctl;
   struct uv__iou* iou;
+  struct uv__iou* net;
   int real_timeout;
   struct uv__queue* q;
+  uv_batch_t* batch;
   uv__io_t* w;
   sigset_t* sigmask;
   sigset_t sigset;
@@ -1373,10 +2327,27 @@ void uv__io_poll(uv_loop_t* loop, int timeout) {
   int i;
   int user_timeout;
   int reset_timeout;
+  uv_batch_flush_reason_t reason;
+  int64_t batch_timeout;
+  uint64_t window;
+  int harvest;
+  int staged;
+  int woken;
+  int left;
 
   lfields = uv__get_internal_fields(loop);
   ctl = &lfields->ctl;
   iou = &lfields->iou;
+  net = &lfields->net;
+
+  /* With batching enabled, readiness events are staged and dispatched
+   * together instead of one callback per epoll_pwait() result.
+   */
+  batch = NULL;
+  if (loop->batch_enabled && loop->batch_system != NULL)
+    batch = loop->batch_system;
+  harvest = 0;
+  woken = 0;
 
   sigmask = NULL;
   if (loop->flags & UV_LOOP_BLOCK_SIGPROF) {
@@ -1413,8 +2384,15 @@ void uv__io_poll(uv_loop_t* loop, int timeout) {
     if (w->events == 0)
       op = EPOLL_CTL_ADD;
 
-    w->events = w->pevents;
-    e.events = w->pevents;
+    /* Edge-triggered watchers are registered for reading and writing once,
+     * uv__io_start() and uv__io_stop() leave the kernel out of it after that.
+     */
+    if (w->pevents & UV__POLLET)
+      w->events = POLLIN | POLLOUT | UV__POLLRDHUP | UV__POLLET;
+    else
+      w->events = w->pevents;
+
+    e.events = w->events;
     e.data.fd = w->fd;
     fd = w->fd;
 
@@ -1440,7 +2418,7 @@ void uv__io_poll(uv_loop_t* loop, int timeout) {
 
   for (;;) {
     if (loop->nfds == 0)
-      if (iou->in_flight == 0)
+      if (iou->in_flight == 0 && net->in_flight == 0)
         break;
 
     /* All event mask mutations should be visible to the kernel before
@@ -1450,6 +2428,9 @@ void uv__io_poll(uv_loop_t* loop, int timeout) {
       while (*ctl->sqhead != *ctl->sqtail)
         uv__epoll_ctl_flush(epollfd, ctl, &prep);
 
+    /* Stream operations queue up until the loop is about to block. */
+    uv__iou_flush(loop);
+
     /* Only need to set the provider_entry_time if timeout != 0. The function
      * will return early if the loop isn't configured with UV_METRICS_IDLE_TIME.
      */
@@ -1462,7 +2443,26 @@ void uv__io_poll(uv_loop_t* loop, int timeout) {
      */
     lfields->current_timeout = timeout;
 
-    nfds = epoll_pwait(epollfd, events, ARRAY_SIZE(events), timeout, sigmask);
+    /* A pending batch can be due before the next timer, and sooner than the
+     * millisecond resolution of timeout allows for.
+     */
+    batch_timeout = -1;
+    if (batch != NULL && timeout != 0) {
+      batch_timeout = uv__batch_adjust_timeout(loop, -1);
+      if (timeout != -1 && batch_timeout >= (int64_t) timeout * 1000000)
+        batch_timeout = -1;
+    }
+
+    if (batch_timeout != -1) {
+      timeout = (int) ((batch_timeout + 999999) / 1000000);
+      nfds = uv__epoll_pwait_ns(epollfd,
+                                events,
+                                ARRAY_SIZE(events),
+                                batch_timeout,
+                                sigmask);
+    } else {
+      nfds = epoll_pwait(epollfd, events, ARRAY_SIZE(events), timeout, sigmask);
+    }
 
     /* Update loop->time unconditionally. It's tempting to skip the update when
      * timeout == 0 (i.e. non-blocking poll) but there is no guarantee that the
@@ -1476,7 +2476,10 @@ void uv__io_poll(uv_loop_t* loop, int timeout) {
       /* Unlimited timeout should only return with events or signal. */
       assert(timeout != -1);
 
-    if (nfds == 0 || nfds == -1) {
+    /* Nothing new during a slice of the batch window is no reason to cut
+     * it short, see below.
+     */
+    if (nfds == -1 || (nfds == 0 && harvest == 0)) {
       if (reset_timeout != 0) {
         timeout = user_timeout;
         reset_timeout = 0;
@@ -1509,6 +2512,12 @@ void uv__io_poll(uv_loop_t* loop, int timeout) {
         continue;
       }
 
+      if (fd == net->ringfd) {
+        nevents += uv__poll_io_uring_net(loop, net);
+        uv__iou_cancel_unsent(loop);
+        continue;
+      }
+
       assert(fd >= 0);
       assert((unsigned) fd < loop->nwatchers);
 
@@ -1531,9 +2540,14 @@ void uv__io_poll(uv_loop_t* loop, int timeout) {
       /* Give users only events they're interested in. Prevents spurious
        * callbacks when previous callback invocation in this loop has stopped
        * the current watcher. Also, filters out events that users has not
-       * requested us to watch.
+       * requested us to watch. Edge-triggered streams are told about data
+       * when they aren't reading too, the kernel won't report it again, and
+       * need POLLRDHUP to see an EOF behind the data, see uv__stream_io().
        */
-      pe->events &= w->pevents | POLLERR | POLLHUP;
+      if (w->pevents & UV__POLLET)
+        pe->events &= w->pevents | POLLIN | POLLERR | POLLHUP | UV__POLLRDHUP;
+      else
+        pe->events &= w->pevents | POLLERR | POLLHUP;
 
       /* Work around an epoll quirk where it sometimes reports just the
        * EPOLLERR or EPOLLHUP event.  In order to force the event loop to
@@ -1560,6 +2574,18 @@ void uv__io_poll(uv_loop_t* loop, int timeout) {
          */
         if (w == &loop->signal_io_watcher) {
           have_signals = 1;
+        } else if (batch != NULL) {
+          /* A level-triggered fd shows up again on every poll of the batch
+           * window, it is only counted the first time.
+           */
+          staged = uv__batch_io_stage(loop, fd, pe->events);
+          if (staged == 0)
+            continue;
+
+          if (staged < 0) {
+            uv__metrics_update_idle_time(loop);
+            w->cb(loop, w, pe->events);
+          }
         } else {
           uv__metrics_update_idle_time(loop);
           w->cb(loop, w, pe->events);
@@ -1576,6 +2602,44 @@ void uv__io_poll(uv_loop_t* loop, int timeout) {
       uv__metrics_inc_events_waiting(loop, nevents);
     }
 
+    if (batch != NULL && batch->io_count != 0) {
+      /* Give the batch a chance to fill up before dispatching it, unless this
+       * is a non-blocking poll or the loop has to cycle anyway. The window is
+       * waited out one slice at a time, see uv__batch_io_wait(), and each
+       * slice is followed by a non-blocking poll that stages whatever became
+       * ready in the meantime. uv__batch_io_stage() dispatches the batch as
+       * soon as it is full, which ends the window early.
+       */
+      reason = UV_BATCH_FLUSH_FORCED;
+      if (woken == 0 &&
+          have_iou_events == 0 &&
+          have_signals == 0 &&
+          real_timeout != 0) {
+        reason = UV_BATCH_FLUSH_TIMEOUT;
+        window = uv__batch_io_window(loop);
+        if (real_timeout != -1) {
+          left = real_timeout - (int) (loop->time - base);
+          if (left <= 0)
+            window = 0;
+          else if (window > (uint64_t) left * 1000000)
+            window = (uint64_t) left * 1000000;
+        }
+
+        if (window > 0) {
+          if (window > UV__BATCH_IO_SLICE)
+            window = UV__BATCH_IO_SLICE;
+
+          lfields->inv = NULL;
+          woken = uv__batch_io_wait(loop, window, sigmask);
+          harvest = 1;
+          timeout = 0;
+          continue;
+        }
+      }
+
+      uv__batch_io_flush(loop, reason);
+    }
+
     if (have_signals != 0) {
       uv__metrics_update_idle_time(loop);
       loop->signal_io_watcher.cb(loop, &loop->signal_io_watcher, POLLIN);
@@ -1614,6 +2678,9 @@ update_timeout:
     timeout = real_timeout;
   }
 
+  if (batch != NULL)
+    uv__batch_io_flush(loop, UV_BATCH_FLUSH_FORCED);
+
   if (ctl->ringfd != -1)
     while (*ctl->sqhead != *ctl->sqtail)
       uv__epoll_ctl_flush(epollfd, ctl, &prep);
@@ -2430,6 +3497,39 @@ int uv__get_constrained_cpu(uv__cpu_constraint* constraint) {
 }
 
 
+/* Reads a list in the kernel's format, like "0-3,8,10-11" in
+ * /sys/devices/system/node/node0/cpulist, into an array of flags.
+ */
+int uv__read_list(const char* filename, char* set, size_t size) {
+  char buf[4096];
+  unsigned long first;
+  unsigned long last;
+  char* p;
+  int rc;
+
+  rc = uv__slurp(filename, buf, sizeof(buf));
+  if (rc)
+    return rc;
+
+  memset(set, 0, size);
+
+  for (p = buf; *p >= '0' && *p <= '9'; p++) {
+    first = strtoul(p, &p, 10);
+    last = first;
+    if (*p == '-')
+      last = strtoul(p + 1, &p, 10);
+
+    for (; first <= last && first < size; first++)
+      set[first] = 1;
+
+    if (*p != ',')
+      break;
+  }
+
+  return 0;
+}
+
+
 void uv_loadavg(double avg[3]) {
   struct sysinfo info;
   char buf[128];  /* Large enough to hold all of /proc/loadavg. */
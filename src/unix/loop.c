@@ -48,6 +48,8 @@ int uv_loop_init(uv_loop_t* loop) {
   memset(&lfields->loop_metrics.metrics,
          0,
          sizeof(lfields->loop_metrics.metrics));
+  uv__queue_init(&lfields->read_skipped);
+  uv__queue_init(&lfields->read_cut);
 
   heap_init((struct heap*) &loop->timer_heap);
   uv__queue_init(&loop->wq);
@@ -165,6 +167,7 @@ int uv_loop_fork(uv_loop_t* loop) {
 void uv__loop_close(uv_loop_t* loop) {
   uv__loop_internal_fields_t* lfields;
 
+  uv_batch_cleanup(loop);
   uv__signal_loop_cleanup(loop);
   uv__platform_loop_delete(loop);
   uv__async_stop(loop);
@@ -179,10 +182,9 @@ void uv__loop_close(uv_loop_t* loop) {
     loop->backend_fd = -1;
   }
 
-  uv_mutex_lock(&loop->wq_mutex);
-  assert(uv__queue_empty(&loop->wq) && "thread pool work queue not empty!");
+  assert(uv__get_internal_fields(loop)->work_done == NULL &&
+         "thread pool work queue not empty!");
   assert(!uv__has_active_reqs(loop));
-  uv_mutex_unlock(&loop->wq_mutex);
   uv_mutex_destroy(&loop->wq_mutex);
 
   /*
@@ -203,6 +205,7 @@ void uv__loop_close(uv_loop_t* loop) {
 
   lfields = uv__get_internal_fields(loop);
   uv_mutex_destroy(&lfields->loop_metrics.lock);
+  uv__free(lfields->read_buf);
   uv__free(lfields);
   loop->internal_fields = NULL;
 }
@@ -222,8 +225,33 @@ int uv__loop_configure(uv_loop_t* loop, uv_loop_option option, va_list ap) {
     loop->flags |= UV_LOOP_ENABLE_IO_URING_SQPOLL;
     return 0;
   }
+
+  if (option == UV_LOOP_USE_IO_URING_STREAMS) {
+    loop->flags |= UV_LOOP_ENABLE_IO_URING_STREAMS;
+    return 0;
+  }
+
+  if (option == UV_LOOP_USE_IO_URING_ACCEPT) {
+    loop->flags |= UV_LOOP_ENABLE_IO_URING_ACCEPT;
+    return 0;
+  }
+
+  if (option == UV_LOOP_USE_EDGE_TRIGGERED) {
+    loop->flags |= UV_LOOP_ENABLE_EDGE_TRIGGERED;
+    return 0;
+  }
 #endif
 
+  if (option == UV_LOOP_READ_BUDGET) {
+    lfields->read_budget = va_arg(ap, size_t);
+    lfields->read_left = lfields->read_budget;
+    return 0;
+  }
+
+  if (option == UV_LOOP_CORK_WRITES) {
+    loop->flags |= UV_LOOP_ENABLE_WRITE_CORK;
+    return 0;
+  }
 
   if (option != UV_LOOP_BLOCK_SIGNAL)
     return UV_ENOSYS;
@@ -70,13 +70,43 @@ union uv__cmsg {
 
 STATIC_ASSERT(256 == sizeof(union uv__cmsg));
 
+/* Room for the buffers of the alloc_cb of uv_read_start_v(). */
+#define UV__READ_V_MAX 16
+
+/* How many buffers uv__write() sends from consecutive requests at once. */
+#define UV__WRITE_GATHER_MAX 128
+
+STATIC_ASSERT(sizeof(struct uv__stream_fields) <=
+              sizeof(((uv_stream_t*) 0)->u.reserved));
+
+#if defined(__linux__)
+/* The numbers of the zero-copy sends of a write request, see
+ * uv__try_write_zerocopy(). They live in the request's reserved space.
+ */
+struct uv__write_zc {
+  unsigned int start;
+  unsigned int end;
+  unsigned int pending;
+};
+
+STATIC_ASSERT(sizeof(struct uv__write_zc) <=
+              sizeof(((uv_write_t*) 0)->reserved));
+
+#define uv__get_write_zc(req) ((struct uv__write_zc*) (req)->reserved)
+#endif /* defined(__linux__) */
+
 static void uv__stream_connect(uv_stream_t*);
 static void uv__write(uv_stream_t* stream);
-static void uv__read(uv_stream_t* stream);
+static void uv__read(uv_stream_t* stream, int drain);
 static void uv__stream_io(uv_loop_t* loop, uv__io_t* w, unsigned int events);
 static void uv__write_callbacks(uv_stream_t* stream);
 static size_t uv__write_req_size(uv_write_t* req);
 static void uv__drain(uv_stream_t* stream);
+static void uv__stream_read_arm(uv_stream_t* stream);
+static void uv__server_iou_deliver(uv_stream_t* stream);
+#if defined(__linux__)
+static void uv__stream_iou_read_held(uv_stream_t* stream);
+#endif
 
 
 void uv__stream_init(uv_loop_t* loop,
@@ -87,6 +117,7 @@ void uv__stream_init(uv_loop_t* loop,
   uv__handle_init(loop, (uv_handle_t*)stream, type);
   stream->read_cb = NULL;
   stream->alloc_cb = NULL;
+  uv__get_stream_fields(stream)->alloc_v_cb = NULL;
   stream->close_cb = NULL;
   stream->connection_cb = NULL;
   stream->connect_req = NULL;
@@ -96,6 +127,7 @@ void uv__stream_init(uv_loop_t* loop,
   stream->delayed_error = 0;
   uv__queue_init(&stream->write_queue);
   uv__queue_init(&stream->write_completed_queue);
+  uv__queue_init(&uv__get_stream_fields(stream)->read_queue);
   stream->write_queue_size = 0;
 
   if (loop->emfile_fd == -1) {
@@ -113,10 +145,31 @@ void uv__stream_init(uv_loop_t* loop,
   stream->select = NULL;
 #endif /* defined(__APPLE_) */
 
+  uv__get_stream_fields(stream)->ext = NULL;
+
   uv__io_init(&stream->io_watcher, uv__stream_io, -1);
 }
 
 
+#if defined(__linux__)
+struct uv__stream_ext* uv__stream_ext(uv_stream_t* stream) {
+  struct uv__stream_fields* fields;
+
+  fields = uv__get_stream_fields(stream);
+  if (fields->ext == NULL) {
+    fields->ext = uv__calloc(1, sizeof(*fields->ext));
+    if (fields->ext != NULL) {
+      uv__queue_init(&fields->ext->zc_queue);
+      uv__queue_init(&fields->ext->iou_unsent);
+      fields->ext->stream = stream;
+    }
+  }
+
+  return fields->ext;
+}
+#endif /* defined(__linux__) */
+
+
 static void uv__stream_osx_interrupt_select(uv_stream_t* stream) {
 #if defined(__APPLE__)
   /* Notify select() thread about state change */
@@ -420,6 +473,11 @@ int uv__stream_open(uv_stream_t* stream, int fd, int flags) {
         uv__tcp_keepalive(fd, 1, 60)) {
       return UV__ERR(errno);
     }
+
+#if defined(__linux__)
+    if ((stream->flags & UV_HANDLE_TCP_ZEROCOPY) && uv__tcp_zerocopy(fd, 1))
+      return UV__ERR(errno);
+#endif
   }
 
 #if defined(__APPLE__)
@@ -433,6 +491,13 @@ int uv__stream_open(uv_stream_t* stream, int fd, int flags) {
 
   stream->io_watcher.fd = fd;
 
+  /* Listening sockets go back to level-triggered in uv__server_start(). */
+  if ((stream->loop->flags & UV_LOOP_ENABLE_EDGE_TRIGGERED) &&
+      stream->type != UV_TTY &&
+      !uv__iou_stream(stream)) {
+    uv__io_set_edge(stream->loop, &stream->io_watcher, 1);
+  }
+
   return 0;
 }
 
@@ -454,6 +519,7 @@ void uv__stream_flush_write_queue(uv_stream_t* stream, int error) {
 
 void uv__stream_destroy(uv_stream_t* stream) {
   assert(!uv__io_active(&stream->io_watcher, POLLIN | POLLOUT));
+  assert(!uv__stream_zc_queued(stream));
   assert(stream->flags & UV_HANDLE_CLOSED);
 
   if (stream->connect_req) {
@@ -467,6 +533,14 @@ void uv__stream_destroy(uv_stream_t* stream) {
   uv__drain(stream);
 
   assert(stream->write_queue_size == 0);
+
+#if defined(__linux__)
+  uv__iou_cancel_forget(stream);
+  if (uv__get_stream_fields(stream)->ext != NULL)
+    uv__free(uv__get_stream_fields(stream)->ext->iou_bufs);
+#endif
+  uv__free(uv__get_stream_fields(stream)->ext);
+  uv__get_stream_fields(stream)->ext = NULL;
 }
 
 
@@ -511,10 +585,16 @@ void uv__server_io(uv_loop_t* loop, uv__io_t* w, unsigned int events) {
   int fd;
 
   stream = container_of(w, uv_stream_t, io_watcher);
-  assert(events & POLLIN);
-  assert(stream->accepted_fd == -1);
   assert(!(stream->flags & UV_HANDLE_CLOSING));
 
+  /* Fed by uv__server_start(). */
+  if (!(events & POLLIN)) {
+    uv__server_iou_deliver(stream);
+    return;
+  }
+
+  assert(stream->accepted_fd == -1);
+
   fd = uv__stream_fd(stream);
   err = uv__accept(fd);
 
@@ -533,6 +613,67 @@ void uv__server_io(uv_loop_t* loop, uv__io_t* w, unsigned int events) {
 }
 
 
+/* Start accepting connections, with the io_uring when the stream can. The
+ * connections that it accepted while the user wasn't accepting are handed
+ * over first.
+ */
+void uv__server_start(uv_stream_t* stream) {
+  /* uv__server_io() leaves connections in the backlog when the user doesn't
+   * accept them.
+   */
+  uv__io_set_edge(stream->loop, &stream->io_watcher, 0);
+
+  if (uv__iou_stream(stream)) {
+    if (stream->queued_fds != NULL) {
+      uv__io_feed(stream->loop, &stream->io_watcher);
+      return;
+    }
+
+    if (uv__iou_busy(stream, 1u << UV__IOU_ACCEPT))
+      return;
+
+    if (uv__iou_accept(stream)) {
+      uv__io_stop(stream->loop, &stream->io_watcher, POLLIN);
+      return;
+    }
+  }
+
+  uv__io_start(stream->loop, &stream->io_watcher, POLLIN);
+}
+
+
+/* Hand the queued connections to connection_cb until the user stops
+ * accepting them, uv_accept() picks up from there.
+ */
+static void uv__server_iou_deliver(uv_stream_t* stream) {
+  uv__stream_queued_fds_t* queued_fds;
+
+  while (stream->accepted_fd == -1 && stream->queued_fds != NULL) {
+    queued_fds = stream->queued_fds;
+    stream->accepted_fd = queued_fds->fds[0];
+
+    if (--queued_fds->offset == 0) {
+      uv__free(queued_fds);
+      stream->queued_fds = NULL;
+    } else {
+      memmove(queued_fds->fds,
+              queued_fds->fds + 1,
+              queued_fds->offset * sizeof(*queued_fds->fds));
+    }
+
+    stream->connection_cb(stream, 0);
+    if (uv__is_closing(stream))
+      return;
+  }
+
+  /* Like uv__server_io(), stop accepting while the user hasn't accepted. */
+  if (stream->accepted_fd != -1)
+    uv__iou_cancel(stream, 1u << UV__IOU_ACCEPT);
+  else
+    uv__server_start(stream);
+}
+
+
 int uv_accept(uv_stream_t* server, uv_stream_t* client) {
   int err;
 
@@ -569,8 +710,8 @@ int uv_accept(uv_stream_t* server, uv_stream_t* client) {
   client->flags |= UV_HANDLE_BOUND;
 
 done:
-  /* Process queued fds */
-  if (server->queued_fds != NULL) {
+  /* Process queued fds. A server hands them to connection_cb. */
+  if (server->queued_fds != NULL && server->io_watcher.cb != uv__server_io) {
     uv__stream_queued_fds_t* queued_fds;
 
     queued_fds = server->queued_fds;
@@ -592,7 +733,7 @@ done:
   } else {
     server->accepted_fd = -1;
     if (err == 0)
-      uv__io_start(server->loop, &server->io_watcher, POLLIN);
+      uv__server_start(server);
   }
   return err;
 }
@@ -636,6 +777,12 @@ static void uv__drain(uv_stream_t* stream) {
   if (!uv__is_stream_shutting(stream))
     return;
 
+#if defined(__linux__)
+  /* Shut down once the zero-copy writes have completed. */
+  if (uv__stream_zc_queued(stream))
+    return;
+#endif
+
   req = stream->shutdown_req;
   assert(req);
 
@@ -729,6 +876,17 @@ static void uv__write_req_finish(uv_write_t* req) {
     req->bufs = NULL;
   }
 
+#if defined(__linux__)
+  /* Wait until the kernel is done with the data, and let requests that come
+   * after a zero-copy one wait for it, see uv__stream_zerocopy_done().
+   */
+  if (uv__get_write_zc(req)->pending != 0 || uv__stream_zc_queued(stream)) {
+    uv__queue_insert_tail(&uv__get_stream_fields(stream)->ext->zc_queue,
+                          &req->queue);
+    return;
+  }
+#endif
+
   /* Add it to the write_completed_queue where it will have its
    * callback called in the near future.
    */
@@ -837,14 +995,400 @@ static int uv__try_write(uv_stream_t* stream,
   return UV__ERR(errno);
 }
 
+
+#if defined(__linux__)
+/* Smaller writes are cheaper to copy than to pin and wait for. */
+#define UV__ZEROCOPY_MIN (16 * 1024)
+
+struct uv__sock_extended_err {
+  uint32_t ee_errno;
+  uint8_t ee_origin;
+  uint8_t ee_type;
+  uint8_t ee_code;
+  uint8_t ee_pad;
+  uint32_t ee_info;
+  uint32_t ee_data;
+};
+
+enum {
+  UV__SO_EE_ORIGIN_ZEROCOPY = 5,
+  UV__SO_EE_CODE_ZEROCOPY_COPIED = 1
+};
+
+
+static int uv__write_zerocopy(uv_stream_t* stream, uv_write_t* req) {
+  return (stream->flags & UV_HANDLE_TCP_ZEROCOPY) &&
+         stream->type == UV_TCP &&
+         req->send_handle == NULL &&
+         !uv__iou_stream(stream) &&
+         uv__write_req_size(req) >= UV__ZEROCOPY_MIN;
+}
+
+
+/* Like uv__try_write() but the kernel sends the data straight from the
+ * request's buffers. The kernel numbers the sends and reports on the error
+ * queue when it's done with them, until then the request holds on to the
+ * numbers.
+ */
+static ssize_t uv__try_write_zerocopy(uv_stream_t* stream, uv_write_t* req) {
+  struct uv__stream_ext* ext;
+  struct uv__write_zc* zc;
+  struct msghdr msg;
+  ssize_t n;
+  int iovcnt;
+
+  iovcnt = req->nbufs - req->write_index;
+  if (iovcnt > uv__getiovmax())
+    iovcnt = uv__getiovmax();
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = (struct iovec*) &req->bufs[req->write_index];
+  msg.msg_iovlen = iovcnt;
+
+  do
+    n = sendmsg(uv__stream_fd(stream), &msg, UV__MSG_ZEROCOPY);
+  while (n == -1 && errno == EINTR);
+
+  if (n == -1) {
+    /* Too many notifications are outstanding, copy until they're read. */
+    if (errno == ENOBUFS)
+      return uv__try_write(stream,
+                           &req->bufs[req->write_index],
+                           req->nbufs - req->write_index,
+                           NULL);
+
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return UV_EAGAIN;
+
+    return UV__ERR(errno);
+  }
+
+  if (n > 0) {
+    zc = uv__get_write_zc(req);
+    ext = uv__get_stream_fields(stream)->ext;
+    if (zc->start == zc->end)
+      zc->start = ext->zc_seq;
+    zc->end = ++ext->zc_seq;
+    zc->pending++;
+    uv__io_start(stream->loop, &stream->io_watcher, POLLERR);
+  }
+
+  return n;
+}
+
+
+static void uv__write_req_release(uv_write_t* req,
+                                  unsigned int lo,
+                                  unsigned int hi) {
+  struct uv__write_zc* zc;
+  int start;
+  int end;
+
+  /* Relative to the first number of the request, they wrap around. */
+  zc = uv__get_write_zc(req);
+  start = (int) (lo - zc->start);
+  end = (int) (hi + 1 - zc->start);
+
+  if (start < 0)
+    start = 0;
+
+  if (end > (int) (zc->end - zc->start))
+    end = (int) (zc->end - zc->start);
+
+  if (end > start)
+    zc->pending -= end - start;
+}
+
+
+/* Reads the notifications off the error queue. A request is done when the
+ * kernel has released all of its sends, which usually happens in order but
+ * not always, and when the requests before it are done.
+ */
+static void uv__stream_zerocopy_done(uv_stream_t* stream) {
+  struct uv__sock_extended_err ee;
+  struct uv__stream_ext* ext;
+  struct uv__queue* zc_queue;
+  struct cmsghdr* cmsg;
+  struct uv__queue* q;
+  union uv__cmsg cmsgbuf;
+  struct msghdr msg;
+  uv_write_t* req;
+  ssize_t n;
+
+  ext = uv__get_stream_fields(stream)->ext;
+  zc_queue = &ext->zc_queue;
+
+  for (;;) {
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = &cmsgbuf;
+    msg.msg_controllen = sizeof(cmsgbuf);
+
+    do
+      n = recvmsg(uv__stream_fd(stream), &msg, MSG_ERRQUEUE);
+    while (n == -1 && errno == EINTR);
+
+    if (n == -1)
+      break;
+
+    for (cmsg = CMSG_FIRSTHDR(&msg);
+         cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (cmsg->cmsg_level != IPPROTO_IP && cmsg->cmsg_level != IPPROTO_IPV6)
+        continue;
+
+      memcpy(&ee, CMSG_DATA(cmsg), sizeof(ee));
+      if (ee.ee_origin != UV__SO_EE_ORIGIN_ZEROCOPY || ee.ee_errno != 0)
+        continue;
+
+      /* The kernel copied the data after all, like it does on loopback
+       * connections. Copying it up front is cheaper then.
+       */
+      if ((ee.ee_code & UV__SO_EE_CODE_ZEROCOPY_COPIED) && !ext->zc_keep)
+        stream->flags &= ~UV_HANDLE_TCP_ZEROCOPY;
+
+      uv__queue_foreach(q, zc_queue) {
+        req = uv__queue_data(q, uv_write_t, queue);
+        uv__write_req_release(req, ee.ee_info, ee.ee_data);
+      }
+
+      if (!uv__queue_empty(&stream->write_queue)) {
+        q = uv__queue_head(&stream->write_queue);
+        req = uv__queue_data(q, uv_write_t, queue);
+        uv__write_req_release(req, ee.ee_info, ee.ee_data);
+      }
+    }
+  }
+
+  while (!uv__queue_empty(zc_queue)) {
+    q = uv__queue_head(zc_queue);
+    req = uv__queue_data(q, uv_write_t, queue);
+    if (uv__get_write_zc(req)->pending != 0)
+      break;
+
+    uv__queue_remove(q);
+    uv__queue_insert_tail(&stream->write_completed_queue, q);
+  }
+
+  if (!uv__queue_empty(zc_queue))
+    return;
+
+  if (!uv__queue_empty(&stream->write_queue)) {
+    q = uv__queue_head(&stream->write_queue);
+    req = uv__queue_data(q, uv_write_t, queue);
+    if (uv__get_write_zc(req)->pending != 0)
+      return;
+  }
+
+  uv__io_stop(stream->loop, &stream->io_watcher, POLLERR);
+}
+
+
+/* The watcher of a closed stream that waits for its zero-copy writes. The
+ * write callbacks run from uv__stream_destroy() as usual.
+ */
+static void uv__stream_zerocopy_closing(uv_loop_t* loop,
+                                        uv__io_t* w,
+                                        unsigned int events) {
+  uv_stream_t* stream;
+
+  stream = container_of(w, uv_stream_t, io_watcher);
+  uv__stream_zerocopy_done(stream);
+
+  if (uv__stream_zc_queued(stream))
+    return;
+
+  uv__io_close(loop, w);
+  uv__close(w->fd);
+  w->fd = -1;
+  uv__make_close_pending((uv_handle_t*) stream);
+}
+
+
+/* The kernel may still send from the buffers of zero-copy writes when the
+ * stream is closed. Their notifications are read from the socket, so it stays
+ * open until the last one arrived. Returns whether the stream waits, then
+ * uv__stream_zerocopy_closing() finishes the close.
+ */
+static int uv__stream_zerocopy_close(uv_stream_t* stream) {
+  struct uv__queue* q;
+  uv_write_t* req;
+
+  /* A write that was cut short still holds on to its sent data. */
+  if (!uv__queue_empty(&stream->write_queue)) {
+    q = uv__queue_head(&stream->write_queue);
+    req = uv__queue_data(q, uv_write_t, queue);
+    if (uv__get_write_zc(req)->pending != 0) {
+      req->error = UV_ECANCELED;
+      uv__queue_remove(q);
+      uv__queue_insert_tail(&uv__get_stream_fields(stream)->ext->zc_queue, q);
+    }
+  }
+
+  if (!uv__stream_zc_queued(stream))
+    return 0;
+
+  uv__io_init(&stream->io_watcher,
+              uv__stream_zerocopy_closing,
+              stream->io_watcher.fd);
+  uv__io_start(stream->loop, &stream->io_watcher, POLLERR);
+  return 1;
+}
+#else
+#define uv__write_zerocopy(stream, req) 0
+#define uv__try_write_zerocopy(stream, req) 0
+#define uv__stream_zerocopy_done(stream) do {} while (0)
+#define uv__stream_zerocopy_close(stream) 0
+#endif /* defined(__linux__) */
+
+
+/* Requests that can share a writev() with their neighbours. */
+static int uv__write_gatherable(uv_stream_t* stream, uv_write_t* req) {
+  return req->send_handle == NULL && !uv__write_zerocopy(stream, req);
+}
+
+
+/* Copies the buffers of the requests at the head of the write queue that
+ * uv__write() can send with a single writev() to `bufs` and returns how many
+ * requests that are. Small writes that queued up while the stream wasn't
+ * writable, or that were corked, then go out in one system call.
+ */
+static unsigned int uv__write_gather(uv_stream_t* stream,
+                                     uv_buf_t* bufs,
+                                     unsigned int* nbufs) {
+  struct uv__queue* q;
+  uv_write_t* req;
+  unsigned int nreqs;
+  unsigned int n;
+
+  nreqs = 0;
+  *nbufs = 0;
+
+  uv__queue_foreach(q, &stream->write_queue) {
+    req = uv__queue_data(q, uv_write_t, queue);
+    if (!uv__write_gatherable(stream, req))
+      break;
+
+    n = req->nbufs - req->write_index;
+    if (*nbufs + n > UV__WRITE_GATHER_MAX)
+      break;
+
+    memcpy(bufs + *nbufs, req->bufs + req->write_index, n * sizeof(*bufs));
+    *nbufs += n;
+    nreqs++;
+  }
+
+  return nreqs;
+}
+
+
+/* Like uv__write_req_update() but for the first `nreqs` requests of the
+ * write queue, the ones that are written in full are finished. Returns 1 if
+ * all of them have been written.
+ */
+static int uv__write_reqs_update(uv_stream_t* stream,
+                                 size_t n,
+                                 unsigned int nreqs) {
+  uv_write_t* req;
+  size_t size;
+
+  while (nreqs-- > 0) {
+    req = uv__queue_data(uv__queue_head(&stream->write_queue),
+                         uv_write_t,
+                         queue);
+    size = uv__write_req_size(req);
+
+    if (n < size) {
+      if (n > 0)
+        uv__write_req_update(stream, req, n);
+      return 0;
+    }
+
+    /* Zero-length requests have nothing left to update. */
+    if (size > 0)
+      uv__write_req_update(stream, req, size);
+
+    uv__write_req_finish(req);
+    n -= size;
+  }
+
+  return 1;
+}
+
+
+#if defined(__linux__)
+/* Sends the requests at the head of the write queue in the background, all
+ * of them that uv__write_gather() takes with one writev(), like uv__write()
+ * does without the io_uring. The next ones are sent when that completes, see
+ * uv__stream_iou_sent(). Returns 0 if the stream has to be written to
+ * directly instead.
+ */
+static int uv__write_iou(uv_stream_t* stream) {
+  struct uv__stream_ext* ext;
+  struct uv__queue* q;
+  uv_write_t* req;
+  unsigned int nbufs;
+  unsigned int nreqs;
+  uv_buf_t* bufs;
+
+  ext = uv__get_stream_fields(stream)->ext;
+  q = uv__queue_head(&stream->write_queue);
+  req = uv__queue_data(q, uv_write_t, queue);
+
+  nreqs = 0;
+  if (uv__queue_next(q) != &stream->write_queue) {
+    /* The kernel reads the buffer list when it runs the send. */
+    if (ext->iou_bufs == NULL)
+      ext->iou_bufs = uv__malloc(UV__WRITE_GATHER_MAX * sizeof(*ext->iou_bufs));
+    if (ext->iou_bufs != NULL)
+      nreqs = uv__write_gather(stream, ext->iou_bufs, &nbufs);
+  }
+
+  if (nreqs > 1) {
+    bufs = ext->iou_bufs;
+  } else {
+    nreqs = 1;
+    bufs = &req->bufs[req->write_index];
+    nbufs = req->nbufs - req->write_index;
+    if (nbufs > (unsigned int) uv__getiovmax())
+      nbufs = uv__getiovmax();
+  }
+
+  if (!uv__iou_send(stream, bufs, nbufs))
+    return 0;
+
+  ext->iou_nreqs = nreqs;
+  return 1;
+}
+#else
+#define uv__write_iou(stream) 0
+#endif /* defined(__linux__) */
+
+
 static void uv__write(uv_stream_t* stream) {
+  uv_buf_t bufs[UV__WRITE_GATHER_MAX];
   struct uv__queue* q;
   uv_write_t* req;
+  unsigned int nbufs;
+  unsigned int nreqs;
   ssize_t n;
   int count;
+  int done;
 
   assert(uv__stream_fd(stream) >= 0);
 
+  if (uv__iou_stream(stream)) {
+    if (uv__iou_busy(stream, 1u << UV__IOU_SEND))
+      return;
+
+    if (uv__queue_empty(&stream->write_queue))
+      return;
+
+    if (uv__write_iou(stream)) {
+      uv__io_stop(stream->loop, &stream->io_watcher, POLLOUT);
+      return;
+    }
+  }
+
   /* Prevent loop starvation when the consumer of this stream read as fast as
    * (or faster than) we can write it. This `count` mechanism does not need to
    * change even if we switch to edge-triggered I/O.
@@ -859,28 +1403,50 @@ static void uv__write(uv_stream_t* stream) {
     req = uv__queue_data(q, uv_write_t, queue);
     assert(req->handle == stream);
 
-    n = uv__try_write(stream,
-                      &(req->bufs[req->write_index]),
-                      req->nbufs - req->write_index,
-                      req->send_handle);
+    nreqs = 1;
+    if (uv__queue_next(q) != &stream->write_queue)
+      nreqs = uv__write_gather(stream, bufs, &nbufs);
+
+    if (uv__write_zerocopy(stream, req))
+      n = uv__try_write_zerocopy(stream, req);
+    else if (nreqs > 1)
+      n = uv__try_write(stream, bufs, nbufs, NULL);
+    else
+      n = uv__try_write(stream,
+                        &(req->bufs[req->write_index]),
+                        req->nbufs - req->write_index,
+                        req->send_handle);
 
     /* Ensure the handle isn't sent again in case this is a partial write. */
     if (n >= 0) {
       req->send_handle = NULL;
-      if (uv__write_req_update(stream, req, n)) {
+      if (nreqs > 1)
+        done = uv__write_reqs_update(stream, n, nreqs);
+      else if ((done = uv__write_req_update(stream, req, n)))
         uv__write_req_finish(req);
+
+      if (done) {
         if (count-- > 0)
           continue; /* Start trying to write the next request. */
 
+        /* Zero-copy requests don't feed the watcher when they finish. */
+        if (stream->io_watcher.pevents & UV__POLLET)
+          uv__io_feed(stream->loop, &stream->io_watcher);
+
         return;
       }
     } else if (n != UV_EAGAIN)
       goto error;
 
-    /* If this is a blocking stream, try again. */
+    /* If this is a blocking stream, try again. An edge-triggered one is
+     * only reported as writable again after a write has failed with EAGAIN.
+     */
     if (stream->flags & UV_HANDLE_BLOCKING_WRITES)
       continue;
 
+    if (n >= 0 && (stream->io_watcher.pevents & UV__POLLET))
+      continue;
+
     /* We're not done. */
     uv__io_start(stream->loop, &stream->io_watcher, POLLOUT);
 
@@ -939,6 +1505,75 @@ static void uv__stream_eof(uv_stream_t* stream, const uv_buf_t* buf) {
 }
 
 
+/* The alloc_cb of uv_read_start_pooled(). uv__read() is done with the buffer
+ * when read_cb returns, so all streams of the loop can share it.
+ */
+static void uv__read_pool_alloc(uv_handle_t* handle,
+                                size_t suggested_size,
+                                uv_buf_t* buf) {
+  uv__loop_internal_fields_t* lfields;
+
+  lfields = uv__get_internal_fields(handle->loop);
+  if (lfields->read_buf == NULL)
+    lfields->read_buf = uv__malloc(64 * 1024);
+
+  if (lfields->read_buf != NULL)
+    *buf = uv_buf_init(lfields->read_buf, 64 * 1024);
+}
+
+
+/* The alloc_cb of uv_read_start_v(). It marks the stream, uv__read() calls
+ * alloc_v_cb itself to get all the buffers at once.
+ */
+static void uv__read_v_alloc(uv_handle_t* handle,
+                             size_t suggested_size,
+                             uv_buf_t* buf) {
+  uv_stream_t* stream;
+  unsigned int nbufs;
+
+  stream = (uv_stream_t*) handle;
+  nbufs = 1;
+  uv__get_stream_fields(stream)->alloc_v_cb(handle,
+                                            suggested_size,
+                                            buf,
+                                            &nbufs);
+  if (nbufs == 0)
+    *buf = uv_buf_init(NULL, 0);
+}
+
+
+/* Waits for data to read. With the io_uring the kernel reports when the
+ * stream is readable, or receives into a provided buffer for
+ * uv_read_start_pooled(). Either way alloc_cb and read_cb only run once there
+ * is data.
+ */
+static void uv__stream_read_arm(uv_stream_t* stream) {
+  int armed;
+
+  if (uv__iou_stream(stream)) {
+    if (uv__iou_busy(stream, 1u << UV__IOU_RECV))
+      return;
+
+    /* Without provided buffers the pooled stream waits for readiness and
+     * reads into the shared buffer.
+     */
+    armed = 0;
+    if (stream->alloc_cb == uv__read_pool_alloc)
+      armed = uv__iou_recv(stream);
+    if (!armed)
+      armed = uv__iou_poll(stream);
+
+    if (armed) {
+      uv__io_stop(stream->loop, &stream->io_watcher, POLLIN);
+      return;
+    }
+  }
+
+  uv__io_start(stream->loop, &stream->io_watcher, POLLIN);
+  uv__stream_osx_interrupt_select(stream);
+}
+
+
 static int uv__stream_queue_fd(uv_stream_t* stream, int fd) {
   uv__stream_queued_fds_t* queued_fds;
   unsigned int queue_size;
@@ -1022,21 +1657,100 @@ static int uv__stream_recv_cmsg(uv_stream_t* stream, struct msghdr* msg) {
 }
 
 
-static void uv__read(uv_stream_t* stream) {
-  uv_buf_t buf;
+/* Called when the read budget of the loop iteration has run out, or when an
+ * edge-triggered stream may have data left that the kernel won't report
+ * again. The stream is read from before the loop polls again. Streams that
+ * didn't get to read at all go before the ones that were cut short, so a busy
+ * stream can't keep the others from reading by coming first in every
+ * iteration.
+ */
+static void uv__stream_read_defer(uv_stream_t* stream, int skipped) {
+  uv__loop_internal_fields_t* lfields;
+  struct uv__queue* q;
+
+  if (stream->flags & UV_HANDLE_READ_DEFERRED)
+    return;
+
+  /* The short read, if any, was followed by more data. Don't let it stand for
+   * "nothing left before the EOF" while the stream is set aside.
+   */
+  lfields = uv__get_internal_fields(stream->loop);
+  stream->flags &= ~UV_HANDLE_READ_PARTIAL;
+  stream->flags |= UV_HANDLE_READ_DEFERRED;
+  q = &uv__get_stream_fields(stream)->read_queue;
+  if (skipped)
+    uv__queue_insert_tail(&lfields->read_skipped, q);
+  else
+    uv__queue_insert_tail(&lfields->read_cut, q);
+}
+
+
+void uv__stream_read_deferred(uv_loop_t* loop) {
+  uv__loop_internal_fields_t* lfields;
+  struct uv__queue queue;
+  struct uv__queue* q;
+  uv_stream_t* stream;
+
+  lfields = uv__get_internal_fields(loop);
+  lfields->read_left = lfields->read_budget;
+
+  uv__queue_move(&lfields->read_skipped, &queue);
+  if (!uv__queue_empty(&lfields->read_cut)) {
+    uv__queue_add(&queue, &lfields->read_cut);
+    uv__queue_init(&lfields->read_cut);
+  }
+
+  /* A read_cb that stops reading or closes a stream takes it off the queue. */
+  while (!uv__queue_empty(&queue)) {
+    q = uv__queue_head(&queue);
+    uv__queue_remove(q);
+    uv__queue_init(q);
+
+    stream = uv__queue_data(q, uv_stream_t, u);  /* read_queue comes first */
+    stream->flags &= ~UV_HANDLE_READ_DEFERRED;
+    uv__read(stream, stream->io_watcher.pevents & UV__POLLET);
+  }
+}
+
+
+/* With `drain` set, reads until EAGAIN instead of stopping at the first short
+ * read. Edge-triggered streams that have been set aside may have missed an
+ * EOF behind the data.
+ */
+static void uv__read(uv_stream_t* stream, int drain) {
+  uv__loop_internal_fields_t* lfields;
+  uv_buf_t bufs[UV__READ_V_MAX];
+  unsigned int nbufs;
   ssize_t nread;
   struct msghdr msg;
   union uv__cmsg cmsg;
+  size_t buflen;
+  size_t total;
   int count;
   int err;
   int is_ipc;
 
+  /* Read from before the next poll, see uv__stream_read_deferred(). */
+  if (stream->flags & UV_HANDLE_READ_DEFERRED)
+    return;
+
+#if defined(__linux__)
+  /* What the io_uring received after uv_read_stop() comes first. */
+  if (uv__iou_held(stream)) {
+    uv__stream_iou_read_held(stream);
+    return;
+  }
+#endif
+
   stream->flags &= ~UV_HANDLE_READ_PARTIAL;
 
   /* Prevent loop starvation when the data comes in as fast as (or faster than)
-   * we can read it. XXX Need to rearm fd if we switch to edge-triggered I/O.
+   * we can read it. Edge-triggered streams are read from again before the
+   * next poll when they stop here, see the end of this function.
    */
   count = 32;
+  total = 0;
+  lfields = uv__get_internal_fields(stream->loop);
 
   is_ipc = stream->type == UV_NAMED_PIPE && ((uv_pipe_t*) stream)->ipc;
 
@@ -1048,27 +1762,47 @@ static void uv__read(uv_stream_t* stream) {
       && (count-- > 0)) {
     assert(stream->alloc_cb != NULL);
 
-    buf = uv_buf_init(NULL, 0);
-    stream->alloc_cb((uv_handle_t*)stream, 64 * 1024, &buf);
-    if (buf.base == NULL || buf.len == 0) {
-      /* User indicates it can't or won't handle the read. */
-      stream->read_cb(stream, UV_ENOBUFS, &buf);
+    if (lfields->read_budget != 0 && lfields->read_left == 0) {
+      uv__stream_read_defer(stream, total == 0);
       return;
     }
 
-    assert(buf.base != NULL);
+    nbufs = 1;
+    bufs[0] = uv_buf_init(NULL, 0);
+    if (stream->alloc_cb == uv__read_v_alloc) {
+      /* uv_read_start_v(), fill all the buffers with one system call. */
+      nbufs = ARRAY_SIZE(bufs);
+      uv__get_stream_fields(stream)->alloc_v_cb((uv_handle_t*)stream,
+                                                64 * 1024,
+                                                bufs,
+                                                &nbufs);
+      assert(nbufs <= ARRAY_SIZE(bufs));
+    } else {
+      stream->alloc_cb((uv_handle_t*)stream, 64 * 1024, &bufs[0]);
+    }
+
+    buflen = uv__count_bufs(bufs, nbufs);
+    if (bufs[0].base == NULL || buflen == 0) {
+      /* User indicates it can't or won't handle the read. */
+      stream->read_cb(stream, UV_ENOBUFS, bufs);
+      goto again;
+    }
+
     assert(uv__stream_fd(stream) >= 0);
 
     if (!is_ipc) {
       do {
-        nread = read(uv__stream_fd(stream), buf.base, buf.len);
+        if (nbufs == 1)
+          nread = read(uv__stream_fd(stream), bufs[0].base, bufs[0].len);
+        else
+          nread = readv(uv__stream_fd(stream), (struct iovec*) bufs, nbufs);
       }
       while (nread < 0 && errno == EINTR);
     } else {
       /* ipc uses recvmsg */
       msg.msg_flags = 0;
-      msg.msg_iov = (struct iovec*) &buf;
-      msg.msg_iovlen = 1;
+      msg.msg_iov = (struct iovec*) bufs;
+      msg.msg_iovlen = nbufs;
       msg.msg_name = NULL;
       msg.msg_namelen = 0;
       /* Set up to receive a descriptor even if one isn't in the message */
@@ -1085,20 +1819,19 @@ static void uv__read(uv_stream_t* stream) {
       /* Error */
       if (errno == EAGAIN || errno == EWOULDBLOCK) {
         /* Wait for the next one. */
-        if (stream->flags & UV_HANDLE_READING) {
-          uv__io_start(stream->loop, &stream->io_watcher, POLLIN);
-          uv__stream_osx_interrupt_select(stream);
-        }
-        stream->read_cb(stream, 0, &buf);
+        stream->flags &= ~UV_HANDLE_READ_READY;
+        if (stream->flags & UV_HANDLE_READING)
+          uv__stream_read_arm(stream);
+        stream->read_cb(stream, 0, bufs);
 #if defined(__CYGWIN__) || defined(__MSYS__)
       } else if (errno == ECONNRESET && stream->type == UV_NAMED_PIPE) {
-        uv__stream_eof(stream, &buf);
+        uv__stream_eof(stream, bufs);
         return;
 #endif
       } else {
         /* Error. User should call uv_close(). */
         stream->flags &= ~(UV_HANDLE_READABLE | UV_HANDLE_WRITABLE);
-        stream->read_cb(stream, UV__ERR(errno), &buf);
+        stream->read_cb(stream, UV__ERR(errno), bufs);
         if (stream->flags & UV_HANDLE_READING) {
           stream->flags &= ~UV_HANDLE_READING;
           uv__io_stop(stream->loop, &stream->io_watcher, POLLIN);
@@ -1108,16 +1841,21 @@ static void uv__read(uv_stream_t* stream) {
       }
       return;
     } else if (nread == 0) {
-      uv__stream_eof(stream, &buf);
+      uv__stream_eof(stream, bufs);
       return;
     } else {
       /* Successful read */
-      ssize_t buflen = buf.len;
+      /* The last read of the budget may go over it by less than a buffer. */
+      total += nread;
+      if (lfields->read_left > (size_t) nread)
+        lfields->read_left -= nread;
+      else
+        lfields->read_left = 0;
 
       if (is_ipc) {
         err = uv__stream_recv_cmsg(stream, &msg);
         if (err != 0) {
-          stream->read_cb(stream, err, &buf);
+          stream->read_cb(stream, err, bufs);
           return;
         }
       }
@@ -1137,7 +1875,7 @@ static void uv__read(uv_stream_t* stream) {
           nread = uv__recvmsg(uv__stream_fd(stream), &msg, 0);
           err = uv__stream_recv_cmsg(stream, &msg);
           if (err != 0) {
-            stream->read_cb(stream, err, &buf);
+            stream->read_cb(stream, err, bufs);
             msg.msg_iov = old;
             return;
           }
@@ -1145,18 +1883,289 @@ static void uv__read(uv_stream_t* stream) {
         msg.msg_iov = old;
       }
 #endif
-      stream->read_cb(stream, nread, &buf);
+      stream->read_cb(stream, nread, bufs);
 
       /* Return if we didn't fill the buffer, there is no more data to read. */
-      if (nread < buflen) {
+      if ((size_t) nread < buflen) {
         stream->flags |= UV_HANDLE_READ_PARTIAL;
+        if (!drain) {
+          /* The io_uring reports readiness once per wait. */
+          if (uv__iou_stream(stream) && (stream->flags & UV_HANDLE_READING))
+            uv__stream_read_arm(stream);
+          return;
+        }
+      } else {
+        stream->flags &= ~UV_HANDLE_READ_PARTIAL;
+      }
+    }
+  }
+
+again:
+  if (!(stream->flags & UV_HANDLE_READING) || stream->read_cb == NULL)
+    return;
+
+  /* Stopped with data left, the kernel won't report it again. A wait in the
+   * io_uring completes right away when there is data.
+   */
+  if (stream->io_watcher.pevents & UV__POLLET)
+    uv__stream_read_defer(stream, 0);
+  else if (uv__iou_stream(stream))
+    uv__stream_read_arm(stream);
+}
+
+
+#if defined(__linux__)
+/* Hands out the data that the io_uring received while the stream wasn't
+ * reading, in the order it arrived. Pooled streams read it from the provided
+ * buffers, the others get a copy in a buffer from alloc_cb.
+ */
+static void uv__stream_iou_read_held(uv_stream_t* stream) {
+  const uv_buf_t* held;
+  uv_buf_t buf;
+  size_t n;
+
+  while (uv__iou_held(stream) &&
+         (stream->flags & UV_HANDLE_READING) &&
+         stream->read_cb != NULL) {
+    held = uv__iou_held_buf(stream);
+    if (stream->alloc_cb == uv__read_pool_alloc) {
+      buf = *held;
+      n = buf.len;
+    } else {
+      buf = uv_buf_init(NULL, 0);
+      stream->alloc_cb((uv_handle_t*) stream, held->len, &buf);
+      if (buf.base == NULL || buf.len == 0) {
+        /* User indicates it can't or won't handle the read. */
+        stream->read_cb(stream, UV_ENOBUFS, &buf);
+        uv__stream_read_defer(stream, 0);
         return;
       }
+
+      n = buf.len < held->len ? buf.len : held->len;
+      memcpy(buf.base, held->base, n);
     }
+
+    stream->read_cb(stream, n, &buf);
+    uv__iou_held_consume(stream, n);
+  }
+
+  if (!uv__is_closing(stream) &&
+      !uv__iou_held(stream) &&
+      (stream->flags & UV_HANDLE_READING)) {
+    uv__stream_read_arm(stream);
   }
 }
 
 
+/* Returns 1 when the stream holds on to the provided buffer. */
+static int uv__stream_iou_received(uv_stream_t* stream,
+                                   int res,
+                                   const uv_buf_t* rbuf) {
+  uv_buf_t buf;
+
+  /* The stream is readable, or the wait was cancelled by uv_read_stop(). */
+  if (uv__iou_flags(stream) & UV__IOU_POLL) {
+    uv__get_stream_fields(stream)->ext->iou_flags &= ~UV__IOU_POLL;
+
+    if (!(stream->flags & UV_HANDLE_READING)) {
+      if (!uv__iou_busy(stream, 1u << UV__IOU_RECV)) {
+        stream->read_cb = NULL;
+        stream->alloc_cb = NULL;
+      }
+    } else if (res == UV_ECANCELED) {
+      /* uv_read_start() was called again before the cancellation landed. */
+      uv__stream_read_arm(stream);
+    } else {
+      uv__read(stream, 0);
+    }
+
+    return 0;
+  }
+
+  /* Data that arrives after uv_read_stop(), or behind data that did, waits
+   * for the next uv_read_start(). The kernel reports an EOF or error again
+   * then.
+   */
+  if (!(stream->flags & UV_HANDLE_READING) || uv__iou_held(stream)) {
+    if (stream->flags & UV_HANDLE_READING) {
+      uv__stream_read_defer(stream, 1);
+    } else if (!uv__iou_busy(stream, 1u << UV__IOU_RECV)) {
+      stream->read_cb = NULL;
+      stream->alloc_cb = NULL;
+    }
+
+    return res > 0 && rbuf->base != NULL;
+  }
+
+  buf = *rbuf;
+  if (res > 0) {
+    stream->read_cb(stream, res, &buf);
+  } else if (res == 0) {
+    uv__stream_eof(stream, &buf);
+  } else if (res != UV_ECANCELED &&
+             res != UV_EAGAIN &&
+             res != UV_EINTR &&
+             res != UV_ENOBUFS) {
+    /* Error. User should call uv_close(). Otherwise nothing was read, and
+     * there is no buffer to hand back. UV_ENOBUFS means that the provided
+     * buffers ran out.
+     */
+    stream->flags &= ~(UV_HANDLE_READABLE | UV_HANDLE_WRITABLE);
+    stream->read_cb(stream, res, &buf);
+    if (stream->flags & UV_HANDLE_READING) {
+      stream->flags &= ~UV_HANDLE_READING;
+      uv__handle_stop(stream);
+    }
+  }
+
+  if (uv__is_closing(stream))
+    return 0;
+
+  if (stream->flags & UV_HANDLE_READING) {
+    /* Read into the shared buffer until the socket is drained, uv__read()
+     * tries the io_uring again after that.
+     */
+    if (res == UV_ENOBUFS)
+      uv__io_start(stream->loop, &stream->io_watcher, POLLIN);
+    else
+      uv__stream_read_arm(stream);
+  } else if (!uv__iou_busy(stream, 1u << UV__IOU_RECV)) {
+    /* Left for this completion by uv_read_stop(). */
+    stream->read_cb = NULL;
+    stream->alloc_cb = NULL;
+  }
+
+  return 0;
+}
+
+
+static void uv__stream_iou_sent(uv_stream_t* stream, int res) {
+  unsigned int nreqs;
+  uv_write_t* req;
+
+  req = uv__queue_data(uv__queue_head(&stream->write_queue),
+                       uv_write_t,
+                       queue);
+  nreqs = uv__get_stream_fields(stream)->ext->iou_nreqs;
+
+  if (res >= 0) {
+    if (nreqs > 1)
+      uv__write_reqs_update(stream, res, nreqs);
+    else if (uv__write_req_update(stream, req, res))
+      uv__write_req_finish(req);
+  } else if (res != UV_EAGAIN && res != UV_EINTR) {
+    req->error = res;
+    uv__write_req_finish(req);
+  }
+
+  /* Same as uv__stream_io(), the kernel can send the next request while the
+   * callbacks run.
+   */
+  uv__write(stream);
+  uv__write_callbacks(stream);
+
+  if (uv__queue_empty(&stream->write_queue))
+    uv__drain(stream);
+}
+
+
+static void uv__stream_iou_connected(uv_stream_t* stream, int res) {
+  uv_connect_t* req;
+
+  req = stream->connect_req;
+  stream->connect_req = NULL;
+  uv__req_unregister(stream->loop);
+
+  if (req->cb)
+    req->cb(req, res);
+
+  if (uv__stream_fd(stream) == -1)
+    return;
+
+  if (res < 0) {
+    uv__stream_flush_write_queue(stream, UV_ECANCELED);
+    uv__write_callbacks(stream);
+  } else {
+    uv__write(stream);
+  }
+}
+
+
+/* Called by uv__io_poll() when an operation in the io_uring completed. */
+static void uv__stream_iou_accepted(uv_stream_t* stream, int res) {
+  if (res >= 0) {
+    /* More connections arrive until the cancellation from
+     * uv__server_iou_deliver() takes effect, keep them in order.
+     */
+    if (stream->accepted_fd == -1 && stream->queued_fds == NULL) {
+      stream->accepted_fd = res;
+      stream->connection_cb(stream, 0);
+      if (uv__is_closing(stream))
+        return;
+    } else if (uv__stream_queue_fd(stream, res)) {
+      uv__close(res);
+    }
+  } else if (res == UV_EMFILE || res == UV_ENFILE) {
+    uv__emfile_trick(stream->loop, uv__stream_fd(stream));  /* Shed load. */
+  } else if (res != UV_ECANCELED) {
+    /* Accept with epoll until uv_accept() tries the io_uring again. */
+    uv__io_start(stream->loop, &stream->io_watcher, POLLIN);
+    return;
+  }
+
+  uv__server_iou_deliver(stream);
+}
+
+
+int uv__stream_iou_done(uv_stream_t* stream,
+                        int op,
+                        int res,
+                        const uv_buf_t* buf) {
+  uv_write_t* req;
+
+  if (uv__is_closing(stream)) {
+    /* A request that went out in full still succeeded, uv__stream_destroy()
+     * cancels the others. Like on Windows, there is no read_cb for the
+     * buffer of a closed stream.
+     */
+    if (op == UV__IOU_SEND && res >= 0) {
+      req = uv__queue_data(uv__queue_head(&stream->write_queue),
+                           uv_write_t,
+                           queue);
+      if (uv__write_req_update(stream, req, res)) {
+        uv__queue_remove(&req->queue);
+        uv__queue_insert_tail(&stream->write_completed_queue, &req->queue);
+      }
+    }
+
+    if (op == UV__IOU_ACCEPT && res >= 0)
+      uv__close(res);
+
+    if (!uv__iou_busy(stream, UV__IOU_BUSY))
+      uv__make_close_pending((uv_handle_t*) stream);
+
+    return 0;
+  }
+
+  switch (op) {
+    case UV__IOU_RECV:
+      return uv__stream_iou_received(stream, res, buf);
+    case UV__IOU_SEND:
+      uv__stream_iou_sent(stream, res);
+      break;
+    case UV__IOU_CONNECT:
+      uv__stream_iou_connected(stream, res);
+      break;
+    case UV__IOU_ACCEPT:
+      uv__stream_iou_accepted(stream, res);
+      break;
+  }
+
+  return 0;
+}
+#endif /* defined(__linux__) */
+
+
 int uv_shutdown(uv_shutdown_t* req, uv_stream_t* stream, uv_shutdown_cb cb) {
   assert(stream->type == UV_TCP ||
          stream->type == UV_TTY ||
@@ -1196,8 +2205,16 @@ static void uv__stream_io(uv_loop_t* loop, uv__io_t* w, unsigned int events) {
          stream->type == UV_TTY);
   assert(!(stream->flags & UV_HANDLE_CLOSING));
 
+  /* Edge-triggered streams are told about data once, uv_read_start() reads
+   * it when it arrived while the stream wasn't reading.
+   */
+  if (events & (POLLIN | POLLERR | POLLHUP | UV__POLLRDHUP))
+    stream->flags |= UV_HANDLE_READ_READY;
+
   if (stream->connect_req) {
-    uv__stream_connect(stream);
+    /* The io_uring reports the outcome, see uv__stream_iou_connected(). */
+    if (!uv__iou_busy(stream, 1u << UV__IOU_CONNECT))
+      uv__stream_connect(stream);
     return;
   }
 
@@ -1205,7 +2222,7 @@ static void uv__stream_io(uv_loop_t* loop, uv__io_t* w, unsigned int events) {
 
   /* Ignore POLLHUP here. Even if it's set, there may still be data to read. */
   if (events & (POLLIN | POLLERR | POLLHUP))
-    uv__read(stream);
+    uv__read(stream, 0);
 
   if (uv__stream_fd(stream) == -1)
     return;  /* read_cb closed stream. */
@@ -1214,11 +2231,14 @@ static void uv__stream_io(uv_loop_t* loop, uv__io_t* w, unsigned int events) {
    * events and uv__read() reported a partial read but not EOF. If the EOF
    * flag is set, uv__read() called read_cb with err=UV_EOF and we don't
    * have to do anything. If the partial read flag is not set, we can't
-   * report the EOF yet because there is still data to read.
+   * report the EOF yet because there is still data to read. Edge-triggered
+   * streams get POLLRDHUP, and aren't told about the EOF again otherwise.
+   * A deferred stream hasn't been read from yet; it finds the EOF itself.
    */
-  if ((events & POLLHUP) &&
+  if ((events & (POLLHUP | UV__POLLRDHUP)) &&
       (stream->flags & UV_HANDLE_READING) &&
       (stream->flags & UV_HANDLE_READ_PARTIAL) &&
+      !(stream->flags & UV_HANDLE_READ_DEFERRED) &&
       !(stream->flags & UV_HANDLE_READ_EOF)) {
     uv_buf_t buf = { NULL, 0 };
     uv__stream_eof(stream, &buf);
@@ -1227,6 +2247,9 @@ static void uv__stream_io(uv_loop_t* loop, uv__io_t* w, unsigned int events) {
   if (uv__stream_fd(stream) == -1)
     return;  /* read_cb closed stream. */
 
+  if ((events & POLLERR) && uv__io_active(&stream->io_watcher, POLLERR))
+    uv__stream_zerocopy_done(stream);
+
   if (events & (POLLOUT | POLLERR | POLLHUP)) {
     uv__write(stream);
     uv__write_callbacks(stream);
@@ -1279,6 +2302,18 @@ static void uv__stream_connect(uv_stream_t* stream) {
     uv__io_stop(stream->loop, &stream->io_watcher, POLLOUT);
   }
 
+  /* The event that completed the connect isn't reported again, even when it
+   * also said that there is data to read.
+   */
+  if (error == 0 && (stream->io_watcher.events & UV__POLLET)) {
+    if (!uv__queue_empty(&stream->write_queue))
+      uv__io_feed(stream->loop, &stream->io_watcher);
+    if ((stream->flags & UV_HANDLE_READING) &&
+        (stream->flags & UV_HANDLE_READ_READY)) {
+      uv__stream_read_defer(stream, 1);
+    }
+  }
+
   if (req->cb)
     req->cb(req, error);
 
@@ -1330,6 +2365,27 @@ static int uv__check_before_write(uv_stream_t* stream,
   return 0;
 }
 
+/* With UV_LOOP_CORK_WRITES a write to an idle stream is held back until the
+ * pending watchers run, the writes that are queued until then are corked as
+ * well. Handles are sent right away, they are often closed after uv_write2().
+ */
+static int uv__write_corked(uv_write_t* req, int empty_queue) {
+  uv_stream_t* stream;
+
+  stream = req->handle;
+  if (!(stream->loop->flags & UV_LOOP_ENABLE_WRITE_CORK))
+    return 0;
+
+  if (stream->flags & UV_HANDLE_BLOCKING_WRITES)
+    return 0;
+
+  if (req->send_handle != NULL)
+    return 0;
+
+  return empty_queue || !uv__queue_empty(&stream->io_watcher.pending_queue);
+}
+
+
 int uv_write2(uv_write_t* req,
               uv_stream_t* stream,
               const uv_buf_t bufs[],
@@ -1370,6 +2426,9 @@ int uv_write2(uv_write_t* req,
   req->nbufs = nbufs;
   req->write_index = 0;
   stream->write_queue_size += uv__count_bufs(bufs, nbufs);
+#if defined(__linux__)
+  memset(uv__get_write_zc(req), 0, sizeof(struct uv__write_zc));
+#endif
 
   /* Append the request to write_queue. */
   uv__queue_insert_tail(&stream->write_queue, &req->queue);
@@ -1381,6 +2440,15 @@ int uv_write2(uv_write_t* req,
   if (stream->connect_req) {
     /* Still connecting, do nothing. */
   }
+  else if (uv__iou_stream(stream)) {
+    uv__write(stream);
+  }
+  else if (uv__write_corked(req, empty_queue)) {
+    /* Written after the current loop phase, together with the writes that
+     * follow, see uv__run_pending().
+     */
+    uv__io_feed(stream->loop, &stream->io_watcher);
+  }
   else if (empty_queue) {
     uv__write(stream);
   }
@@ -1454,14 +2522,50 @@ int uv__read_start(uv_stream_t* stream,
   stream->read_cb = read_cb;
   stream->alloc_cb = alloc_cb;
 
-  uv__io_start(stream->loop, &stream->io_watcher, POLLIN);
   uv__handle_start(stream);
-  uv__stream_osx_interrupt_select(stream);
+
+  /* The io_uring received data after uv_read_stop(), hand it out before the
+   * next poll.
+   */
+  if (uv__iou_held(stream)) {
+    uv__stream_read_defer(stream, 1);
+    return 0;
+  }
+
+  uv__stream_read_arm(stream);
+
+  /* The kernel doesn't report data that arrived while the edge-triggered
+   * stream wasn't reading again, read it before the next poll.
+   */
+  if ((stream->io_watcher.events & UV__POLLET) &&
+      (stream->flags & UV_HANDLE_READ_READY)) {
+    uv__stream_read_defer(stream, 1);
+  }
 
   return 0;
 }
 
 
+int uv_read_start_pooled(uv_stream_t* stream, uv_read_cb read_cb) {
+  return uv_read_start(stream, uv__read_pool_alloc, read_cb);
+}
+
+
+int uv_read_start_v(uv_stream_t* stream,
+                    uv_alloc_v_cb alloc_cb,
+                    uv_read_cb read_cb) {
+  if (stream == NULL || alloc_cb == NULL)
+    return UV_EINVAL;
+
+  /* Don't replace the callback of a stream that is reading already. */
+  if (stream->flags & UV_HANDLE_READING)
+    return UV_EALREADY;
+
+  uv__get_stream_fields(stream)->alloc_v_cb = alloc_cb;
+  return uv_read_start(stream, uv__read_v_alloc, read_cb);
+}
+
+
 int uv_read_stop(uv_stream_t* stream) {
   if (!(stream->flags & UV_HANDLE_READING))
     return 0;
@@ -1471,6 +2575,18 @@ int uv_read_stop(uv_stream_t* stream) {
   uv__handle_stop(stream);
   uv__stream_osx_interrupt_select(stream);
 
+  if (stream->flags & UV_HANDLE_READ_DEFERRED) {
+    stream->flags &= ~UV_HANDLE_READ_DEFERRED;
+    uv__queue_remove(&uv__get_stream_fields(stream)->read_queue);
+    uv__queue_init(&uv__get_stream_fields(stream)->read_queue);
+  }
+
+  /* The completion of a receive in the io_uring clears the callbacks, data
+   * that it brings in waits for the next uv_read_start().
+   */
+  if (uv__iou_cancel(stream, 1u << UV__IOU_RECV))
+    return 0;
+
   stream->read_cb = NULL;
   stream->alloc_cb = NULL;
   return 0;
@@ -1529,12 +2645,29 @@ void uv__stream_close(uv_stream_t* handle) {
   }
 #endif /* defined(__APPLE__) */
 
+  /* Corked writes were accepted while the stream was open. */
+  if ((handle->loop->flags & UV_LOOP_ENABLE_WRITE_CORK) &&
+      handle->connect_req == NULL &&
+      handle->io_watcher.fd != -1 &&
+      !uv__iou_stream(handle) &&
+      !uv__queue_empty(&handle->write_queue) &&
+      !uv__queue_empty(&handle->io_watcher.pending_queue)) {
+    uv__write(handle);
+  }
+
   uv__io_close(handle->loop, &handle->io_watcher);
   uv_read_stop(handle);
   uv__handle_stop(handle);
   handle->flags &= ~(UV_HANDLE_READABLE | UV_HANDLE_WRITABLE);
 
-  if (handle->io_watcher.fd != -1) {
+  /* The kernel must see the operations on the file descriptor, and their
+   * cancellation, before it is closed and can be reused.
+   */
+  if (uv__iou_cancel(handle, UV__IOU_BUSY))
+    uv__iou_flush(handle->loop);
+  uv__iou_held_drop(handle);
+
+  if (handle->io_watcher.fd != -1 && !uv__stream_zerocopy_close(handle)) {
     /* Don't close stdio file descriptors.  Nothing good comes from it. */
     if (handle->io_watcher.fd > STDERR_FILENO)
       uv__close(handle->io_watcher.fd);
@@ -1560,6 +2693,10 @@ void uv__stream_close(uv_stream_t* handle) {
 
 
 int uv_stream_set_blocking(uv_stream_t* handle, int blocking) {
+  /* Reading and writing until EAGAIN would block. */
+  if (blocking)
+    uv__io_set_edge(handle->loop, &handle->io_watcher, 0);
+
   /* Don't need to check the file descriptor, uv__nonblock()
    * will fail with EBADF if it's not valid.
    */
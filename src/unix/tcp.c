@@ -305,6 +305,13 @@ int uv__tcp_connect(uv_connect_t* req,
     }
   }
 
+  /* The io_uring reports the outcome to uv__stream_iou_connected(), errors
+   * included.
+   */
+  if (uv__iou_stream((uv_stream_t*) handle))
+    if (uv__iou_connect((uv_stream_t*) handle, addr, addrlen))
+      goto out;
+
   do {
     errno = 0;
     r = connect(uv__stream_fd(handle), addr, addrlen);
@@ -340,7 +347,8 @@ out:
   uv__queue_init(&req->queue);
   handle->connect_req = req;
 
-  uv__io_start(handle->loop, &handle->io_watcher, POLLOUT);
+  if (!uv__iou_busy((uv_stream_t*) handle, 1u << UV__IOU_CONNECT))
+    uv__io_start(handle->loop, &handle->io_watcher, POLLOUT);
 
   if (handle->delayed_error)
     uv__io_feed(handle->loop, &handle->io_watcher);
@@ -445,7 +453,7 @@ int uv__tcp_listen(uv_tcp_t* tcp, int backlog, uv_connection_cb cb) {
 
   /* Start listening for connections. */
   tcp->io_watcher.cb = uv__server_io;
-  uv__io_start(tcp->loop, &tcp->io_watcher, POLLIN);
+  uv__server_start((uv_stream_t*) tcp);
 
   return 0;
 }
@@ -622,6 +630,49 @@ int uv_tcp_simultaneous_accepts(uv_tcp_t* handle, int enable) {
 }
 
 
+#if defined(__linux__)
+int uv__tcp_zerocopy(int fd, int on) {
+  if (setsockopt(fd, SOL_SOCKET, UV__SO_ZEROCOPY, &on, sizeof(on)))
+    return UV__ERR(errno);
+  return 0;
+}
+#endif /* defined(__linux__) */
+
+
+int uv_tcp_zerocopy(uv_tcp_t* handle, int on) {
+#if defined(__linux__)
+  struct uv__stream_ext* ext;
+  char* val;
+  int err;
+
+  if (on) {
+    ext = uv__stream_ext((uv_stream_t*) handle);
+    if (ext == NULL)
+      return UV_ENOMEM;
+
+    /* Keeps loopback connections on zero-copy sends, for testing. */
+    val = getenv("UV_TCP_ZEROCOPY_KEEP");
+    ext->zc_keep = val != NULL && atoi(val) > 0;
+  }
+
+  if (uv__stream_fd(handle) != -1) {
+    err = uv__tcp_zerocopy(uv__stream_fd(handle), on);
+    if (err)
+      return err;
+  }
+
+  if (on)
+    handle->flags |= UV_HANDLE_TCP_ZEROCOPY;
+  else
+    handle->flags &= ~UV_HANDLE_TCP_ZEROCOPY;
+
+  return 0;
+#else
+  return UV_ENOTSUP;
+#endif
+}
+
+
 void uv__tcp_close(uv_tcp_t* handle) {
   uv__stream_close((uv_stream_t*)handle);
 }
@@ -886,6 +886,7 @@ int uv_loop_close(uv_loop_t* loop) {
       return UV_EBUSY;
   }
 
+  uv__work_cleanup(loop);
   uv__loop_close(loop);
 
 #ifndef NDEBUG
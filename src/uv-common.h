@@ -73,6 +73,18 @@ extern int snprintf(char*, size_t, const char*, ...);
   atomic_exchange_explicit((_Atomic int*)(p), v, memory_order_relaxed)
 #endif
 
+#ifdef _MSC_VER
+#define uv__fetch_add_int(p, v)                                               \
+  InterlockedExchangeAdd((LONG volatile*)(p), v)
+#define uv__load_int(p)                                                       \
+  InterlockedOr((LONG volatile*)(p), 0)
+#else
+#define uv__fetch_add_int(p, v)                                               \
+  atomic_fetch_add((_Atomic int*)(p), v)
+#define uv__load_int(p)                                                       \
+  atomic_load((_Atomic int*)(p))
+#endif
+
 #define UV__UDP_DGRAM_MAXSIZE (64 * 1024)
 
 /* Handle flags. Some flags are specific to Windows or UNIX. */
@@ -88,6 +100,7 @@ enum {
   /* Used by streams. */
   UV_HANDLE_LISTENING                   = 0x00000040,
   UV_HANDLE_CONNECTION                  = 0x00000080,
+  UV_HANDLE_READ_DEFERRED               = 0x00000100,
   UV_HANDLE_SHUT                        = 0x00000200,
   UV_HANDLE_READ_PARTIAL                = 0x00000400,
   UV_HANDLE_READ_EOF                    = 0x00000800,
@@ -107,12 +120,16 @@ enum {
   /* Used by uv_tcp_t and uv_udp_t handles */
   UV_HANDLE_IPV6                        = 0x00400000,
 
+  /* Only used by edge-triggered streams. */
+  UV_HANDLE_READ_READY                  = 0x00800000,
+
   /* Only used by uv_tcp_t handles. */
   UV_HANDLE_TCP_NODELAY                 = 0x01000000,
   UV_HANDLE_TCP_KEEPALIVE               = 0x02000000,
   UV_HANDLE_TCP_SINGLE_ACCEPT           = 0x04000000,
   UV_HANDLE_TCP_ACCEPT_STATE_CHANGING   = 0x08000000,
   UV_HANDLE_SHARED_TCP_SOCKET           = 0x10000000,
+  UV_HANDLE_TCP_ZEROCOPY                = 0x20000000,
 
   /* Only used by uv_udp_t handles. */
   UV_HANDLE_UDP_PROCESSING              = 0x01000000,
@@ -212,6 +229,20 @@ enum uv__work_kind {
   UV__WORK_SLOW_IO
 };
 
+/* Thread pool state of a request that doesn't fit its public struct, owned by
+ * the loop, see uv__work_submit(). A request takes one from the loop when it
+ * is submitted and gives it back right before its done callback.
+ */
+struct uv__work_info {
+  uv_loop_t* loop;
+  struct uv__work_info* next;  /* In the loop's spare records. */
+  uint64_t queued;    /* uv_hrtime() when submitted. */
+  uint64_t started;   /* uv_hrtime() when a worker took it. */
+  uint64_t finished;  /* uv_hrtime() when its work returned. */
+  int kind;           /* enum uv__work_kind */
+  int throttled;      /* Held back by the slow I/O thread limit. */
+};
+
 void uv__work_submit(uv_loop_t* loop,
                      struct uv__work *w,
                      enum uv__work_kind kind,
@@ -220,6 +251,8 @@ void uv__work_submit(uv_loop_t* loop,
 
 void uv__work_done(uv_async_t* handle);
 
+void uv__work_cleanup(uv_loop_t* loop);
+
 size_t uv__count_bufs(const uv_buf_t bufs[], unsigned int nbufs);
 
 int uv__socket_sockopt(uv_handle_t* handle, int optname, int* value);
@@ -421,15 +454,42 @@ struct uv__iou {
   int ringfd;
   uint32_t in_flight;
 };
+
+/* Provided-buffer ring of the net ring, see uv__iou_recv(). */
+struct uv__iou_bufs {
+  void* ring;  /* array of struct uv__io_uring_buf shared with the kernel */
+  char* base;  /* the buffers */
+  uint16_t tail;
+  int state;  /* 0 uninitialized, 1 registered, -1 failed */
+  uint16_t held_next[64];  /* buffers held for a stream, see linux.c */
+  uint32_t held_len[64];
+};
 #endif  /* __linux__ */
 
 struct uv__loop_internal_fields_s {
   unsigned int flags;
   uv__loop_metrics_t loop_metrics;
   int current_timeout;
+  unsigned int work_home;  /* UV_THREADPOOL_MODE=steal-loop worker + 1 */
+  uv_threadpool_metrics_t work_metrics;
+#ifdef _MSC_VER
+  struct uv__work* volatile work_done;
+#else
+  _Atomic(struct uv__work*) work_done;  /* Completed work, newest first */
+#endif
+  struct uv__work_info* work_spare;
+  struct uv__work_info work_untimed;  /* Shared when out of memory */
+  char* read_buf;  /* Shared by the uv_read_start_pooled() streams, unix */
+  size_t read_budget;  /* UV_LOOP_READ_BUDGET, bytes per iteration, unix */
+  size_t read_left;
+  struct uv__queue read_skipped;  /* Streams that didn't read at all */
+  struct uv__queue read_cut;  /* Streams that were cut short */
 #ifdef __linux__
   struct uv__iou ctl;
   struct uv__iou iou;
+  struct uv__iou net;  /* TCP and pipe I/O, see uv__iou_stream() */
+  struct uv__iou_bufs bufs;
+  struct uv__queue iou_unsent;  /* Streams with cancellations to submit */
   void* inv;  /* used by uv__platform_invalidate_fd() */
 #endif  /* __linux__ */
 };
@@ -385,10 +385,9 @@ void uv__loop_close(uv_loop_t *loop)
       closesocket(sock);
   }
 
-  uv_mutex_lock(&loop->wq_mutex);
-  assert(uv__queue_empty(&loop->wq) && "thread pool work queue not empty!");
+  assert(uv__get_internal_fields(loop)->work_done == NULL &&
+         "thread pool work queue not empty!");
   assert(!uv__has_active_reqs(loop));
-  uv_mutex_unlock(&loop->wq_mutex);
   uv_mutex_destroy(&loop->wq_mutex);
 
   uv__free(loop->timer_heap);
@@ -618,17 +617,9 @@ int uv_run(uv_loop_t *loop, uv_run_mode mode)
      */
     uv__metrics_update_idle_time(loop);
 
-    if (loop->batch_enabled && loop->batch_pending > 0 &&
-        loop->batch_system != NULL &&
-        (loop->batch_system->flags & UV_BATCH_THRESHOLD_PROCESS))
-    {
-
-      // Clear the flag first
-      loop->batch_system->flags &= ~UV_BATCH_THRESHOLD_PROCESS;
-
-      // Process the pending events
-      uv__batch_process_pending(loop);
-    }
+    // Drain batched events whose flush was requested since the last poll
+    if (loop->batch_pending > 0)
+      uv__batch_run(loop);
 
     uv__check_invoke(loop);
     uv__process_endgames(loop);
@@ -2,10 +2,48 @@
 #include <windows.h>
 #include "uv.h"
 #include "event_batch.h"
-#include "event_batch.c"
 #include "internal.h"
 #include "stdlib.h"
 
+/* Allocate the IOCP event array */
+int uv__batch_platform_init(uv_loop_t *loop, uv_batch_t *batch)
+{
+  batch->iocp_events = (uv_batch_iocp_event_t *)
+      uv__malloc(sizeof(uv_batch_iocp_event_t) * batch->capacity);
+
+  if (batch->iocp_events == NULL)
+    return UV_ENOMEM;
+
+  return 0;
+}
+
+void uv__batch_platform_cleanup(uv_batch_t *batch)
+{
+  uv__batch_windows_cleanup(batch);
+}
+
+int uv__batch_platform_resize(uv_batch_t *batch, unsigned int capacity)
+{
+  uv_batch_iocp_event_t *events;
+
+  events = (uv_batch_iocp_event_t *)
+      uv__reallocf(batch->iocp_events, sizeof(uv_batch_iocp_event_t) * capacity);
+  batch->iocp_events = events;
+  if (events == NULL)
+    return UV_ENOMEM;
+
+  return 0;
+}
+
+/* Signal batch processing on Windows */
+void uv__batch_windows_signal(uv_batch_t *batch)
+{
+  if (batch && batch->event_handle)
+  {
+    SetEvent(batch->event_handle);
+  }
+}
+
 /* Initialize Windows-specific batch resources */
 int uv__batch_windows_init(uv_loop_t *loop, uv_batch_t *batch)
 {
@@ -62,7 +100,7 @@ int uv__batch_add_iocp_event(uv_loop_t *loop, DWORD bytes, ULONG_PTR key, OVERLA
     if (batch_system->flags & UV_BATCH_AUTO_PROCESS)
     {
       // Process current batch if auto-processing enabled
-      uv__batch_process_pending(loop);
+      uv__batch_process_pending(loop, UV_BATCH_FLUSH_FULL);
     }
     else
     {
@@ -72,14 +110,9 @@ int uv__batch_add_iocp_event(uv_loop_t *loop, DWORD bytes, ULONG_PTR key, OVERLA
     }
   }
 
-  // Validate batch capacity and allocate IOCP events array
-  if (batch_system->capacity == 0 || batch_system->capacity > UV_BATCH_MAX_SIZE) {
-    uv_mutex_unlock(&batch_system->mutex);
-    return -1;
-  }
-
-  batch_system->iocp_events = (uv_batch_iocp_event_t *)uv__malloc(sizeof(uv_batch_iocp_event_t) * batch_system->capacity);
-  if (batch_system->iocp_events == NULL) {
+  // Validate batch capacity
+  if (batch_system->iocp_events == NULL ||
+      loop->batch_pending >= batch_system->capacity) {
     uv_mutex_unlock(&batch_system->mutex);
     return -1;
   }
@@ -93,13 +126,10 @@ int uv__batch_add_iocp_event(uv_loop_t *loop, DWORD bytes, ULONG_PTR key, OVERLA
   // Increment pending count
   loop->batch_pending++;
 
-  // Start timer if this is the first event
+  // Make sure the batch gets drained if it doesn't fill up
   if (loop->batch_pending == 1)
   {
-    if (uv_timer_start(&batch_system->timeout_timer, uv__batch_timer_cb, batch_system->timeout_ms, 0) != 0) {
-      uv_mutex_unlock(&batch_system->mutex);
-      return -1;
-    }
+    uv__batch_schedule_processing(loop, 0);
   }
 
   uv_mutex_unlock(&batch_system->mutex);
@@ -125,7 +155,7 @@ int uv__batch_windows_process_pending(uv_loop_t *loop)
   result = WaitForSingleObject(batch->event_handle, 100); // 100 ms timeout
   if (result == WAIT_OBJECT_0) {
     ResetEvent(batch->event_handle);
-    uv__batch_process(batch);
+    uv__batch_process(batch, UV_BATCH_FLUSH_TIMEOUT);
     return 1;
   }
 
@@ -91,6 +91,19 @@ int uv__read_start(uv_stream_t* handle,
 }
 
 
+int uv_read_start_pooled(uv_stream_t* handle, uv_read_cb read_cb) {
+  /* Pending reads own their buffer until they complete. */
+  return UV_ENOSYS;
+}
+
+
+int uv_read_start_v(uv_stream_t* handle,
+                    uv_alloc_v_cb alloc_cb,
+                    uv_read_cb read_cb) {
+  return UV_ENOSYS;
+}
+
+
 int uv_read_stop(uv_stream_t* handle) {
   int err;
 
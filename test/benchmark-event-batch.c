@@ -0,0 +1,783 @@
+/* Copyright libuv project contributors. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "task.h"
+#include "uv.h"
+
+#include <string.h>
+
+#ifdef __linux__
+# include <linux/perf_event.h>
+# include <sys/ioctl.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+#endif
+
+#define NUM_EVENTS (1000 * 1000)
+
+static unsigned int dispatched;
+
+
+static void dispatch_cb(void* data) {
+  dispatched++;
+}
+
+
+/* Cost of dispatching one batched event, for a range of batch sizes. Events
+ * cycle through all priorities so the batch has to be put in priority order
+ * before dispatch; that should not make the per-event cost grow with the
+ * size of the batch.
+ */
+BENCHMARK_IMPL(batch_dispatch_scaling) {
+  static const unsigned int sizes[] = { 1, 16, 64, 256, 1000 };
+  uv_loop_t* loop;
+  uint64_t before;
+  uint64_t elapsed;
+  unsigned int size;
+  unsigned int i;
+  unsigned int j;
+
+  loop = uv_default_loop();
+  uv_batch_enable(loop);
+
+  for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+    size = sizes[i];
+    ASSERT_OK(uv_batch_set_max_size(loop, size));
+    dispatched = 0;
+
+    /* Every size-th event fills the batch, which dispatches it right away. */
+    before = uv_hrtime();
+    for (j = 0; j < NUM_EVENTS; j++)
+      ASSERT_OK(uv_batch_add_event(loop,
+                                   UV_BATCH_WORK_EVENT,
+                                   (uv_batch_priority_t) ((NUM_EVENTS - j) % 3),
+                                   &j,
+                                   sizeof(j),
+                                   dispatch_cb));
+    ASSERT_OK(uv_run(loop, UV_RUN_DEFAULT));
+    elapsed = uv_hrtime() - before;
+
+    ASSERT_EQ(dispatched, NUM_EVENTS);
+    fprintf(stderr,
+            "batch size %4u: %.1f ns/event (%.2f seconds)\n",
+            size,
+            (double) elapsed / NUM_EVENTS,
+            elapsed / 1e9);
+    fflush(stderr);
+  }
+
+  uv_batch_disable(loop);
+  MAKE_VALGRIND_HAPPY(loop);
+  return 0;
+}
+
+
+#define SUBMIT_THREADS 4
+
+static uv_loop_t* submit_loop;
+static uv_async_t submit_done;
+
+
+static void submit_cb(void* data) {
+  if (++dispatched == SUBMIT_THREADS * NUM_EVENTS)
+    uv_close((uv_handle_t*) &submit_done, NULL);
+}
+
+
+static void submit_thread(void* arg) {
+  unsigned int i;
+
+  for (i = 0; i < NUM_EVENTS; i++)
+    ASSERT_OK(uv_batch_submit(submit_loop,
+                              UV_BATCH_WORK_EVENT,
+                              UV_BATCH_PRIORITY_NORMAL,
+                              &i,
+                              sizeof(i),
+                              submit_cb));
+}
+
+
+/* Throughput of uv_batch_submit() with several threads feeding one loop. */
+BENCHMARK_IMPL(batch_submit_throughput) {
+  uv_thread_t threads[SUBMIT_THREADS];
+  uint64_t before;
+  uint64_t elapsed;
+  unsigned int i;
+
+  submit_loop = uv_default_loop();
+  ASSERT_OK(uv_batch_set_max_size(submit_loop, 256));
+  uv_batch_enable(submit_loop);
+  ASSERT_OK(uv_async_init(submit_loop, &submit_done, NULL));
+  dispatched = 0;
+
+  before = uv_hrtime();
+  for (i = 0; i < SUBMIT_THREADS; i++)
+    ASSERT_OK(uv_thread_create(&threads[i], submit_thread, NULL));
+
+  ASSERT_OK(uv_run(submit_loop, UV_RUN_DEFAULT));
+  elapsed = uv_hrtime() - before;
+
+  for (i = 0; i < SUBMIT_THREADS; i++)
+    ASSERT_OK(uv_thread_join(&threads[i]));
+
+  ASSERT_EQ(dispatched, SUBMIT_THREADS * NUM_EVENTS);
+  fprintf(stderr,
+          "%d producers: %.2f million events/s (%.2f seconds)\n",
+          SUBMIT_THREADS,
+          dispatched / (elapsed / 1e9) / 1e6,
+          elapsed / 1e9);
+  fflush(stderr);
+
+  uv_batch_disable(submit_loop);
+  MAKE_VALGRIND_HAPPY(submit_loop);
+  return 0;
+}
+
+
+#define LOCALITY_HANDLERS 8
+#define LOCALITY_STATE (16 * 1024)
+
+/* Per handler state. One table fits the L1 data cache, all of them don't, so
+ * handlers that run interleaved evict each other's state.
+ */
+static unsigned char locality_state[LOCALITY_HANDLERS][LOCALITY_STATE];
+static unsigned int locality_sum;
+
+#define LOCALITY_HANDLER(n)                                                   \
+  static void locality_cb_##n(void* data) {                                   \
+    unsigned char* state;                                                     \
+    unsigned int i;                                                           \
+                                                                              \
+    state = locality_state[n];                                                \
+    for (i = 0; i < LOCALITY_STATE; i += 64) {                                \
+      state[i] = (unsigned char) (state[i] * (2 * n + 3) + i);                \
+      locality_sum += state[i] ^ (n << 3);                                    \
+    }                                                                         \
+    dispatched++;                                                             \
+  }
+
+LOCALITY_HANDLER(0)
+LOCALITY_HANDLER(1)
+LOCALITY_HANDLER(2)
+LOCALITY_HANDLER(3)
+LOCALITY_HANDLER(4)
+LOCALITY_HANDLER(5)
+LOCALITY_HANDLER(6)
+LOCALITY_HANDLER(7)
+
+static const uv_batch_cb locality_cbs[LOCALITY_HANDLERS] = {
+  locality_cb_0, locality_cb_1, locality_cb_2, locality_cb_3,
+  locality_cb_4, locality_cb_5, locality_cb_6, locality_cb_7
+};
+
+
+#ifdef __linux__
+static int perf_open(uint64_t cache, int group) {
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.config = cache |
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.disabled = group == -1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP;
+
+  return (int) syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+#endif
+
+
+/* Dispatch cost of a mixed workload, where consecutive events alternate
+ * between handlers, with and without UV_BATCH_LOCALITY. L1 instruction and
+ * data cache misses are reported where perf counters are available.
+ */
+BENCHMARK_IMPL(batch_locality) {
+  uv_batch_config_t config;
+  uv_loop_t* loop;
+  uint64_t before;
+  uint64_t elapsed;
+  uint64_t misses[3];
+  unsigned int i;
+  int counters[2];
+  int pass;
+
+  loop = uv_default_loop();
+  uv_batch_enable(loop);
+
+  config.batch_size = 256;
+  config.timeout_ms = 1;
+  config.latency_us = 0;
+
+  counters[0] = -1;
+  counters[1] = -1;
+#ifdef __linux__
+  counters[0] = perf_open(PERF_COUNT_HW_CACHE_L1I, -1);
+  if (counters[0] != -1)
+    counters[1] = perf_open(PERF_COUNT_HW_CACHE_L1D, counters[0]);
+#endif
+
+  for (pass = 0; pass < 2; pass++) {
+    config.flags = pass ? UV_BATCH_LOCALITY : 0;
+    ASSERT_OK(uv_batch_configure(loop, &config));
+    dispatched = 0;
+
+#ifdef __linux__
+    if (counters[1] != -1) {
+      ioctl(counters[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl(counters[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+
+    before = uv_hrtime();
+    for (i = 0; i < NUM_EVENTS; i++)
+      ASSERT_OK(uv_batch_add_event(loop,
+                                   (uv_batch_event_type_t) (i % 4),
+                                   UV_BATCH_PRIORITY_NORMAL,
+                                   &i,
+                                   sizeof(i),
+                                   locality_cbs[i % LOCALITY_HANDLERS]));
+    ASSERT_OK(uv_run(loop, UV_RUN_DEFAULT));
+    elapsed = uv_hrtime() - before;
+
+    ASSERT_EQ(dispatched, NUM_EVENTS);
+    fprintf(stderr,
+            "%-9s %.1f ns/event",
+            pass ? "grouped:" : "in order:",
+            (double) elapsed / NUM_EVENTS);
+
+#ifdef __linux__
+    if (counters[1] != -1) {
+      ioctl(counters[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+      ASSERT_EQ(sizeof(misses), read(counters[0], misses, sizeof(misses)));
+      fprintf(stderr,
+              ", %.2f L1i misses/event, %.2f L1d misses/event",
+              (double) misses[1] / NUM_EVENTS,
+              (double) misses[2] / NUM_EVENTS);
+    }
+#endif
+
+    fprintf(stderr, "\n");
+    fflush(stderr);
+  }
+
+  if (counters[1] == -1)
+    fprintf(stderr, "perf counters unavailable, cache misses not reported\n");
+
+#ifdef __linux__
+  if (counters[1] != -1)
+    close(counters[1]);
+  if (counters[0] != -1)
+    close(counters[0]);
+#endif
+
+  uv_batch_disable(loop);
+  MAKE_VALGRIND_HAPPY(loop);
+  return 0;
+}
+
+
+/* Settings the batch_throughput_* and batch_latency_* benchmarks are run
+ * with. A batch size of 1 with no timeout dispatches every event as soon as
+ * it is added or polled, which is the unbatched baseline.
+ */
+static const struct {
+  unsigned int batch_size;
+  unsigned int timeout_ms;
+} batch_settings[] = {
+  { 1, 0 },
+  { 16, 0 },
+  { 64, 1 },
+  { 256, 1 },
+  { 256, 10 },
+};
+
+/* How long each latency run offers load for */
+#define LATENCY_TIME (500 * 1000 * 1000)
+
+static uv_async_t keepalive;
+static uint64_t deadline;
+
+
+static void batch_run_settings(uint64_t (*run)(uv_loop_t* loop)) {
+  uv_batch_config_t config;
+  uv_batch_stats_t stats;
+  uv_loop_t* loop;
+  uint64_t before;
+  uint64_t elapsed;
+  uint64_t events;
+  unsigned int i;
+
+  loop = uv_default_loop();
+  uv_batch_enable(loop);
+
+  for (i = 0; i < ARRAY_SIZE(batch_settings); i++) {
+    config.batch_size = batch_settings[i].batch_size;
+    config.timeout_ms = batch_settings[i].timeout_ms;
+    config.flags = 0;
+    config.latency_us = 0;
+    ASSERT_OK(uv_batch_configure(loop, &config));
+    uv_batch_reset_stats(loop);
+
+    before = uv_hrtime();
+    events = run(loop);
+    elapsed = uv_hrtime() - before;
+
+    ASSERT_OK(uv_batch_get_stats(loop, &stats));
+    fprintf(stderr,
+            "%-9s size %4u, timeout %2u ms: %10.0f events/s, "
+            "latency p50 %8.1f us, p99 %8.1f us, p999 %8.1f us\n",
+            config.batch_size == 1 ? "unbatched" : "batched",
+            config.batch_size,
+            config.timeout_ms,
+            events / (elapsed / 1e9),
+            stats.latency_p50 / 1e3,
+            stats.latency_p99 / 1e3,
+            stats.latency_p999 / 1e3);
+    fflush(stderr);
+  }
+
+  uv_batch_disable(loop);
+}
+
+
+static uint64_t synthetic_run(uv_loop_t* loop) {
+  unsigned int i;
+
+  dispatched = 0;
+  for (i = 0; i < NUM_EVENTS; i++)
+    ASSERT_OK(uv_batch_add_event(loop,
+                                 (uv_batch_event_type_t) (i % 4),
+                                 UV_BATCH_PRIORITY_NORMAL,
+                                 &i,
+                                 sizeof(i),
+                                 dispatch_cb));
+  ASSERT_OK(uv_run(loop, UV_RUN_DEFAULT));
+  ASSERT_EQ(dispatched, NUM_EVENTS);
+
+  return dispatched;
+}
+
+
+#define PACED_RATE 100000
+#define PACED_EVENTS (PACED_RATE / 2)
+
+
+static void paced_cb(void* data) {
+  if (++dispatched == PACED_EVENTS)
+    uv_close((uv_handle_t*) &keepalive, NULL);
+}
+
+
+/* Submits events at a fixed rate, independent of how fast they are
+ * dispatched, so the latency includes the time spent waiting for a batch.
+ */
+static void paced_thread(void* arg) {
+  uint64_t start;
+  unsigned int i;
+
+  start = uv_hrtime();
+  for (i = 0; i < PACED_EVENTS; i++) {
+    while (uv_hrtime() - start < (uint64_t) i * (1000000000 / PACED_RATE))
+      ;
+    ASSERT_OK(uv_batch_submit((uv_loop_t*) arg,
+                              UV_BATCH_WORK_EVENT,
+                              UV_BATCH_PRIORITY_NORMAL,
+                              &i,
+                              sizeof(i),
+                              paced_cb));
+  }
+}
+
+
+static uint64_t paced_run(uv_loop_t* loop) {
+  uv_thread_t thread;
+
+  dispatched = 0;
+  ASSERT_OK(uv_async_init(loop, &keepalive, NULL));
+  ASSERT_OK(uv_thread_create(&thread, paced_thread, loop));
+  ASSERT_OK(uv_run(loop, UV_RUN_DEFAULT));
+  ASSERT_OK(uv_thread_join(&thread));
+  ASSERT_EQ(dispatched, PACED_EVENTS);
+
+  return dispatched;
+}
+
+
+#define PUMP_CONNECTIONS 2
+#define PUMP_CHUNK (64 * 1024)
+#define PUMP_BYTES (128 * 1024 * 1024)
+#define PING_SIZE 64
+
+static uv_tcp_t pump_server;
+static uv_tcp_t pump_clients[PUMP_CONNECTIONS];
+static uv_tcp_t pump_peers[PUMP_CONNECTIONS];
+static uv_connect_t pump_connect_reqs[PUMP_CONNECTIONS];
+static uv_write_t pump_client_reqs[PUMP_CONNECTIONS];
+static uv_write_t pump_peer_reqs[PUMP_CONNECTIONS];
+static uint64_t pump_sent[PUMP_CONNECTIONS];
+static uint64_t pump_received;
+static unsigned int pump_accepted;
+static unsigned int pump_done;
+static uint64_t pump_events;
+static int pump_ping;
+static char pump_buf[PUMP_CHUNK];
+static char pump_read_buf[PUMP_CHUNK];
+
+
+static void pump_alloc_cb(uv_handle_t* handle,
+                          size_t suggested_size,
+                          uv_buf_t* buf) {
+  buf->base = pump_read_buf;
+  buf->len = sizeof(pump_read_buf);
+}
+
+
+static void pump_close_all(void) {
+  unsigned int i;
+
+  for (i = 0; i < PUMP_CONNECTIONS; i++) {
+    uv_close((uv_handle_t*) &pump_clients[i], NULL);
+    uv_close((uv_handle_t*) &pump_peers[i], NULL);
+  }
+  uv_close((uv_handle_t*) &pump_server, NULL);
+}
+
+
+static void pump_write(uv_tcp_t* handle,
+                       uv_write_t* req,
+                       size_t len,
+                       uv_write_cb cb) {
+  uv_buf_t buf;
+
+  buf = uv_buf_init(pump_buf, len);
+  ASSERT_OK(uv_write(req, (uv_stream_t*) handle, &buf, 1, cb));
+}
+
+
+/* Writes are cancelled when the run ends */
+static void pump_echo_cb(uv_write_t* req, int status) {
+}
+
+
+static void pump_write_cb(uv_write_t* req, int status) {
+  unsigned int i;
+
+  if (status != 0 || pump_ping)
+    return;
+
+  i = req - pump_client_reqs;
+  pump_sent[i] += PUMP_CHUNK;
+  if (pump_sent[i] < PUMP_BYTES)
+    pump_write(&pump_clients[i], req, PUMP_CHUNK, pump_write_cb);
+}
+
+
+/* The accepted side, counts what it receives or echoes it back */
+static void pump_peer_read_cb(uv_stream_t* stream,
+                              ssize_t nread,
+                              const uv_buf_t* buf) {
+  unsigned int i;
+
+  if (nread <= 0)
+    return;
+
+  i = (uv_tcp_t*) stream - pump_peers;
+  if (pump_ping) {
+    pump_write(&pump_peers[i], &pump_peer_reqs[i], nread, pump_echo_cb);
+    return;
+  }
+
+  pump_events++;
+  pump_received += nread;
+  if (pump_received == (uint64_t) PUMP_CONNECTIONS * PUMP_BYTES)
+    pump_close_all();
+}
+
+
+/* The connecting side in ping mode, one round trip per event */
+static void pump_client_read_cb(uv_stream_t* stream,
+                                ssize_t nread,
+                                const uv_buf_t* buf) {
+  unsigned int i;
+
+  if (nread <= 0)
+    return;
+
+  i = (uv_tcp_t*) stream - pump_clients;
+  pump_sent[i] += nread;
+  if (pump_sent[i] % PING_SIZE != 0)
+    return;
+
+  pump_events++;
+  if (uv_hrtime() < deadline) {
+    pump_write(&pump_clients[i], &pump_client_reqs[i], PING_SIZE, pump_write_cb);
+    return;
+  }
+
+  ASSERT_OK(uv_read_stop(stream));
+  if (++pump_done == PUMP_CONNECTIONS)
+    pump_close_all();
+}
+
+
+static void pump_connection_cb(uv_stream_t* server, int status) {
+  uv_tcp_t* peer;
+
+  ASSERT_OK(status);
+  ASSERT_LT(pump_accepted, PUMP_CONNECTIONS);
+
+  peer = &pump_peers[pump_accepted++];
+  ASSERT_OK(uv_tcp_init(server->loop, peer));
+  ASSERT_OK(uv_accept(server, (uv_stream_t*) peer));
+  ASSERT_OK(uv_read_start((uv_stream_t*) peer,
+                          pump_alloc_cb,
+                          pump_peer_read_cb));
+}
+
+
+static void pump_connect_cb(uv_connect_t* req, int status) {
+  unsigned int i;
+
+  ASSERT_OK(status);
+  i = req - pump_connect_reqs;
+
+  if (pump_ping) {
+    ASSERT_OK(uv_read_start((uv_stream_t*) &pump_clients[i],
+                            pump_alloc_cb,
+                            pump_client_read_cb));
+    pump_write(&pump_clients[i], &pump_client_reqs[i], PING_SIZE, pump_write_cb);
+  } else {
+    pump_write(&pump_clients[i], &pump_client_reqs[i], PUMP_CHUNK, pump_write_cb);
+  }
+}
+
+
+/* Two connections over loopback, both ends on the loop being measured */
+static uint64_t pump_run(uv_loop_t* loop) {
+  struct sockaddr_in addr;
+  unsigned int i;
+
+  ASSERT_OK(uv_ip4_addr("127.0.0.1", TEST_PORT, &addr));
+  memset(pump_sent, 0, sizeof(pump_sent));
+  pump_received = 0;
+  pump_accepted = 0;
+  pump_done = 0;
+  pump_events = 0;
+  deadline = uv_hrtime() + LATENCY_TIME;
+
+  ASSERT_OK(uv_tcp_init(loop, &pump_server));
+  ASSERT_OK(uv_tcp_bind(&pump_server, (const struct sockaddr*) &addr, 0));
+  ASSERT_OK(uv_listen((uv_stream_t*) &pump_server, 128, pump_connection_cb));
+
+  for (i = 0; i < PUMP_CONNECTIONS; i++) {
+    ASSERT_OK(uv_tcp_init(loop, &pump_clients[i]));
+    ASSERT_OK(uv_tcp_connect(&pump_connect_reqs[i],
+                             &pump_clients[i],
+                             (const struct sockaddr*) &addr,
+                             pump_connect_cb));
+  }
+
+  ASSERT_OK(uv_run(loop, UV_RUN_DEFAULT));
+  ASSERT_EQ(pump_accepted, PUMP_CONNECTIONS);
+
+  return pump_events;
+}
+
+
+static uint64_t pump_throughput_run(uv_loop_t* loop) {
+  pump_ping = 0;
+  return pump_run(loop);
+}
+
+
+static uint64_t pump_latency_run(uv_loop_t* loop) {
+  pump_ping = 1;
+  return pump_run(loop);
+}
+
+
+#define WORK_OUTSTANDING 64
+#define WORK_EVENTS (200 * 1000)
+
+static uv_work_t work_reqs[WORK_OUTSTANDING];
+static unsigned int work_queued;
+static unsigned int work_outstanding;
+static unsigned char work_steps[WORK_OUTSTANDING];
+static int work_submit;
+
+
+static void work_event_cb(void* data);
+
+
+static void work_cb(uv_work_t* req) {
+  if (work_submit)
+    ASSERT_OK(uv_batch_submit(req->loop,
+                              UV_BATCH_WORK_EVENT,
+                              UV_BATCH_PRIORITY_NORMAL,
+                              &req,
+                              sizeof(req),
+                              work_event_cb));
+}
+
+
+static void work_queue(uv_work_t* req);
+
+
+/* With work_submit the request can only be reused once both its
+ * after_work_cb and its batched event have run, in either order.
+ */
+static void work_step(uv_work_t* req) {
+  unsigned int i;
+
+  i = req - work_reqs;
+  if (++work_steps[i] < 2)
+    return;
+
+  work_steps[i] = 0;
+  work_queue(req);
+}
+
+
+static void after_work_cb(uv_work_t* req, int status) {
+  ASSERT_OK(status);
+  if (work_submit) {
+    work_step(req);
+    return;
+  }
+
+  dispatched++;
+  work_queue(req);
+}
+
+
+/* Completion delivered through the batch */
+static void work_event_cb(void* data) {
+  dispatched++;
+  work_step(*(uv_work_t**) data);
+}
+
+
+static void work_queue(uv_work_t* req) {
+  int more;
+
+  if (work_submit)
+    more = uv_hrtime() < deadline;
+  else
+    more = work_queued < WORK_EVENTS;
+
+  if (!more) {
+    if (--work_outstanding == 0 && work_submit)
+      uv_close((uv_handle_t*) &keepalive, NULL);
+    return;
+  }
+
+  work_queued++;
+  ASSERT_OK(uv_queue_work(req->loop, req, work_cb, after_work_cb));
+}
+
+
+static uint64_t work_run(uv_loop_t* loop) {
+  unsigned int i;
+
+  dispatched = 0;
+  work_queued = 0;
+  work_outstanding = WORK_OUTSTANDING;
+  deadline = uv_hrtime() + LATENCY_TIME;
+
+  /* Submitted completions don't keep the loop alive by themselves */
+  if (work_submit)
+    ASSERT_OK(uv_async_init(loop, &keepalive, NULL));
+
+  for (i = 0; i < WORK_OUTSTANDING; i++) {
+    work_reqs[i].loop = loop;
+    work_steps[i] = 0;
+    work_queue(&work_reqs[i]);
+  }
+
+  ASSERT_OK(uv_run(loop, UV_RUN_DEFAULT));
+  ASSERT_OK(work_outstanding);
+
+  return dispatched;
+}
+
+
+static uint64_t work_throughput_run(uv_loop_t* loop) {
+  work_submit = 0;
+  return work_run(loop);
+}
+
+
+static uint64_t work_latency_run(uv_loop_t* loop) {
+  work_submit = 1;
+  return work_run(loop);
+}
+
+
+/* Events added on the loop thread as fast as they can be dispatched */
+BENCHMARK_IMPL(batch_throughput_synthetic) {
+  batch_run_settings(synthetic_run);
+  MAKE_VALGRIND_HAPPY(uv_default_loop());
+  return 0;
+}
+
+
+/* Events submitted from another thread at a fixed rate */
+BENCHMARK_IMPL(batch_latency_synthetic) {
+  batch_run_settings(paced_run);
+  MAKE_VALGRIND_HAPPY(uv_default_loop());
+  return 0;
+}
+
+
+/* Bulk transfer over two loopback connections, one event per read */
+BENCHMARK_IMPL(batch_throughput_tcp_pump2) {
+  batch_run_settings(pump_throughput_run);
+  MAKE_VALGRIND_HAPPY(uv_default_loop());
+  return 0;
+}
+
+
+/* Ping-pong over two loopback connections, one event per round trip */
+BENCHMARK_IMPL(batch_latency_tcp_pump2) {
+  batch_run_settings(pump_latency_run);
+  MAKE_VALGRIND_HAPPY(uv_default_loop());
+  return 0;
+}
+
+
+/* uv_queue_work() completions, woken up through the loop's async handle */
+BENCHMARK_IMPL(batch_throughput_threadpool) {
+  batch_run_settings(work_throughput_run);
+  MAKE_VALGRIND_HAPPY(uv_default_loop());
+  return 0;
+}
+
+
+/* Thread pool completions delivered with uv_batch_submit() */
+BENCHMARK_IMPL(batch_latency_threadpool) {
+  batch_run_settings(work_latency_run);
+  MAKE_VALGRIND_HAPPY(uv_default_loop());
+  return 0;
+}
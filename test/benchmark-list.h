@@ -28,6 +28,7 @@ BENCHMARK_DECLARE (ping_udp1)
 BENCHMARK_DECLARE (ping_udp10)
 BENCHMARK_DECLARE (ping_udp100)
 BENCHMARK_DECLARE (tcp_write_batch)
+BENCHMARK_DECLARE (tcp_write_batch_cork)
 BENCHMARK_DECLARE (tcp4_pound_100)
 BENCHMARK_DECLARE (tcp4_pound_1000)
 BENCHMARK_DECLARE (pipe_pound_100)
@@ -40,6 +41,11 @@ BENCHMARK_DECLARE (pipe_pump1_client)
 BENCHMARK_DECLARE (tcp_multi_accept2)
 BENCHMARK_DECLARE (tcp_multi_accept4)
 BENCHMARK_DECLARE (tcp_multi_accept8)
+BENCHMARK_DECLARE (tcp_multi_accept2_io_uring)
+BENCHMARK_DECLARE (tcp_multi_accept4_io_uring)
+BENCHMARK_DECLARE (tcp_multi_accept8_io_uring)
+BENCHMARK_DECLARE (tcp_read_fairness)
+BENCHMARK_DECLARE (tcp_read_fairness_budget)
 
 /* Run until X packets have been sent/received. */
 BENCHMARK_DECLARE (udp_pummel_1v1)
@@ -76,8 +82,22 @@ BENCHMARK_DECLARE (async_pummel_2)
 BENCHMARK_DECLARE (async_pummel_4)
 BENCHMARK_DECLARE (async_pummel_8)
 BENCHMARK_DECLARE (queue_work)
+BENCHMARK_DECLARE (queue_work_scaling_shared)
+BENCHMARK_DECLARE (queue_work_scaling_steal)
+BENCHMARK_DECLARE (queue_work_scaling_steal_loop)
+BENCHMARK_DECLARE (queue_work_batch)
+BENCHMARK_DECLARE (queue_work_priority)
 BENCHMARK_DECLARE (spawn)
 BENCHMARK_DECLARE (thread_create)
+BENCHMARK_DECLARE (batch_dispatch_scaling)
+BENCHMARK_DECLARE (batch_submit_throughput)
+BENCHMARK_DECLARE (batch_locality)
+BENCHMARK_DECLARE (batch_throughput_synthetic)
+BENCHMARK_DECLARE (batch_latency_synthetic)
+BENCHMARK_DECLARE (batch_throughput_tcp_pump2)
+BENCHMARK_DECLARE (batch_latency_tcp_pump2)
+BENCHMARK_DECLARE (batch_throughput_threadpool)
+BENCHMARK_DECLARE (batch_latency_threadpool)
 BENCHMARK_DECLARE (million_async)
 BENCHMARK_DECLARE (million_timers)
 HELPER_DECLARE    (tcp4_blackhole_server)
@@ -101,6 +121,8 @@ TASK_LIST_START
 
   BENCHMARK_ENTRY  (tcp_write_batch)
   BENCHMARK_HELPER (tcp_write_batch, tcp4_blackhole_server)
+  BENCHMARK_ENTRY  (tcp_write_batch_cork)
+  BENCHMARK_HELPER (tcp_write_batch_cork, tcp4_blackhole_server)
 
   BENCHMARK_ENTRY  (tcp_pump100_client)
   BENCHMARK_HELPER (tcp_pump100_client, tcp_pump_server)
@@ -129,6 +151,11 @@ TASK_LIST_START
   BENCHMARK_ENTRY  (tcp_multi_accept2)
   BENCHMARK_ENTRY  (tcp_multi_accept4)
   BENCHMARK_ENTRY  (tcp_multi_accept8)
+  BENCHMARK_ENTRY  (tcp_multi_accept2_io_uring)
+  BENCHMARK_ENTRY  (tcp_multi_accept4_io_uring)
+  BENCHMARK_ENTRY  (tcp_multi_accept8_io_uring)
+  BENCHMARK_ENTRY  (tcp_read_fairness)
+  BENCHMARK_ENTRY  (tcp_read_fairness_budget)
 
   BENCHMARK_ENTRY  (udp_pummel_1v1)
   BENCHMARK_ENTRY  (udp_pummel_1v10)
@@ -165,9 +192,23 @@ TASK_LIST_START
   BENCHMARK_ENTRY  (async_pummel_4)
   BENCHMARK_ENTRY  (async_pummel_8)
   BENCHMARK_ENTRY  (queue_work)
+  BENCHMARK_ENTRY  (queue_work_scaling_shared)
+  BENCHMARK_ENTRY  (queue_work_scaling_steal)
+  BENCHMARK_ENTRY  (queue_work_scaling_steal_loop)
+  BENCHMARK_ENTRY  (queue_work_batch)
+  BENCHMARK_ENTRY  (queue_work_priority)
 
   BENCHMARK_ENTRY  (spawn)
   BENCHMARK_ENTRY  (thread_create)
+  BENCHMARK_ENTRY  (batch_dispatch_scaling)
+  BENCHMARK_ENTRY  (batch_submit_throughput)
+  BENCHMARK_ENTRY  (batch_locality)
+  BENCHMARK_ENTRY  (batch_throughput_synthetic)
+  BENCHMARK_ENTRY  (batch_latency_synthetic)
+  BENCHMARK_ENTRY  (batch_throughput_tcp_pump2)
+  BENCHMARK_ENTRY  (batch_latency_tcp_pump2)
+  BENCHMARK_ENTRY  (batch_throughput_threadpool)
+  BENCHMARK_ENTRY  (batch_latency_threadpool)
   BENCHMARK_ENTRY  (million_async)
   BENCHMARK_ENTRY  (million_timers)
 TASK_LIST_END
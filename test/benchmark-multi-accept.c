@@ -67,6 +67,7 @@ struct ipc_client_ctx {
 struct server_ctx {
   handle_storage_t server_handle;
   unsigned int num_connects;
+  int use_io_uring;
   uv_async_t async_handle;
   uv_thread_t thread_id;
   uv_sem_t semaphore;
@@ -261,6 +262,9 @@ static void server_cb(void *arg) {
   ctx = arg;
   ASSERT_OK(uv_loop_init(&loop));
 
+  if (ctx->use_io_uring)
+    ASSERT_OK(uv_loop_configure(&loop, UV_LOOP_USE_IO_URING_STREAMS));
+
   ASSERT_OK(uv_async_init(&loop, &ctx->async_handle, sv_async_cb));
   uv_unref((uv_handle_t*) &ctx->async_handle);
 
@@ -359,7 +363,9 @@ static void cl_close_cb(uv_handle_t* handle) {
 }
 
 
-static int test_tcp(unsigned int num_servers, unsigned int num_clients) {
+static int test_tcp(unsigned int num_servers,
+                    unsigned int num_clients,
+                    int use_io_uring) {
   struct server_ctx* servers;
   struct client_ctx* clients;
   uv_loop_t* loop;
@@ -381,6 +387,7 @@ static int test_tcp(unsigned int num_servers, unsigned int num_clients) {
    */
   for (i = 0; i < num_servers; i++) {
     struct server_ctx* ctx = servers + i;
+    ctx->use_io_uring = use_io_uring;
     ASSERT_OK(uv_sem_init(&ctx->semaphore, 0));
     ASSERT_OK(uv_thread_create(&ctx->thread_id, server_cb, ctx));
   }
@@ -437,15 +444,40 @@ static int test_tcp(unsigned int num_servers, unsigned int num_clients) {
 
 
 BENCHMARK_IMPL(tcp_multi_accept2) {
-  return test_tcp(2, 40);
+  return test_tcp(2, 40, 0);
 }
 
 
 BENCHMARK_IMPL(tcp_multi_accept4) {
-  return test_tcp(4, 40);
+  return test_tcp(4, 40, 0);
 }
 
 
 BENCHMARK_IMPL(tcp_multi_accept8) {
-  return test_tcp(8, 40);
+  return test_tcp(8, 40, 0);
+}
+
+
+/* The servers accept with multishot io_uring requests. */
+BENCHMARK_IMPL(tcp_multi_accept2_io_uring) {
+#if !defined(__linux__)
+  RETURN_SKIP("io_uring is Linux only");
+#endif
+  return test_tcp(2, 40, 1);
+}
+
+
+BENCHMARK_IMPL(tcp_multi_accept4_io_uring) {
+#if !defined(__linux__)
+  RETURN_SKIP("io_uring is Linux only");
+#endif
+  return test_tcp(4, 40, 1);
+}
+
+
+BENCHMARK_IMPL(tcp_multi_accept8_io_uring) {
+#if !defined(__linux__)
+  RETURN_SKIP("io_uring is Linux only");
+#endif
+  return test_tcp(8, 40, 1);
 }
@@ -69,3 +69,338 @@ BENCHMARK_IMPL(queue_work) {
   MAKE_VALGRIND_HAPPY(loop);
   return 0;
 }
+
+
+#define SCALING_INFLIGHT 16
+#define SCALING_TIME 1000 /* ms */
+
+typedef struct {
+  uv_loop_t loop;
+  uv_timer_t timer;
+  uv_work_t reqs[SCALING_INFLIGHT];
+  unsigned int events;
+  int done;
+} scaling_loop_t;
+
+
+static void scaling_work_cb(uv_work_t* req) {
+}
+
+
+static void scaling_after_work_cb(uv_work_t* req, int status) {
+  scaling_loop_t* s;
+
+  s = req->data;
+  s->events++;
+  if (!s->done)
+    ASSERT_OK(uv_queue_work(&s->loop,
+                            req,
+                            scaling_work_cb,
+                            scaling_after_work_cb));
+}
+
+
+static void scaling_timer_cb(uv_timer_t* handle) {
+  scaling_loop_t* s;
+
+  s = container_of(handle, scaling_loop_t, timer);
+  s->done = 1;
+}
+
+
+/* One submitting loop, keeps SCALING_INFLIGHT jobs queued */
+static void scaling_thread(void* arg) {
+  scaling_loop_t* s;
+  unsigned int i;
+
+  s = arg;
+  ASSERT_OK(uv_loop_init(&s->loop));
+  ASSERT_OK(uv_timer_init(&s->loop, &s->timer));
+  ASSERT_OK(uv_timer_start(&s->timer, scaling_timer_cb, SCALING_TIME, 0));
+
+  for (i = 0; i < SCALING_INFLIGHT; i++) {
+    s->reqs[i].data = s;
+    ASSERT_OK(uv_queue_work(&s->loop,
+                            &s->reqs[i],
+                            scaling_work_cb,
+                            scaling_after_work_cb));
+  }
+
+  ASSERT_OK(uv_run(&s->loop, UV_RUN_DEFAULT));
+  uv_close((uv_handle_t*) &s->timer, NULL);
+  ASSERT_OK(uv_run(&s->loop, UV_RUN_DEFAULT));
+  ASSERT_OK(uv_loop_close(&s->loop));
+}
+
+
+/* Threadpool throughput with 1 to N loops submitting work at once, N being
+ * the available parallelism but at least 4. The pool is started in the given
+ * UV_THREADPOOL_MODE.
+ */
+static int queue_work_scaling(const char* mode) {
+  char fmtbuf[32];
+  scaling_loop_t* loops;
+  uv_thread_t* threads;
+  unsigned int nloops;
+  unsigned int max;
+  unsigned int events;
+  unsigned int i;
+
+  ASSERT_OK(uv_os_setenv("UV_THREADPOOL_MODE", mode));
+
+  max = uv_available_parallelism();
+  if (max < 4)
+    max = 4;
+
+  loops = calloc(max, sizeof(loops[0]));
+  threads = calloc(max, sizeof(threads[0]));
+  ASSERT_NOT_NULL(loops);
+  ASSERT_NOT_NULL(threads);
+
+  for (nloops = 1; nloops <= max; nloops *= 2) {
+    memset(loops, 0, max * sizeof(loops[0]));
+
+    for (i = 0; i < nloops; i++)
+      ASSERT_OK(uv_thread_create(&threads[i], scaling_thread, &loops[i]));
+
+    events = 0;
+    for (i = 0; i < nloops; i++) {
+      ASSERT_OK(uv_thread_join(&threads[i]));
+      events += loops[i].events;
+    }
+
+    printf("%s: %3u loops, %s jobs/s\n",
+           mode,
+           nloops,
+           fmt(&fmtbuf, events / (SCALING_TIME / 1000.)));
+    fflush(stdout);
+
+    if (nloops < max && nloops * 2 > max)
+      nloops = max / 2;
+  }
+
+  free(loops);
+  free(threads);
+
+  MAKE_VALGRIND_HAPPY(uv_default_loop());
+  return 0;
+}
+
+
+BENCHMARK_IMPL(queue_work_scaling_shared) {
+  return queue_work_scaling("shared");
+}
+
+
+BENCHMARK_IMPL(queue_work_scaling_steal) {
+  return queue_work_scaling("steal");
+}
+
+
+BENCHMARK_IMPL(queue_work_scaling_steal_loop) {
+  return queue_work_scaling("steal-loop");
+}
+
+
+#define BATCH_JOBS 1000
+#define BATCH_TIME 1000 /* ms */
+
+static uv_work_t batch_reqs[BATCH_JOBS];
+static uv_work_batch_t batch;
+static unsigned int batch_pending;
+static unsigned int batch_rounds;
+static uint64_t batch_end;
+
+
+static void batch_submit(uv_loop_t* loop, int batched);
+
+
+static void batch_req_done_cb(uv_work_t* req, int status) {
+  if (--batch_pending == 0)
+    batch_submit(req->loop, 0);
+}
+
+
+static void batch_done_cb(uv_work_batch_t* b, int status) {
+  batch_submit(b->loop, 1);
+}
+
+
+/* Queues BATCH_JOBS jobs one at a time or as one batch, until BATCH_TIME
+ * has passed */
+static void batch_submit(uv_loop_t* loop, int batched) {
+  unsigned int i;
+
+  if (uv_hrtime() >= batch_end)
+    return;
+
+  batch_rounds++;
+  if (batched) {
+    ASSERT_OK(uv_queue_work_batch(loop,
+                                  &batch,
+                                  batch_reqs,
+                                  BATCH_JOBS,
+                                  NULL,
+                                  scaling_work_cb,
+                                  batch_done_cb));
+    return;
+  }
+
+  batch_pending = BATCH_JOBS;
+  for (i = 0; i < BATCH_JOBS; i++)
+    ASSERT_OK(uv_queue_work(loop,
+                            &batch_reqs[i],
+                            scaling_work_cb,
+                            batch_req_done_cb));
+}
+
+
+/* Rounds of BATCH_JOBS empty jobs, queued with uv_queue_work() and with
+ * uv_queue_work_batch() */
+BENCHMARK_IMPL(queue_work_batch) {
+  char fmtbuf[32];
+  uv_loop_t* loop;
+  int batched;
+
+  loop = uv_default_loop();
+
+  for (batched = 0; batched < 2; batched++) {
+    batch_rounds = 0;
+    batch_end = uv_hrtime() + BATCH_TIME * (uint64_t) 1000000;
+    batch_submit(loop, batched);
+    ASSERT_OK(uv_run(loop, UV_RUN_DEFAULT));
+
+    printf("%s: %s jobs/s\n",
+           batched ? "uv_queue_work_batch" : "uv_queue_work",
+           fmt(&fmtbuf, batch_rounds * BATCH_JOBS / (BATCH_TIME / 1000.)));
+    fflush(stdout);
+  }
+
+  MAKE_VALGRIND_HAPPY(loop);
+  return 0;
+}
+
+
+#define PRIORITY_FLOOD 64
+#define PRIORITY_FLOOD_WORK 200000 /* ns */
+#define PRIORITY_PROBES 500
+#define PRIORITY_INTERVAL 2 /* ms */
+
+static uv_work_t flood_reqs[PRIORITY_FLOOD];
+static uv_work_t probe_reqs[PRIORITY_PROBES];
+static uint64_t probe_start[PRIORITY_PROBES];
+static uint64_t probe_latency[PRIORITY_PROBES];
+static unsigned int probes_sent;
+static unsigned int probes_done;
+static uv_work_options_t flood_options;
+static uv_work_options_t probe_options;
+static int flood_done;
+
+
+static void flood_work_cb(uv_work_t* req) {
+  uint64_t end;
+
+  end = uv_hrtime() + PRIORITY_FLOOD_WORK;
+  while (uv_hrtime() < end);
+}
+
+
+static void flood_after_work_cb(uv_work_t* req, int status) {
+  if (!flood_done)
+    ASSERT_OK(uv_queue_work_ex(req->loop,
+                               req,
+                               &flood_options,
+                               flood_work_cb,
+                               flood_after_work_cb));
+}
+
+
+static void probe_after_work_cb(uv_work_t* req, int status) {
+  unsigned int i;
+
+  i = req - probe_reqs;
+  probe_latency[i] = uv_hrtime() - probe_start[i];
+  if (++probes_done == PRIORITY_PROBES)
+    flood_done = 1;
+}
+
+
+static void probe_timer_cb(uv_timer_t* handle) {
+  unsigned int i;
+
+  i = probes_sent++;
+  probe_start[i] = uv_hrtime();
+  ASSERT_OK(uv_queue_work_ex(handle->loop,
+                             &probe_reqs[i],
+                             &probe_options,
+                             scaling_work_cb,
+                             probe_after_work_cb));
+
+  if (probes_sent == PRIORITY_PROBES)
+    uv_timer_stop(handle);
+}
+
+
+static int uint64_cmp(const void* a, const void* b) {
+  uint64_t x;
+  uint64_t y;
+
+  x = *(const uint64_t*) a;
+  y = *(const uint64_t*) b;
+  return x < y ? -1 : x > y;
+}
+
+
+/* Latency of short probe jobs while a flood of long jobs keeps the pool
+ * busy, with the probes at the flood's priority and above it.
+ */
+BENCHMARK_IMPL(queue_work_priority) {
+  static const uv_work_priority_t priorities[][2] = {
+    /* flood, probe */
+    { UV_WORK_PRIORITY_NORMAL, UV_WORK_PRIORITY_NORMAL },
+    { UV_WORK_PRIORITY_LOW, UV_WORK_PRIORITY_HIGH },
+  };
+  static const char* names[] = { "high", "normal", "low" };
+  uv_timer_t timer;
+  uv_loop_t* loop;
+  unsigned int run;
+  unsigned int i;
+
+  loop = uv_default_loop();
+
+  for (run = 0; run < ARRAY_SIZE(priorities); run++) {
+    flood_options.priority = priorities[run][0];
+    probe_options.priority = priorities[run][1];
+    flood_done = 0;
+    probes_sent = 0;
+    probes_done = 0;
+
+    for (i = 0; i < PRIORITY_FLOOD; i++)
+      ASSERT_OK(uv_queue_work_ex(loop,
+                                 &flood_reqs[i],
+                                 &flood_options,
+                                 flood_work_cb,
+                                 flood_after_work_cb));
+
+    ASSERT_OK(uv_timer_init(loop, &timer));
+    ASSERT_OK(uv_timer_start(&timer,
+                             probe_timer_cb,
+                             PRIORITY_INTERVAL,
+                             PRIORITY_INTERVAL));
+    ASSERT_OK(uv_run(loop, UV_RUN_DEFAULT));
+    uv_close((uv_handle_t*) &timer, NULL);
+    ASSERT_OK(uv_run(loop, UV_RUN_DEFAULT));
+
+    qsort(probe_latency, PRIORITY_PROBES, sizeof(probe_latency[0]), uint64_cmp);
+    printf("%s probes under a %s flood: p50 %.1f us, p99 %.1f us, max %.1f us\n",
+           names[priorities[run][1]],
+           names[priorities[run][0]],
+           probe_latency[PRIORITY_PROBES / 2] / 1e3,
+           probe_latency[PRIORITY_PROBES * 99 / 100] / 1e3,
+           probe_latency[PRIORITY_PROBES - 1] / 1e3);
+    fflush(stdout);
+  }
+
+  MAKE_VALGRIND_HAPPY(loop);
+  return 0;
+}
@@ -0,0 +1,327 @@
+/* Copyright libuv project contributors. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "uv.h"
+#include "task.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* One connection that streams data the server has to work through byte by
+ * byte, and many connections that send small requests and wait for the
+ * answer. Reports how long the requests take, with and without a read
+ * budget for the server loop.
+ */
+#define NUM_REQUESTERS 32
+#define REQUEST_SIZE 64
+#define BULK_WRITE_SIZE (256 * 1024)
+#define BULK_WRITES 4
+#define READ_BUDGET (64 * 1024)
+#define DURATION 3000  /* ms */
+#define MAX_SAMPLES (1024 * 1024)
+
+typedef struct {
+  uv_tcp_t handle;
+  int is_bulk;
+  char buf[64 * 1024];
+} server_conn_t;
+
+typedef struct {
+  uv_tcp_t handle;
+  uv_connect_t connect_req;
+  uv_write_t write_req;
+  uint64_t sent;
+  size_t nread;
+  char buf[REQUEST_SIZE];
+} requester_t;
+
+static uv_loop_t server_loop;
+static uv_tcp_t server;
+static uv_sem_t server_ready;
+static server_conn_t server_conns[1 + NUM_REQUESTERS];
+static int server_nconns;
+static int server_nclosed;
+static size_t read_budget;
+static uint64_t bulk_nread;
+static volatile unsigned int checksum;
+
+static uv_tcp_t bulk;
+static uv_connect_t bulk_connect_req;
+static uv_write_t bulk_write_reqs[BULK_WRITES];
+static char bulk_data[BULK_WRITE_SIZE];
+static requester_t requesters[NUM_REQUESTERS];
+static char request[REQUEST_SIZE];
+static uv_timer_t timer;
+static struct sockaddr_in addr;
+static uint64_t* samples;
+static size_t nsamples;
+static int stopping;
+
+
+static void server_close_cb(uv_handle_t* handle) {
+  if (++server_nclosed == server_nconns)
+    uv_close((uv_handle_t*) &server, NULL);
+}
+
+
+static void server_alloc_cb(uv_handle_t* handle,
+                            size_t suggested_size,
+                            uv_buf_t* buf) {
+  server_conn_t* conn;
+
+  conn = container_of(handle, server_conn_t, handle);
+  buf->base = conn->buf;
+  buf->len = sizeof(conn->buf);
+}
+
+
+static void server_read_cb(uv_stream_t* stream,
+                           ssize_t nread,
+                           const uv_buf_t* buf) {
+  server_conn_t* conn;
+  unsigned int sum;
+  uv_buf_t reply;
+  ssize_t i;
+
+  conn = container_of(stream, server_conn_t, handle);
+
+  if (nread < 0) {
+    uv_close((uv_handle_t*) stream, server_close_cb);
+    return;
+  }
+
+  if (conn->is_bulk) {
+    /* Stands in for parsing or decoding the data. */
+    sum = checksum;
+    for (i = 0; i < nread; i++)
+      sum = sum * 31 + (unsigned char) buf->base[i];
+    checksum = sum;
+    bulk_nread += nread;
+    return;
+  }
+
+  /* The requester waits for the answer before it sends the next request, so
+   * there is always room for it in the socket buffer.
+   */
+  if (nread > 0) {
+    reply = uv_buf_init(buf->base, nread);
+    ASSERT_EQ(nread, uv_try_write(stream, &reply, 1));
+  }
+}
+
+
+static void server_connection_cb(uv_stream_t* stream, int status) {
+  server_conn_t* conn;
+
+  ASSERT_OK(status);
+  ASSERT_LT(server_nconns, ARRAY_SIZE(server_conns));
+
+  /* The bulk connection is made before the others. */
+  conn = &server_conns[server_nconns];
+  conn->is_bulk = server_nconns == 0;
+  server_nconns++;
+
+  ASSERT_OK(uv_tcp_init(stream->loop, &conn->handle));
+  ASSERT_OK(uv_accept(stream, (uv_stream_t*) &conn->handle));
+  ASSERT_OK(uv_read_start((uv_stream_t*) &conn->handle,
+                          server_alloc_cb,
+                          server_read_cb));
+}
+
+
+static void server_thread(void* arg) {
+  ASSERT_OK(uv_loop_init(&server_loop));
+  if (read_budget != 0)
+    ASSERT_OK(uv_loop_configure(&server_loop,
+                                UV_LOOP_READ_BUDGET,
+                                read_budget));
+
+  ASSERT_OK(uv_tcp_init(&server_loop, &server));
+  ASSERT_OK(uv_tcp_bind(&server, (const struct sockaddr*) &addr, 0));
+  ASSERT_OK(uv_listen((uv_stream_t*) &server, 128, server_connection_cb));
+  uv_sem_post(&server_ready);
+
+  ASSERT_OK(uv_run(&server_loop, UV_RUN_DEFAULT));
+  ASSERT_OK(uv_loop_close(&server_loop));
+}
+
+
+static void requester_send(requester_t* r) {
+  uv_buf_t buf;
+
+  buf = uv_buf_init(request, sizeof(request));
+  r->sent = uv_hrtime();
+  r->nread = 0;
+  ASSERT_OK(uv_write(&r->write_req, (uv_stream_t*) &r->handle, &buf, 1, NULL));
+}
+
+
+static void requester_alloc_cb(uv_handle_t* handle,
+                               size_t suggested_size,
+                               uv_buf_t* buf) {
+  requester_t* r;
+
+  r = container_of(handle, requester_t, handle);
+  buf->base = r->buf + r->nread;
+  buf->len = sizeof(r->buf) - r->nread;
+}
+
+
+static void requester_read_cb(uv_stream_t* stream,
+                              ssize_t nread,
+                              const uv_buf_t* buf) {
+  requester_t* r;
+
+  r = container_of(stream, requester_t, handle);
+  ASSERT_GE(nread, 0);
+
+  r->nread += nread;
+  if (r->nread < REQUEST_SIZE)
+    return;
+
+  if (nsamples < MAX_SAMPLES)
+    samples[nsamples++] = uv_hrtime() - r->sent;
+
+  if (!stopping)
+    requester_send(r);
+}
+
+
+static void requester_connect_cb(uv_connect_t* req, int status) {
+  requester_t* r;
+
+  ASSERT_OK(status);
+  r = container_of(req, requester_t, connect_req);
+  ASSERT_OK(uv_read_start((uv_stream_t*) &r->handle,
+                          requester_alloc_cb,
+                          requester_read_cb));
+  requester_send(r);
+}
+
+
+static void bulk_write_cb(uv_write_t* req, int status) {
+  uv_buf_t buf;
+
+  if (stopping)
+    return;
+
+  ASSERT_OK(status);
+  buf = uv_buf_init(bulk_data, sizeof(bulk_data));
+  ASSERT_OK(uv_write(req, (uv_stream_t*) &bulk, &buf, 1, bulk_write_cb));
+}
+
+
+static void bulk_connect_cb(uv_connect_t* req, int status) {
+  int i;
+
+  ASSERT_OK(status);
+
+  for (i = 0; i < BULK_WRITES; i++)
+    bulk_write_cb(&bulk_write_reqs[i], 0);
+
+  for (i = 0; i < NUM_REQUESTERS; i++) {
+    ASSERT_OK(uv_tcp_init(req->handle->loop, &requesters[i].handle));
+    ASSERT_OK(uv_tcp_nodelay(&requesters[i].handle, 1));
+    ASSERT_OK(uv_tcp_connect(&requesters[i].connect_req,
+                             &requesters[i].handle,
+                             (const struct sockaddr*) &addr,
+                             requester_connect_cb));
+  }
+}
+
+
+static void timer_cb(uv_timer_t* handle) {
+  int i;
+
+  stopping = 1;
+  uv_close((uv_handle_t*) &bulk, NULL);
+  for (i = 0; i < NUM_REQUESTERS; i++)
+    uv_close((uv_handle_t*) &requesters[i].handle, NULL);
+}
+
+
+static int compare_samples(const void* a, const void* b) {
+  uint64_t x;
+  uint64_t y;
+
+  x = *(const uint64_t*) a;
+  y = *(const uint64_t*) b;
+  return (x > y) - (x < y);
+}
+
+
+static int read_fairness(const char* name, size_t budget) {
+  uv_thread_t tid;
+  uv_loop_t* loop;
+
+  read_budget = budget;
+  samples = malloc(MAX_SAMPLES * sizeof(*samples));
+  ASSERT_NOT_NULL(samples);
+
+  ASSERT_OK(uv_ip4_addr("127.0.0.1", TEST_PORT, &addr));
+  ASSERT_OK(uv_sem_init(&server_ready, 0));
+  ASSERT_OK(uv_thread_create(&tid, server_thread, NULL));
+  uv_sem_wait(&server_ready);
+
+  loop = uv_default_loop();
+  ASSERT_OK(uv_tcp_init(loop, &bulk));
+  ASSERT_OK(uv_tcp_connect(&bulk_connect_req,
+                           &bulk,
+                           (const struct sockaddr*) &addr,
+                           bulk_connect_cb));
+  ASSERT_OK(uv_timer_init(loop, &timer));
+  ASSERT_OK(uv_timer_start(&timer, timer_cb, DURATION, 0));
+  uv_unref((uv_handle_t*) &timer);
+
+  ASSERT_OK(uv_run(loop, UV_RUN_DEFAULT));
+  ASSERT_OK(uv_thread_join(&tid));
+  uv_sem_destroy(&server_ready);
+
+  ASSERT_GT(nsamples, 0);
+  qsort(samples, nsamples, sizeof(*samples), compare_samples);
+
+  fprintf(stderr,
+          "%s: %llu requests, "
+          "p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us, "
+          "bulk %.1f MB/s\n",
+          name,
+          (unsigned long long) nsamples,
+          samples[nsamples / 2] / 1e3,
+          samples[nsamples * 99 / 100] / 1e3,
+          samples[nsamples * 999 / 1000] / 1e3,
+          samples[nsamples - 1] / 1e3,
+          bulk_nread / (DURATION / 1e3) / (1024 * 1024));
+  fflush(stderr);
+
+  free(samples);
+  MAKE_VALGRIND_HAPPY(loop);
+  return 0;
+}
+
+
+BENCHMARK_IMPL(tcp_read_fairness) {
+  return read_fairness("tcp_read_fairness", 0);
+}
+
+
+BENCHMARK_IMPL(tcp_read_fairness_budget) {
+  return read_fairness("tcp_read_fairness_budget", READ_BUDGET);
+}
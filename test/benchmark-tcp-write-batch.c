@@ -94,7 +94,7 @@ static void close_cb(uv_handle_t* handle) {
 }
 
 
-BENCHMARK_IMPL(tcp_write_batch) {
+static int run_write_batch(int cork) {
   struct sockaddr_in addr;
   uv_loop_t* loop;
   uint64_t start;
@@ -112,6 +112,9 @@ BENCHMARK_IMPL(tcp_write_batch) {
   }
 
   loop = uv_default_loop();
+  if (cork)
+    ASSERT_OK(uv_loop_configure(loop, UV_LOOP_CORK_WRITES));
+
   ASSERT_OK(uv_ip4_addr("127.0.0.1", TEST_PORT, &addr));
 
   r = uv_tcp_init(loop, &tcp_client);
@@ -135,10 +138,21 @@ BENCHMARK_IMPL(tcp_write_batch) {
   ASSERT_EQ(1, shutdown_cb_called);
   ASSERT_EQ(1, close_cb_called);
 
-  printf("%ld write requests in %.2fs.\n",
+  printf("%ld write requests%s in %.2fs.\n",
          (long)NUM_WRITE_REQS,
+         cork ? " (corked)" : "",
          (stop - start) / 1e9);
 
   MAKE_VALGRIND_HAPPY(loop);
   return 0;
 }
+
+
+BENCHMARK_IMPL(tcp_write_batch) {
+  return run_write_batch(0);
+}
+
+
+BENCHMARK_IMPL(tcp_write_batch_cork) {
+  return run_write_batch(1);
+}
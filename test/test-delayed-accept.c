@@ -170,8 +170,7 @@ static void client_connect(void) {
 }
 
 
-
-TEST_IMPL(delayed_accept) {
+static int run_delayed_accept(void) {
   start_server();
 
   client_connect();
@@ -187,3 +186,20 @@ TEST_IMPL(delayed_accept) {
   MAKE_VALGRIND_HAPPY(uv_default_loop());
   return 0;
 }
+
+
+TEST_IMPL(delayed_accept) {
+  return run_delayed_accept();
+}
+
+
+TEST_IMPL(delayed_accept_io_uring) {
+#if !defined(__linux__)
+  RETURN_SKIP("io_uring is Linux only");
+#endif
+  ASSERT_OK(uv_loop_configure(uv_default_loop(),
+                              UV_LOOP_USE_IO_URING_STREAMS));
+  ASSERT_OK(uv_loop_configure(uv_default_loop(),
+                              UV_LOOP_USE_IO_URING_ACCEPT));
+  return run_delayed_accept();
+}
@@ -0,0 +1,1122 @@
+/* Copyright libuv project contributors. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "uv.h"
+#include "task.h"
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#define NUM_PAIRS 4
+
+static int fds[NUM_PAIRS][2];
+static uv_poll_t poll_handles[NUM_PAIRS];
+static int poll_cb_called;
+static int close_cb_called;
+
+
+static void make_pairs(void) {
+#ifndef _WIN32
+  int i;
+
+  for (i = 0; i < NUM_PAIRS; i++)
+    ASSERT_OK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds[i]));
+#endif
+}
+
+
+static void close_pairs(void) {
+#ifndef _WIN32
+  int i;
+
+  for (i = 0; i < NUM_PAIRS; i++) {
+    close(fds[i][0]);
+    close(fds[i][1]);
+  }
+#endif
+}
+
+
+static void send_byte(int i) {
+#ifndef _WIN32
+  ASSERT_EQ(1, write(fds[i][1], "x", 1));
+#endif
+}
+
+
+static void close_cb(uv_handle_t* handle) {
+  close_cb_called++;
+}
+
+
+static void poll_cb(uv_poll_t* handle, int status, int events) {
+  ASSERT_OK(status);
+  ASSERT(events & UV_READABLE);
+  poll_cb_called++;
+}
+
+
+static void poll_close_other_cb(uv_poll_t* handle, int status, int events) {
+  uv_poll_t* other;
+
+  poll_cb_called++;
+
+  other = &poll_handles[0];
+  if (handle == other)
+    other = &poll_handles[1];
+
+  /* The other handle's event is still staged, it must never be delivered. */
+  uv_close((uv_handle_t*) handle, close_cb);
+  uv_close((uv_handle_t*) other, close_cb);
+}
+
+
+static void poll_resize_cb(uv_poll_t* handle, int status, int events) {
+  poll_cb_called++;
+
+  /* The staged events are still being dispatched. */
+  ASSERT_EQ(UV_EBUSY, uv_batch_set_max_size(handle->loop, 1));
+  ASSERT_EQ(UV_EBUSY, uv_batch_set_max_size(handle->loop, 500));
+}
+
+
+static void start_polls(uv_loop_t* loop, int n, uv_poll_cb cb) {
+  int i;
+
+  for (i = 0; i < n; i++) {
+    ASSERT_OK(uv_poll_init(loop, &poll_handles[i], fds[i][0]));
+    ASSERT_OK(uv_poll_start(&poll_handles[i], UV_READABLE, cb));
+  }
+}
+
+
+static void close_polls(int n) {
+  int i;
+
+  for (i = 0; i < n; i++)
+    uv_close((uv_handle_t*) &poll_handles[i], close_cb);
+}
+
+
+TEST_IMPL(event_batch_io_nowait) {
+#ifndef __linux__
+  RETURN_SKIP("Readiness batching is only implemented on Linux.");
+#else
+  uv_loop_t loop;
+  int i;
+
+  make_pairs();
+  ASSERT_OK(uv_loop_init(&loop));
+  ASSERT_OK(uv_batch_set_timeout(&loop, 50));
+  uv_batch_enable(&loop);
+
+  start_polls(&loop, NUM_PAIRS, poll_cb);
+  for (i = 0; i < NUM_PAIRS; i++)
+    send_byte(i);
+
+  /* A non-blocking run doesn't hold events back. */
+  poll_cb_called = 0;
+  ASSERT_EQ(1, uv_run(&loop, UV_RUN_NOWAIT));
+  ASSERT_EQ(NUM_PAIRS, poll_cb_called);
+
+  close_polls(NUM_PAIRS);
+  ASSERT_OK(uv_run(&loop, UV_RUN_DEFAULT));
+  ASSERT_EQ(NUM_PAIRS, close_cb_called);
+
+  close_pairs();
+  MAKE_VALGRIND_HAPPY(&loop);
+  return 0;
+#endif
+}
+
+
+TEST_IMPL(event_batch_io_window) {
+#ifndef __linux__
+  RETURN_SKIP("Readiness batching is only implemented on Linux.");
+#else
+  uv_loop_t loop;
+  uint64_t start;
+
+  make_pairs();
+  ASSERT_OK(uv_loop_init(&loop));
+  ASSERT_OK(uv_batch_set_timeout(&loop, 50));
+  uv_batch_enable(&loop);
+
+  start_polls(&loop, 1, poll_cb);
+  send_byte(0);
+
+  /* The byte is never read so epoll keeps reporting the fd while the batch
+   * window is open. It must be coalesced into a single callback that runs
+   * once the window closes.
+   */
+  poll_cb_called = 0;
+  start = uv_hrtime();
+  ASSERT_EQ(1, uv_run(&loop, UV_RUN_ONCE));
+  ASSERT_EQ(1, poll_cb_called);
+  ASSERT_GE(uv_hrtime() - start, 40 * 1000 * 1000);
+
+  /* A full batch is dispatched without waiting for the window. */
+  uv_batch_disable(&loop);
+  close_polls(1);
+  ASSERT_OK(uv_run(&loop, UV_RUN_DEFAULT));
+  ASSERT_OK(uv_batch_set_max_size(&loop, 2));
+  ASSERT_OK(uv_batch_set_timeout(&loop, 100));
+  uv_batch_enable(&loop);
+
+  start_polls(&loop, 2, poll_cb);
+  send_byte(1);
+  poll_cb_called = 0;
+  ASSERT_EQ(1, uv_run(&loop, UV_RUN_ONCE));
+  ASSERT_EQ(2, poll_cb_called);
+
+  close_polls(2);
+  ASSERT_OK(uv_run(&loop, UV_RUN_DEFAULT));
+  ASSERT_EQ(3, close_cb_called);
+
+  close_pairs();
+  MAKE_VALGRIND_HAPPY(&loop);
+  return 0;
+#endif
+}
+
+
+static void send_byte_thread(void* arg) {
+  uv_sleep(10);
+  send_byte(1);
+}
+
+
+TEST_IMPL(event_batch_io_fill) {
+#ifndef __linux__
+  RETURN_SKIP("Readiness batching is only implemented on Linux.");
+#else
+  uv_batch_stats_t stats;
+  uv_metrics_t metrics;
+  uv_thread_t thread;
+  uv_loop_t loop;
+  uint64_t start;
+
+  make_pairs();
+  ASSERT_OK(uv_loop_init(&loop));
+  ASSERT_OK(uv_batch_set_max_size(&loop, 2));
+  ASSERT_OK(uv_batch_set_timeout(&loop, 100));
+  uv_batch_enable(&loop);
+
+  start_polls(&loop, 2, poll_cb);
+  send_byte(0);
+
+  /* The second fd becomes ready while the window is open. That fills the
+   * batch, which is dispatched right away instead of when the window closes.
+   */
+  poll_cb_called = 0;
+  start = uv_hrtime();
+  ASSERT_OK(uv_thread_create(&thread, send_byte_thread, NULL));
+  ASSERT_EQ(1, uv_run(&loop, UV_RUN_ONCE));
+  ASSERT_EQ(2, poll_cb_called);
+  ASSERT_LT(uv_hrtime() - start, 80 * 1000 * 1000);
+  ASSERT_OK(uv_thread_join(&thread));
+
+  ASSERT_OK(uv_batch_get_stats(&loop, &stats));
+  ASSERT_EQ(1, stats.flushes[UV_BATCH_FLUSH_FULL]);
+
+  /* The first fd is reported by every poll of the window, it still only
+   * counts as one event.
+   */
+  ASSERT_OK(uv_metrics_info(&loop, &metrics));
+  ASSERT_EQ(2, metrics.events);
+
+  close_cb_called = 0;
+  close_polls(2);
+  ASSERT_OK(uv_run(&loop, UV_RUN_DEFAULT));
+  ASSERT_EQ(2, close_cb_called);
+
+  close_pairs();
+  MAKE_VALGRIND_HAPPY(&loop);
+  return 0;
+#endif
+}
+
+
+TEST_IMPL(event_batch_io_close_staged) {
+#ifndef __linux__
+  RETURN_SKIP("Readiness batching is only implemented on Linux.");
+#else
+  uv_loop_t loop;
+
+  make_pairs();
+  ASSERT_OK(uv_loop_init(&loop));
+  ASSERT_OK(uv_batch_set_timeout(&loop, 10));
+  uv_batch_enable(&loop);
+
+  start_polls(&loop, 2, poll_close_other_cb);
+  send_byte(0);
+  send_byte(1);
+
+  poll_cb_called = 0;
+  close_cb_called = 0;
+  ASSERT_OK(uv_run(&loop, UV_RUN_DEFAULT));
+  ASSERT_EQ(1, poll_cb_called);
+  ASSERT_EQ(2, close_cb_called);
+
+  close_pairs();
+  MAKE_VALGRIND_HAPPY(&loop);
+  return 0;
+#endif
+}
+
+
+TEST_IMPL(event_batch_io_resize_busy) {
+#ifndef __linux__
+  RETURN_SKIP("Readiness batching is only implemented on Linux.");
+#else
+  uv_loop_t loop;
+  int i;
+
+  make_pairs();
+  ASSERT_OK(uv_loop_init(&loop));
+  ASSERT_OK(uv_batch_set_timeout(&loop, 10));
+  uv_batch_enable(&loop);
+
+  start_polls(&loop, NUM_PAIRS, poll_resize_cb);
+  for (i = 0; i < NUM_PAIRS; i++)
+    send_byte(i);
+
+  poll_cb_called = 0;
+  ASSERT_EQ(1, uv_run(&loop, UV_RUN_ONCE));
+  ASSERT_EQ(NUM_PAIRS, poll_cb_called);
+
+  /* Outside of a dispatch the size can change again. */
+  close_cb_called = 0;
+  close_polls(NUM_PAIRS);
+  ASSERT_OK(uv_run(&loop, UV_RUN_DEFAULT));
+  ASSERT_EQ(NUM_PAIRS, close_cb_called);
+  ASSERT_OK(uv_batch_set_max_size(&loop, 500));
+
+  close_pairs();
+  MAKE_VALGRIND_HAPPY(&loop);
+  return 0;
+#endif
+}
+
+
+static uv_async_t wakeup_async;
+static int wakeup_cb_called;
+
+
+static void wakeup_cb(uv_async_t* handle) {
+  wakeup_cb_called++;
+  uv_close((uv_handle_t*) handle, close_cb);
+}
+
+
+static void wakeup_thread(void* arg) {
+  uv_sleep(10);
+  ASSERT_OK(uv_async_send(&wakeup_async));
+}
+
+
+TEST_IMPL(event_batch_io_wakeup) {
+#ifndef __linux__
+  RETURN_SKIP("Readiness batching is only implemented on Linux.");
+#else
+  uv_thread_t thread;
+  uv_loop_t loop;
+  uint64_t start;
+
+  make_pairs();
+  ASSERT_OK(uv_loop_init(&loop));
+  ASSERT_OK(uv_batch_set_timeout(&loop, 100));
+  uv_batch_enable(&loop);
+
+  ASSERT_OK(uv_async_init(&loop, &wakeup_async, wakeup_cb));
+  start_polls(&loop, 1, poll_cb);
+  send_byte(0);
+
+  /* The async handle cuts the batch window short. */
+  poll_cb_called = 0;
+  close_cb_called = 0;
+  start = uv_hrtime();
+  ASSERT_OK(uv_thread_create(&thread, wakeup_thread, NULL));
+  while (wakeup_cb_called == 0)
+    uv_run(&loop, UV_RUN_ONCE);
+  ASSERT_LT(uv_hrtime() - start, 80 * 1000 * 1000);
+  ASSERT_GE(poll_cb_called, 1);
+  ASSERT_OK(uv_thread_join(&thread));
+
+  close_polls(1);
+  ASSERT_OK(uv_run(&loop, UV_RUN_DEFAULT));
+  ASSERT_EQ(2, close_cb_called);
+
+  close_pairs();
+  MAKE_VALGRIND_HAPPY(&loop);
+  return 0;
+#endif
+}
+
+
+static int order[8];
+static int order_len;
+
+
+static void order_cb(void* data) {
+  order[order_len++] = *(int*) data;
+}
+
+
+TEST_IMPL(event_batch_priority_order) {
+  static const uv_batch_priority_t prios[] = {
+    UV_BATCH_PRIORITY_LOW,
+    UV_BATCH_PRIORITY_HIGH,
+    UV_BATCH_PRIORITY_NORMAL,
+    UV_BATCH_PRIORITY_HIGH,
+    UV_BATCH_PRIORITY_LOW,
+    UV_BATCH_PRIORITY_NORMAL,
+  };
+  static const int expected[] = { 1, 3, 2, 5, 0, 4 };
+  uv_loop_t loop;
+  int i;
+
+  ASSERT_OK(uv_loop_init(&loop));
+  ASSERT_OK(uv_batch_set_timeout(&loop, 1));
+
+  /* Events are rejected while batching is disabled. */
+  i = 0;
+  ASSERT_EQ(UV_EINVAL, uv_batch_add_event(&loop,
+                                          UV_BATCH_WORK_EVENT,
+                                          UV_BATCH_PRIORITY_NORMAL,
+                                          &i,
+                                          sizeof(i),
+                                          order_cb));
+
+  uv_batch_enable(&loop);
+  for (i = 0; i < (int) ARRAY_SIZE(prios); i++)
+    ASSERT_OK(uv_batch_add_event(&loop,
+                                 UV_BATCH_WORK_EVENT,
+                                 prios[i],
+                                 &i,
+                                 sizeof(i),
+                                 order_cb));
+
+  /* Pending events keep the loop alive until the batch is dispatched. */
+  ASSERT_EQ(1, uv_loop_alive(&loop));
+  ASSERT_OK(uv_run(&loop, UV_RUN_DEFAULT));
+
+  /* Highest priority first, arrival order within a priority. */
+  ASSERT_EQ(ARRAY_SIZE(expected), order_len);
+  for (i = 0; i < order_len; i++)
+    ASSERT_EQ(expected[i], order[i]);
+
+  MAKE_VALGRIND_HAPPY(&loop);
+  return 0;
+}
+
+
+TEST_IMPL(event_batch_cleanup) {
+  uv_loop_t loop;
+  int i;
+
+  ASSERT_OK(uv_loop_init(&loop));
+  uv_batch_enable(&loop);
+
+  order_len = 0;
+  i = 0;
+  ASSERT_OK(uv_batch_add_event(&loop,
+                               UV_BATCH_WORK_EVENT,
+                               UV_BATCH_PRIORITY_NORMAL,
+                               &i,
+                               sizeof(i),
+                               order_cb));
+
+  /* Pending events are dispatched and the batch system's handles are gone
+   * from the loop, which has to keep running without them.
+   */
+  uv_batch_cleanup(&loop);
+  ASSERT_EQ(1, order_len);
+  ASSERT_OK(uv_loop_alive(&loop));
+  ASSERT_OK(uv_run(&loop, UV_RUN_DEFAULT));
+
+  /* Enabling batching again sets it up from scratch. */
+  uv_batch_enable(&loop);
+  i = 1;
+  ASSERT_OK(uv_batch_add_event(&loop,
+                               UV_BATCH_WORK_EVENT,
+                               UV_BATCH_PRIORITY_NORMAL,
+                               &i,
+                               sizeof(i),
+                               order_cb));
+  ASSERT_OK(uv_run(&loop, UV_RUN_DEFAULT));
+  ASSERT_EQ(2, order_len);
+  ASSERT_EQ(1, order[1]);
+
+  MAKE_VALGRIND_HAPPY(&loop);
+  return 0;
+}
+
+
+static char big_payload[256];
+static int payload_cb_called;
+
+
+static void payload_cb(void* data) {
+  if (payload_cb_called++ == 0)
+    ASSERT_OK(memcmp(data, big_payload, sizeof(big_payload)));
+  else
+    ASSERT_EQ(42, *(int*) data);
+}
+
+
+TEST_IMPL(event_batch_payload) {
+  uv_loop_t loop;
+  size_t i;
+  int small;
+
+  for (i = 0; i < sizeof(big_payload); i++)
+    big_payload[i] = (char) i;
+
+  ASSERT_OK(uv_loop_init(&loop));
+  ASSERT_OK(uv_batch_set_timeout(&loop, 0));
+  uv_batch_enable(&loop);
+
+  /* Payloads too big for the inline storage get copied to the heap. */
+  ASSERT_OK(uv_batch_add_event(&loop,
+                               UV_BATCH_FS_EVENT,
+                               UV_BATCH_PRIORITY_HIGH,
+                               big_payload,
+                               sizeof(big_payload),
+                               payload_cb));
+
+  /* The event owns a copy of the data. */
+  small = 42;
+  ASSERT_OK(uv_batch_add_event(&loop,
+                               UV_BATCH_FS_EVENT,
+                               UV_BATCH_PRIORITY_LOW,
+                               &small,
+                               sizeof(small),
+                               payload_cb));
+  small = 0;
+
+  ASSERT_OK(uv_run(&loop, UV_RUN_DEFAULT));
+  ASSERT_EQ(2, payload_cb_called);
+
+  MAKE_VALGRIND_HAPPY(&loop);
+  return 0;
+}
+
+
+static uv_loop_t* requeue_loop;
+static int requeue_cb_called;
+static int requeue_left;
+
+
+static void requeue_cb(void* data) {
+  int value;
+
+  ASSERT_EQ(requeue_cb_called, *(int*) data);
+  requeue_cb_called++;
+  if (requeue_left == 0)
+    return;
+
+  /* Queued while the batch is resized, from a forced flush. */
+  requeue_left--;
+  value = requeue_cb_called;
+  ASSERT_OK(uv_batch_add_event(requeue_loop,
+                               UV_BATCH_WORK_EVENT,
+                               UV_BATCH_PRIORITY_NORMAL,
+                               &value,
+                               sizeof(value),
+                               requeue_cb));
+}
+
+
+TEST_IMPL(event_batch_resize_requeue) {
+  uv_loop_t loop;
+  int value;
+
+  ASSERT_OK(uv_loop_init(&loop));
+  ASSERT_OK(uv_batch_set_timeout(&loop, 50));
+  uv_batch_enable(&loop);
+  requeue_loop = &loop;
+
+  /* Events queued by the flushed callbacks are flushed as well. */
+  value = 0;
+  requeue_left = 3;
+  ASSERT_OK(uv_batch_add_event(&loop,
+                               UV_BATCH_WORK_EVENT,
+                               UV_BATCH_PRIORITY_NORMAL,
+                               &value,
+                               sizeof(value),
+                               requeue_cb));
+  ASSERT_OK(uv_batch_set_max_size(&loop, 16));
+  ASSERT_EQ(4, requeue_cb_called);
+
+  /* Callbacks that never stop queueing keep the old size. */
+  requeue_left = 1000;
+  value = requeue_cb_called;
+  ASSERT_OK(uv_batch_add_event(&loop,
+                               UV_BATCH_WORK_EVENT,
+                               UV_BATCH_PRIORITY_NORMAL,
+                               &value,
+                               sizeof(value),
+                               requeue_cb));
+  ASSERT_EQ(UV_EBUSY, uv_batch_set_max_size(&loop, 32));
+  ASSERT_GT(requeue_cb_called, 4);
+
+  requeue_left = 0;
+  ASSERT_OK(uv_run(&loop, UV_RUN_DEFAULT));
+  ASSERT_OK(uv_batch_set_max_size(&loop, 32));
+
+  MAKE_VALGRIND_HAPPY(&loop);
+  return 0;
+}
+
+
+static int adaptive_cb_called;
+
+
+static void adaptive_cb(void* data) {
+  adaptive_cb_called++;
+}
+
+
+TEST_IMPL(event_batch_adaptive) {
+  uv_batch_config_t config;
+  uv_loop_t loop;
+  uint64_t start;
+  int i;
+
+  ASSERT_OK(uv_loop_init(&loop));
+
+  config.batch_size = 64;
+  config.timeout_ms = 50;
+  config.flags = UV_BATCH_ADAPTIVE;
+  config.latency_us = 10 * 1000 * 1000;
+  ASSERT_EQ(UV_EINVAL, uv_batch_configure(&loop, &config));
+
+  config.latency_us = 1000;
+  ASSERT_OK(uv_batch_configure(&loop, &config));
+  uv_batch_enable(&loop);
+
+  /* Without any traffic to batch with, events go out right away. */
+  i = 0;
+  ASSERT_OK(uv_batch_add_event(&loop,
+                               UV_BATCH_WORK_EVENT,
+                               UV_BATCH_PRIORITY_NORMAL,
+                               &i,
+                               sizeof(i),
+                               adaptive_cb));
+  ASSERT_EQ(1, adaptive_cb_called);
+
+  /* A burst makes the controller hold events back and dispatch them in
+   * batches, the last one of which is still pending.
+   */
+  adaptive_cb_called = 0;
+  for (i = 0; i < 1000; i++)
+    ASSERT_OK(uv_batch_add_event(&loop,
+                                 UV_BATCH_WORK_EVENT,
+                                 UV_BATCH_PRIORITY_NORMAL,
+                                 &i,
+                                 sizeof(i),
+                                 adaptive_cb));
+  ASSERT_LT(adaptive_cb_called, 1000);
+
+  /* The rest goes out well within the configured timeout. */
+  start = uv_hrtime();
+  ASSERT_OK(uv_run(&loop, UV_RUN_DEFAULT));
+  ASSERT_EQ(1000, adaptive_cb_called);
+  ASSERT_LT(uv_hrtime() - start, 40 * 1000 * 1000);
+
+#ifdef __linux__
+  /* Same for readiness events when the loop is otherwise idle. */
+  make_pairs();
+  start_polls(&loop, 1, poll_cb);
+  send_byte(0);
+
+  poll_cb_called = 0;
+  start = uv_hrtime();
+  ASSERT_EQ(1, uv_run(&loop, UV_RUN_ONCE));
+  ASSERT_EQ(1, poll_cb_called);
+  ASSERT_LT(uv_hrtime() - start, 40 * 1000 * 1000);
+
+  close_cb_called = 0;
+  close_polls(1);
+  ASSERT_OK(uv_run(&loop, UV_RUN_DEFAULT));
+  ASSERT_EQ(1, close_cb_called);
+  close_pairs();
+#endif
+
+  MAKE_VALGRIND_HAPPY(&loop);
+  return 0;
+}
+
+
+/* Ticks of BURST_PERIOD ms, bursts of BURST_EVENTS events per tick go on and
+ * off every BURST_LENGTH ticks. Handling what produces an event takes
+ * BURST_WORK_NS, so the loop is busy for 2 ms of every tick during a burst.
+ */
+#define BURST_TICKS 200
+#define BURST_PERIOD 5
+#define BURST_LENGTH 10
+#define BURST_EVENTS 20
+#define BURST_WORK_NS (100 * 1000)
+#define BURST_BOUND_US 6000
+
+static uv_timer_t burst_timer;
+static uv_loop_t* burst_loop;
+static int burst_ticks;
+
+
+static void burst_event_cb(void* data) {
+}
+
+
+static void burst_cb(uv_timer_t* handle) {
+  uint64_t start;
+  int i;
+
+  burst_ticks++;
+  if (burst_ticks == BURST_TICKS / 2)
+    uv_batch_reset_stats(burst_loop);
+
+  if (burst_ticks == BURST_TICKS) {
+    uv_close((uv_handle_t*) handle, NULL);
+    return;
+  }
+
+  /* The loop can be busy when a batch is due, which the controller's model
+   * doesn't know about.
+   */
+  if ((burst_ticks / BURST_LENGTH) % 2 == 1)
+    return;
+
+  for (i = 0; i < BURST_EVENTS; i++) {
+    ASSERT_OK(uv_batch_add_event(burst_loop,
+                                 UV_BATCH_WORK_EVENT,
+                                 UV_BATCH_PRIORITY_NORMAL,
+                                 &i,
+                                 sizeof(i),
+                                 burst_event_cb));
+    start = uv_hrtime();
+    while (uv_hrtime() - start < BURST_WORK_NS)
+      ;
+  }
+}
+
+
+TEST_IMPL(event_batch_adaptive_p99) {
+  uv_batch_config_t config;
+  uv_batch_stats_t stats;
+  uv_loop_t loop;
+
+  ASSERT_OK(uv_loop_init(&loop));
+  burst_loop = &loop;
+
+  config.batch_size = 1000;
+  config.timeout_ms = 50;
+  config.flags = UV_BATCH_ADAPTIVE;
+  config.latency_us = BURST_BOUND_US;
+  ASSERT_OK(uv_batch_configure(&loop, &config));
+  uv_batch_enable(&loop);
+
+  ASSERT_OK(uv_timer_init(&loop, &burst_timer));
+  ASSERT_OK(uv_timer_start(&burst_timer, burst_cb, BURST_PERIOD, BURST_PERIOD));
+  ASSERT_OK(uv_run(&loop, UV_RUN_DEFAULT));
+
+  /* The second half runs with the controller settled. Events still go out
+   * in batches and the p99 stays within the bound, give or take the width of
+   * its histogram bucket.
+   */
+  ASSERT_OK(uv_batch_get_stats(&loop, &stats));
+  ASSERT_GT(stats.max_batch_size, 1);
+  ASSERT_LE(stats.latency_p99, BURST_BOUND_US * 1000 * 9 / 8);
+
+  MAKE_VALGRIND_HAPPY(&loop);
+  return 0;
+}
+
+
+TEST_IMPL(event_batch_timeout_us) {
+  uv_loop_t loop;
+  uint64_t elapsed;
+  uint64_t best;
+  uint64_t start;
+  int i;
+
+  ASSERT_OK(uv_loop_init(&loop));
+  ASSERT_EQ(UV_EINVAL, uv_batch_set_timeout_us(&loop, 100 * 1000 + 1));
+  ASSERT_OK(uv_batch_set_timeout_us(&loop, 300));
+  uv_batch_enable(&loop);
+
+  /* The event is held for the whole window, even though it's shorter than
+   * the resolution of the loop's timers.
+   */
+  adaptive_cb_called = 0;
+  i = 0;
+  start = uv_hrtime();
+  ASSERT_OK(uv_batch_add_event(&loop,
+                               UV_BATCH_WORK_EVENT,
+                               UV_BATCH_PRIORITY_NORMAL,
+                               &i,
+                               sizeof(i),
+                               adaptive_cb));
+  ASSERT_OK(uv_run(&loop, UV_RUN_DEFAULT));
+  ASSERT_EQ(1, adaptive_cb_called);
+  ASSERT_GE(uv_hrtime() - start, 300 * 1000);
+
+#ifdef __linux__
+  /* Readiness events are dispatched once the window closes, not on the
+   * next millisecond tick. Take the best of a few runs to tolerate
+   * scheduling noise.
+   */
+  make_pairs();
+  start_polls(&loop, 1, poll_cb);
+  send_byte(0);
+
+  best = UINT64_MAX;
+  poll_cb_called = 0;
+  for (i = 0; i < 5; i++) {
+    start = uv_hrtime();
+    ASSERT_EQ(1, uv_run(&loop, UV_RUN_ONCE));
+    elapsed = uv_hrtime() - start;
+    ASSERT_GE(elapsed, 300 * 1000);
+    if (elapsed < best)
+      best = elapsed;
+  }
+  ASSERT_EQ(5, poll_cb_called);
+  ASSERT_LT(best, 1000 * 1000);
+
+  close_cb_called = 0;
+  close_polls(1);
+  ASSERT_OK(uv_run(&loop, UV_RUN_DEFAULT));
+  ASSERT_EQ(1, close_cb_called);
+  close_pairs();
+#else
+  (void) elapsed;
+  (void) best;
+#endif
+
+  MAKE_VALGRIND_HAPPY(&loop);
+  return 0;
+}
+
+
+TEST_IMPL(event_batch_stats) {
+  uv_batch_stats_t stats;
+  uv_loop_t loop;
+  int i;
+
+  ASSERT_OK(uv_loop_init(&loop));
+  ASSERT_EQ(UV_EINVAL, uv_batch_get_stats(&loop, NULL));
+  ASSERT_OK(uv_batch_set_max_size(&loop, 4));
+  ASSERT_OK(uv_batch_set_timeout(&loop, 1));
+  uv_batch_enable(&loop);
+
+  /* Two full batches go out straight away, the rest when the timeout
+   * expires.
+   */
+  adaptive_cb_called = 0;
+  for (i = 0; i < 10; i++)
+    ASSERT_OK(uv_batch_add_event(&loop,
+                                 i < 3 ? UV_BATCH_FS_EVENT : UV_BATCH_WORK_EVENT,
+                                 UV_BATCH_PRIORITY_NORMAL,
+                                 &i,
+                                 sizeof(i),
+                                 adaptive_cb));
+  ASSERT_EQ(8, adaptive_cb_called);
+  ASSERT_OK(uv_run(&loop, UV_RUN_DEFAULT));
+  ASSERT_EQ(10, adaptive_cb_called);
+
+  ASSERT_OK(uv_batch_get_stats(&loop, &stats));
+  ASSERT_EQ(10, stats.total_events_processed);
+  ASSERT_EQ(3, stats.events_by_type[UV_BATCH_FS_EVENT]);
+  ASSERT_EQ(7, stats.events_by_type[UV_BATCH_WORK_EVENT]);
+  ASSERT_EQ(3, stats.total_batches);
+  ASSERT_EQ(2, stats.flushes[UV_BATCH_FLUSH_FULL]);
+  ASSERT_EQ(1, stats.flushes[UV_BATCH_FLUSH_TIMEOUT]);
+  ASSERT_EQ(3, stats.avg_batch_size);
+  ASSERT_EQ(4, stats.max_batch_size);
+  ASSERT_EQ(1, stats.batch_size_hist[1]);
+  ASSERT_EQ(2, stats.batch_size_hist[2]);
+
+  /* The two events that waited for the timeout make up the tail. */
+  ASSERT_GE(stats.max_latency, 1000 * 1000);
+  ASSERT_LE(stats.latency_p50, stats.latency_p99);
+  ASSERT_LE(stats.latency_p99, stats.latency_p999);
+  ASSERT_LE(stats.latency_p999, stats.max_latency);
+  ASSERT_GE(stats.latency_p999, stats.max_latency - stats.max_latency / 8);
+  ASSERT_LT(stats.latency_p50, 1000 * 1000);
+  ASSERT_EQ(stats.latency_p50, uv_batch_stats_percentile(&stats, 50.0));
+
+  uv_batch_reset_stats(&loop);
+  ASSERT_OK(uv_batch_get_stats(&loop, &stats));
+  ASSERT_OK(stats.total_events_processed);
+  ASSERT_OK(stats.total_batches);
+  ASSERT_OK(stats.latency_p99);
+
+  MAKE_VALGRIND_HAPPY(&loop);
+  return 0;
+}
+
+
+#define SUBMIT_THREADS 4
+#define SUBMIT_EVENTS 10000
+
+typedef struct {
+  unsigned int producer;
+  unsigned int seq;
+} submit_event_t;
+
+static uv_loop_t submit_loop;
+static uv_async_t submit_keepalive;
+static unsigned int submit_next[SUBMIT_THREADS];
+static unsigned int submit_cb_called;
+
+
+static void submit_cb(void* data) {
+  submit_event_t* e;
+
+  e = data;
+  ASSERT_LT(e->producer, SUBMIT_THREADS);
+  ASSERT_EQ(e->seq, submit_next[e->producer]);
+  submit_next[e->producer]++;
+
+  if (++submit_cb_called == SUBMIT_THREADS * SUBMIT_EVENTS)
+    uv_close((uv_handle_t*) &submit_keepalive, NULL);
+}
+
+
+static void submit_thread(void* arg) {
+  submit_event_t e;
+
+  e.producer = (unsigned int) (uintptr_t) arg;
+  for (e.seq = 0; e.seq < SUBMIT_EVENTS; e.seq++)
+    ASSERT_OK(uv_batch_submit(&submit_loop,
+                              UV_BATCH_WORK_EVENT,
+                              UV_BATCH_PRIORITY_NORMAL,
+                              &e,
+                              sizeof(e),
+                              submit_cb));
+}
+
+
+TEST_IMPL(event_batch_submit) {
+  uv_thread_t threads[SUBMIT_THREADS];
+  uv_batch_stats_t stats;
+  uintptr_t i;
+
+  ASSERT_OK(uv_loop_init(&submit_loop));
+  ASSERT_OK(uv_batch_set_timeout_us(&submit_loop, 200));
+  uv_batch_enable(&submit_loop);
+
+  /* The submission wakeup doesn't keep the loop alive by itself. */
+  ASSERT_OK(uv_async_init(&submit_loop, &submit_keepalive, NULL));
+
+  for (i = 0; i < SUBMIT_THREADS; i++)
+    ASSERT_OK(uv_thread_create(&threads[i], submit_thread, (void*) i));
+
+  /* Events from each producer are dispatched in submission order. */
+  ASSERT_OK(uv_run(&submit_loop, UV_RUN_DEFAULT));
+  ASSERT_EQ(SUBMIT_THREADS * SUBMIT_EVENTS, submit_cb_called);
+
+  for (i = 0; i < SUBMIT_THREADS; i++)
+    ASSERT_OK(uv_thread_join(&threads[i]));
+
+  ASSERT_OK(uv_batch_get_stats(&submit_loop, &stats));
+  ASSERT_EQ(SUBMIT_THREADS * SUBMIT_EVENTS,
+            stats.events_by_type[UV_BATCH_WORK_EVENT]);
+
+  MAKE_VALGRIND_HAPPY(&submit_loop);
+  return 0;
+}
+
+
+static int policy_order[16];
+static int policy_cb_called;
+
+static void policy_cb(void* data) {
+  ASSERT_LT(policy_cb_called, ARRAY_SIZE(policy_order));
+  policy_order[policy_cb_called++] = *(int*) data;
+}
+
+
+static void policy_add(uv_loop_t* loop, uv_batch_event_type_t type, int value) {
+  ASSERT_OK(uv_batch_add_event(loop,
+                               type,
+                               UV_BATCH_PRIORITY_NORMAL,
+                               &value,
+                               sizeof(value),
+                               policy_cb));
+}
+
+
+TEST_IMPL(event_batch_policy) {
+  uv_batch_policy_t policy;
+  uv_batch_stats_t stats;
+  uv_loop_t loop;
+  uint64_t start;
+  int i;
+
+  ASSERT_OK(uv_loop_init(&loop));
+  ASSERT_OK(uv_batch_set_max_size(&loop, 16));
+  ASSERT_OK(uv_batch_set_timeout(&loop, 50));
+
+  policy.batch_size = 0;
+  policy.timeout_us = 0;
+  ASSERT_EQ(UV_EINVAL, uv_batch_set_policy(&loop, UV_BATCH_FS_EVENT, &policy));
+  policy.batch_size = 17;
+  ASSERT_EQ(UV_EINVAL, uv_batch_set_policy(&loop, UV_BATCH_FS_EVENT, &policy));
+  policy.batch_size = 8;
+  policy.timeout_us = 100 * 1000 + 1;
+  ASSERT_EQ(UV_EINVAL, uv_batch_set_policy(&loop, UV_BATCH_FS_EVENT, &policy));
+  policy.timeout_us = 5000;
+  ASSERT_EQ(UV_EINVAL,
+            uv_batch_set_policy(&loop, UV_BATCH_MAX_EVENT_TYPE, &policy));
+
+  /* FS completions are batched for 5 ms, network events go out right away
+   * and everything else waits for the loop wide 50 ms timeout.
+   */
+  ASSERT_OK(uv_batch_set_policy(&loop, UV_BATCH_FS_EVENT, &policy));
+  policy.batch_size = 1;
+  policy.timeout_us = 0;
+  ASSERT_OK(uv_batch_set_policy(&loop, UV_BATCH_NET_EVENT, &policy));
+  uv_batch_enable(&loop);
+
+  start = uv_hrtime();
+  policy_add(&loop, UV_BATCH_FS_EVENT, 1);
+  policy_add(&loop, UV_BATCH_WORK_EVENT, 2);
+  policy_add(&loop, UV_BATCH_FS_EVENT, 3);
+  ASSERT_OK(policy_cb_called);
+  policy_add(&loop, UV_BATCH_NET_EVENT, 4);
+  ASSERT_EQ(1, policy_cb_called);
+  ASSERT_EQ(4, policy_order[0]);
+
+  ASSERT_EQ(1, uv_run(&loop, UV_RUN_ONCE));
+  ASSERT_EQ(3, policy_cb_called);
+  ASSERT_EQ(1, policy_order[1]);
+  ASSERT_EQ(3, policy_order[2]);
+  ASSERT_LT(uv_hrtime() - start, 50 * 1000 * 1000);
+
+  ASSERT_OK(uv_run(&loop, UV_RUN_DEFAULT));
+  ASSERT_EQ(4, policy_cb_called);
+  ASSERT_EQ(2, policy_order[3]);
+  ASSERT_GE(uv_hrtime() - start, 50 * 1000 * 1000);
+
+  ASSERT_OK(uv_batch_get_stats(&loop, &stats));
+  ASSERT_EQ(3, stats.total_batches);
+  ASSERT_EQ(1, stats.flushes[UV_BATCH_FLUSH_FULL]);
+  ASSERT_EQ(2, stats.flushes[UV_BATCH_FLUSH_TIMEOUT]);
+  ASSERT_EQ(1, stats.type_flushes[UV_BATCH_NET_EVENT][UV_BATCH_FLUSH_FULL]);
+  ASSERT_EQ(1, stats.type_flushes[UV_BATCH_FS_EVENT][UV_BATCH_FLUSH_TIMEOUT]);
+  for (i = 0; i < UV_BATCH_FLUSH_REASON_MAX; i++)
+    ASSERT_OK(stats.type_flushes[UV_BATCH_WORK_EVENT][i]);
+
+  /* Shrinking the batch clamps the FS policy to the new capacity. */
+  ASSERT_OK(uv_batch_set_max_size(&loop, 2));
+  policy_cb_called = 0;
+  policy_add(&loop, UV_BATCH_FS_EVENT, 5);
+  ASSERT_OK(policy_cb_called);
+  policy_add(&loop, UV_BATCH_FS_EVENT, 6);
+  ASSERT_EQ(2, policy_cb_called);
+
+  /* Without a policy network events are batched like the rest. */
+  ASSERT_OK(uv_batch_set_policy(&loop, UV_BATCH_NET_EVENT, NULL));
+  policy_add(&loop, UV_BATCH_NET_EVENT, 7);
+  policy_add(&loop, UV_BATCH_WORK_EVENT, 8);
+  ASSERT_EQ(4, policy_cb_called);
+  ASSERT_EQ(7, policy_order[2]);
+  ASSERT_EQ(8, policy_order[3]);
+
+  ASSERT_OK(uv_batch_get_stats(&loop, &stats));
+  ASSERT_EQ(1, stats.type_flushes[UV_BATCH_NET_EVENT][UV_BATCH_FLUSH_FULL]);
+  ASSERT_EQ(1, stats.type_flushes[UV_BATCH_FS_EVENT][UV_BATCH_FLUSH_FULL]);
+
+  ASSERT_OK(uv_run(&loop, UV_RUN_DEFAULT));
+  MAKE_VALGRIND_HAPPY(&loop);
+  return 0;
+}
+
+
+static void locality_a_cb(void* data) {
+  policy_cb(data);
+}
+
+
+TEST_IMPL(event_batch_locality) {
+  static const int grouped[] = { 6, 1, 3, 2, 5, 4 };
+  static const int added[] = { 6, 1, 2, 3, 4, 5 };
+  uv_batch_config_t config;
+  uv_loop_t loop;
+  const int* expected;
+  int pass;
+  int i;
+
+  ASSERT_OK(uv_loop_init(&loop));
+  uv_batch_enable(&loop);
+
+  config.batch_size = 16;
+  config.timeout_ms = 1;
+  config.latency_us = 0;
+
+  for (pass = 0; pass < 2; pass++) {
+    config.flags = pass ? UV_BATCH_LOCALITY : 0;
+    ASSERT_OK(uv_batch_configure(&loop, &config));
+    policy_cb_called = 0;
+
+    /* The same callback under another type is a separate group and the
+     * high priority event still goes first.
+     */
+    i = 1;
+    ASSERT_OK(uv_batch_add_event(&loop, UV_BATCH_WORK_EVENT,
+                                 UV_BATCH_PRIORITY_NORMAL,
+                                 &i, sizeof(i), locality_a_cb));
+    i = 2;
+    ASSERT_OK(uv_batch_add_event(&loop, UV_BATCH_FS_EVENT,
+                                 UV_BATCH_PRIORITY_NORMAL,
+                                 &i, sizeof(i), policy_cb));
+    i = 3;
+    ASSERT_OK(uv_batch_add_event(&loop, UV_BATCH_WORK_EVENT,
+                                 UV_BATCH_PRIORITY_NORMAL,
+                                 &i, sizeof(i), locality_a_cb));
+    i = 4;
+    ASSERT_OK(uv_batch_add_event(&loop, UV_BATCH_WORK_EVENT,
+                                 UV_BATCH_PRIORITY_NORMAL,
+                                 &i, sizeof(i), policy_cb));
+    i = 5;
+    ASSERT_OK(uv_batch_add_event(&loop, UV_BATCH_FS_EVENT,
+                                 UV_BATCH_PRIORITY_NORMAL,
+                                 &i, sizeof(i), policy_cb));
+    i = 6;
+    ASSERT_OK(uv_batch_add_event(&loop, UV_BATCH_NET_EVENT,
+                                 UV_BATCH_PRIORITY_HIGH,
+                                 &i, sizeof(i), policy_cb));
+
+    ASSERT_OK(uv_run(&loop, UV_RUN_DEFAULT));
+    ASSERT_EQ(6, policy_cb_called);
+
+    expected = pass ? grouped : added;
+    for (i = 0; i < 6; i++)
+      ASSERT_EQ(expected[i], policy_order[i]);
+  }
+
+  MAKE_VALGRIND_HAPPY(&loop);
+  return 0;
+}
@@ -98,7 +98,10 @@ TEST_DECLARE   (tcp6_ping_pong)
 TEST_DECLARE   (tcp6_ping_pong_vec)
 TEST_DECLARE   (pipe_ping_pong)
 TEST_DECLARE   (pipe_ping_pong_vec)
+TEST_DECLARE   (tcp_ping_pong_io_uring)
+TEST_DECLARE   (pipe_ping_pong_io_uring)
 TEST_DECLARE   (delayed_accept)
+TEST_DECLARE   (delayed_accept_io_uring)
 TEST_DECLARE   (multiple_listen)
 #ifndef _WIN32
 TEST_DECLARE   (tcp_write_after_connect)
@@ -109,6 +112,11 @@ TEST_DECLARE   (tcp_try_write)
 TEST_DECLARE   (tcp_write_in_a_row)
 TEST_DECLARE   (tcp_try_write_error)
 TEST_DECLARE   (tcp_write_queue_order)
+TEST_DECLARE   (tcp_write_cork)
+TEST_DECLARE   (tcp_write_cork_close)
+TEST_DECLARE   (tcp_zerocopy)
+TEST_DECLARE   (tcp_zerocopy_close)
+TEST_DECLARE   (tcp_zerocopy_close_wait)
 TEST_DECLARE   (tcp_open)
 TEST_DECLARE   (tcp_open_twice)
 TEST_DECLARE   (tcp_open_bound)
@@ -144,6 +152,7 @@ TEST_DECLARE   (tcp_create_early)
 TEST_DECLARE   (tcp_create_early_bad_bind)
 TEST_DECLARE   (tcp_create_early_bad_domain)
 TEST_DECLARE   (tcp_create_early_accept)
+TEST_DECLARE   (tcp_edge_triggered)
 #ifndef _WIN32
 TEST_DECLARE   (tcp_close_accept)
 TEST_DECLARE   (tcp_oob)
@@ -151,6 +160,13 @@ TEST_DECLARE   (tcp_oob)
 TEST_DECLARE   (tcp_flags)
 TEST_DECLARE   (tcp_write_to_half_open_connection)
 TEST_DECLARE   (tcp_unexpected_read)
+TEST_DECLARE   (tcp_read_pooled)
+TEST_DECLARE   (tcp_read_pooled_io_uring)
+TEST_DECLARE   (tcp_read_pooled_stop)
+TEST_DECLARE   (tcp_read_v)
+TEST_DECLARE   (tcp_read_budget)
+TEST_DECLARE   (tcp_read_budget_eof)
+TEST_DECLARE   (tcp_read_budget_order)
 TEST_DECLARE   (tcp_read_stop)
 TEST_DECLARE   (tcp_read_stop_start)
 TEST_DECLARE   (tcp_reuseport)
@@ -279,6 +295,23 @@ TEST_DECLARE   (process_priority)
 TEST_DECLARE   (has_ref)
 TEST_DECLARE   (active)
 TEST_DECLARE   (embed)
+TEST_DECLARE   (event_batch_io_nowait)
+TEST_DECLARE   (event_batch_io_window)
+TEST_DECLARE   (event_batch_io_fill)
+TEST_DECLARE   (event_batch_io_close_staged)
+TEST_DECLARE   (event_batch_io_resize_busy)
+TEST_DECLARE   (event_batch_io_wakeup)
+TEST_DECLARE   (event_batch_priority_order)
+TEST_DECLARE   (event_batch_cleanup)
+TEST_DECLARE   (event_batch_payload)
+TEST_DECLARE   (event_batch_resize_requeue)
+TEST_DECLARE   (event_batch_adaptive)
+TEST_DECLARE   (event_batch_adaptive_p99)
+TEST_DECLARE   (event_batch_timeout_us)
+TEST_DECLARE   (event_batch_stats)
+TEST_DECLARE   (event_batch_submit)
+TEST_DECLARE   (event_batch_policy)
+TEST_DECLARE   (event_batch_locality)
 TEST_DECLARE   (async)
 TEST_DECLARE   (async_null_cb)
 TEST_DECLARE   (eintr_handling)
@@ -458,6 +491,15 @@ TEST_DECLARE   (strscpy)
 TEST_DECLARE   (strtok)
 TEST_DECLARE   (threadpool_queue_work_simple)
 TEST_DECLARE   (threadpool_queue_work_einval)
+TEST_DECLARE   (threadpool_work_stealing)
+TEST_DECLARE   (threadpool_work_stealing_loop)
+TEST_DECLARE   (threadpool_queue_work_batch)
+TEST_DECLARE   (threadpool_dynamic_size)
+TEST_DECLARE   (threadpool_metrics)
+TEST_DECLARE   (threadpool_priority)
+TEST_DECLARE   (threadpool_priority_steal)
+TEST_DECLARE   (threadpool_priority_steal_loop)
+TEST_DECLARE   (threadpool_pin)
 TEST_DECLARE   (threadpool_multiple_event_loops)
 TEST_DECLARE   (threadpool_cancel_getaddrinfo)
 TEST_DECLARE   (threadpool_cancel_getnameinfo)
@@ -694,7 +736,14 @@ TASK_LIST_START
   TEST_ENTRY  (pipe_ping_pong_vec)
   TEST_HELPER (pipe_ping_pong_vec, pipe_echo_server)
 
+  TEST_ENTRY  (tcp_ping_pong_io_uring)
+  TEST_HELPER (tcp_ping_pong_io_uring, tcp4_echo_server)
+
+  TEST_ENTRY  (pipe_ping_pong_io_uring)
+  TEST_HELPER (pipe_ping_pong_io_uring, pipe_echo_server)
+
   TEST_ENTRY  (delayed_accept)
+  TEST_ENTRY  (delayed_accept_io_uring)
   TEST_ENTRY  (multiple_listen)
 
 #ifndef _WIN32
@@ -716,6 +765,11 @@ TASK_LIST_START
   TEST_ENTRY  (tcp_try_write_error)
 
   TEST_ENTRY  (tcp_write_queue_order)
+  TEST_ENTRY  (tcp_write_cork)
+  TEST_ENTRY  (tcp_write_cork_close)
+  TEST_ENTRY  (tcp_zerocopy)
+  TEST_ENTRY  (tcp_zerocopy_close)
+  TEST_ENTRY  (tcp_zerocopy_close_wait)
 
   TEST_ENTRY  (tcp_open)
   TEST_HELPER (tcp_open, tcp4_echo_server)
@@ -764,6 +818,7 @@ TASK_LIST_START
   TEST_ENTRY  (tcp_create_early_bad_bind)
   TEST_ENTRY  (tcp_create_early_bad_domain)
   TEST_ENTRY  (tcp_create_early_accept)
+  TEST_ENTRY  (tcp_edge_triggered)
 #ifndef _WIN32
   TEST_ENTRY  (tcp_close_accept)
   TEST_ENTRY  (tcp_oob)
@@ -772,6 +827,14 @@ TASK_LIST_START
   TEST_ENTRY  (tcp_write_to_half_open_connection)
   TEST_ENTRY  (tcp_unexpected_read)
 
+  TEST_ENTRY  (tcp_read_pooled)
+  TEST_ENTRY  (tcp_read_pooled_io_uring)
+  TEST_ENTRY  (tcp_read_pooled_stop)
+  TEST_ENTRY  (tcp_read_v)
+  TEST_ENTRY  (tcp_read_budget)
+  TEST_ENTRY  (tcp_read_budget_eof)
+  TEST_ENTRY  (tcp_read_budget_order)
+
   TEST_ENTRY  (tcp_read_stop)
   TEST_HELPER (tcp_read_stop, tcp4_echo_server)
 
@@ -925,6 +988,24 @@ TASK_LIST_START
 
   TEST_ENTRY  (embed)
 
+  TEST_ENTRY  (event_batch_io_nowait)
+  TEST_ENTRY  (event_batch_io_window)
+  TEST_ENTRY  (event_batch_io_fill)
+  TEST_ENTRY  (event_batch_io_close_staged)
+  TEST_ENTRY  (event_batch_io_resize_busy)
+  TEST_ENTRY  (event_batch_io_wakeup)
+  TEST_ENTRY  (event_batch_priority_order)
+  TEST_ENTRY  (event_batch_cleanup)
+  TEST_ENTRY  (event_batch_payload)
+  TEST_ENTRY  (event_batch_resize_requeue)
+  TEST_ENTRY  (event_batch_adaptive)
+  TEST_ENTRY  (event_batch_adaptive_p99)
+  TEST_ENTRY  (event_batch_timeout_us)
+  TEST_ENTRY  (event_batch_stats)
+  TEST_ENTRY  (event_batch_submit)
+  TEST_ENTRY  (event_batch_policy)
+  TEST_ENTRY  (event_batch_locality)
+
   TEST_ENTRY  (async)
   TEST_ENTRY  (async_null_cb)
   TEST_ENTRY  (eintr_handling)
@@ -1177,6 +1258,15 @@ TASK_LIST_START
   TEST_ENTRY  (strtok)
   TEST_ENTRY  (threadpool_queue_work_simple)
   TEST_ENTRY  (threadpool_queue_work_einval)
+  TEST_ENTRY  (threadpool_work_stealing)
+  TEST_ENTRY  (threadpool_work_stealing_loop)
+  TEST_ENTRY  (threadpool_queue_work_batch)
+  TEST_ENTRY  (threadpool_dynamic_size)
+  TEST_ENTRY  (threadpool_metrics)
+  TEST_ENTRY  (threadpool_priority)
+  TEST_ENTRY  (threadpool_priority_steal)
+  TEST_ENTRY  (threadpool_priority_steal_loop)
+  TEST_ENTRY  (threadpool_pin)
   TEST_ENTRY_CUSTOM (threadpool_multiple_event_loops, 0, 0, 60000)
   TEST_ENTRY  (threadpool_cancel_getaddrinfo)
   TEST_ENTRY  (threadpool_cancel_getnameinfo)
@@ -437,3 +437,34 @@ TEST_IMPL(pipe_ping_pong_vec) {
   pipe2_pinger_new(1);
   return run_ping_pong_test();
 }
+
+
+TEST_IMPL(tcp_ping_pong_io_uring) {
+#if !defined(__linux__)
+  RETURN_SKIP("io_uring is Linux only");
+#endif
+  ASSERT_OK(uv_loop_configure(uv_default_loop(),
+                              UV_LOOP_USE_IO_URING_STREAMS));
+  tcp_pinger_new(1);
+  run_ping_pong_test();
+
+  completed_pingers = 0;
+  socketpair_pinger_new(0);
+  return run_ping_pong_test();
+}
+
+
+TEST_IMPL(pipe_ping_pong_io_uring) {
+#if !defined(__linux__)
+  RETURN_SKIP("io_uring is Linux only");
+#endif
+  ASSERT_OK(uv_loop_configure(uv_default_loop(),
+                              UV_LOOP_USE_IO_URING_STREAMS));
+  pipe_pinger_new(1);
+  run_ping_pong_test();
+
+  /* uv_pipe() makes pipes, not sockets, they stay on epoll. */
+  completed_pingers = 0;
+  pipe2_pinger_new(0);
+  return run_ping_pong_test();
+}
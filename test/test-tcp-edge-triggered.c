@@ -0,0 +1,155 @@
+/* Copyright libuv project contributors. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "uv.h"
+#include "task.h"
+
+/* The reading side stops after every read and starts again from a timer, so
+ * data and the EOF arrive while it isn't reading and no new edge is reported
+ * for them.
+ */
+#define TRANSFER_SIZE (1024 * 1024)
+
+static uv_tcp_t server;
+static uv_tcp_t client;
+static uv_tcp_t peer;
+static uv_timer_t timer;
+static uv_connect_t connect_req;
+static uv_write_t write_req;
+static uv_shutdown_t shutdown_req;
+static char data[TRANSFER_SIZE];
+static char slab[16384];
+static size_t nread;
+static int read_restarts;
+static int shutdown_cb_called;
+static int eof_cb_called;
+static int close_cb_called;
+
+
+static void close_cb(uv_handle_t* handle) {
+  close_cb_called++;
+}
+
+
+static void alloc_cb(uv_handle_t* handle, size_t size, uv_buf_t* buf) {
+  buf->base = slab;
+  buf->len = sizeof(slab);
+}
+
+
+static void read_cb(uv_stream_t* stream, ssize_t n, const uv_buf_t* buf);
+
+
+static void timer_cb(uv_timer_t* handle) {
+  read_restarts++;
+  ASSERT_OK(uv_read_start((uv_stream_t*) &peer, alloc_cb, read_cb));
+}
+
+
+static void read_cb(uv_stream_t* stream, ssize_t n, const uv_buf_t* buf) {
+  if (n == UV_EOF) {
+    ASSERT_EQ(nread, TRANSFER_SIZE);
+    eof_cb_called++;
+    uv_close((uv_handle_t*) stream, close_cb);
+    uv_close((uv_handle_t*) &timer, close_cb);
+    uv_close((uv_handle_t*) &server, close_cb);
+    return;
+  }
+
+  ASSERT_GE(n, 0);
+  ASSERT_OK(memcmp(buf->base, data + nread, n));
+  nread += n;
+
+  if (n > 0) {
+    ASSERT_OK(uv_read_stop(stream));
+    ASSERT_OK(uv_timer_start(&timer, timer_cb, 1, 0));
+  }
+}
+
+
+static void connection_cb(uv_stream_t* stream, int status) {
+  ASSERT_OK(status);
+  ASSERT_OK(uv_tcp_init(stream->loop, &peer));
+  ASSERT_OK(uv_accept(stream, (uv_stream_t*) &peer));
+  ASSERT_OK(uv_read_start((uv_stream_t*) &peer, alloc_cb, read_cb));
+}
+
+
+static void shutdown_cb(uv_shutdown_t* req, int status) {
+  ASSERT_OK(status);
+  shutdown_cb_called++;
+  uv_close((uv_handle_t*) req->handle, close_cb);
+}
+
+
+static void write_cb(uv_write_t* req, int status) {
+  ASSERT_OK(status);
+}
+
+
+static void connect_cb(uv_connect_t* req, int status) {
+  uv_buf_t buf;
+
+  ASSERT_OK(status);
+
+  buf = uv_buf_init(data, sizeof(data));
+  ASSERT_OK(uv_write(&write_req, req->handle, &buf, 1, write_cb));
+  ASSERT_OK(uv_shutdown(&shutdown_req, req->handle, shutdown_cb));
+}
+
+
+TEST_IMPL(tcp_edge_triggered) {
+  struct sockaddr_in addr;
+  uv_loop_t* loop;
+  size_t i;
+  int r;
+
+  loop = uv_default_loop();
+  r = uv_loop_configure(loop, UV_LOOP_USE_EDGE_TRIGGERED);
+  if (r == UV_ENOSYS)
+    RETURN_SKIP("Edge-triggered mode is Linux only");
+  ASSERT_OK(r);
+
+  for (i = 0; i < sizeof(data); i++)
+    data[i] = i % 251;
+
+  ASSERT_OK(uv_ip4_addr("127.0.0.1", TEST_PORT, &addr));
+  ASSERT_OK(uv_timer_init(loop, &timer));
+  ASSERT_OK(uv_tcp_init(loop, &server));
+  ASSERT_OK(uv_tcp_bind(&server, (const struct sockaddr*) &addr, 0));
+  ASSERT_OK(uv_listen((uv_stream_t*) &server, 128, connection_cb));
+
+  ASSERT_OK(uv_tcp_init(loop, &client));
+  ASSERT_OK(uv_tcp_connect(&connect_req,
+                           &client,
+                           (const struct sockaddr*) &addr,
+                           connect_cb));
+
+  ASSERT_OK(uv_run(loop, UV_RUN_DEFAULT));
+
+  ASSERT_EQ(shutdown_cb_called, 1);
+  ASSERT_EQ(eof_cb_called, 1);
+  ASSERT_GT(read_restarts, 0);
+  ASSERT_EQ(close_cb_called, 4);
+
+  MAKE_VALGRIND_HAPPY(loop);
+  return 0;
+}
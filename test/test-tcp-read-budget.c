@@ -0,0 +1,443 @@
+/* Copyright libuv project contributors. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "uv.h"
+#include "task.h"
+
+#ifndef _WIN32
+# include <netinet/in.h>
+# include <sys/socket.h>
+# include <unistd.h>
+#endif
+
+/* Connections that all have more data to read than the loop may read in one
+ * iteration.
+ */
+#define NUM_CLIENTS 4
+#define TRANSFER_SIZE (1024 * 1024)
+#define READ_BUDGET (64 * 1024)
+#define READ_SIZE (64 * 1024)
+
+typedef struct {
+  uv_tcp_t handle;
+  size_t nread;
+} conn_t;
+
+static uv_tcp_t server;
+static uv_check_t check_handle;
+static uv_tcp_t clients[NUM_CLIENTS];
+static uv_connect_t connect_reqs[NUM_CLIENTS];
+static uv_write_t write_reqs[NUM_CLIENTS];
+static uv_shutdown_t shutdown_reqs[NUM_CLIENTS];
+static conn_t conns[NUM_CLIENTS];
+static char data[TRANSFER_SIZE];
+static char slab[READ_SIZE];
+static size_t iteration_nread;
+static size_t max_iteration_nread;
+static int connection_cb_called;
+static int eof_cb_called;
+static int close_cb_called;
+
+
+static void close_cb(uv_handle_t* handle) {
+  close_cb_called++;
+
+  if (close_cb_called == 2 * NUM_CLIENTS) {
+    uv_close((uv_handle_t*) &server, NULL);
+    uv_close((uv_handle_t*) &check_handle, NULL);
+  }
+}
+
+
+static void check_cb(uv_check_t* handle) {
+  if (iteration_nread > max_iteration_nread)
+    max_iteration_nread = iteration_nread;
+  iteration_nread = 0;
+}
+
+
+static void alloc_cb(uv_handle_t* handle, size_t size, uv_buf_t* buf) {
+  buf->base = slab;
+  buf->len = sizeof(slab);
+}
+
+
+static void read_cb(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
+  conn_t* conn;
+
+  conn = container_of(stream, conn_t, handle);
+
+  if (nread == UV_EOF) {
+    ASSERT_EQ(conn->nread, TRANSFER_SIZE);
+    eof_cb_called++;
+    uv_close((uv_handle_t*) stream, close_cb);
+    return;
+  }
+
+  ASSERT_GE(nread, 0);
+  ASSERT_OK(memcmp(buf->base, data + conn->nread, nread));
+  conn->nread += nread;
+
+  /* The last read may go over the budget by less than a buffer. */
+  iteration_nread += nread;
+  ASSERT_LT(iteration_nread, READ_BUDGET + READ_SIZE);
+}
+
+
+static void connection_cb(uv_stream_t* stream, int status) {
+  conn_t* conn;
+
+  ASSERT_OK(status);
+  ASSERT_LT(connection_cb_called, NUM_CLIENTS);
+
+  conn = &conns[connection_cb_called++];
+  ASSERT_OK(uv_tcp_init(stream->loop, &conn->handle));
+  ASSERT_OK(uv_accept(stream, (uv_stream_t*) &conn->handle));
+  ASSERT_OK(uv_read_start((uv_stream_t*) &conn->handle, alloc_cb, read_cb));
+}
+
+
+static void shutdown_cb(uv_shutdown_t* req, int status) {
+  ASSERT_OK(status);
+  uv_close((uv_handle_t*) req->handle, close_cb);
+}
+
+
+static void write_cb(uv_write_t* req, int status) {
+  ASSERT_OK(status);
+}
+
+
+static void connect_cb(uv_connect_t* req, int status) {
+  uv_buf_t buf;
+  size_t i;
+
+  ASSERT_OK(status);
+  i = req - connect_reqs;
+
+  buf = uv_buf_init(data, sizeof(data));
+  ASSERT_OK(uv_write(&write_reqs[i], req->handle, &buf, 1, write_cb));
+  ASSERT_OK(uv_shutdown(&shutdown_reqs[i], req->handle, shutdown_cb));
+}
+
+
+TEST_IMPL(tcp_read_budget) {
+  struct sockaddr_in addr;
+  uv_loop_t* loop;
+  size_t i;
+  int r;
+
+  loop = uv_default_loop();
+  r = uv_loop_configure(loop, UV_LOOP_READ_BUDGET, (size_t) READ_BUDGET);
+  if (r == UV_ENOSYS)
+    RETURN_SKIP("UV_LOOP_READ_BUDGET is not supported on this platform");
+  ASSERT_OK(r);
+
+  for (i = 0; i < sizeof(data); i++)
+    data[i] = i % 251;
+
+  ASSERT_OK(uv_check_init(loop, &check_handle));
+  ASSERT_OK(uv_check_start(&check_handle, check_cb));
+  uv_unref((uv_handle_t*) &check_handle);
+
+  ASSERT_OK(uv_ip4_addr("127.0.0.1", TEST_PORT, &addr));
+  ASSERT_OK(uv_tcp_init(loop, &server));
+  ASSERT_OK(uv_tcp_bind(&server, (const struct sockaddr*) &addr, 0));
+  ASSERT_OK(uv_listen((uv_stream_t*) &server, 128, connection_cb));
+
+  for (i = 0; i < NUM_CLIENTS; i++) {
+    ASSERT_OK(uv_tcp_init(loop, &clients[i]));
+    ASSERT_OK(uv_tcp_connect(&connect_reqs[i],
+                             &clients[i],
+                             (const struct sockaddr*) &addr,
+                             connect_cb));
+  }
+
+  ASSERT_OK(uv_run(loop, UV_RUN_DEFAULT));
+
+  ASSERT_EQ(connection_cb_called, NUM_CLIENTS);
+  ASSERT_EQ(eof_cb_called, NUM_CLIENTS);
+  ASSERT_EQ(close_cb_called, 2 * NUM_CLIENTS);
+  ASSERT_GT(max_iteration_nread, 0);
+
+  MAKE_VALGRIND_HAPPY(loop);
+  return 0;
+}
+
+
+#ifdef __linux__
+/* A stream that is set aside right after a short read gets the EOF from the
+ * poll that follows, with the data sent before it still unread.
+ */
+#define EOF_READ_BUDGET 32
+#define EOF_READ_SIZE 64
+#define EOF_FIRST_SIZE 100
+#define EOF_SECOND_SIZE 50
+
+static uv_tcp_t eof_peer;
+static char eof_slab[EOF_READ_SIZE];
+static size_t eof_nread;
+static int eof_fd;
+
+
+static void eof_close_cb(uv_handle_t* handle) {
+  close_cb_called++;
+}
+
+
+static void eof_alloc_cb(uv_handle_t* handle, size_t size, uv_buf_t* buf) {
+  buf->base = eof_slab;
+  buf->len = sizeof(eof_slab);
+}
+
+
+static void eof_read_cb(uv_stream_t* stream,
+                        ssize_t nread,
+                        const uv_buf_t* buf) {
+  if (nread == UV_EOF) {
+    ASSERT_EQ(eof_nread, EOF_FIRST_SIZE + EOF_SECOND_SIZE);
+    eof_cb_called++;
+    uv_close((uv_handle_t*) stream, eof_close_cb);
+    uv_close((uv_handle_t*) &server, eof_close_cb);
+    return;
+  }
+
+  ASSERT_GE(nread, 0);
+  ASSERT_OK(memcmp(buf->base, data + eof_nread, nread));
+  eof_nread += nread;
+
+  /* The stream has just been drained and is out of budget. */
+  if (nread > 0 && eof_nread == EOF_FIRST_SIZE) {
+    ASSERT_EQ(EOF_SECOND_SIZE,
+              write(eof_fd, data + EOF_FIRST_SIZE, EOF_SECOND_SIZE));
+    ASSERT_OK(shutdown(eof_fd, SHUT_WR));
+  }
+}
+
+
+static void eof_connection_cb(uv_stream_t* stream, int status) {
+  ASSERT_OK(status);
+  ASSERT_OK(uv_tcp_init(stream->loop, &eof_peer));
+  ASSERT_OK(uv_accept(stream, (uv_stream_t*) &eof_peer));
+  ASSERT_OK(uv_read_start((uv_stream_t*) &eof_peer,
+                          eof_alloc_cb,
+                          eof_read_cb));
+}
+#endif
+
+
+TEST_IMPL(tcp_read_budget_eof) {
+#ifndef __linux__
+  RETURN_SKIP("Edge-triggered mode is Linux only");
+#else
+  struct sockaddr_in addr;
+  uv_loop_t* loop;
+  size_t i;
+
+  loop = uv_default_loop();
+  ASSERT_OK(uv_loop_configure(loop,
+                              UV_LOOP_READ_BUDGET,
+                              (size_t) EOF_READ_BUDGET));
+  ASSERT_OK(uv_loop_configure(loop, UV_LOOP_USE_EDGE_TRIGGERED));
+
+  for (i = 0; i < EOF_FIRST_SIZE + EOF_SECOND_SIZE; i++)
+    data[i] = i % 251;
+
+  ASSERT_OK(uv_ip4_addr("127.0.0.1", TEST_PORT, &addr));
+  ASSERT_OK(uv_tcp_init(loop, &server));
+  ASSERT_OK(uv_tcp_bind(&server, (const struct sockaddr*) &addr, 0));
+  ASSERT_OK(uv_listen((uv_stream_t*) &server, 128, eof_connection_cb));
+
+  /* The first read fills the buffer and uses up the budget. The next one
+   * drains the rest, after which the peer sends more and shuts down.
+   */
+  eof_fd = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_GE(eof_fd, 0);
+  ASSERT_OK(connect(eof_fd, (const struct sockaddr*) &addr, sizeof(addr)));
+  ASSERT_EQ(EOF_FIRST_SIZE, write(eof_fd, data, EOF_FIRST_SIZE));
+
+  ASSERT_OK(uv_run(loop, UV_RUN_DEFAULT));
+
+  ASSERT_EQ(eof_cb_called, 1);
+  ASSERT_EQ(close_cb_called, 2);
+  ASSERT_EQ(eof_nread, EOF_FIRST_SIZE + EOF_SECOND_SIZE);
+  ASSERT_OK(close(eof_fd));
+
+  MAKE_VALGRIND_HAPPY(loop);
+  return 0;
+#endif
+}
+
+
+#ifndef _WIN32
+/* Connections that have their data and EOF waiting before the loop runs. The
+ * budget is used up by every read, so exactly one stream reads in each
+ * iteration, and the streams must take turns.
+ */
+#define ORDER_NUM_STREAMS 3
+#define ORDER_READ_BUDGET 32
+#define ORDER_READ_SIZE 64
+#define ORDER_NUM_READS 3
+#define ORDER_TRANSFER_SIZE (ORDER_NUM_READS * ORDER_READ_SIZE)
+
+static uv_tcp_t order_peers[ORDER_NUM_STREAMS];
+static size_t order_nread[ORDER_NUM_STREAMS];
+static int order_fds[ORDER_NUM_STREAMS];
+static int order_readers[ORDER_NUM_STREAMS * ORDER_NUM_READS];
+static int order_iterations[ORDER_NUM_STREAMS * ORDER_NUM_READS];
+static char order_slab[ORDER_READ_SIZE];
+static int order_iteration;
+static int order_nreads;
+static int order_connections;
+
+
+static void order_close_cb(uv_handle_t* handle) {
+  close_cb_called++;
+
+  if (close_cb_called == ORDER_NUM_STREAMS) {
+    uv_close((uv_handle_t*) &server, NULL);
+    uv_close((uv_handle_t*) &check_handle, NULL);
+  }
+}
+
+
+static void order_check_cb(uv_check_t* handle) {
+  order_iteration++;
+}
+
+
+static void order_alloc_cb(uv_handle_t* handle, size_t size, uv_buf_t* buf) {
+  buf->base = order_slab;
+  buf->len = sizeof(order_slab);
+}
+
+
+static void order_read_cb(uv_stream_t* stream,
+                          ssize_t nread,
+                          const uv_buf_t* buf) {
+  int i;
+
+  i = (uv_tcp_t*) stream - order_peers;
+
+  if (nread == UV_EOF) {
+    ASSERT_EQ(order_nread[i], ORDER_TRANSFER_SIZE);
+    eof_cb_called++;
+    uv_close((uv_handle_t*) stream, order_close_cb);
+    return;
+  }
+
+  ASSERT_EQ(nread, ORDER_READ_SIZE);
+  ASSERT_OK(memcmp(buf->base, data + order_nread[i], nread));
+  order_nread[i] += nread;
+
+  ASSERT_LT(order_nreads, ARRAY_SIZE(order_readers));
+  order_readers[order_nreads] = i;
+  order_iterations[order_nreads] = order_iteration;
+  order_nreads++;
+}
+
+
+static void order_connection_cb(uv_stream_t* stream, int status) {
+  uv_tcp_t* peer;
+
+  ASSERT_OK(status);
+  ASSERT_LT(order_connections, ORDER_NUM_STREAMS);
+
+  peer = &order_peers[order_connections++];
+  ASSERT_OK(uv_tcp_init(stream->loop, peer));
+  ASSERT_OK(uv_accept(stream, (uv_stream_t*) peer));
+
+  /* Start reading once all streams are there, so they all have data waiting
+   * in the same poll.
+   */
+  if (order_connections < ORDER_NUM_STREAMS)
+    return;
+
+  for (peer = order_peers; peer < order_peers + ORDER_NUM_STREAMS; peer++)
+    ASSERT_OK(uv_read_start((uv_stream_t*) peer,
+                            order_alloc_cb,
+                            order_read_cb));
+}
+#endif
+
+
+TEST_IMPL(tcp_read_budget_order) {
+#ifdef _WIN32
+  RETURN_SKIP("UV_LOOP_READ_BUDGET is not supported on this platform");
+#else
+  struct sockaddr_in addr;
+  uv_loop_t* loop;
+  size_t i;
+
+  loop = uv_default_loop();
+  ASSERT_OK(uv_loop_configure(loop,
+                              UV_LOOP_READ_BUDGET,
+                              (size_t) ORDER_READ_BUDGET));
+
+  for (i = 0; i < ORDER_TRANSFER_SIZE; i++)
+    data[i] = i % 251;
+
+  ASSERT_OK(uv_check_init(loop, &check_handle));
+  ASSERT_OK(uv_check_start(&check_handle, order_check_cb));
+  uv_unref((uv_handle_t*) &check_handle);
+
+  ASSERT_OK(uv_ip4_addr("127.0.0.1", TEST_PORT, &addr));
+  ASSERT_OK(uv_tcp_init(loop, &server));
+  ASSERT_OK(uv_tcp_bind(&server, (const struct sockaddr*) &addr, 0));
+  ASSERT_OK(uv_listen((uv_stream_t*) &server, 128, order_connection_cb));
+
+  for (i = 0; i < ORDER_NUM_STREAMS; i++) {
+    order_fds[i] = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_GE(order_fds[i], 0);
+    ASSERT_OK(connect(order_fds[i],
+                      (const struct sockaddr*) &addr,
+                      sizeof(addr)));
+    ASSERT_EQ(ORDER_TRANSFER_SIZE,
+              write(order_fds[i], data, ORDER_TRANSFER_SIZE));
+    ASSERT_OK(shutdown(order_fds[i], SHUT_WR));
+  }
+
+  ASSERT_OK(uv_run(loop, UV_RUN_DEFAULT));
+
+  ASSERT_EQ(order_connections, ORDER_NUM_STREAMS);
+  ASSERT_EQ(eof_cb_called, ORDER_NUM_STREAMS);
+  ASSERT_EQ(order_nreads, ORDER_NUM_STREAMS * ORDER_NUM_READS);
+
+  /* One read per iteration. The streams that were skipped read before the
+   * one that was cut short, so each stream reads again only after all the
+   * others have had their turn.
+   */
+  for (i = 1; i < (size_t) order_nreads; i++) {
+    ASSERT_GT(order_iterations[i], order_iterations[i - 1]);
+    if (i < ORDER_NUM_STREAMS)
+      ASSERT_NE(order_readers[i], order_readers[0]);
+    else
+      ASSERT_EQ(order_readers[i], order_readers[i - ORDER_NUM_STREAMS]);
+  }
+  ASSERT_NE(order_readers[1], order_readers[2]);
+
+  for (i = 0; i < ORDER_NUM_STREAMS; i++)
+    ASSERT_OK(close(order_fds[i]));
+
+  MAKE_VALGRIND_HAPPY(loop);
+  return 0;
+#endif
+}
@@ -0,0 +1,198 @@
+/* Copyright libuv project contributors. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "uv.h"
+#include "task.h"
+
+/* More connections than the loop has provided buffers, so that they can run
+ * out when the io_uring is used.
+ */
+#define NUM_CLIENTS 100
+#define TRANSFER_SIZE (256 * 1024)
+
+typedef struct {
+  uv_tcp_t handle;
+  uv_timer_t restart;
+  size_t nread;
+} conn_t;
+
+static uv_tcp_t server;
+static uv_tcp_t clients[NUM_CLIENTS];
+static uv_connect_t connect_reqs[NUM_CLIENTS];
+static uv_write_t write_reqs[NUM_CLIENTS];
+static uv_shutdown_t shutdown_reqs[NUM_CLIENTS];
+static conn_t conns[NUM_CLIENTS];
+static char data[TRANSFER_SIZE];
+static int connection_cb_called;
+static int shutdown_cb_called;
+static int eof_cb_called;
+static int close_cb_called;
+static int stop_reading;
+
+
+static void close_cb(uv_handle_t* handle) {
+  close_cb_called++;
+
+  if (close_cb_called == 2 * NUM_CLIENTS)
+    uv_close((uv_handle_t*) &server, NULL);
+}
+
+
+static void read_cb(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf);
+
+
+static void restart_cb(uv_timer_t* timer) {
+  conn_t* conn;
+
+  conn = container_of(timer, conn_t, restart);
+  ASSERT_OK(uv_read_start_pooled((uv_stream_t*) &conn->handle, read_cb));
+}
+
+
+static void read_cb(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
+  conn_t* conn;
+  ssize_t i;
+
+  conn = container_of(stream, conn_t, handle);
+
+  if (nread == UV_EOF) {
+    ASSERT_EQ(conn->nread, TRANSFER_SIZE);
+    eof_cb_called++;
+    uv_close((uv_handle_t*) stream, close_cb);
+    uv_close((uv_handle_t*) &conn->restart, NULL);
+    return;
+  }
+
+  ASSERT(uv_is_active((uv_handle_t*) stream));
+  ASSERT_GE(nread, 0);
+  ASSERT_LE(nread, buf->len);
+
+  for (i = 0; i < nread; i++)
+    ASSERT_EQ(buf->base[i], data[conn->nread + i]);
+
+  conn->nread += nread;
+
+  /* The data that arrives until reading starts again must not get lost. */
+  if (stop_reading && nread > 0) {
+    ASSERT_OK(uv_read_stop(stream));
+    ASSERT_OK(uv_timer_start(&conn->restart, restart_cb, 0, 0));
+  }
+}
+
+
+static void connection_cb(uv_stream_t* stream, int status) {
+  conn_t* conn;
+
+  ASSERT_OK(status);
+  ASSERT_LT(connection_cb_called, NUM_CLIENTS);
+
+  conn = &conns[connection_cb_called++];
+  ASSERT_OK(uv_tcp_init(stream->loop, &conn->handle));
+  ASSERT_OK(uv_timer_init(stream->loop, &conn->restart));
+  ASSERT_OK(uv_accept(stream, (uv_stream_t*) &conn->handle));
+  ASSERT_OK(uv_read_start_pooled((uv_stream_t*) &conn->handle, read_cb));
+}
+
+
+static void shutdown_cb(uv_shutdown_t* req, int status) {
+  ASSERT_OK(status);
+  shutdown_cb_called++;
+  uv_close((uv_handle_t*) req->handle, close_cb);
+}
+
+
+static void write_cb(uv_write_t* req, int status) {
+  ASSERT_OK(status);
+}
+
+
+static void connect_cb(uv_connect_t* req, int status) {
+  uv_buf_t buf;
+  size_t i;
+
+  ASSERT_OK(status);
+  i = req - connect_reqs;
+
+  buf = uv_buf_init(data, sizeof(data));
+  ASSERT_OK(uv_write(&write_reqs[i], req->handle, &buf, 1, write_cb));
+  ASSERT_OK(uv_shutdown(&shutdown_reqs[i], req->handle, shutdown_cb));
+}
+
+
+static int run_read_pooled_test(uv_loop_t* loop) {
+  struct sockaddr_in addr;
+  size_t i;
+
+  for (i = 0; i < sizeof(data); i++)
+    data[i] = i % 251;
+
+  ASSERT_OK(uv_ip4_addr("127.0.0.1", TEST_PORT, &addr));
+  ASSERT_OK(uv_tcp_init(loop, &server));
+  ASSERT_OK(uv_tcp_bind(&server, (const struct sockaddr*) &addr, 0));
+  ASSERT_OK(uv_listen((uv_stream_t*) &server, 128, connection_cb));
+
+  for (i = 0; i < NUM_CLIENTS; i++) {
+    ASSERT_OK(uv_tcp_init(loop, &clients[i]));
+    ASSERT_OK(uv_tcp_connect(&connect_reqs[i],
+                             &clients[i],
+                             (const struct sockaddr*) &addr,
+                             connect_cb));
+  }
+
+  ASSERT_OK(uv_run(loop, UV_RUN_DEFAULT));
+
+  ASSERT_EQ(connection_cb_called, NUM_CLIENTS);
+  ASSERT_EQ(shutdown_cb_called, NUM_CLIENTS);
+  ASSERT_EQ(eof_cb_called, NUM_CLIENTS);
+  ASSERT_EQ(close_cb_called, 2 * NUM_CLIENTS);
+
+  MAKE_VALGRIND_HAPPY(loop);
+  return 0;
+}
+
+
+TEST_IMPL(tcp_read_pooled) {
+#ifdef _WIN32
+  RETURN_SKIP("uv_read_start_pooled() is not supported on Windows");
+#endif
+  return run_read_pooled_test(uv_default_loop());
+}
+
+
+TEST_IMPL(tcp_read_pooled_io_uring) {
+#if !defined(__linux__)
+  RETURN_SKIP("io_uring is Linux only");
+#endif
+  ASSERT_OK(uv_loop_configure(uv_default_loop(),
+                              UV_LOOP_USE_IO_URING_STREAMS));
+  return run_read_pooled_test(uv_default_loop());
+}
+
+
+TEST_IMPL(tcp_read_pooled_stop) {
+#if !defined(__linux__)
+  RETURN_SKIP("io_uring is Linux only");
+#endif
+  ASSERT_OK(uv_loop_configure(uv_default_loop(),
+                              UV_LOOP_USE_IO_URING_STREAMS));
+  stop_reading = 1;
+  return run_read_pooled_test(uv_default_loop());
+}
@@ -0,0 +1,162 @@
+/* Copyright libuv project contributors. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "uv.h"
+#include "task.h"
+
+/* The reading side keeps a ring buffer whose free space wraps around its end,
+ * a single read fills both parts.
+ */
+#define RING_SIZE 10000
+#define TRANSFER_SIZE (1024 * 1024)
+
+static uv_tcp_t server;
+static uv_tcp_t client;
+static uv_tcp_t peer;
+static uv_connect_t connect_req;
+static uv_write_t write_req;
+static uv_shutdown_t shutdown_req;
+static char data[TRANSFER_SIZE];
+static char ring[RING_SIZE];
+static size_t head;
+static size_t nread;
+static int wrapped_reads;
+static int shutdown_cb_called;
+static int eof_cb_called;
+static int close_cb_called;
+
+
+static void close_cb(uv_handle_t* handle) {
+  close_cb_called++;
+}
+
+
+static void alloc_v_cb(uv_handle_t* handle,
+                       size_t suggested_size,
+                       uv_buf_t* bufs,
+                       unsigned int* nbufs) {
+  ASSERT_GE(*nbufs, 2);
+
+  /* Everything that was read has been consumed, the ring is empty. */
+  bufs[0] = uv_buf_init(ring + head, RING_SIZE - head);
+  bufs[1] = uv_buf_init(ring, head);
+  *nbufs = head == 0 ? 1 : 2;
+}
+
+
+static void read_cb(uv_stream_t* stream, ssize_t n, const uv_buf_t* buf) {
+  size_t len;
+
+  if (n == UV_EOF) {
+    ASSERT_EQ(nread, TRANSFER_SIZE);
+    eof_cb_called++;
+    uv_close((uv_handle_t*) stream, close_cb);
+    uv_close((uv_handle_t*) &server, close_cb);
+    return;
+  }
+
+  ASSERT_GE(n, 0);
+  ASSERT_LE(n, RING_SIZE);
+
+  /* The first buffer is the one at the head of the ring. */
+  ASSERT_PTR_EQ(buf->base, ring + head);
+  len = RING_SIZE - head;
+  if ((size_t) n > len) {
+    ASSERT_OK(memcmp(ring + head, data + nread, len));
+    ASSERT_OK(memcmp(ring, data + nread + len, n - len));
+    wrapped_reads++;
+  } else {
+    ASSERT_OK(memcmp(ring + head, data + nread, n));
+  }
+
+  head = (head + n) % RING_SIZE;
+  nread += n;
+}
+
+
+static void connection_cb(uv_stream_t* stream, int status) {
+  ASSERT_OK(status);
+  ASSERT_OK(uv_tcp_init(stream->loop, &peer));
+  ASSERT_OK(uv_accept(stream, (uv_stream_t*) &peer));
+  ASSERT_OK(uv_read_start_v((uv_stream_t*) &peer, alloc_v_cb, read_cb));
+  ASSERT_EQ(UV_EALREADY,
+            uv_read_start_v((uv_stream_t*) &peer, alloc_v_cb, read_cb));
+}
+
+
+static void shutdown_cb(uv_shutdown_t* req, int status) {
+  ASSERT_OK(status);
+  shutdown_cb_called++;
+  uv_close((uv_handle_t*) req->handle, close_cb);
+}
+
+
+static void write_cb(uv_write_t* req, int status) {
+  ASSERT_OK(status);
+}
+
+
+static void connect_cb(uv_connect_t* req, int status) {
+  uv_buf_t buf;
+
+  ASSERT_OK(status);
+
+  buf = uv_buf_init(data, sizeof(data));
+  ASSERT_OK(uv_write(&write_req, req->handle, &buf, 1, write_cb));
+  ASSERT_OK(uv_shutdown(&shutdown_req, req->handle, shutdown_cb));
+}
+
+
+TEST_IMPL(tcp_read_v) {
+  struct sockaddr_in addr;
+  uv_loop_t* loop;
+  size_t i;
+
+#ifdef _WIN32
+  RETURN_SKIP("uv_read_start_v() is not supported on Windows");
+#endif
+
+  loop = uv_default_loop();
+
+  for (i = 0; i < sizeof(data); i++)
+    data[i] = i % 251;
+
+  ASSERT_OK(uv_ip4_addr("127.0.0.1", TEST_PORT, &addr));
+  ASSERT_OK(uv_tcp_init(loop, &server));
+  ASSERT_OK(uv_tcp_bind(&server, (const struct sockaddr*) &addr, 0));
+  ASSERT_OK(uv_listen((uv_stream_t*) &server, 128, connection_cb));
+
+  ASSERT_OK(uv_tcp_init(loop, &client));
+  ASSERT_OK(uv_tcp_connect(&connect_req,
+                           &client,
+                           (const struct sockaddr*) &addr,
+                           connect_cb));
+
+  ASSERT_OK(uv_run(loop, UV_RUN_DEFAULT));
+
+  ASSERT_EQ(shutdown_cb_called, 1);
+  ASSERT_EQ(eof_cb_called, 1);
+  ASSERT_GT(wrapped_reads, 0);
+  ASSERT_EQ(close_cb_called, 3);
+
+  MAKE_VALGRIND_HAPPY(loop);
+  return 0;
+}
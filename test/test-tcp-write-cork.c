@@ -0,0 +1,179 @@
+/* Copyright libuv project contributors. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "uv.h"
+#include "task.h"
+
+/* Many small writes from one callback. They are held back until the callback
+ * returns and then sent together.
+ */
+#define NUM_WRITES 1000
+#define WRITE_SIZE 10
+
+static uv_tcp_t server;
+static uv_tcp_t client;
+static uv_tcp_t peer;
+static uv_connect_t connect_req;
+static uv_write_t write_reqs[NUM_WRITES];
+static uv_shutdown_t shutdown_req;
+static char data[NUM_WRITES * WRITE_SIZE];
+static char slab[65536];
+static size_t nread;
+static size_t nwritten;
+static int write_cb_called;
+static int shutdown_cb_called;
+static int close_cb_called;
+static int close_early;
+
+
+static void close_cb(uv_handle_t* handle) {
+  close_cb_called++;
+}
+
+
+static void alloc_cb(uv_handle_t* handle, size_t size, uv_buf_t* buf) {
+  buf->base = slab;
+  buf->len = sizeof(slab);
+}
+
+
+static void read_cb(uv_stream_t* stream, ssize_t n, const uv_buf_t* buf) {
+  if (n == UV_EOF) {
+    uv_close((uv_handle_t*) stream, close_cb);
+    uv_close((uv_handle_t*) &server, close_cb);
+    return;
+  }
+
+  ASSERT_GE(n, 0);
+  ASSERT_OK(memcmp(buf->base, data + nread, n));
+  nread += n;
+}
+
+
+static void connection_cb(uv_stream_t* stream, int status) {
+  ASSERT_OK(status);
+  ASSERT_OK(uv_tcp_init(stream->loop, &peer));
+  ASSERT_OK(uv_accept(stream, (uv_stream_t*) &peer));
+  ASSERT_OK(uv_read_start((uv_stream_t*) &peer, alloc_cb, read_cb));
+}
+
+
+static void shutdown_cb(uv_shutdown_t* req, int status) {
+  ASSERT_OK(status);
+  ASSERT_EQ(write_cb_called, NUM_WRITES);
+  shutdown_cb_called++;
+  uv_close((uv_handle_t*) req->handle, close_cb);
+}
+
+
+static void write_cb(uv_write_t* req, int status) {
+  /* The callbacks run in the order of the writes. */
+  ASSERT_EQ(req - write_reqs, write_cb_called);
+  write_cb_called++;
+
+  /* Streams that use io_uring send one request at a time, closing cancels
+   * the ones that haven't been sent yet.
+   */
+  if (close_early && status == UV_ECANCELED)
+    return;
+
+  ASSERT_OK(status);
+  ASSERT_EQ(nwritten, (req - write_reqs) * WRITE_SIZE);
+  nwritten += WRITE_SIZE;
+}
+
+
+static void connect_cb(uv_connect_t* req, int status) {
+  uv_buf_t buf;
+  int i;
+
+  ASSERT_OK(status);
+
+  for (i = 0; i < NUM_WRITES; i++) {
+    buf = uv_buf_init(data + i * WRITE_SIZE, WRITE_SIZE);
+    ASSERT_OK(uv_write(&write_reqs[i], req->handle, &buf, 1, write_cb));
+
+    /* Nothing has been written yet. */
+    ASSERT_EQ(req->handle->write_queue_size, (i + 1) * WRITE_SIZE);
+    ASSERT_EQ(UV_EAGAIN, uv_try_write(req->handle, &buf, 1));
+  }
+
+  ASSERT_OK(write_cb_called);
+
+  if (close_early)
+    uv_close((uv_handle_t*) req->handle, close_cb);
+  else
+    ASSERT_OK(uv_shutdown(&shutdown_req, req->handle, shutdown_cb));
+}
+
+
+static int run_write_cork_test(int early) {
+  struct sockaddr_in addr;
+  uv_loop_t* loop;
+  size_t i;
+  int r;
+
+  close_early = early;
+  loop = uv_default_loop();
+  r = uv_loop_configure(loop, UV_LOOP_CORK_WRITES);
+  if (r == UV_ENOSYS)
+    RETURN_SKIP("Corked writes are not supported on this platform");
+  ASSERT_OK(r);
+
+  for (i = 0; i < sizeof(data); i++)
+    data[i] = i % 251;
+
+  ASSERT_OK(uv_ip4_addr("127.0.0.1", TEST_PORT, &addr));
+  ASSERT_OK(uv_tcp_init(loop, &server));
+  ASSERT_OK(uv_tcp_bind(&server, (const struct sockaddr*) &addr, 0));
+  ASSERT_OK(uv_listen((uv_stream_t*) &server, 128, connection_cb));
+
+  ASSERT_OK(uv_tcp_init(loop, &client));
+  ASSERT_OK(uv_tcp_connect(&connect_req,
+                           &client,
+                           (const struct sockaddr*) &addr,
+                           connect_cb));
+
+  ASSERT_OK(uv_run(loop, UV_RUN_DEFAULT));
+
+  /* Closing the stream sends the corked writes first. */
+  ASSERT_EQ(write_cb_called, NUM_WRITES);
+  ASSERT_GT(nwritten, 0);
+  ASSERT_EQ(nread, nwritten);
+  if (!early)
+    ASSERT_EQ(nread, sizeof(data));
+  ASSERT_EQ(shutdown_cb_called, early ? 0 : 1);
+  ASSERT_EQ(close_cb_called, 3);
+
+  MAKE_VALGRIND_HAPPY(loop);
+  return 0;
+}
+
+
+TEST_IMPL(tcp_write_cork) {
+  return run_write_cork_test(0);
+}
+
+
+TEST_IMPL(tcp_write_cork_close) {
+  return run_write_cork_test(1);
+}
@@ -0,0 +1,319 @@
+/* Copyright libuv project contributors. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "uv.h"
+#include "task.h"
+
+#include <stdlib.h>
+
+/* Large writes that are sent without copying, with small ones in between that
+ * are copied but must not complete before them.
+ */
+#define NUM_WRITES 16
+#define LARGE_SIZE (256 * 1024)
+#define SMALL_SIZE 100
+
+static uv_tcp_t server;
+static uv_tcp_t client;
+static uv_tcp_t peer;
+static uv_connect_t connect_req;
+static uv_write_t write_reqs[NUM_WRITES];
+static uv_shutdown_t shutdown_req;
+static char data[NUM_WRITES * LARGE_SIZE];
+static char slab[65536];
+static size_t nwritten;
+static size_t nread;
+static int write_cb_called;
+static int shutdown_cb_called;
+static int close_cb_called;
+static int close_early;
+
+/* tcp_zerocopy_close_wait: the peer only reads once the client is closed. */
+static uv_timer_t timer;
+static int write_cb_before_close;
+static int peer_reading;
+
+
+static void close_cb(uv_handle_t* handle) {
+  close_cb_called++;
+}
+
+
+static void alloc_cb(uv_handle_t* handle, size_t size, uv_buf_t* buf) {
+  buf->base = slab;
+  buf->len = sizeof(slab);
+}
+
+
+static void read_cb(uv_stream_t* stream, ssize_t n, const uv_buf_t* buf) {
+  if (n < 0) {
+    ASSERT(n == UV_EOF || n == UV_ECONNRESET);
+    if (!close_early)
+      ASSERT_EQ(nread, nwritten);
+    uv_close((uv_handle_t*) stream, close_cb);
+    uv_close((uv_handle_t*) &server, close_cb);
+    return;
+  }
+
+  ASSERT_OK(memcmp(buf->base, data + nread, n));
+  nread += n;
+}
+
+
+static void connection_cb(uv_stream_t* stream, int status) {
+  ASSERT_OK(status);
+  ASSERT_OK(uv_tcp_init(stream->loop, &peer));
+  ASSERT_OK(uv_accept(stream, (uv_stream_t*) &peer));
+  ASSERT_OK(uv_read_start((uv_stream_t*) &peer, alloc_cb, read_cb));
+}
+
+
+static void shutdown_cb(uv_shutdown_t* req, int status) {
+  ASSERT_OK(status);
+  ASSERT_EQ(write_cb_called, NUM_WRITES);
+  shutdown_cb_called++;
+  uv_close((uv_handle_t*) req->handle, close_cb);
+}
+
+
+static void write_cb(uv_write_t* req, int status) {
+  /* The callbacks run in the order of the writes. */
+  ASSERT_EQ(req - write_reqs, write_cb_called);
+  write_cb_called++;
+
+  if (close_early)
+    ASSERT(status == 0 || status == UV_ECANCELED);
+  else
+    ASSERT_OK(status);
+}
+
+
+static void connect_cb(uv_connect_t* req, int status) {
+  uv_buf_t buf;
+  size_t len;
+  int i;
+
+  ASSERT_OK(status);
+
+  for (i = 0; i < NUM_WRITES; i++) {
+    len = i % 4 == 3 ? SMALL_SIZE : LARGE_SIZE;
+    buf = uv_buf_init(data + nwritten, len);
+    ASSERT_OK(uv_write(&write_reqs[i], req->handle, &buf, 1, write_cb));
+    nwritten += len;
+  }
+
+  if (close_early)
+    uv_close((uv_handle_t*) req->handle, close_cb);
+  else
+    ASSERT_OK(uv_shutdown(&shutdown_req, req->handle, shutdown_cb));
+}
+
+
+static int run_zerocopy_test(int early) {
+  struct sockaddr_in addr;
+  uv_loop_t* loop;
+  size_t i;
+  int r;
+
+  close_early = early;
+  loop = uv_default_loop();
+
+  for (i = 0; i < sizeof(data); i++)
+    data[i] = i % 251;
+
+  ASSERT_OK(uv_ip4_addr("127.0.0.1", TEST_PORT, &addr));
+  ASSERT_OK(uv_tcp_init(loop, &server));
+  ASSERT_OK(uv_tcp_bind(&server, (const struct sockaddr*) &addr, 0));
+  ASSERT_OK(uv_listen((uv_stream_t*) &server, 128, connection_cb));
+
+  /* Applied to the socket once it's created. */
+  ASSERT_OK(uv_tcp_init(loop, &client));
+  r = uv_tcp_zerocopy(&client, 1);
+  if (r == UV_ENOTSUP)
+    RETURN_SKIP("Zero-copy sends are not supported on this platform");
+  ASSERT_OK(r);
+
+  ASSERT_OK(uv_tcp_connect(&connect_req,
+                           &client,
+                           (const struct sockaddr*) &addr,
+                           connect_cb));
+
+  ASSERT_OK(uv_run(loop, UV_RUN_DEFAULT));
+
+  ASSERT_EQ(write_cb_called, NUM_WRITES);
+  ASSERT_EQ(shutdown_cb_called, early ? 0 : 1);
+  ASSERT_EQ(close_cb_called, 3);
+
+  MAKE_VALGRIND_HAPPY(loop);
+  return 0;
+}
+
+
+TEST_IMPL(tcp_zerocopy) {
+  return run_zerocopy_test(0);
+}
+
+
+TEST_IMPL(tcp_zerocopy_close) {
+  return run_zerocopy_test(1);
+}
+
+
+static void close_wait_peer_close_cb(uv_handle_t* handle) {
+  close_cb_called++;
+}
+
+
+static void close_wait_client_close_cb(uv_handle_t* handle) {
+  /* The write callbacks ran first, after the peer made room for the data. */
+  ASSERT_EQ(write_cb_called, NUM_WRITES);
+  ASSERT_EQ(1, peer_reading);
+  close_cb_called++;
+}
+
+
+static void close_wait_read_cb(uv_stream_t* stream,
+                               ssize_t n,
+                               const uv_buf_t* buf) {
+  if (n < 0) {
+    ASSERT(n == UV_EOF || n == UV_ECONNRESET);
+    uv_close((uv_handle_t*) stream, close_wait_peer_close_cb);
+    uv_close((uv_handle_t*) &server, close_wait_peer_close_cb);
+    return;
+  }
+
+  ASSERT_OK(memcmp(buf->base, data + nread, n));
+  nread += n;
+}
+
+
+static void close_wait_connection_cb(uv_stream_t* stream, int status) {
+  ASSERT_OK(status);
+  ASSERT_OK(uv_tcp_init(stream->loop, &peer));
+  ASSERT_OK(uv_accept(stream, (uv_stream_t*) &peer));
+}
+
+
+static void close_wait_write_cb(uv_write_t* req, int status) {
+  ASSERT_EQ(req - write_reqs, write_cb_called);
+  ASSERT(status == 0 || status == UV_ECANCELED);
+
+  /* The kernel can't release the data that's stuck in the send queue. */
+  if (write_cb_called >= write_cb_before_close)
+    ASSERT_EQ(1, peer_reading);
+
+  write_cb_called++;
+}
+
+
+static void close_wait_read_timer_cb(uv_timer_t* handle) {
+  /* The client is closed but its callbacks are still waiting. */
+  ASSERT_EQ(write_cb_called, write_cb_before_close);
+  ASSERT_EQ(0, close_cb_called);
+
+  peer_reading = 1;
+  ASSERT_OK(uv_read_start((uv_stream_t*) &peer, alloc_cb, close_wait_read_cb));
+  uv_close((uv_handle_t*) handle, NULL);
+}
+
+
+static void close_wait_close_timer_cb(uv_timer_t* handle) {
+  /* The peer doesn't read, so not everything can have been sent. */
+  write_cb_before_close = write_cb_called;
+  ASSERT_LT(write_cb_before_close, NUM_WRITES);
+
+  uv_close((uv_handle_t*) &client, close_wait_client_close_cb);
+  ASSERT_OK(uv_timer_start(handle, close_wait_read_timer_cb, 200, 0));
+}
+
+
+static void close_wait_connect_cb(uv_connect_t* req, int status) {
+  uv_buf_t buf;
+  int i;
+
+  ASSERT_OK(status);
+
+  for (i = 0; i < NUM_WRITES; i++) {
+    buf = uv_buf_init(data + nwritten, LARGE_SIZE);
+    ASSERT_OK(uv_write(&write_reqs[i],
+                       req->handle,
+                       &buf,
+                       1,
+                       close_wait_write_cb));
+    nwritten += LARGE_SIZE;
+  }
+
+  ASSERT_OK(uv_timer_start(&timer, close_wait_close_timer_cb, 200, 0));
+}
+
+
+/* Closing the client doesn't run the callbacks of the zero-copy writes until
+ * the kernel has released their data.
+ */
+TEST_IMPL(tcp_zerocopy_close_wait) {
+  struct sockaddr_in addr;
+  uv_loop_t* loop;
+  size_t size;
+  size_t i;
+  char val[32];
+  int r;
+
+  /* Streams that use io_uring always copy. */
+  size = sizeof(val);
+  if (uv_os_getenv("UV_USE_IO_URING_STREAMS", val, &size) == 0 &&
+      atoi(val) > 0) {
+    RETURN_SKIP("Zero-copy sends are not used with io_uring streams");
+  }
+
+  loop = uv_default_loop();
+
+  for (i = 0; i < sizeof(data); i++)
+    data[i] = i % 251;
+
+  ASSERT_OK(uv_ip4_addr("127.0.0.1", TEST_PORT, &addr));
+  ASSERT_OK(uv_tcp_init(loop, &server));
+  ASSERT_OK(uv_tcp_bind(&server, (const struct sockaddr*) &addr, 0));
+  ASSERT_OK(uv_listen((uv_stream_t*) &server, 128, close_wait_connection_cb));
+  ASSERT_OK(uv_timer_init(loop, &timer));
+
+  /* Loopback connections copy the data, keep sending it zero-copy anyway. */
+  ASSERT_OK(uv_os_setenv("UV_TCP_ZEROCOPY_KEEP", "1"));
+  ASSERT_OK(uv_tcp_init(loop, &client));
+  r = uv_tcp_zerocopy(&client, 1);
+  ASSERT_OK(uv_os_unsetenv("UV_TCP_ZEROCOPY_KEEP"));
+  if (r == UV_ENOTSUP)
+    RETURN_SKIP("Zero-copy sends are not supported on this platform");
+  ASSERT_OK(r);
+
+  ASSERT_OK(uv_tcp_connect(&connect_req,
+                           &client,
+                           (const struct sockaddr*) &addr,
+                           close_wait_connect_cb));
+
+  ASSERT_OK(uv_run(loop, UV_RUN_DEFAULT));
+
+  ASSERT_EQ(write_cb_called, NUM_WRITES);
+  ASSERT_EQ(1, peer_reading);
+  ASSERT_EQ(close_cb_called, 3);
+
+  MAKE_VALGRIND_HAPPY(loop);
+  return 0;
+}
@@ -74,3 +74,589 @@ TEST_IMPL(threadpool_queue_work_einval) {
   MAKE_VALGRIND_HAPPY(uv_default_loop());
   return 0;
 }
+
+
+#define STEAL_THREADS 4
+#define STEAL_REQS 8
+#define STEAL_WORK 2000
+
+typedef struct {
+  uv_loop_t loop;
+  uv_work_t reqs[STEAL_REQS];
+  unsigned int queued;
+  unsigned int done;
+} steal_loop_t;
+
+static uv_sem_t steal_started;
+static uv_sem_t steal_block;
+static int steal_cancelled;
+
+
+static void steal_work_cb(uv_work_t* req) {
+}
+
+
+static void steal_after_work_cb(uv_work_t* req, int status) {
+  steal_loop_t* s;
+
+  ASSERT_OK(status);
+  s = req->data;
+  s->done++;
+  if (s->queued < STEAL_WORK) {
+    s->queued++;
+    ASSERT_OK(uv_queue_work(&s->loop,
+                            req,
+                            steal_work_cb,
+                            steal_after_work_cb));
+  }
+}
+
+
+static void steal_thread(void* arg) {
+  steal_loop_t* s;
+  unsigned int i;
+
+  s = arg;
+  ASSERT_OK(uv_loop_init(&s->loop));
+
+  for (i = 0; i < STEAL_REQS; i++) {
+    s->reqs[i].data = s;
+    s->queued++;
+    ASSERT_OK(uv_queue_work(&s->loop,
+                            &s->reqs[i],
+                            steal_work_cb,
+                            steal_after_work_cb));
+  }
+
+  ASSERT_OK(uv_run(&s->loop, UV_RUN_DEFAULT));
+  ASSERT_EQ(STEAL_WORK, s->done);
+  ASSERT_OK(uv_loop_close(&s->loop));
+}
+
+
+static void steal_block_cb(uv_work_t* req) {
+  uv_sem_post(&steal_started);
+  uv_sem_wait(&steal_block);
+}
+
+
+static void steal_cancel_cb(uv_work_t* req, int status) {
+  if (req->data == NULL) {
+    ASSERT_OK(status);
+    return;
+  }
+
+  ASSERT_EQ(status, UV_ECANCELED);
+  steal_cancelled++;
+}
+
+
+static int threadpool_steal(const char* mode) {
+  uv_thread_t threads[STEAL_THREADS];
+  steal_loop_t loops[STEAL_THREADS];
+  uv_work_t blockers[4];
+  uv_work_t victim;
+  unsigned int i;
+
+  ASSERT_OK(uv_os_setenv("UV_THREADPOOL_SIZE", "4"));
+  ASSERT_OK(uv_os_setenv("UV_THREADPOOL_MODE", mode));
+
+  /* Several loops submitting at once. */
+  memset(loops, 0, sizeof(loops));
+  for (i = 0; i < STEAL_THREADS; i++)
+    ASSERT_OK(uv_thread_create(&threads[i], steal_thread, &loops[i]));
+  for (i = 0; i < STEAL_THREADS; i++)
+    ASSERT_OK(uv_thread_join(&threads[i]));
+
+  /* Queued work can still be cancelled while all workers are busy. */
+  ASSERT_OK(uv_sem_init(&steal_started, 0));
+  ASSERT_OK(uv_sem_init(&steal_block, 0));
+
+  for (i = 0; i < ARRAY_SIZE(blockers); i++) {
+    blockers[i].data = NULL;
+    ASSERT_OK(uv_queue_work(uv_default_loop(),
+                            &blockers[i],
+                            steal_block_cb,
+                            steal_cancel_cb));
+  }
+  for (i = 0; i < ARRAY_SIZE(blockers); i++)
+    uv_sem_wait(&steal_started);
+
+  victim.data = &victim;
+  ASSERT_OK(uv_queue_work(uv_default_loop(),
+                          &victim,
+                          steal_work_cb,
+                          steal_cancel_cb));
+  ASSERT_OK(uv_cancel((uv_req_t*) &victim));
+
+  for (i = 0; i < ARRAY_SIZE(blockers); i++)
+    uv_sem_post(&steal_block);
+
+  ASSERT_OK(uv_run(uv_default_loop(), UV_RUN_DEFAULT));
+  ASSERT_EQ(1, steal_cancelled);
+
+  uv_sem_destroy(&steal_started);
+  uv_sem_destroy(&steal_block);
+
+  MAKE_VALGRIND_HAPPY(uv_default_loop());
+  return 0;
+}
+
+
+TEST_IMPL(threadpool_work_stealing) {
+  return threadpool_steal("steal");
+}
+
+
+TEST_IMPL(threadpool_work_stealing_loop) {
+  return threadpool_steal("steal-loop");
+}
+
+
+#define BATCH_REQS 1000
+
+static uv_work_t batch_reqs[BATCH_REQS];
+static int batch_results[BATCH_REQS];
+static int batch_cb_count;
+static int batch_status;
+
+
+static void batch_work_cb(uv_work_t* req) {
+  batch_results[req - batch_reqs] = 1;
+}
+
+
+static void batch_after_work_cb(uv_work_batch_t* batch, int status) {
+  ASSERT_PTR_EQ(batch->reqs, batch_reqs);
+  ASSERT_PTR_EQ(batch->data, &data);
+  batch_status = status;
+  batch_cb_count++;
+}
+
+
+TEST_IMPL(threadpool_queue_work_batch) {
+  uv_work_batch_t batch;
+  uv_work_t blockers[4];
+  unsigned int i;
+
+  ASSERT_EQ(UV_EINVAL, uv_queue_work_batch(uv_default_loop(),
+                                           &batch,
+                                           batch_reqs,
+                                           0,
+                                           NULL,
+                                           batch_work_cb,
+                                           batch_after_work_cb));
+  ASSERT_EQ(UV_EINVAL, uv_queue_work_batch(uv_default_loop(),
+                                           &batch,
+                                           batch_reqs,
+                                           BATCH_REQS,
+                                           NULL,
+                                           NULL,
+                                           batch_after_work_cb));
+
+  /* All requests run, the callback runs once when they are done. */
+  batch.data = &data;
+  ASSERT_OK(uv_queue_work_batch(uv_default_loop(),
+                                &batch,
+                                batch_reqs,
+                                BATCH_REQS,
+                                NULL,
+                                batch_work_cb,
+                                batch_after_work_cb));
+  ASSERT_OK(uv_run(uv_default_loop(), UV_RUN_DEFAULT));
+  ASSERT_EQ(1, batch_cb_count);
+  ASSERT_OK(batch_status);
+  for (i = 0; i < BATCH_REQS; i++)
+    ASSERT_EQ(1, batch_results[i]);
+
+  /* A cancelled request fails the whole batch with UV_ECANCELED. */
+  ASSERT_OK(uv_sem_init(&steal_started, 0));
+  ASSERT_OK(uv_sem_init(&steal_block, 0));
+
+  for (i = 0; i < ARRAY_SIZE(blockers); i++) {
+    blockers[i].data = NULL;
+    ASSERT_OK(uv_queue_work(uv_default_loop(),
+                            &blockers[i],
+                            steal_block_cb,
+                            steal_cancel_cb));
+  }
+  for (i = 0; i < ARRAY_SIZE(blockers); i++)
+    uv_sem_wait(&steal_started);
+
+  memset(batch_results, 0, sizeof(batch_results));
+  ASSERT_OK(uv_queue_work_batch(uv_default_loop(),
+                                &batch,
+                                batch_reqs,
+                                BATCH_REQS,
+                                NULL,
+                                batch_work_cb,
+                                batch_after_work_cb));
+  ASSERT_OK(uv_cancel((uv_req_t*) &batch_reqs[BATCH_REQS / 2]));
+
+  for (i = 0; i < ARRAY_SIZE(blockers); i++)
+    uv_sem_post(&steal_block);
+
+  ASSERT_OK(uv_run(uv_default_loop(), UV_RUN_DEFAULT));
+  ASSERT_EQ(2, batch_cb_count);
+  ASSERT_EQ(batch_status, UV_ECANCELED);
+  ASSERT_OK(batch_results[BATCH_REQS / 2]);
+
+  uv_sem_destroy(&steal_started);
+  uv_sem_destroy(&steal_block);
+
+  MAKE_VALGRIND_HAPPY(uv_default_loop());
+  return 0;
+}
+
+
+static void dynamic_after_work_cb(uv_work_t* req, int status) {
+  ASSERT_OK(status);
+}
+
+
+TEST_IMPL(threadpool_dynamic_size) {
+  uv_work_t blockers[4];
+  uv_work_t waiting[2];
+  uv_threadpool_metrics_t metrics;
+  unsigned int i;
+
+  /* The work-stealing modes have a fixed size. */
+  ASSERT_OK(uv_os_setenv("UV_THREADPOOL_MODE", "shared"));
+  ASSERT_OK(uv_os_setenv("UV_THREADPOOL_SIZE", "1"));
+  ASSERT_OK(uv_os_setenv("UV_THREADPOOL_MAX_SIZE", "4"));
+  ASSERT_OK(uv_os_setenv("UV_THREADPOOL_IDLE_TIMEOUT", "20"));
+
+  ASSERT_OK(uv_sem_init(&steal_started, 0));
+  ASSERT_OK(uv_sem_init(&steal_block, 0));
+
+  /* The pool grows until all blocking work runs at once. */
+  for (i = 0; i < ARRAY_SIZE(blockers); i++)
+    ASSERT_OK(uv_queue_work(uv_default_loop(),
+                            &blockers[i],
+                            steal_block_cb,
+                            dynamic_after_work_cb));
+  for (i = 0; i < ARRAY_SIZE(blockers); i++)
+    uv_sem_wait(&steal_started);
+
+  /* But not beyond the maximum. */
+  for (i = 0; i < ARRAY_SIZE(waiting); i++)
+    ASSERT_OK(uv_queue_work(uv_default_loop(),
+                            &waiting[i],
+                            steal_work_cb,
+                            dynamic_after_work_cb));
+  uv_sleep(10);
+
+  ASSERT_OK(uv_threadpool_metrics(uv_default_loop(), &metrics));
+  ASSERT_UINT64_EQ(4, metrics.size);
+  ASSERT_UINT64_EQ(2, metrics.queue_depth);
+
+  for (i = 0; i < ARRAY_SIZE(blockers); i++)
+    uv_sem_post(&steal_block);
+  ASSERT_OK(uv_run(uv_default_loop(), UV_RUN_DEFAULT));
+
+  /* Idle workers above the minimum retire. */
+  for (i = 0; i < 500; i++) {
+    ASSERT_OK(uv_threadpool_metrics(uv_default_loop(), &metrics));
+    if (metrics.size == 1)
+      break;
+    uv_sleep(10);
+  }
+  ASSERT_UINT64_EQ(1, metrics.size);
+  ASSERT_UINT64_EQ(0, metrics.queue_depth);
+
+  /* And come back when needed. */
+  for (i = 0; i < ARRAY_SIZE(blockers); i++)
+    ASSERT_OK(uv_queue_work(uv_default_loop(),
+                            &blockers[i],
+                            steal_block_cb,
+                            dynamic_after_work_cb));
+  for (i = 0; i < ARRAY_SIZE(blockers); i++)
+    uv_sem_wait(&steal_started);
+  for (i = 0; i < ARRAY_SIZE(blockers); i++)
+    uv_sem_post(&steal_block);
+  ASSERT_OK(uv_run(uv_default_loop(), UV_RUN_DEFAULT));
+
+  uv_sem_destroy(&steal_started);
+  uv_sem_destroy(&steal_block);
+
+  MAKE_VALGRIND_HAPPY(uv_default_loop());
+  return 0;
+}
+
+
+static void metrics_work_cb(uv_work_t* req) {
+  uv_sleep(5);
+}
+
+
+static void metrics_fs_cb(uv_fs_t* req) {
+  ASSERT_OK(req->result);
+  uv_fs_req_cleanup(req);
+}
+
+
+static void metrics_cancel_cb(uv_work_t* req, int status) {
+  ASSERT(status == 0 || status == UV_ECANCELED);
+}
+
+
+static uint64_t metrics_hist_sum(const uv_threadpool_timing_t* t) {
+  uint64_t sum;
+  unsigned int i;
+
+  sum = 0;
+  for (i = 0; i < ARRAY_SIZE(t->hist); i++)
+    sum += t->hist[i];
+
+  return sum;
+}
+
+
+TEST_IMPL(threadpool_metrics) {
+  uv_threadpool_metrics_t metrics;
+  uv_work_t reqs[4];
+  uv_work_t cancelled;
+  uv_fs_t fs_req;
+  unsigned int i;
+
+  ASSERT_OK(uv_threadpool_metrics(uv_default_loop(), &metrics));
+  ASSERT_UINT64_EQ(0, metrics.run[UV_THREADPOOL_CPU].count);
+
+  for (i = 0; i < ARRAY_SIZE(reqs); i++)
+    ASSERT_OK(uv_queue_work(uv_default_loop(),
+                            &reqs[i],
+                            metrics_work_cb,
+                            dynamic_after_work_cb));
+  ASSERT_OK(uv_fs_stat(uv_default_loop(), &fs_req, ".", metrics_fs_cb));
+
+  /* Cancelled work doesn't count. */
+  ASSERT_OK(uv_queue_work(uv_default_loop(),
+                          &cancelled,
+                          metrics_work_cb,
+                          metrics_cancel_cb));
+  if (uv_cancel((uv_req_t*) &cancelled) != 0)
+    i++;
+
+  ASSERT_OK(uv_run(uv_default_loop(), UV_RUN_DEFAULT));
+
+  ASSERT_OK(uv_threadpool_metrics(uv_default_loop(), &metrics));
+  ASSERT_UINT64_EQ(i, metrics.wait[UV_THREADPOOL_CPU].count);
+  ASSERT_UINT64_EQ(i, metrics.run[UV_THREADPOOL_CPU].count);
+  ASSERT_UINT64_EQ(i, metrics.done[UV_THREADPOOL_CPU].count);
+  ASSERT_UINT64_GE(metrics.run[UV_THREADPOOL_CPU].max, 5000000);
+  ASSERT_UINT64_GE(metrics.run[UV_THREADPOOL_CPU].total, i * 5000000);
+  ASSERT_UINT64_EQ(i, metrics_hist_sum(&metrics.run[UV_THREADPOOL_CPU]));
+  ASSERT_UINT64_EQ(1, metrics.run[UV_THREADPOOL_FAST_IO].count);
+  ASSERT_UINT64_EQ(1, metrics_hist_sum(&metrics.wait[UV_THREADPOOL_FAST_IO]));
+  ASSERT_UINT64_EQ(0, metrics.run[UV_THREADPOOL_SLOW_IO].count);
+
+  MAKE_VALGRIND_HAPPY(uv_default_loop());
+  return 0;
+}
+
+
+#define PRIORITY_FLOOD 20
+
+static uv_work_t* priority_order[PRIORITY_FLOOD + 1];
+static unsigned int priority_ran;
+
+
+static void priority_work_cb(uv_work_t* req) {
+  priority_order[priority_ran++] = req;
+}
+
+
+/* Keeps the single worker busy until priority_release(). */
+static void priority_block(uv_work_t* blocker) {
+  ASSERT_OK(uv_queue_work(uv_default_loop(),
+                          blocker,
+                          steal_block_cb,
+                          dynamic_after_work_cb));
+  uv_sem_wait(&steal_started);
+  priority_ran = 0;
+}
+
+
+static void priority_release(unsigned int n) {
+  uv_sem_post(&steal_block);
+  ASSERT_OK(uv_run(uv_default_loop(), UV_RUN_DEFAULT));
+  ASSERT_EQ(n, priority_ran);
+}
+
+
+/* Runs reqs[i] with priorities[i] on a single worker that is busy until
+ * they are all queued.
+ */
+static void priority_run(uv_work_t* reqs,
+                         const uv_work_priority_t* priorities,
+                         unsigned int n) {
+  uv_work_options_t options;
+  uv_work_t blocker;
+  unsigned int i;
+
+  priority_block(&blocker);
+
+  for (i = 0; i < n; i++) {
+    options.priority = priorities[i];
+    ASSERT_OK(uv_queue_work_ex(uv_default_loop(),
+                               &reqs[i],
+                               &options,
+                               priority_work_cb,
+                               dynamic_after_work_cb));
+  }
+
+  priority_release(n);
+}
+
+
+static int threadpool_priority(const char* mode) {
+  static const uv_work_priority_t mixed[] = {
+    UV_WORK_PRIORITY_LOW,
+    UV_WORK_PRIORITY_NORMAL,
+    UV_WORK_PRIORITY_HIGH,
+    UV_WORK_PRIORITY_LOW,
+    UV_WORK_PRIORITY_HIGH,
+    UV_WORK_PRIORITY_NORMAL
+  };
+  uv_work_priority_t flood[PRIORITY_FLOOD + 1];
+  uv_work_t reqs[PRIORITY_FLOOD + 1];
+  uv_work_options_t options;
+  uv_work_batch_t batch;
+  uv_work_t blocker;
+  unsigned int i;
+
+  ASSERT_OK(uv_os_setenv("UV_THREADPOOL_MODE", mode));
+  ASSERT_OK(uv_os_setenv("UV_THREADPOOL_SIZE", "1"));
+
+  options.priority = UV_WORK_PRIORITY_MAX;
+  ASSERT_EQ(UV_EINVAL, uv_queue_work_ex(uv_default_loop(),
+                                        &reqs[0],
+                                        &options,
+                                        priority_work_cb,
+                                        NULL));
+  ASSERT_EQ(UV_EINVAL, uv_queue_work_batch(uv_default_loop(),
+                                           &batch,
+                                           reqs,
+                                           2,
+                                           &options,
+                                           priority_work_cb,
+                                           NULL));
+
+  ASSERT_OK(uv_sem_init(&steal_started, 0));
+  ASSERT_OK(uv_sem_init(&steal_block, 0));
+
+  /* Highest priority first, in submission order within a priority. */
+  priority_run(reqs, mixed, ARRAY_SIZE(mixed));
+  ASSERT_PTR_EQ(priority_order[0], &reqs[2]);
+  ASSERT_PTR_EQ(priority_order[1], &reqs[4]);
+  ASSERT_PTR_EQ(priority_order[2], &reqs[1]);
+  ASSERT_PTR_EQ(priority_order[3], &reqs[5]);
+  ASSERT_PTR_EQ(priority_order[4], &reqs[0]);
+  ASSERT_PTR_EQ(priority_order[5], &reqs[3]);
+
+  /* A batch runs with its own priority too. */
+  priority_block(&blocker);
+  options.priority = UV_WORK_PRIORITY_NORMAL;
+  ASSERT_OK(uv_queue_work_ex(uv_default_loop(),
+                             &reqs[0],
+                             &options,
+                             priority_work_cb,
+                             dynamic_after_work_cb));
+  options.priority = UV_WORK_PRIORITY_HIGH;
+  ASSERT_OK(uv_queue_work_batch(uv_default_loop(),
+                                &batch,
+                                reqs + 1,
+                                2,
+                                &options,
+                                priority_work_cb,
+                                NULL));
+  priority_release(3);
+  ASSERT_PTR_EQ(priority_order[0], &reqs[1]);
+  ASSERT_PTR_EQ(priority_order[1], &reqs[2]);
+  ASSERT_PTR_EQ(priority_order[2], &reqs[0]);
+
+  /* Low priority work isn't starved by a flood of high priority work. */
+  flood[0] = UV_WORK_PRIORITY_LOW;
+  for (i = 1; i < ARRAY_SIZE(flood); i++)
+    flood[i] = UV_WORK_PRIORITY_HIGH;
+
+  priority_run(reqs, flood, ARRAY_SIZE(flood));
+  for (i = 0; i < ARRAY_SIZE(flood); i++)
+    if (priority_order[i] == &reqs[0])
+      break;
+  ASSERT_GT(i, 0);
+  ASSERT_LT(i, PRIORITY_FLOOD / 2);
+
+  uv_sem_destroy(&steal_started);
+  uv_sem_destroy(&steal_block);
+
+  MAKE_VALGRIND_HAPPY(uv_default_loop());
+  return 0;
+}
+
+
+TEST_IMPL(threadpool_priority) {
+  return threadpool_priority("shared");
+}
+
+
+TEST_IMPL(threadpool_priority_steal) {
+  return threadpool_priority("steal");
+}
+
+
+TEST_IMPL(threadpool_priority_steal_loop) {
+  return threadpool_priority("steal-loop");
+}
+
+
+static int pin_cpus;
+
+
+static void pin_work_cb(uv_work_t* req) {
+  uv_thread_t self;
+  char* mask;
+  int size;
+  int i;
+
+  size = uv_cpumask_size();
+  mask = malloc(size);
+  ASSERT_NOT_NULL(mask);
+
+  self = uv_thread_self();
+  ASSERT_OK(uv_thread_getaffinity(&self, mask, size));
+
+  for (i = 0; i < size; i++)
+    pin_cpus += mask[i];
+
+  free(mask);
+}
+
+
+static void pin_after_work_cb(uv_work_t* req, int status) {
+  ASSERT_OK(status);
+}
+
+
+TEST_IMPL(threadpool_pin) {
+  uv_work_t req;
+
+  if (uv_cpumask_size() <= 0)
+    RETURN_SKIP("cpu affinity not supported");
+
+  ASSERT_OK(uv_os_setenv("UV_THREADPOOL_MODE", "steal"));
+  ASSERT_OK(uv_os_setenv("UV_THREADPOOL_SIZE", "2"));
+  ASSERT_OK(uv_os_setenv("UV_THREADPOOL_PIN", "cpu"));
+
+  ASSERT_OK(uv_queue_work(uv_default_loop(),
+                          &req,
+                          pin_work_cb,
+                          pin_after_work_cb));
+  ASSERT_OK(uv_run(uv_default_loop(), UV_RUN_DEFAULT));
+
+  /* Each worker runs on a single CPU. */
+  ASSERT_EQ(1, pin_cpus);
+
+  MAKE_VALGRIND_HAPPY(uv_default_loop());
+  return 0;
+}